@@ -70,6 +70,16 @@ config_option(CAmkESConnectorTiming CAMKES_CONNECTOR_TIMING
     DEFAULT OFF
 )
 
+config_option(CAmkESConnectorTimingHistograms CAMKES_CONNECTOR_TIMING_HISTOGRAMS
+    "Count the cycles taken by each phase of every seL4RPC and seL4RPCCall
+    method call (e.g. marshalling, communication and unmarshalling on the
+    client, and unmarshalling, the implementation and marshalling on an
+    seL4RPCCall server) in log-linear latency histograms. These use a constant amount of memory per method and
+    can be retrieved with <interface>_timing_histograms() or decoded from a
+    memory dump with tools/timing_histograms.py."
+    DEFAULT OFF
+)
+
 config_option(CAmkESProvideTCBCaps CAMKES_PROVIDE_TCB_CAPS
     "Hand out TCB caps to components. These caps are used by the component
     to exit cleanly by suspending. Disabling this option leaves components
@@ -97,6 +107,41 @@ config_choice(CAmkESTLSModel CAMKES_TLS_MODEL
     "per-thread;CAmkESTLSPerThreadGlobal;CAMKES_TLS_PTG"
 )
 
+config_choice(CAmkESDMAAllocator CAMKES_DMA_ALLOCATOR
+    "Select the allocator backing camkes_dma_alloc and camkes_dma_free within each
+    component's DMA pool.
+
+    list -> Keep free memory in a single unsorted list that is searched on every
+    allocation and defragmented when an allocation fails. This has the least
+    bookkeeping overhead, but allocation time grows with fragmentation of the pool.
+
+    segregated -> Keep free memory in size-class bins and coalesce adjacent free
+    regions as they are freed. Allocation and free take constant time regardless
+    of fragmentation. All allocations are rounded up to a multiple of 64 bytes (32
+    bytes on 32-bit platforms) and alignments must be powers of 2. A bitmap of one
+    bit per 64 (32) bytes of the DMA pool is allocated from the component's heap."
+    "list;CAmkESDMAAllocatorList;CAMKES_DMA_ALLOCATOR_LIST"
+    "segregated;CAmkESDMAAllocatorSegregated;CAMKES_DMA_ALLOCATOR_SEGREGATED"
+)
+
+config_option(CAmkESDMAThreadCache CAMKES_DMA_THREAD_CACHE
+    "Cache freed DMA buffers of up to 4KiB per thread, so that a thread
+    repeatedly allocating and freeing buffers of similar sizes does not contend
+    for the DMA pool shared by all threads of its component. Buffers are rounded
+    up to a power of 2 size. Each thread may hold up to 8 free buffers of each
+    size, so with many threads a component may need a larger dma_pool."
+    DEFAULT OFF
+)
+
+config_string(CAmkESRPCArenaSize CAMKES_RPC_ARENA_SIZE
+    "Size in bytes of the buffer each seL4RPCCall server thread unmarshals
+    string and array parameters into, instead of allocating each of them from
+    the heap. The buffer is reused for every call. Parameters that do not fit
+    are allocated from the heap as before. Set this to 0 to always use the heap."
+    DEFAULT 4096
+    UNQUOTE
+)
+
 config_string(CAmkESDefaultPriority CAMKES_DEFAULT_PRIORITY
     "Default priority for component threads if this is not overridden via an
     attribute. Generally you want to set this as high as possible due to
@@ -136,6 +181,20 @@ if((${CAmkESDefaultAffinity} < 0) OR (${CAmkESDefaultAffinity} GREATER ${MaxNumN
     message(FATAL_ERROR "Invalid CAmkESDefaultAffinity")
 endif()
 
+set(CAmkESRenderJobs 1 CACHE STRING
+    "Number of worker processes in which to render templates that do not allocate
+    capabilities. These templates are rendered in parallel with the templates that
+    do, which must be rendered in a fixed order. A value of 1 renders everything
+    in order in a single process."
+)
+
+set(CAmkESProfileDir "" CACHE STRING
+    "Directory in which to write a profile of each invocation of the code generator.
+    Each profile records the time and memory spent in each phase, template and
+    CapDL filter. Use tools/profile_report.py to summarise the profiles of a
+    build. Leave empty to disable profiling."
+)
+
 set(CAmkESAllowForwardReferences OFF CACHE BOOL
     "By default, you can only refer to objects in your specification which
     have been defined before the point at which you reference them.
@@ -504,6 +563,7 @@ function(GenerateCAmkESRootserver)
         --architecture ${KernelSel4Arch}
         --default-priority ${CAmkESDefaultPriority}
         --default-affinity ${CAmkESDefaultAffinity}
+        --render-jobs ${CAmkESRenderJobs}
     )
     # Build extra flags from the configuration
     # Each of these arguments is a CONDITION FLAG_IF_CONDITION_TRUE [FLAG_IF_CONDITION_FALSE]
@@ -536,6 +596,9 @@ function(GenerateCAmkESRootserver)
     foreach(template IN LISTS templates)
         list(APPEND CAMKES_FLAGS --templates "${template}")
     endforeach()
+    if(NOT "${CAmkESProfileDir}" STREQUAL "")
+        file(MAKE_DIRECTORY "${CAmkESProfileDir}")
+    endif()
     # Need to ensure our camkes_gen folder exists as camkes will not create the directory
     file(MAKE_DIRECTORY "${CMAKE_CURRENT_BINARY_DIR}/camkes_gen")
     set(deps_file "${CMAKE_CURRENT_BINARY_DIR}/camkes_gen/deps")
@@ -40,6 +40,7 @@ export CONFIG_CAMKES_USE_OBJDUMP_ON \
     CONFIG_CAMKES_PYTHON_INTERPRETER_FIGLEAF \
     CONFIG_CAMKES_PYTHON_INTERPRETER_COVERAGE \
     CONFIG_CAMKES_ACCELERATOR \
+    CONFIG_CAMKES_SERVER \
 
 # HACK: See the note in seL4RPC-from-template.c for why this variable needs to
 # be available in the environment.
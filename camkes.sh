@@ -15,10 +15,20 @@
 # an entry point in preference to calling Python files directly because it
 # checks the dependencies for you.
 
+DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
+
+# If the user has the code generation server enabled, tell the accelerator
+# where to find it. Each CAmkES checkout has a server of its own, as a server
+# exits when it sees a client from a different version.
+if [ -n "${CONFIG_CAMKES_SERVER}" ] && [ -z "${CAMKES_SERVER}" ]; then
+    export CAMKES_SERVER=${HOME}/.camkes/server-$(printf '%s' "${DIR}" | cksum | cut -d ' ' -f 1).sock
+fi
+
 # If the user has the CAmkES accelerator enabled, first try to see if it can
 # retrieve the requested output from the level A cache. Note that the
-# accelerator returns non-zero on a cache miss and we just fall back on running
-# the CAmkES code generator.
+# accelerator returns non-zero on a cache miss (or, with the server enabled,
+# when the server could not generate the output) and we just fall back on
+# running the CAmkES code generator.
 if [ -n "${CONFIG_CAMKES_ACCELERATOR}" ]; then
     camkes-accelerator "${@}"
     if [ $? -eq 0 ]; then
@@ -26,8 +36,6 @@ if [ -n "${CONFIG_CAMKES_ACCELERATOR}" ]; then
     fi
 fi
 
-DIR="$( cd "$( dirname "${BASH_SOURCE[0]}" )" && pwd )"
-
 if [ -z "${PYTHONPATH}" ]; then
     export PYTHONPATH=${DIR}
 else
@@ -59,4 +67,12 @@ else
     fi
 fi
 
+# Start the code generation server for the benefit of future invocations if it
+# is not already running. This invocation goes ahead without it.
+if [ -n "${CAMKES_SERVER}" ] && [ ! -S "${CAMKES_SERVER}" ]; then
+    mkdir -p "$(dirname "${CAMKES_SERVER}")"
+    setsid ${PYTHON} ${O} -m camkes.runner.server --socket "${CAMKES_SERVER}" \
+        </dev/null >/dev/null 2>&1 &
+fi
+
 ${PYTHON} ${O} -m camkes.runner "${@}"
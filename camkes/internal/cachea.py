@@ -71,6 +71,19 @@ Setting up inputs is separated into its own manual step because the common case
 within CAmkES involves caching many things with the same set of inputs. It
 would be unnecessarily costly to repeatedly hash the same files.
 
+Hashing inputs is similarly the dominant cost of a lookup for large
+specifications. Along with its hash, each input records a stat fingerprint
+(device, inode, size, modification and change time) and a lookup trusts an
+input whose fingerprint is unchanged without re-hashing it, in the manner of
+Ccache. Only when the fingerprint differs is the file hashed, and if the hash
+still matches the fingerprint is refreshed for next time. Files that were
+modified very shortly before they were primed have no fingerprint recorded,
+because a subsequent modification within the granularity of the file system's
+timestamps would otherwise go unnoticed.
+
+The database schema carries a version number (SQLite's `user_version`).
+Databases with a different version are discarded and recreated on open.
+
 To explain why SQLite serves as the backing store for this cache rather than
 something simpler like pickle or shelve, an anticipated use case is for this
 cache to be accessed by external tools. Storing data in a structured, language-
@@ -96,7 +109,7 @@ from __future__ import absolute_import, division, print_function, \
     unicode_literals
 from camkes.internal.seven import cmp, filter, map, zip
 
-import collections, os, six, sqlite3, tempfile
+import collections, os, six, sqlite3, tempfile, time
 from .cache import Cache as Base
 from .flatten_args import flatten_args
 from .mkdirp import mkdirp
@@ -113,16 +126,91 @@ SELECT_OUTPUT = open(os.path.join(MY_DIR, 'select_output.sql'), 'rt').read()
 SELECT_INPUTS = open(os.path.join(MY_DIR, 'select_inputs.sql'), 'rt').read()
 DELETE_OUTPUT = open(os.path.join(MY_DIR, 'delete_output.sql'), 'rt').read()
 DELETE_INPUTS = open(os.path.join(MY_DIR, 'delete_inputs.sql'), 'rt').read()
+UPDATE_INPUT = open(os.path.join(MY_DIR, 'update_input.sql'), 'rt').read()
+SELECT_SCHEMA_VERSION = open(os.path.join(MY_DIR,
+    'select_schema_version.sql'), 'rt').read()
+
+# Version of the database schema. This needs to match SCHEMA_VERSION in the
+# accelerator.
+SCHEMA_VERSION = 2
+
+# Inputs modified less than this many nanoseconds before being primed do not
+# get a stat fingerprint.
+RACY_WINDOW_NS = 2 * 10 ** 9
+
+# A fingerprint that never matches.
+NO_FINGERPRINT = (None,) * 5
 
 def hash_file(filename):
     with open(filename, 'rb') as f:
         return hash_string(f.read())
 
+def _ns(st, field):
+    ns = getattr(st, 'st_%s_ns' % field, None)
+    if ns is None:
+        # Python 2 only gives us floating point timestamps. Fingerprints
+        # derived from these will rarely match the accelerator's, which just
+        # means the accelerator falls back on hashing.
+        ns = int(getattr(st, 'st_%s' % field) * 10 ** 9)
+    return ns
+
+def stat_file(path):
+    '''
+    Return the stat fingerprint of a file.
+    '''
+    st = os.stat(path)
+    return (st.st_dev, st.st_ino, st.st_size, _ns(st, 'mtime'),
+        _ns(st, 'ctime'))
+
 def prime_inputs(paths):
     '''
     Setup some inputs for later use in a call to `save`.
     '''
-    return tuple((p, hash_file(p)) for p in paths)
+    inputs = []
+    for p in paths:
+        # Note that we stat before hashing, so a modification in-between is
+        # caught by a fingerprint mismatch.
+        fingerprint = stat_file(p)
+        now = int(time.time() * 10 ** 9)
+        if now - fingerprint[3] < RACY_WINDOW_NS:
+            fingerprint = NO_FINGERPRINT
+        inputs.append((p, hash_file(p)) + fingerprint)
+    return tuple(inputs)
+
+def check_inputs(inputs, cwd=None):
+    '''
+    Check whether a set of primed inputs is still valid. Returns a pair of
+    whether they are and a list of (path, fingerprint) for inputs whose
+    fingerprint was stale but whose content is unchanged.
+    '''
+    refreshed = []
+    for input in inputs:
+        path, sig, fingerprint = input[0], input[1], tuple(input[2:])
+        if cwd is not None and not os.path.isabs(path):
+            path = os.path.join(cwd, path)
+        try:
+            current = stat_file(path)
+        except OSError:
+            return False, []
+        if current == fingerprint:
+            # Unchanged since it was primed. No need to hash it.
+            continue
+        try:
+            if sig != hash_file(path):
+                # Mismatch (== cache miss).
+                return False, []
+        except IOError:
+            return False, []
+        now = int(time.time() * 10 ** 9)
+        if now - current[3] >= RACY_WINDOW_NS:
+            refreshed.append((input[0], current))
+    return True, refreshed
+
+def valid_inputs(inputs, cwd=None):
+    '''
+    Whether a set of primed inputs still reflects the files on disk.
+    '''
+    return check_inputs(inputs, cwd)[0]
 
 class Cache(Base):
     def __init__(self, root):
@@ -159,7 +247,7 @@ class Cache(Base):
                     'insertion to output table (bug in level A cache table ' \
                     'schema?)'
                 fk = c.lastrowid
-                c.executemany(INSERT_INPUT, ((fk, p, h) for p, h in inputs))
+                c.executemany(INSERT_INPUT, ((fk,) + tuple(i) for i in inputs))
 
         self.pending = {}
 
@@ -170,6 +258,7 @@ class Cache(Base):
 
         args = flatten_args(argv)
 
+        id = None
         try:
             # First try retrieving from our in-memory cache.
             sha256, inputs = self.pending[(args, cwd)]
@@ -191,12 +280,21 @@ class Cache(Base):
                 inputs = c.execute(SELECT_INPUTS, (id,)).fetchall()
 
         # Check the inputs are identical to when we saved this record.
-        for path, sig in inputs:
-            if not os.path.isabs(path):
-                path = os.path.join(cwd, path)
-            if not os.path.exists(path) or sig != hash_file(path):
-                # Mismatch (== cache miss).
-                return None
+        valid, refreshed = check_inputs(inputs, cwd)
+        if not valid:
+            return None
+
+        # Opportunistically record fingerprints of inputs that were touched
+        # without being modified so future lookups can avoid hashing them.
+        if id is not None and len(refreshed) > 0:
+            try:
+                conn = self._open_db(args, cwd)
+                with conn:
+                    conn.executemany(UPDATE_INPUT, (fingerprint + (id, path)
+                        for path, fingerprint in refreshed))
+            except sqlite3.OperationalError:
+                # Contended. Never mind; we'll just hash again next time.
+                pass
 
         with open(os.path.join(self.data, sha256), 'rt') as f:
             return f.read()
@@ -217,6 +315,16 @@ class Cache(Base):
 
         conn = sqlite3.connect(db)
 
+        if conn.execute(SELECT_SCHEMA_VERSION).fetchone()[0] != SCHEMA_VERSION:
+            # A database from an older (or newer) layout. Its entries are not
+            # usable, so atomically replace it with a blank database.
+            conn.close()
+            fd, tmp = tempfile.mkstemp(dir=dirname)
+            with os.fdopen(fd, 'wb') as f:
+                f.write(blank_database())
+            os.rename(tmp, db)
+            conn = sqlite3.connect(db)
+
         return conn
 
     def save(self, argv, cwd, output, inputs):
@@ -255,6 +363,7 @@ def blank_database():
     with conn:
         conn.execute(CREATE_OUTPUT)
         conn.execute(CREATE_INPUT)
+        conn.execute('pragma user_version = %d' % SCHEMA_VERSION)
     conn.close()
 
     data = open(tmp, 'rb').read()
@@ -1,4 +1,9 @@
 create table if not exists input (
     output integer not null references output (id),
     path text not null,
-    sha256 text not null);
+    sha256 text not null,
+    dev integer,
+    inode integer,
+    size integer,
+    mtime_ns integer,
+    ctime_ns integer);
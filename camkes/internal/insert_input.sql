@@ -1 +1 @@
-insert into input (output, path, sha256) values (?, ?, ?);
+insert into input (output, path, sha256, dev, inode, size, mtime_ns, ctime_ns) values (?, ?, ?, ?, ?, ?, ?, ?);
@@ -0,0 +1,122 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Phase-level profiling of the code generator.
+
+While profiling is enabled, code wrapped in `phase` is recorded as a complete
+event with its wall clock time, CPU time and the process' peak resident set
+size at the end of the phase. Phases may nest. Events are written in the Chrome
+trace-event format (a JSON object with a `traceEvents` list), so a profile can
+be loaded into chrome://tracing or Perfetto directly, or aggregated across the
+invocations of a whole build with tools/profile_report.py. Timestamps are
+wall clock microseconds since the epoch, so the profiles of concurrent
+invocations line up when merged.
+
+Like logging, profiling is process-wide state. When it is disabled, `phase`
+costs little more than a function call.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+from camkes.internal.seven import cmp, filter, map, zip
+
+import contextlib, json, os, sys, time
+
+try:
+    import resource
+except ImportError:
+    # Not available on this platform. Peak RSS will not be reported.
+    resource = None
+
+# Events recorded so far, or None if profiling is disabled.
+_events = None
+
+def enable():
+    global _events
+    _events = []
+
+def disable():
+    global _events
+    _events = None
+
+def enabled():
+    return _events is not None
+
+def cpu_time():
+    '''User and system CPU time consumed by this process, in seconds.'''
+    t = os.times()
+    return t[0] + t[1]
+
+def max_rss():
+    '''Peak resident set size of this process in KiB, or None if unknown.'''
+    if resource is None:
+        return None
+    rss = resource.getrusage(resource.RUSAGE_SELF).ru_maxrss
+    if sys.platform == 'darwin':
+        # Reported in bytes, rather than KiB as on Linux.
+        rss //= 1024
+    return rss
+
+def record(name, category, start, wall, cpu, rss=None, pid=None, **args):
+    '''
+    Record an event that has already been measured. `start` is in seconds
+    since the epoch and `wall` and `cpu` are durations in seconds. This is for
+    events measured elsewhere (e.g. in a worker process).
+    '''
+    if _events is None:
+        return
+    args['cpu_us'] = int(cpu * 1000000)
+    if rss is not None:
+        args['max_rss_kb'] = rss
+    _events.append({
+        'name':name,
+        'cat':category,
+        'ph':'X',
+        'ts':int(start * 1000000),
+        'dur':int(wall * 1000000),
+        'pid':os.getpid() if pid is None else pid,
+        'tid':0,
+        'args':args,
+    })
+
+@contextlib.contextmanager
+def phase(name, category='phase', **args):
+    '''
+    Record the execution of the body of a `with` statement as an event.
+    '''
+    if _events is None:
+        yield
+        return
+    start = time.time()
+    cpu = cpu_time()
+    try:
+        yield
+    finally:
+        record(name, category, start, time.time() - start, cpu_time() - cpu,
+            max_rss(), **args)
+
+def write(path, **metadata):
+    '''
+    Write the events recorded so far to `path` as a trace-event file. Any
+    keyword arguments are stored in the file's `otherData`.
+    '''
+    assert _events is not None, 'profiling is not enabled'
+    with open(path, 'wt') as f:
+        json.dump({
+            'traceEvents':_events,
+            'displayTimeUnit':'ms',
+            'otherData':metadata,
+        }, f, indent=0, sort_keys=True)
@@ -1 +1 @@
-select path, sha256 from input where output=? order by path;
+select path, sha256, dev, inode, size, mtime_ns, ctime_ns from input where output=? order by path;
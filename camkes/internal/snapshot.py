@@ -0,0 +1,138 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Versioned, sectioned snapshots of Python data structures.
+
+A snapshot stores a number of named values (sections), each pickled on its
+own. Values that share references must be stored in the same section to keep
+their identity. A snapshot file is laid out as follows:
+
+    header     magic, format version, section count and a 32-byte digest
+               supplied by the writer to identify what the snapshot was
+               derived from
+    directory  one fixed-size entry (name, offset, length) per section
+    sections   pickled data
+
+Readers memory-map the file and only unpickle the sections they access, so a
+caller can check a small section (e.g. the inputs the snapshot was derived
+from) before paying for a large one. Snapshots with the wrong magic or format
+version are rejected with a `SnapshotError`. Checking the digest is left to
+the caller, who knows what it should be.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+from camkes.internal.seven import cmp, filter, map, zip
+
+import mmap, os, struct
+from six.moves import cPickle as pickle
+
+MAGIC = b'CAmkESss'
+
+# Version of the format below. Bump this whenever the layout of a snapshot or
+# the representation of a section changes.
+FORMAT_VERSION = 2
+
+HEADER = struct.Struct('<8sII32s')
+ENTRY = struct.Struct('<16sQQ')
+
+class SnapshotError(Exception):
+    pass
+
+def dumps(sections, digest):
+    '''
+    Serialise a snapshot. `sections` is a sequence of (name, value) pairs.
+    '''
+    assert len(digest) == 32
+    payloads = [(name, pickle.dumps(value, pickle.HIGHEST_PROTOCOL))
+        for name, value in sections]
+
+    offset = HEADER.size + ENTRY.size * len(payloads)
+    directory = []
+    for name, data in payloads:
+        name = name.encode('utf-8')
+        assert len(name) <= 16, 'section name too long'
+        directory.append(ENTRY.pack(name, offset, len(data)))
+        offset += len(data)
+
+    return b''.join([HEADER.pack(MAGIC, FORMAT_VERSION, len(payloads), digest)]
+        + directory + [data for _, data in payloads])
+
+def save(path, sections, digest):
+    '''
+    Write a snapshot to `path`. The file is replaced atomically. Returns the
+    serialised snapshot.
+    '''
+    data = dumps(sections, digest)
+    tmp = '%s.%d' % (path, os.getpid())
+    with open(tmp, 'wb') as f:
+        f.write(data)
+    os.rename(tmp, path)
+    return data
+
+class Snapshot(object):
+    def __init__(self, data):
+        '''
+        Parse a snapshot from `data`, which can be anything that supports
+        slicing into bytes (e.g. a `bytes` or an `mmap`).
+        '''
+        self.data = data
+
+        if len(data) < HEADER.size:
+            raise SnapshotError('truncated snapshot')
+        magic, version, count, digest = HEADER.unpack(data[:HEADER.size])
+        if magic != MAGIC:
+            raise SnapshotError('not a snapshot')
+        if version != FORMAT_VERSION:
+            raise SnapshotError('unsupported snapshot format version %d' %
+                version)
+        self.digest = digest
+
+        end = HEADER.size + ENTRY.size * count
+        if len(data) < end:
+            raise SnapshotError('truncated snapshot')
+        self.sections = {}
+        for offset in range(HEADER.size, end, ENTRY.size):
+            name, start, length = ENTRY.unpack(data[offset:offset + ENTRY.size])
+            if start + length > len(data):
+                raise SnapshotError('truncated snapshot')
+            self.sections[name.rstrip(b'\0').decode('utf-8')] = (start, length)
+
+        self.materialised = {}
+
+    @classmethod
+    def open(cls, path):
+        with open(path, 'rb') as f:
+            # The mapping remains valid after the file is closed.
+            m = mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+        return cls(m)
+
+    def __contains__(self, name):
+        return name in self.sections
+
+    def __getitem__(self, name):
+        '''
+        Retrieve the value of a section, unpickling it on first access.
+        '''
+        if name not in self:
+            raise KeyError(name)
+        try:
+            return self.materialised[name]
+        except KeyError:
+            start, length = self.sections[name]
+            value = pickle.loads(self.data[start:start + length])
+            self.materialised[name] = value
+            return value
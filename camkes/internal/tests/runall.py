@@ -26,6 +26,7 @@ from testcachea import TestCacheA
 from testcacheb import TestCacheB
 from testfilehash import TestFileHash
 from testfrozendict import TestFrozenDict
+from testsnapshot import TestSnapshot
 from testsqlsource import TestSQLSource
 from teststrhash import TestStringHash
 
@@ -16,14 +16,15 @@
 from __future__ import absolute_import, division, print_function, \
     unicode_literals
 
-import os, stat, sys, tempfile, unittest
+import glob, os, sqlite3, stat, sys, tempfile, unittest
 
 ME = os.path.abspath(__file__)
 
 # Make CAmkES importable
 sys.path.append(os.path.join(os.path.dirname(ME), '../../..'))
 
-from camkes.internal.cachea import Cache, prime_inputs
+import camkes.internal.cachea
+from camkes.internal.cachea import Cache, prime_inputs, SCHEMA_VERSION
 from camkes.internal.tests.utils import CAmkESTest
 
 class TestCacheA(CAmkESTest):
@@ -335,5 +336,98 @@ class TestCacheA(CAmkESTest):
         output = c.load(['arg1', 'arg2'], cwd)
         self.assertEqual(output, 'hello world')
 
+    def test_fingerprint_trusted(self):
+        '''
+        Ensure an input whose stat fingerprint is unchanged is not re-hashed.
+        '''
+        root = self.mkdtemp()
+        c = Cache(root)
+
+        input = self.mkstemp()
+        with open(input, 'wt') as f:
+            f.write('foo bar')
+
+        # Backdate the input so it is not considered too recently modified to
+        # fingerprint.
+        st = os.stat(input)
+        os.utime(input, (st[stat.ST_ATIME] - 3600, st[stat.ST_MTIME] - 3600))
+
+        inputs = prime_inputs([input])
+
+        cwd = os.getcwd()
+        c.save(['arg1', 'arg2'], cwd, 'hello world', inputs)
+        c.flush()
+
+        def fail(*_):
+            raise Exception('unexpected hash of unchanged input')
+        hash_file = camkes.internal.cachea.hash_file
+        camkes.internal.cachea.hash_file = fail
+        try:
+            output = c.load(['arg1', 'arg2'], cwd)
+        finally:
+            camkes.internal.cachea.hash_file = hash_file
+        self.assertEqual(output, 'hello world')
+
+    def test_fingerprint_same_size_modification(self):
+        '''
+        Ensure a modification that preserves size and modification time is
+        still noticed.
+        '''
+        root = self.mkdtemp()
+        c = Cache(root)
+
+        input = self.mkstemp()
+        with open(input, 'wt') as f:
+            f.write('foo bar')
+
+        st = os.stat(input)
+        os.utime(input, (st[stat.ST_ATIME] - 3600, st[stat.ST_MTIME] - 3600))
+        st = os.stat(input)
+
+        inputs = prime_inputs([input])
+
+        cwd = os.getcwd()
+        c.save(['arg1', 'arg2'], cwd, 'hello world', inputs)
+        c.flush()
+
+        # Modify the input and restore its modification time.
+        with open(input, 'wt') as f:
+            f.write('bar foo')
+        os.utime(input, (st[stat.ST_ATIME], st[stat.ST_MTIME]))
+
+        output = c.load(['arg1', 'arg2'], cwd)
+        self.assertIsNone(output)
+
+    def test_schema_version_mismatch(self):
+        '''
+        Ensure a database with a different schema version is discarded rather
+        than used.
+        '''
+        root = self.mkdtemp()
+        c = Cache(root)
+
+        inputs = prime_inputs([])
+
+        cwd = os.getcwd()
+        c.save(['arg1', 'arg2'], cwd, 'hello world', inputs)
+        c.flush()
+
+        # Mark the database as coming from an older CAmkES.
+        dbs = glob.glob(os.path.join(root, 'dbs', '*', '*', 'cache.db'))
+        self.assertLen(dbs, 1)
+        conn = sqlite3.connect(dbs[0])
+        conn.execute('pragma user_version = %d' % (SCHEMA_VERSION - 1))
+        conn.commit()
+        conn.close()
+
+        output = c.load(['arg1', 'arg2'], cwd)
+        self.assertIsNone(output)
+
+        # The database should have been replaced with a current one.
+        conn = sqlite3.connect(dbs[0])
+        version = conn.execute('pragma user_version').fetchone()[0]
+        conn.close()
+        self.assertEqual(version, SCHEMA_VERSION)
+
 if __name__ == '__main__':
     unittest.main()
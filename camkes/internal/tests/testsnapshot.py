@@ -0,0 +1,94 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import os, sys, unittest
+
+ME = os.path.abspath(__file__)
+
+# Make CAmkES importable
+sys.path.append(os.path.join(os.path.dirname(ME), '../../..'))
+
+from camkes.internal.snapshot import dumps, FORMAT_VERSION, HEADER, save, \
+    Snapshot, SnapshotError
+from camkes.internal.tests.utils import CAmkESTest
+
+class Node(object):
+    def __init__(self, name):
+        self.name = name
+        self.peers = []
+
+DIGEST = b'\x42' * 32
+
+class TestSnapshot(CAmkESTest):
+    def test_round_trip(self):
+        tmp = self.mkstemp()
+        save(tmp, [('foo', {'a': 1, 'b': [2, 3]}), ('bar', 'hello world')],
+            DIGEST)
+
+        s = Snapshot.open(tmp)
+        self.assertEqual(s.digest, DIGEST)
+        self.assertEqual(s['foo'], {'a': 1, 'b': [2, 3]})
+        self.assertEqual(s['bar'], 'hello world')
+        self.assertIn('foo', s)
+        self.assertNotIn('baz', s)
+        with self.assertRaises(KeyError):
+            s['baz']
+
+    def test_shared_objects(self):
+        '''
+        Objects shared within a section should retain their identity.
+        '''
+        a = Node('a')
+        b = Node('b')
+        a.peers.append(b)
+        b.peers.append(a)
+
+        s = Snapshot(dumps([('nodes', ({'a': a}, [b]))], DIGEST))
+
+        first, second = s['nodes']
+        self.assertEqual(first['a'].name, 'a')
+        self.assertIs(first['a'].peers[0], second[0])
+        self.assertIs(second[0].peers[0], first['a'])
+
+    def test_lazy(self):
+        '''
+        Sections should only be unpickled when accessed.
+        '''
+        s = Snapshot(dumps([('first', 1), ('second', 2)], DIGEST))
+        self.assertEqual(s['second'], 2)
+        self.assertNotIn('first', s.materialised)
+
+    def test_bad_magic(self):
+        with self.assertRaises(SnapshotError):
+            Snapshot(b'\0' * 1024)
+
+    def test_bad_version(self):
+        data = dumps([('foo', 1)], DIGEST)
+        magic, _, count, digest = HEADER.unpack(data[:HEADER.size])
+        data = HEADER.pack(magic, FORMAT_VERSION + 1, count, digest) + \
+            data[HEADER.size:]
+        with self.assertRaises(SnapshotError):
+            Snapshot(data)
+
+    def test_truncated(self):
+        data = dumps([('foo', 'hello world')], DIGEST)
+        with self.assertRaises(SnapshotError):
+            Snapshot(data[:-1])
+
+if __name__ == '__main__':
+    unittest.main()
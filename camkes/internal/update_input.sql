@@ -0,0 +1 @@
+update input set dev=?, inode=?, size=?, mtime_ns=?, ctime_ns=? where output=? and path=?;
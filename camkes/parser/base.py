@@ -18,6 +18,7 @@ from __future__ import absolute_import, division, print_function, \
 from camkes.internal.seven import cmp, filter, map, zip
 
 from camkes.ast import LiftedAST
+import camkes.internal.profile as profile
 import abc, collections, six
 
 class Parser(six.with_metaclass(abc.ABCMeta, object)):
@@ -41,7 +42,8 @@ class Transformer(six.with_metaclass(abc.ABCMeta, Parser)):
         assert isinstance(filename, six.string_types)
         ast_lifted, read = self.subordinate.parse_file(filename)
         assert self.precondition(ast_lifted, read)
-        result, result_read = self.transform(ast_lifted, read)
+        with profile.phase('parser/%s' % type(self).__name__, 'parser'):
+            result, result_read = self.transform(ast_lifted, read)
         assert self.postcondition(result, result_read)
         return result, result_read
 
@@ -49,7 +51,8 @@ class Transformer(six.with_metaclass(abc.ABCMeta, Parser)):
         assert isinstance(string, six.string_types)
         ast_lifted, read = self.subordinate.parse_string(string)
         assert self.precondition(ast_lifted, read)
-        result, result_read = self.transform(ast_lifted, read)
+        with profile.phase('parser/%s' % type(self).__name__, 'parser'):
+            result, result_read = self.transform(ast_lifted, read)
         assert self.postcondition(result, result_read)
         return result, result_read
 
@@ -0,0 +1,121 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Per-file cache of the output of stages 0-3 of the parser.
+
+Parsing an input specification is dominated by the stage 1 parser, and a
+specification generally imports many files that rarely change (e.g. the
+built-in interface definitions). This cache stores, for each file read by the
+stage 2 import resolver, that file's top-level items with everything except
+import statements already lifted by the stage 3 lifter. Import statements are
+kept in their raw form, to be resolved afresh on every parse. The stage 2 and 3
+parsers consume entries from this cache in place of re-reading and re-parsing
+the files they correspond to, and stages 4-10 then run over the assembled
+result as usual.
+
+Entries are addressed by the file's path and content, and the options that
+affect how it is read (pre-processor and its flags, import path). When the
+pre-processor is in use, the files it read while processing an entry's file
+are recorded alongside the entry and checked before the entry is used, as for
+level A cache inputs. The cache is hosted in a root directory containing one
+pickle per entry:
+
+    root
+     ├ <key SHA256 hash>.p
+     ├ <key SHA256 hash>.p
+     └ ...
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+from camkes.internal.seven import cmp, filter, map, zip
+
+from camkes.internal.cachea import prime_inputs, valid_inputs
+from camkes.internal.filehash import hash_file
+from camkes.internal.mkdirp import mkdirp
+from camkes.internal.strhash import hash_string
+from .stage3 import lift_raw
+import os, pickle, tempfile
+
+def is_import(item):
+    return getattr(item, 'head', None) == 'import'
+
+class FileCache(object):
+    def __init__(self, root, options=()):
+        '''
+        Create a cache in the directory `root`. `options` is a sequence of
+        strings describing any parser configuration that affects the reading
+        of an individual file.
+        '''
+        self.root = root
+        self.options = list(options)
+        self.debug = False
+        mkdirp(root)
+
+        # Statistics for the user's benefit.
+        self.hits = 0
+        self.misses = 0
+
+    def _path(self, filename):
+        key = '\n'.join([os.path.abspath(filename), hash_file(filename)] +
+            self.options)
+        return os.path.join(self.root, '%s.p' % hash_string(key))
+
+    def load(self, filename):
+        '''
+        Retrieve the items of the given file and the set of files read while
+        reading it, or `None` on cache miss.
+        '''
+        try:
+            with open(self._path(filename), 'rb') as f:
+                inputs, items = pickle.load(f)
+            if valid_inputs(inputs):
+                self.hits += 1
+                return items, set(x[0] for x in inputs)
+        except Exception:
+            # The file does not exist, is corrupted or was written by an
+            # incompatible CAmkES. Either way, we need to parse it.
+            pass
+        self.misses += 1
+        return None
+
+    def save(self, filename, items, read):
+        '''
+        Lift the non-import items read from a given file and save them in the
+        cache. Returns the items in the form they were saved.
+        '''
+        lifted = [(source, name, item if is_import(item) else
+            lift_raw(item, name, source, self.debug))
+            for source, name, item in items
+            # Skip empty statements, as the stage 2 parser would.
+            if hasattr(item, 'head')]
+
+        # Write the entry atomically, as other CAmkES processes may be reading
+        # the cache concurrently.
+        tmp = None
+        try:
+            path = self._path(filename)
+            fd, tmp = tempfile.mkstemp(dir=self.root)
+            with os.fdopen(fd, 'wb') as f:
+                pickle.dump((prime_inputs(sorted(read)), lifted), f,
+                    protocol=pickle.HIGHEST_PROTOCOL)
+            os.rename(tmp, path)
+        except Exception:
+            # Failing to cache this file is not fatal.
+            if tmp is not None and os.path.exists(tmp):
+                os.unlink(tmp)
+
+        return lifted
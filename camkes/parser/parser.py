@@ -18,6 +18,7 @@ from __future__ import absolute_import, division, print_function, \
 from camkes.internal.seven import cmp, filter, map, zip
 
 from .base import Parser as BaseParser
+from .cache import FileCache
 from .stage0 import CPP, Reader
 from .stage1 import Parse1
 from .stage2 import Parse2
@@ -29,6 +30,7 @@ from .stage7 import Parse7
 from .stage8 import Parse8
 from .stage9 import Parse9
 from .stage10 import Parse10
+import camkes.internal.log as log
 import os
 
 class Parser(BaseParser):
@@ -53,11 +55,23 @@ class Parser(BaseParser):
             import_path = options.import_path
         else:
             import_path = []
-        s2 = Parse2(s1, import_path)
+
+        # Build the per-file cache of lifted items, if requested.
+        debug = hasattr(options, 'verbosity') and options.verbosity > 2
+        self.cache = None
+        if getattr(options, 'cache_dir', None) is not None:
+            if isinstance(s0, CPP):
+                key = ['cpp', s0.toolprefix] + list(s0.flags)
+            else:
+                key = ['nocpp']
+            self.cache = FileCache(options.cache_dir, key + ['--'] +
+                list(import_path))
+            self.cache.debug = debug
+
+        s2 = Parse2(s1, import_path, self.cache)
 
         # Build the lifter.
-        s3 = Parse3(s2, debug=hasattr(options, 'verbosity') and
-            options.verbosity > 2)
+        s3 = Parse3(s2, debug=debug)
 
         # Build the reference resolver.
         allow_forward = hasattr(options, 'allow_forward_references') and \
@@ -85,7 +99,11 @@ class Parser(BaseParser):
         self.parser = s10
 
     def parse_file(self, filename):
-        return self.parser.parse_file(filename)
+        result = self.parser.parse_file(filename)
+        if self.cache is not None:
+            log.info('parser cache: %d of %d files reused' % (self.cache.hits,
+                self.cache.hits + self.cache.misses))
+        return result
 
     def parse_string(self, string):
         return self.parser.parse_string(string)
@@ -28,6 +28,7 @@ import os, plyplus, re
 from .base import Parser
 from camkes.ast import SourceLocation
 from .exception import ParseError
+import camkes.internal.profile as profile
 
 GRAMMAR = os.path.join(os.path.dirname(os.path.realpath(__file__)), 'camkes.g')
 
@@ -47,9 +48,12 @@ class Parse1(Parser):
         self.parse0 = parse0
 
     def parse_file(self, filename):
-        processed, read = self.parse0.parse_file(filename)
+        with profile.phase('parser/%s' % type(self.parse0).__name__, 'parser',
+                file=filename):
+            processed, read = self.parse0.parse_file(filename)
         try:
-            ast_raw = _parse(processed)
+            with profile.phase('parser/Parse1', 'parser', file=filename):
+                ast_raw = _parse(processed)
         except plyplus.ParseError as e:
             location = SourceLocation(filename, e, processed)
             e = augment_exception(e)
@@ -57,9 +61,12 @@ class Parse1(Parser):
         return processed, ast_raw, read
 
     def parse_string(self, string):
-        processed, read = self.parse0.parse_string(string)
+        with profile.phase('parser/%s' % type(self.parse0).__name__,
+                'parser'):
+            processed, read = self.parse0.parse_string(string)
         try:
-            ast_raw = _parse(processed)
+            with profile.phase('parser/Parse1', 'parser'):
+                ast_raw = _parse(processed)
         except plyplus.ParseError as e:
             location = SourceLocation(None, e, processed)
             e = augment_exception(e)
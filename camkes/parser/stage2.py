@@ -25,18 +25,41 @@ from __future__ import absolute_import, division, print_function, \
 from camkes.internal.seven import cmp, filter, map, zip
 
 from .base import Parser
+from camkes.ast import ASTObject
 from .exception import ParseError
+import camkes.internal.profile as profile
 import collections, os
 
 class Parse2(Parser):
-    def __init__(self, parse1, importpath=None):
+    def __init__(self, parse1, importpath=None, cache=None):
         self.parse1 = parse1
         self.importpath = importpath or []
 
-    def _resolve(self, source, filename, ast_raw, read):
+        # An optional `camkes.parser.cache.FileCache`. Items retrieved from
+        # this have already been lifted, with the exception of imports.
+        self.cache = cache
+
+    def _parse_file(self, filename):
+        '''
+        Read the top-level items of a single file, without resolving its
+        imports.
+        '''
+        if self.cache is not None:
+            with profile.phase('parser/cache lookup', 'parser', file=filename):
+                entry = self.cache.load(filename)
+            if entry is not None:
+                return entry
 
+        source, ast_raw, read = self.parse1.parse_file(filename)
         assert ast_raw.head == 'start', 'unexpected raw AST structure'
-        ast_augmented = [(source, filename, t) for t in ast_raw.tail]
+        items = [(source, filename, t) for t in ast_raw.tail]
+
+        if self.cache is not None:
+            items = self.cache.save(filename, items, read)
+
+        return items, read
+
+    def _resolve(self, ast_augmented, read):
 
         queue = collections.deque(ast_augmented)
         final_ast_augmented = []
@@ -44,7 +67,12 @@ class Parse2(Parser):
         while len(queue) > 0:
             source, filename, item = queue.popleft()
 
-            if not hasattr(item, 'head'):
+            if isinstance(item, ASTObject):
+                # An item retrieved from the cache, that has already been
+                # lifted.
+                final_ast_augmented.append((source, filename, item))
+
+            elif not hasattr(item, 'head'):
                 # Empty statement.
                 continue
 
@@ -92,10 +120,8 @@ class Parse2(Parser):
                 if target in read:
                     continue
 
-                more_source, more_ast_raw, r = self.parse1.parse_file(target)
+                more_ast_augmented, r = self._parse_file(target)
                 read |= r
-                assert more_ast_raw.head == 'start', 'unexpected raw AST structure'
-                more_ast_augmented = [(more_source, target, t) for t in more_ast_raw.tail]
 
                 queue.extendleft(reversed(more_ast_augmented))
 
@@ -105,9 +131,13 @@ class Parse2(Parser):
         return final_ast_augmented, read
 
     def parse_file(self, filename):
-        source, ast_raw, read = self.parse1.parse_file(filename)
-        return self._resolve(source, filename, ast_raw, read)
+        # Note that this includes the time spent in the stage 1 parser and
+        # pre-processor for each file read.
+        with profile.phase('parser/Parse2', 'parser'):
+            ast_augmented, read = self._parse_file(filename)
+            return self._resolve(ast_augmented, set(read))
 
     def parse_string(self, string):
         source, ast_raw, read = self.parse1.parse_string(string)
-        return self._resolve(source, None, ast_raw, read)
+        assert ast_raw.head == 'start', 'unexpected raw AST structure'
+        return self._resolve([(source, None, t) for t in ast_raw.tail], read)
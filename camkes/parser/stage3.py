@@ -24,13 +24,14 @@ from __future__ import absolute_import, division, print_function, \
     unicode_literals
 from camkes.internal.seven import cmp, filter, map, zip
 
-from camkes.ast import Assembly, Attribute, AttributeReference, Component, \
+from camkes.ast import Assembly, ASTObject, Attribute, AttributeReference, Component, \
     Composition, Configuration, Connection, ConnectionEnd, Connector, \
     Consumes, Dataport, Emits, Export, Group, Include, Instance, Interface, \
     LiftedAST, Method, Mutex, normalise_type, Parameter, Procedure, Provides, \
     Reference, Semaphore, BinarySemaphore, Setting, SourceLocation, Uses, Struct
 from .base import Parser
 from .exception import ParseError
+import camkes.internal.profile as profile
 import numbers, plyplus, re, six
 
 class Parse3(Parser):
@@ -40,12 +41,14 @@ class Parse3(Parser):
 
     def parse_file(self, filename):
         ast_augmented, read = self.parse2.parse_file(filename)
-        ast_lifted = lift(ast_augmented, self.debug)
+        with profile.phase('parser/Parse3', 'parser'):
+            ast_lifted = lift(ast_augmented, self.debug)
         return ast_lifted, read
 
     def parse_string(self, content):
         ast_augmented, read = self.parse2.parse_string(content)
-        ast_lifted = lift(ast_augmented, self.debug)
+        with profile.phase('parser/Parse3', 'parser'):
+            ast_lifted = lift(ast_augmented, self.debug)
         return ast_lifted, read
 
 def pairwise(xs):
@@ -99,7 +102,10 @@ DONT_LIFT = frozenset([
 ])
 
 def lift(ast_augmented, debug=False):
-    items = [lift_raw(x, name, source, debug) for source, name, x in ast_augmented]
+    # Items the stage 2 parser retrieved from its cache have already been
+    # lifted.
+    items = [x if isinstance(x, ASTObject) else lift_raw(x, name, source, debug)
+        for source, name, x in ast_augmented]
     return LiftedAST(items)
 
 def lift_raw(term, filename=None, source=None, debug=False):
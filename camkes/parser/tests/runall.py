@@ -23,6 +23,7 @@ ME = os.path.abspath(__file__)
 # Make camkes.parser importable
 sys.path.append(os.path.join(os.path.dirname(ME), '../../..'))
 
+from testcache import TestCache
 from testcpp import TestCPP
 from testexamples import TestExamples
 from lint import TestLint
@@ -0,0 +1,114 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import os, sys, unittest
+
+ME = os.path.abspath(__file__)
+
+# Make CAmkES importable
+sys.path.append(os.path.join(os.path.dirname(ME), '../../..'))
+
+from camkes.ast import Component
+from camkes.internal.tests.utils import CAmkESTest
+from camkes.parser.cache import FileCache
+from camkes.parser.stage0 import Reader
+from camkes.parser.stage1 import Parse1
+from camkes.parser.stage2 import Parse2
+from camkes.parser.stage3 import Parse3
+
+class TestCache(CAmkESTest):
+    def setUp(self):
+        super(TestCache, self).setUp()
+        self.root = self.mkdtemp()
+
+    def parse(self, filename):
+        cache = FileCache(self.root)
+        parser = Parse3(Parse2(Parse1(Reader()), cache=cache), debug=True)
+        ast, read = parser.parse_file(filename)
+        return ast, read, cache
+
+    def test_reuse(self):
+        parent = self.mkstemp()
+        child = self.mkstemp()
+
+        with open(parent, 'wt') as f:
+            f.write('''
+                component Foo {}
+                import "%s";
+                ''' % child)
+        with open(child, 'wt') as f:
+            f.write('component Bar {}')
+
+        ast1, read1, cache = self.parse(parent)
+        self.assertEqual((cache.hits, cache.misses), (0, 2))
+
+        ast2, read2, cache = self.parse(parent)
+        self.assertEqual((cache.hits, cache.misses), (2, 0))
+
+        self.assertEqual(read1, read2)
+        self.assertLen(ast2.items, 2)
+        self.assertIsInstance(ast2.items[0], Component)
+        self.assertEqual([x.name for x in ast2.items], ['Foo', 'Bar'])
+
+    def test_modification(self):
+        parent = self.mkstemp()
+        child = self.mkstemp()
+
+        with open(parent, 'wt') as f:
+            f.write('''
+                component Foo {}
+                import "%s";
+                ''' % child)
+        with open(child, 'wt') as f:
+            f.write('component Bar {}')
+
+        self.parse(parent)
+
+        # Modify only the imported file.
+        with open(child, 'wt') as f:
+            f.write('component Baz {}')
+
+        ast, _, cache = self.parse(parent)
+        self.assertEqual((cache.hits, cache.misses), (1, 1))
+        self.assertEqual([x.name for x in ast.items], ['Foo', 'Baz'])
+
+    def test_modified_imports(self):
+        parent = self.mkstemp()
+        child = self.mkstemp()
+
+        with open(parent, 'wt') as f:
+            f.write('component Foo {}')
+        with open(child, 'wt') as f:
+            f.write('component Bar {}')
+
+        self.parse(parent)
+
+        # Imports of a file are not part of its cache entry, so adding one
+        # should be noticed.
+        with open(parent, 'wt') as f:
+            f.write('''
+                component Foo {}
+                import "%s";
+                ''' % child)
+
+        ast, _, cache = self.parse(parent)
+        self.assertEqual(cache.hits, 0)
+        self.assertEqual([x.name for x in ast.items], ['Foo', 'Bar'])
+
+if __name__ == '__main__':
+    unittest.main()
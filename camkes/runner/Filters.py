@@ -18,7 +18,7 @@ from __future__ import absolute_import, division, print_function, \
     unicode_literals
 from camkes.internal.seven import cmp, filter, map, zip
 
-import os, re, six, subprocess
+import collections, os, re, six, subprocess
 from capdl import seL4_FrameObject, Cap, CNode, Frame, TCB, SC, page_sizes, lookup_architecture
 from capdl.util import IA32Arch, X64Arch
 from camkes.internal.memoization import memoize
@@ -45,26 +45,31 @@ def get_symbol(elf, symbol):
                 objdump = None
     if objdump is not None:
         global objdump_output
-        stdout = objdump_output.get(elf[0])
-        if stdout is None:
+        # Key the parsed output by the ELF's identity on disk as well as its
+        # path, as a persistent runner may see the same ELF rebuilt.
+        st = os.stat(elf[0])
+        key = (elf[0], st.st_size, st.st_mtime)
+        symbols = objdump_output.get(key)
+        if symbols is None:
             # We haven't run objdump on this output yet. Need to do it now.
             # Construct the bash invocation we want
             argument = "%s --syms %s | grep -E '^[0-9a-fA-F]{8}' | sed -r 's/^([0-9a-fA-F]{8,})[ \\t].*[ \\t]([0-9a-fA-F]{8,})[ \\t]+(.*)/\\3 \\1 \\2/'" % (objdump, elf[0])
             stdout = subprocess.check_output(['sh', '-c', argument],
                 universal_newlines=True)
-            # Cache the result for future symbol lookups.
-            objdump_output[elf[0]] = stdout
-        sym_index = stdout.find('\n%s ' % symbol)
-        if sym_index == -1:
-            return None, None
-        end_index = stdout[sym_index+1:].find('\n')
-        vaddr_start_index = sym_index + len(symbol) + 2
-        if end_index == -1:
-            substring = stdout[vaddr_start_index:]
-        else:
-            substring = stdout[vaddr_start_index:sym_index + end_index + 1]
-        [vaddr, size] = substring.split()
-        return int(vaddr, 16), int(size, 16)
+            # Index the result for future symbol lookups, rather than
+            # searching the output for each one.
+            symbols = {}
+            for line in stdout.splitlines():
+                fields = line.split()
+                if len(fields) != 3:
+                    continue
+                try:
+                    value = (int(fields[1], 16), int(fields[2], 16))
+                except ValueError:
+                    continue
+                symbols.setdefault(fields[0], value)
+            objdump_output[key] = symbols
+        return symbols.get(symbol, (None, None))
     else:
         return elf[1].get_symbol_vaddr(symbol), elf[1].get_symbol_size(symbol)
 
@@ -159,35 +164,6 @@ def make_indices(arch, vaddr, size):
     indices.append(level.child_index(vaddr))
     return indices
 
-def lookup_vspace_indices(vspace_root, indices):
-    '''Takes a set of indices (of the form generated by make_indices) and
-       traverses the supplied vspace_root, returning the cap and object found'''
-    assert len(indices) > 0, "The root vspace object cannot be indexed, as we cannot return a capability to it"
-    cap = None
-    object = vspace_root
-    for index in indices:
-        cap = object[index]
-        object = cap.referent
-    return (cap, object)
-
-def update_frame_in_vaddr(arch, vspace_root, vaddr, size, cap):
-    '''Updates a frame mapping in a virtual address space. The semantics
-       of what this is doing is such that after performing this then
-       lookup_cap, _ = lookup_vspace_indices(vspace_root, make_indices(arch, vaddr,size))
-       Gives lookup_cap == cap'''
-    indices = make_indices(arch, vaddr, size)
-    object = vspace_root
-    for index in indices[0:-1]:
-        object = object[index].referent
-    object[indices[-1]] = cap
-
-def frame_for_vaddr(arch, vspace_root, vaddr, size):
-    '''Looks up a frame of a given size in a vspace hierarchy, returning
-       the cap and object'''
-    cap, object = lookup_vspace_indices(vspace_root, make_indices(arch, vaddr, size))
-    assert isinstance(object, Frame), "Expected to find a frame"
-    return cap, object
-
 def num_vspace_levels(arch):
     '''Return the number of levels in the vspace hierarchy'''
     level = arch.vspace()
@@ -215,147 +191,228 @@ def find_optimal_frame_size(arch, vaddr, size):
         level_num = level_num + 1
     raise Exception('Failed to find valid frame size for frame at %x of size %d' % (vaddr, size))
 
-def delete_small_frames(arch, obj_space, vspace_root, level_num, map_indices):
-    '''Given a set of indices (map_indices) that correspond to frames in the supplied
-       vspace, this function removes all of the frames from the vspace, as well as any
-       intermediate paging structures specified by the indecies, such that new frames
-       (or anything else) can no be placed straight at the level indicated by level_num'''
-    level = num_vspace_levels(arch)
-    while level >= level_num:
-        for indices in map_indices:
-            sub_indices = indices[0:level]
-            parent_indices = sub_indices[0:-1]
-            if len(parent_indices) == 0:
-                # parent is vspace root
-                parent_object = vspace_root
-            else:
-                (parent_cap, parent_object) = lookup_vspace_indices(vspace_root, parent_indices)
-
-            cap = parent_object[sub_indices[-1]]
-
+class VSpaceIndex(object):
+    '''An index of the paging structures and frames mapped in a virtual address
+       space.
+
+       Each slot of a paging structure covers a naturally aligned range of
+       virtual addresses whose size (the stride) is fixed by its depth below
+       the vspace root, the root's own slots being at depth 1. The index maps
+       (depth, base vaddr) of every populated slot to the paging structure and
+       index holding it, so the frame or paging structure covering an address
+       can be found, replaced or removed in constant time rather than by
+       walking down from the root, and a range of addresses can be cleared
+       without constructing a path to each page in it.
+
+       The index is built by a single walk of the vspace and is kept up to date
+       by the methods below. While an index is in use, its vspace must only be
+       modified through it.'''
+
+    def __init__(self, arch, obj_space, root):
+        self.obj_space = obj_space
+        self.root = root
+
+        # The levels of the paging hierarchy, from the root down.
+        self.levels = []
+        level = arch.vspace()
+        assert level.make_object == type(root), "vspace root must be top of page hierarchy"
+        while level is not None:
+            self.levels.append(level)
+            level = level.child
+
+        # Size of the range covered by a slot at each depth.
+        self.strides = [None] + [l.coverage for l in self.levels[1:]] + \
+            [min(p.size for p in self.levels[-1].pages)]
+
+        # (depth, vaddr) -> (paging structure, index) of populated slots.
+        self.slots = {}
+
+        # (depth, vaddr) -> paging structure. Paging structures are at the
+        # depth of the slot they occupy, with the root at depth 0.
+        self.tables = {}
+
+        self._add_table(0, 0, root)
+
+    def depth(self, size):
+        '''The depth at which a frame of the given size is mapped. This is the
+           number of indices make_indices would return for it.'''
+        depth = 1
+        while depth < len(self.levels) and size < self.levels[depth].coverage:
+            depth += 1
+        return depth
+
+    def _add_table(self, depth, vaddr, table):
+        self.tables[(depth, vaddr)] = table
+        level = self.levels[depth]
+        stride = self.strides[depth + 1]
+        for index, cap in table.slots.items():
             if cap is None:
-                # it's possible that this table entry was removed in a previous iteration
                 continue
-
-            object = cap.referent
-            if object is not None:
-                obj_space.remove(object)
-                parent_object[sub_indices[-1]] = None
-        level = level - 1
-
-def make_indices_to_frame(arch, vspace_root, vaddr):
-    '''Given the root paging structure of a vspace, and a vaddr in that vspace,
-       constructs a list of indices to traverse the paging hierarchy from the root
-       to the frame containing the vaddr.'''
-    level = arch.vspace()
-    assert level.make_object == type(vspace_root), "vspace root must be top of page hierarchy"
-    levels = []
-    obj = vspace_root
-    cap = None
-
-    while not isinstance(obj, Frame):
+            child_vaddr = vaddr + index * stride
+            assert level.child_index(child_vaddr) == index, \
+                'unexpected paging structure layout at 0x%x' % child_vaddr
+            self._add(depth + 1, child_vaddr, table, index, cap)
+
+    def _add(self, depth, vaddr, table, index, cap):
+        self.slots[(depth, vaddr)] = (table, index)
+        if not isinstance(cap.referent, Frame):
+            self._add_table(depth, vaddr, cap.referent)
+
+    def _forget(self, depth, vaddr):
+        '''Remove a slot and anything beneath it from the index.'''
+        self.slots.pop((depth, vaddr), None)
+        table = self.tables.pop((depth, vaddr), None)
+        if table is not None:
+            stride = self.strides[depth + 1]
+            for index, cap in table.slots.items():
+                if cap is not None:
+                    self._forget(depth + 1, vaddr + index * stride)
+
+    def lookup(self, depth, vaddr):
+        '''Return the cap in the slot at the given depth whose range starts at
+           vaddr, or None if there is no such slot or it is empty.'''
+        slot = self.slots.get((depth, vaddr))
+        if slot is None:
+            return None
+        table, index = slot
+        return table.slots.get(index)
+
+    def frame_for_vaddr(self, vaddr, size):
+        '''Looks up a frame of a given size, returning the cap and object'''
+        cap = self.lookup(self.depth(size), vaddr)
+        assert cap is not None and isinstance(cap.referent, Frame), \
+            "Expected to find a frame"
+        return cap, cap.referent
+
+    def frame_covering(self, vaddr):
+        '''Find the frame whose mapping covers vaddr, returning the depth and
+           base vaddr of its slot and the cap, or None if vaddr is unmapped.'''
+        for depth in six.moves.range(1, len(self.strides)):
+            for size in set([self.strides[depth]] +
+                    [p.size for p in self.levels[depth - 1].pages]):
+                base = vaddr - vaddr % size
+                cap = self.lookup(depth, base)
+                if cap is not None and isinstance(cap.referent, Frame) and \
+                        base + cap.referent.size > vaddr:
+                    return depth, base, cap
+        return None
+
+    def set(self, depth, vaddr, cap):
+        '''Place a cap (or None) in the slot at the given depth whose range
+           starts at vaddr. The paging structure holding the slot must already
+           exist.'''
+        level = self.levels[depth - 1]
+        table = self.tables.get((depth - 1, vaddr - vaddr % level.coverage))
+        assert table is not None, 'no paging structure maps 0x%x' % vaddr
         index = level.child_index(vaddr)
+        self._forget(depth, vaddr)
+        table[index] = cap
+        if cap is not None:
+            self._add(depth, vaddr, table, index, cap)
+
+    def update_frame_in_vaddr(self, vaddr, size, cap):
+        '''Updates a frame mapping in the virtual address space, such that
+           afterwards the slot frame_for_vaddr(vaddr, size) looks up holds
+           cap.'''
+        self.set(self.depth(size), vaddr, cap)
+
+    def delete_small_frames(self, vaddr, size, level_num):
+        '''Removes all of the frames and paging structures at or below the
+           level indicated by level_num covering the given range, both from the
+           vspace and the object space, such that new frames (or anything else)
+           can be placed straight at that level.'''
+        for depth in six.moves.range(len(self.strides) - 1, level_num - 1, -1):
+            stride = self.strides[depth]
+            for v in six.moves.range(vaddr - vaddr % stride, vaddr + size,
+                    stride):
+                slot = self.slots.get((depth, v))
+                if slot is None:
+                    continue
+                table, index = slot
+                cap = table.slots.get(index)
+                self._forget(depth, v)
+                if cap is not None and cap.referent is not None:
+                    self.obj_space.remove(cap.referent)
+                table[index] = None
+
+    def replace_large_frames(self, start_vaddr, size, page_size):
+        '''Replaces all frames in a virtual address range with frames of the
+           given (smaller) size, creating necessary intermediate paging
+           structures.'''
+        offset = 0
+        while offset < size:
+            found = self.frame_covering(start_vaddr + offset)
+            assert found is not None, 'no frame maps 0x%x' % \
+                (start_vaddr + offset)
+            depth, base, frame_cap = found
+            frame = frame_cap.referent
+
+            if frame.size <= page_size:
+                # Found frame of desired size - keep going.
+                offset += page_size
+                continue
 
-        levels.append((level, index))
-
-        level = level.child
-        cap = obj[index]
-        obj = cap.referent
-
-    return cap, levels
-
-def replace_frame_with_paging_structure(obj_space, vspace_root, frame_cap, bottom_level, indices):
-    '''Given the root paging structure of a vspace, a cap to a frame in that vspace,
-       a list of indices to traverse the paging hierarchy from the root to the that frame,
-       and the level of the paging hierarchy containing the frame, replaces the frame with
-       a paging structure of the same size, and populates it with appropriately sized frames.'''
-
-    assert len(indices) >= 1, "Empty list of indices"
-
-    paging_structure = obj_space.alloc(bottom_level.object)
-    child_size = min(p.size for p in bottom_level.pages)
-
-    # populate the paging structure with new frames
-    for i in range(0, bottom_level.coverage // child_size):
-        new_frame = obj_space.alloc(seL4_FrameObject, size=child_size)
-        paging_structure[i] = Cap(new_frame, frame_cap.read, frame_cap.write, frame_cap.grant)
-
-    # find the parent paging structure
-    if len(indices) == 1:
-        parent = vspace_root
-    else:
-        _, parent = lookup_vspace_indices(vspace_root, indices[0:-1])
-
-    # replace the entry in the parent
-    parent[indices[-1]] = Cap(paging_structure, frame_cap.read, frame_cap.write, frame_cap.grant)
-
-    # delete the old frame
-    obj_space.remove(frame_cap.referent)
-
-def replace_frame_with_small_frames(obj_space, vspace_root, frame_cap, bottom_level, indices):
-    '''Given the root paging structure of a vspace, a cap to a frame in that vspace,
-       a list of indices to traverse the paging hierarchy from the root to the that frame,
-       and the level of the paging hierarchy containing the frame, replaces the frame with
-       a collection of smaller frames, mapped into the same paging structure.'''
-
-    assert len(indices) >= 1, "Empty list of indices"
-
-    # look up the paging structure containing the frame that we'll be replacing
-    if len(indices) == 1:
-        paging_structure = vspace_root
-    else:
-        _, paging_structure = lookup_vspace_indices(vspace_root, indices[0:-1])
-
-    # index of the frame we're replacing in its paging structure
-    start_index = indices[-1]
-
-    assert paging_structure[start_index] == frame_cap, "Unexpected frame cap"
-
-    old_frame_size = frame_cap.referent.size
-    new_frame_size = min(p.size for p in bottom_level.pages)
-
-    assert old_frame_size % new_frame_size == 0, "Small frame size does not evenly divide larger frame size"
-
-    num_frames = old_frame_size // new_frame_size
-
-    # create new frames and map them in
-    for i in range(0, num_frames):
-        new_frame = obj_space.alloc(seL4_FrameObject, size=new_frame_size)
-        paging_structure[start_index + i] = Cap(new_frame, frame_cap.read, frame_cap.write, frame_cap.grant)
-
-    obj_space.remove(frame_cap.referent)
-
-def replace_large_frames(obj_space, arch, vspace_root, start_vaddr, size, page_size):
-    '''Given the root paging structure of a vspace, and a virtual address range, replaces
-       all frames with frames of the given (smaller) size, creating necessary intermediate
-       paging structures.'''
-    offset = 0
-    while offset < size:
-        vaddr = start_vaddr + offset
-        frame_cap, levels = make_indices_to_frame(arch, vspace_root, vaddr)
-
-        if frame_cap.referent.size <= page_size:
-            # Found frame of desired size - keep going.
-            offset += page_size
-        else:
-            # Found a large frame - replace it.
-            # Note that we don't increment the offset here, as we may
-            # have to replace the frame with even smaller frames.
-
-            # extract a list of indices from the list of (level, index) tuples
-            indices = [l[1] for l in levels]
-
-            (bottom_level, _) = levels[-1]
-            if bottom_level.child is not None and bottom_level.child.coverage == frame_cap.referent.size:
-                # This large frame can be replaced with a paging structure
-                # of the same coverage.
-                replace_frame_with_paging_structure(obj_space, vspace_root, frame_cap, bottom_level.child, indices)
+            # Found a large frame - replace it. Note that we don't increment
+            # the offset here, as we may have to replace the frame with even
+            # smaller frames.
+            level = self.levels[depth - 1]
+            if level.child is not None and level.child.coverage == frame.size:
+                # This large frame can be replaced with a paging structure of
+                # the same coverage, populated with appropriately sized frames.
+                paging_structure = self.obj_space.alloc(level.child.object)
+                child_size = min(p.size for p in level.child.pages)
+                for i in six.moves.range(0, level.child.coverage // child_size):
+                    new_frame = self.obj_space.alloc(seL4_FrameObject,
+                        size=child_size)
+                    paging_structure[i] = Cap(new_frame, frame_cap.read,
+                        frame_cap.write, frame_cap.grant)
+                self.set(depth, base, Cap(paging_structure, frame_cap.read,
+                    frame_cap.write, frame_cap.grant))
             else:
-                # This large frame can be replace by smaller frames in
-                # the same paging structure.
-                replace_frame_with_small_frames(obj_space, vspace_root, frame_cap, bottom_level, indices)
-
-def set_tcb_caps(ast, obj_space, cspaces, elfs, options, **_):
+                # This large frame can be replaced by smaller frames in the
+                # same paging structure.
+                new_frame_size = min(p.size for p in level.pages)
+                assert frame.size % new_frame_size == 0, "Small frame size " \
+                    "does not evenly divide larger frame size"
+                for v in six.moves.range(base, base + frame.size,
+                        new_frame_size):
+                    new_frame = self.obj_space.alloc(seL4_FrameObject,
+                        size=new_frame_size)
+                    self.set(depth, v, Cap(new_frame, frame_cap.read,
+                        frame_cap.write, frame_cap.grant))
+
+            self.obj_space.remove(frame)
+
+class VSpaces(object):
+    '''The vspace roots in a CapDL spec, looked up by name, and an index of
+       each of them constructed on first use. One of these is shared by all
+       the filters in a run so each vspace is only walked once.'''
+
+    def __init__(self, arch, obj_space):
+        self.arch = arch
+        self.obj_space = obj_space
+        self.roots = None
+        self.indices = {}
+
+    def lookup(self, name):
+        '''Return the vspace root of the given name, or None if there is none.'''
+        if self.roots is None:
+            self.roots = collections.defaultdict(list)
+            for o in self.obj_space.spec.objs:
+                self.roots[o.name].append(o)
+        roots = self.roots.get(name, [])
+        if len(roots) > 1:
+            raise Exception('Multiple PDs found named %s' % name)
+        return roots[0] if len(roots) == 1 else None
+
+    def index(self, root):
+        index = self.indices.get(root.name)
+        if index is None:
+            index = VSpaceIndex(self.arch, self.obj_space, root)
+            self.indices[root.name] = index
+        return index
+
+def set_tcb_caps(ast, obj_space, cspaces, elfs, options, vspaces, **_):
     arch = lookup_architecture(options.architecture)
     assembly = ast.assembly
 
@@ -395,13 +452,9 @@ def set_tcb_caps(ast, obj_space, cspaces, elfs, options, **_):
 
             elf_name = perspective['elf_name']
 
-            pd = None
             pd_name = perspective['pd']
-            pds = [x for x in obj_space.spec.objs if x.name == pd_name]
-            if len(pds) > 1:
-                raise Exception('Multiple PDs found for %s' % group)
-            elif len(pds) == 1:
-                pd, = pds
+            pd = vspaces.lookup(pd_name)
+            if pd is not None:
                 tcb['vspace'] = Cap(pd)
             # If no PD was found we were probably just not passed any ELF files
             # in this pass.
@@ -421,7 +474,8 @@ def set_tcb_caps(ast, obj_space, cspaces, elfs, options, **_):
                 ipc_vaddr = get_symbol_vaddr(elf, ipc_symbol) + PAGE_SIZE
 
                 # Find the frame for this
-                (cap, frame) = frame_for_vaddr(arch, pd, ipc_vaddr, PAGE_SIZE)
+                (cap, frame) = vspaces.index(pd).frame_for_vaddr(ipc_vaddr,
+                    PAGE_SIZE)
                 if frame is None:
                     raise Exception('IPC buffer of TCB %s in group %s does ' \
                         'not appear to be backed by a frame' % (tcb.name, group))
@@ -431,7 +485,7 @@ def set_tcb_caps(ast, obj_space, cspaces, elfs, options, **_):
             # Optional fault endpoints are configured in the per-component
             # template.
 
-def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
+def collapse_shared_frames(ast, obj_space, elfs, shmem, options, vspaces, **_):
     """Find regions in virtual address spaces that are intended to be backed by
     shared frames and adjust the capability distribution to reflect this."""
 
@@ -469,10 +523,9 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                 elf = elfs[elf_name]
 
                 # Find this instance's page directory.
-                pd_name = perspective['pd']
-                pds = [x for x in obj_space.spec.objs if x.name == pd_name]
-                assert len(pds) == 1
-                pd = pds[0]
+                pd = vspaces.lookup(perspective['pd'])
+                assert pd is not None
+                vspace = vspaces.index(pd)
 
                 # Look up the ELF-local version of this symbol.
                 vaddr = get_symbol_vaddr(elf, sym)
@@ -490,11 +543,6 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                     'has a size that is not page-aligned (template bug?)' % \
                     (sym, elf_name)
 
-                # Infer the page table(s) and small page(s) that currently back this
-                # region.
-                map_indices = [make_indices(arch, v, PAGE_SIZE)
-                    for v in six.moves.range(vaddr, vaddr + size, PAGE_SIZE)]
-
                 # Permissions that we will apply to the eventual mapping.
                 read = 'R' in permissions
                 write = 'W' in permissions
@@ -516,8 +564,9 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                         new_frames = {}
                         for new_vaddr in six.moves.range(vaddr, vaddr + size, largest_frame_size):
                             new_frames[new_vaddr] = obj_space.alloc(seL4_FrameObject, size=largest_frame_size)
-                        # Iterate over every unique index in every object below this one
-                        delete_small_frames(arch, obj_space, pd, level_num, map_indices)
+                        # Remove the small frames and paging structures currently
+                        # backing this region
+                        vspace.delete_small_frames(vaddr, size, level_num)
                         # Now insert the new frames
                         for new_vaddr in six.moves.range(vaddr, vaddr + size, largest_frame_size):
                             frame = new_frames[new_vaddr]
@@ -525,15 +574,16 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                             if paddr is not None:
                                 frame.paddr = paddr + (new_vaddr - vaddr)
                                 cap.set_cached(cached_hw)
-                            update_frame_in_vaddr(arch, pd, new_vaddr, largest_frame_size, cap)
+                            vspace.update_frame_in_vaddr(new_vaddr, largest_frame_size, cap)
                             frames.append(frame)
 
                     else:
                         # We don't need to handle large frame promotion. Just tweak
                         # the permissions and optionally the physical address of
                         # all the current mappings.
-                        for offset, indices in enumerate(map_indices):
-                            (cap, frame ) = lookup_vspace_indices(pd, indices)
+                        for offset, v in enumerate(six.moves.range(vaddr,
+                                vaddr + size, PAGE_SIZE)):
+                            (cap, frame) = vspace.frame_for_vaddr(v, PAGE_SIZE)
                             cap.read = read
                             cap.write = write
                             cap.grant = execute
@@ -552,8 +602,13 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                     if not exact_frames:
                         # We do not need to preserve the exact same frames / frame sizings, so
                         # we can delete the entire region ready to put in our new frames
-                        # Delete all the underlying frames / objects for this range
-                        delete_small_frames(arch, obj_space, pd, level_num, map_indices)
+                        # Delete all the underlying frames / objects for this range,
+                        # down to the level the discovered frames will be mapped at.
+                        # This may be below level_num if the region could have
+                        # been, but was not, backed by large frames.
+                        _, frames_level_num = find_optimal_frame_size(arch, 0,
+                            max(f.size for f in frames))
+                        vspace.delete_small_frames(vaddr, size, frames_level_num)
                     offset = 0
                     for frame in frames:
                         cap = Cap(frame, read, write, execute)
@@ -565,22 +620,20 @@ def collapse_shared_frames(ast, obj_space, elfs, shmem, options, **_):
                             # for that frame. This is to allow for 'weird' shared memory regions
                             # that have preallocated frames with different sized frames in
                             # the one region.
-                            frame_map_indices = [make_indices(arch, v, PAGE_SIZE)
-                                for v in six.moves.range(vaddr + offset, vaddr + offset + frame.size, PAGE_SIZE)]
                             _, frame_level_num = find_optimal_frame_size(arch, 0, frame.size)
-                            delete_small_frames(arch, obj_space, pd, frame_level_num, frame_map_indices)
+                            vspace.delete_small_frames(vaddr + offset, frame.size, frame_level_num)
                         # Now, with exact_frames or not, we know that the slot for this frame is
                         # free and we can re-insert the correct frame
-                        update_frame_in_vaddr(arch, pd, vaddr + offset, frame.size, cap)
+                        vspace.update_frame_in_vaddr(vaddr + offset, frame.size, cap)
                         offset = offset + frame.size
 
-def describe_fill_frames(ast, obj_space, elfs, fill_frames, options, **_):
+def describe_fill_frames(ast, obj_space, elfs, fill_frames, options, vspaces,
+        **_):
 
     if not elfs:
         # If we haven't been passed any ELF files this step is not relevant yet.
         return
 
-    arch = lookup_architecture(options.architecture)
     assembly = ast.assembly
 
     for name in fill_frames:
@@ -596,10 +649,8 @@ def describe_fill_frames(ast, obj_space, elfs, fill_frames, options, **_):
         elf = elfs[elf_name]
 
         # Find the vspace root
-        root_name = perspective['pd']
-        roots = [x for x in obj_space.spec.objs if x.name == root_name]
-        assert len(roots) == 1, 'No vspace found for instance %s' % name
-        root, = roots
+        root = vspaces.lookup(perspective['pd'])
+        assert root is not None, 'No vspace found for instance %s' % name
 
         # Go over all the fill symbols
         for symbol,fill in iter(fill_frames[name]):
@@ -608,11 +659,11 @@ def describe_fill_frames(ast, obj_space, elfs, fill_frames, options, **_):
             # Ensure this symbol is correctly aligned
             assert base % PAGE_SIZE == 0, 'Fill symbol in elf image is not correctly aligned (template bug?)'
 
-            (cap, frame) = frame_for_vaddr(arch, root, base, PAGE_SIZE)
+            (cap, frame) = vspaces.index(root).frame_for_vaddr(base, PAGE_SIZE)
             assert frame is not None, 'Failed to find frame for symbol at %x (CAmkES bug?)' % base
             frame.set_fill(fill)
 
-def replace_dma_frames(ast, obj_space, elfs, options, **_):
+def replace_dma_frames(ast, obj_space, elfs, options, vspaces, **_):
     '''Locate the DMA pool (a region that needs to have frames whose mappings
     can be reversed) and replace its backing frames with pre-allocated,
     reversible ones.'''
@@ -621,7 +672,6 @@ def replace_dma_frames(ast, obj_space, elfs, options, **_):
         # If we haven't been passed any ELF files this step is not relevant yet.
         return
 
-    arch = lookup_architecture(options.architecture)
     assembly = ast.assembly
 
     for i in (x for x in assembly.composition.instances
@@ -634,10 +684,9 @@ def replace_dma_frames(ast, obj_space, elfs, options, **_):
         elf = elfs[elf_name]
 
         # Find this instance's page directory.
-        pd_name = perspective['pd']
-        pds = [x for x in obj_space.spec.objs if x.name == pd_name]
-        assert len(pds) == 1
-        pd, = pds
+        pd = vspaces.lookup(perspective['pd'])
+        assert pd is not None
+        vspace = vspaces.index(pd)
 
         sym = perspective['dma_pool_symbol']
         base = get_symbol_vaddr(elf, sym)
@@ -673,12 +722,12 @@ def replace_dma_frames(ast, obj_space, elfs, options, **_):
             return obj_space[name]
 
         # Ensure paging structures are in place to map in dma frames
-        replace_large_frames(obj_space, arch, pd, base, sz, page_size)
+        vspace.replace_large_frames(base, sz, page_size)
 
         for page_vaddr in six.moves.range(base, base + sz, page_size):
             cap = Cap(get_dma_frame(dma_frame_index), True, True, False)
             cap.set_cached(False)
-            update_frame_in_vaddr(arch, pd, page_vaddr, page_size, cap)
+            vspace.update_frame_in_vaddr(page_vaddr, page_size, cap)
             dma_frame_index = dma_frame_index + 1
 
 def guard_cnode_caps(cspaces, options, **_):
@@ -692,12 +741,11 @@ def guard_cnode_caps(cspaces, options, **_):
             for cap in space.cnode.slots.values()
             if cap is not None and isinstance(cap.referent, CNode)]
 
-def guard_pages(obj_space, cspaces, elfs, options, **_):
+def guard_pages(obj_space, cspaces, elfs, options, vspaces, **_):
     '''Introduce a guard page around each stack and IPC buffer. Note that the
     templates should have ensured a three page region for each stack in order to
     enable this.'''
 
-    arch = lookup_architecture(options.architecture)
     for group, space in cspaces.items():
         cnode = space.cnode
         for index, tcb in [(k, v.referent) for (k, v) in cnode.slots.items()
@@ -712,13 +760,8 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
             elf_name = perspective['elf_name']
 
             # Find the page directory.
-            pd = None
-            pd_name = perspective['pd']
-            pds = [x for x in obj_space.spec.objs if x.name == pd_name]
-            if len(pds) > 1:
-                raise Exception('Multiple PDs found for group %s' % group)
-            elif len(pds) == 1:
-                pd, = pds
+            pd = vspaces.lookup(perspective['pd'])
+            if pd is not None:
                 tcb['vspace'] = Cap(pd)
             # If no PD was found we were probably just not passed any ELF files
             # in this pass.
@@ -727,13 +770,15 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
 
             if pd and elf:
 
+                vspace = vspaces.index(pd)
+
                 ipc_symbol = perspective['ipc_buffer_symbol']
 
                 # Find the IPC buffer's preceding guard page's virtual address.
                 assert get_symbol_size(elf, ipc_symbol) == PAGE_SIZE * 3
                 pre_guard = get_symbol_vaddr(elf, ipc_symbol)
 
-                (cap, frame) = frame_for_vaddr(arch, pd, pre_guard, PAGE_SIZE)
+                (cap, frame) = vspace.frame_for_vaddr(pre_guard, PAGE_SIZE)
                 if frame is None:
                     raise Exception('IPC buffer region of TCB %s in '
                         'group %s does not appear to be backed by a frame'
@@ -741,7 +786,7 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
 
                 # Delete the page.
                 obj_space.remove(frame)
-                update_frame_in_vaddr(arch, pd, pre_guard, PAGE_SIZE, None)
+                vspace.update_frame_in_vaddr(pre_guard, PAGE_SIZE, None)
 
                 # Now do the same for the following guard page. We do this
                 # calculation separately just in case the region crosses a PT
@@ -749,14 +794,14 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
 
                 post_guard = pre_guard + 2 * PAGE_SIZE
 
-                (cap, frame) = frame_for_vaddr(arch, pd, post_guard, PAGE_SIZE)
+                (cap, frame) = vspace.frame_for_vaddr(post_guard, PAGE_SIZE)
                 if frame is None:
                     raise Exception('IPC buffer region of TCB %s in '
                         'group %s does not appear to be backed by a frame'
                         % (tcb.name, group))
 
                 obj_space.remove(frame)
-                update_frame_in_vaddr(arch, pd, post_guard, PAGE_SIZE, None)
+                vspace.update_frame_in_vaddr(post_guard, PAGE_SIZE, None)
 
                 # Now we do the same thing for the preceding guard page of the
                 # thread's stack...
@@ -765,14 +810,14 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
 
                 pre_guard = get_symbol_vaddr(elf, stack_symbol)
 
-                (cap, frame) = frame_for_vaddr(arch, pd, pre_guard, PAGE_SIZE)
+                (cap, frame) = vspace.frame_for_vaddr(pre_guard, PAGE_SIZE)
                 if frame is None:
                     raise Exception('stack region of TCB %s in '
                         'group %s does not appear to be backed by a frame'
                         % (tcb.name, group))
 
                 obj_space.remove(frame)
-                update_frame_in_vaddr(arch, pd, pre_guard, PAGE_SIZE, None)
+                vspace.update_frame_in_vaddr(pre_guard, PAGE_SIZE, None)
 
                 # ...and the following guard page.
 
@@ -783,14 +828,14 @@ def guard_pages(obj_space, cspaces, elfs, options, **_):
                     'stack region has no room for guard pages'
                 post_guard = pre_guard + stack_region_size - PAGE_SIZE
 
-                (cap, frame) = frame_for_vaddr(arch, pd, post_guard, PAGE_SIZE)
+                (cap, frame) = vspace.frame_for_vaddr(post_guard, PAGE_SIZE)
                 if frame is None:
                     raise Exception('stack region of TCB %s in '
                         'group %s does not appear to be backed by a frame'
                         % (tcb.name, group))
 
                 obj_space.remove(frame)
-                update_frame_in_vaddr(arch, pd, post_guard, PAGE_SIZE, None)
+                vspace.update_frame_in_vaddr(post_guard, PAGE_SIZE, None)
 
 def tcb_default_properties(obj_space, options, **_):
     '''Set up default thread priorities. Note this filter needs to operate
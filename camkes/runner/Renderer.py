@@ -21,10 +21,12 @@ from camkes.internal.seven import cmp, filter, map, zip
 
 from .Context import new_context
 from camkes.internal.mkdirp import mkdirp
+import camkes.internal.profile as profile
 from camkes.internal.version import version
 from camkes.templates import TemplateError, TEMPLATES
 
-import jinja2, os, platform, six, sys
+import jinja2, jinja2.meta, multiprocessing, os, platform, six, sys, time, \
+    traceback
 
 # Jinja is setup by default for HTML templating. We tweak the delimiters to
 # make it more suitable for C.
@@ -35,6 +37,16 @@ END_VARIABLE = '?*/'
 START_COMMENT = '/*#'
 END_COMMENT = '#*/'
 
+# Names in the template context through which a template can observe or modify
+# allocation state, or any other state whose value depends on the order in
+# which templates are rendered. See `Renderer.allocates`.
+STATEFUL_NAMES = frozenset([
+    '_pop', '_stash', 'alloc', 'alloc_cap', 'alloc_obj', 'breakpoint',
+    'c_symbol', 'cap_space', 'exec', 'guard', 'isabelle_symbol', 'keep_symbol',
+    'kept_symbols', 'my_cnode', 'my_pd', 'obj_space', 'pop',
+    'register_fill_frame', 'register_shared_variable', 'shmem', 'stash',
+])
+
 def get_leaves(d):
     '''Generator that yields the leaves of a hierarchical dictionary. See usage
     below.'''
@@ -48,8 +60,45 @@ def get_leaves(d):
             # We're at a leaf node.
             yield v
 
+class RecordingLoader(jinja2.ChoiceLoader):
+    '''
+    A choice loader that remembers the name of every template it loads,
+    including those only imported or included by others.
+    '''
+
+    def __init__(self, loaders):
+        super(RecordingLoader, self).__init__(loaders)
+        self.loaded = set()
+
+    def load(self, environment, name, globals=None):
+        t = super(RecordingLoader, self).load(environment, name, globals)
+        self.loaded.add(name)
+        return t
+
+def environment(roots, precompiled=None, auto_reload=False):
+    '''
+    Construct a Jinja environment for the templates under `roots`, preferring
+    the pre-compiled templates in `precompiled` if given.
+    '''
+    loaders = []
+    if precompiled is not None:
+        loaders.append(jinja2.ModuleLoader(precompiled))
+    loaders.extend(jinja2.FileSystemLoader(x) for x in roots)
+
+    return jinja2.Environment(
+        loader=RecordingLoader(loaders),
+        extensions=["jinja2.ext.do", "jinja2.ext.loopcontrols"],
+        block_start_string=START_BLOCK,
+        block_end_string=END_BLOCK,
+        variable_start_string=START_VARIABLE,
+        variable_end_string=END_VARIABLE,
+        comment_start_string=START_COMMENT,
+        comment_end_string=END_COMMENT,
+        auto_reload=auto_reload,
+        undefined=jinja2.StrictUndefined)
+
 class Renderer(object):
-    def __init__(self, templates, cache, cache_dir):
+    def __init__(self, templates, cache, cache_dir, environments=None):
 
         # PERF: This function is simply constructing a Jinja environment and
         # would be trivial, except that we optimise re-execution of template
@@ -64,26 +113,33 @@ class Renderer(object):
         template_cache = os.path.join(cache_dir, version(),
             'precompiled-templates')
 
-        loaders = []
-        if cache and os.path.exists(template_cache):
-            # Pre-compiled templates.
-            loaders.append(jinja2.ModuleLoader(template_cache))
-
-        # Source templates.
-        loaders.extend(jinja2.FileSystemLoader(os.path.abspath(x)) for x in
-            templates.get_roots())
-
-        self.env = jinja2.Environment(
-            loader=jinja2.ChoiceLoader(loaders),
-            extensions=["jinja2.ext.do", "jinja2.ext.loopcontrols"],
-            block_start_string=START_BLOCK,
-            block_end_string=END_BLOCK,
-            variable_start_string=START_VARIABLE,
-            variable_end_string=END_VARIABLE,
-            comment_start_string=START_COMMENT,
-            comment_end_string=END_COMMENT,
-            auto_reload=False,
-            undefined=jinja2.StrictUndefined)
+        # Pre-compiled templates, if we have them.
+        precompiled = template_cache if cache and \
+            os.path.exists(template_cache) else None
+
+        roots = tuple(os.path.abspath(x) for x in templates.get_roots())
+        self.roots = roots
+        self.precompiled = precompiled
+
+        # Template sources, for analysis by `allocates`. The environment's own
+        # loader may be serving pre-compiled templates that have no source.
+        self.source_loader = jinja2.FileSystemLoader(roots)
+        self.allocating = {}
+
+        # A long-lived caller (the code generation server) can supply a
+        # dictionary in which to retain environments across renderers. Jinja
+        # then only compiles each template once per process. Templates can be
+        # edited during the lifetime of such a process, so we need Jinja to
+        # check for modifications. The key is the arguments to `environment`.
+        key = (roots, precompiled)
+        if environments is not None and key in environments:
+            self.env = environments[key]
+            return
+
+        self.env = environment(roots, precompiled,
+            auto_reload=environments is not None)
+        if environments is not None:
+            environments[key] = self.env
 
         if cache and not os.path.exists(template_cache):
             # The pre-compiled template cache is enabled but does not exist.
@@ -103,6 +159,18 @@ class Renderer(object):
                 ignore_errors=False, py_compile=
                 platform.python_implementation() == 'CPython' and six.PY2)
 
+    def __getstate__(self):
+        # Jinja environments cannot be pickled. Construct a fresh one instead,
+        # using the templates this one has already compiled if any.
+        return {'templates':self.templates, 'roots':self.roots,
+            'precompiled':self.precompiled}
+
+    def __setstate__(self, state):
+        self.__dict__.update(state)
+        self.source_loader = jinja2.FileSystemLoader(self.roots)
+        self.allocating = {}
+        self.env = environment(self.roots, self.precompiled)
+
     def render(self, me, assembly, template, obj_space, cap_space, shmem, kept_symbols, fill_frames,
             **kwargs):
         context = new_context(me, assembly, obj_space, cap_space,
@@ -119,3 +187,89 @@ class Renderer(object):
             # exceptions aren't our fault.
             six.reraise(TemplateError, TemplateError('unhandled exception in '
                 'template %s: %s' % (template, e)), sys.exc_info()[2])
+
+    def allocates(self, template):
+        '''
+        Whether rendering the given template may interact with allocation state
+        (or other state that depends on rendering order). Templates for which
+        this returns False produce the same output regardless of what has been
+        rendered before them. This is a conservative syntactic check of the
+        names the template, and anything it includes or imports, refers to.
+        '''
+        try:
+            return self.allocating[template]
+        except KeyError:
+            pass
+
+        # Assume the worst while we look, in case of recursive inclusion.
+        self.allocating[template] = True
+
+        try:
+            source, _, _ = self.source_loader.get_source(self.env, template)
+            ast = self.env.parse(source)
+        except jinja2.exceptions.TemplateError:
+            return True
+
+        result = len(jinja2.meta.find_undeclared_variables(ast) &
+            STATEFUL_NAMES) > 0 or \
+            any(t is None or self.allocates(t) for t in
+                jinja2.meta.find_referenced_templates(ast))
+
+        self.allocating[template] = result
+        return result
+
+# Work for this `RenderPool` worker, set by `_init_worker`.
+_pool_renderer = None
+_pool_units = None
+
+def _init_worker(renderer, units):
+    # These arrive pickled, or inherited as they are if the worker was
+    # forked, once per worker rather than with each unit.
+    global _pool_renderer, _pool_units
+    _pool_renderer = renderer
+    _pool_units = units
+
+def _render_unit(index):
+    me, assembly, template, kwargs = _pool_units[index]
+    start = time.time()
+    cpu = profile.cpu_time()
+    try:
+        ok, result = True, _pool_renderer.render(me, assembly, template, None,
+            None, None, None, None, **kwargs)
+    except Exception as e:
+        lines = list(e.args) if isinstance(e, TemplateError) else \
+            ['unhandled exception in template %s: %s' % (template, e)]
+        ok, result = False, (lines, traceback.format_exc().splitlines())
+    # Measure the unit here, where it ran, for the parent's profile. Note that
+    # a worker's peak RSS covers every unit it has rendered so far.
+    return ok, result, (os.getpid(), start, time.time() - start,
+        profile.cpu_time() - cpu, profile.max_rss())
+
+class RenderPool(object):
+    '''
+    Renders templates that do not interact with allocation state (see
+    `Renderer.allocates`) in worker processes. Each unit of work is a tuple of
+    (entity, assembly, template, render keyword arguments). All units start
+    rendering immediately, in parallel with whatever the caller does next.
+    '''
+
+    def __init__(self, renderer, units, jobs):
+        self.pool = multiprocessing.Pool(jobs, _init_worker, (renderer, units))
+        self.results = [self.pool.apply_async(_render_unit, (i,))
+            for i in range(len(units))]
+
+    def collect(self):
+        '''
+        Wait for every unit and shut the workers down. Returns a list, in unit
+        order, of (True, output, timing) or (False, (error messages, traceback),
+        timing), where timing is (worker PID, start time, wall clock time, CPU
+        time, worker peak RSS) as taken by `profile.record`.
+        '''
+        try:
+            return [r.get() for r in self.results]
+        finally:
+            self.close()
+
+    def close(self):
+        self.pool.terminate()
+        self.pool.join()
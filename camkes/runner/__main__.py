@@ -32,35 +32,50 @@ if platform.python_implementation() != 'CPython':
         if p not in sys.path:
             sys.path.append(p)
 
-from camkes.ast import ASTError, Connection, Connector
-from camkes.templates import Templates, PLATFORMS, TemplateError
+from camkes.ast import ASTError, Connection, Connector, Method
+from camkes.templates import Templates, PLATFORMS, TemplateError, \
+    sizeof_probe
+from camkes.templates.Template import get_dependencies
 from camkes.internal.cachea import Cache as LevelACache, \
-    prime_inputs as level_a_prime
+    prime_inputs as level_a_prime, valid_inputs as level_a_valid
 from camkes.internal.cacheb import Cache as LevelBCache, \
     prime_ast_hash as level_b_prime
 import camkes.internal.log as log
+import camkes.internal.profile as profile
 from camkes.internal.version import sources, version
 from camkes.internal.exception import CAmkESError
+from camkes.internal.mkdirp import mkdirp
+from camkes.internal.snapshot import save as snapshot_save, Snapshot, \
+    SnapshotError
+from camkes.internal.strhash import hash_string
 from camkes.runner.NameMangling import Perspective, RUNNER
-from camkes.runner.Renderer import Renderer
-from camkes.runner.Filters import CAPDL_FILTERS
+from camkes.runner.Renderer import Renderer, RenderPool
+from camkes.runner.Filters import CAPDL_FILTERS, VSpaces
 
-import argparse, collections, functools, jinja2, locale, numbers, os, re, \
-    six, sqlite3, string, sys, traceback, pickle, errno
+import argparse, binascii, collections, difflib, functools, jinja2, locale, \
+    numbers, os, re, six, sqlite3, string, sys, traceback, pickle, errno
 from capdl import seL4_CapTableObject, ObjectAllocator, CSpaceAllocator, \
     ELF, lookup_architecture
 
 from camkes.parser import parse_file, ParseError
 
-CAPDL_STATE_PICKLE = 'capdl_state.p'
+CAPDL_STATE_SNAPSHOT = 'capdl_state.snapshot'
+
+# The parts of the CapDL state saved in a snapshot, in the order they are
+# unpacked. Kernel objects are shared between them, so they are pickled
+# together in one section.
+CAPDL_STATE = ('obj_space', 'shmem', 'cspaces', 'pds', 'kept_symbols',
+    'fill_frames')
 
 class ParserOptions():
-    def __init__(self, cpp, cpp_flag, import_path, verbosity, allow_forward_references):
+    def __init__(self, cpp, cpp_flag, import_path, verbosity, allow_forward_references,
+            cache_dir=None):
         self.cpp = cpp
         self.cpp_flag = cpp_flag
         self.import_path = import_path
         self.verbosity = verbosity
         self.allow_forward_references = allow_forward_references
+        self.cache_dir = cache_dir
 
 class FilterOptions():
     def __init__(self, architecture, realtime, largeframe, largeframe_dma, default_priority,
@@ -97,6 +112,13 @@ class RenderOptions():
         self.debug_fault_handlers = debug_fault_handlers
         self.realtime = realtime
 
+    def __getstate__(self):
+        # Only the name of the input file is of use to templates, and an open
+        # file cannot be pickled.
+        state = dict(self.__dict__)
+        state['file'] = argparse.Namespace(name=self.file.name)
+        return state
+
 def safe_decode(s):
     '''
     Safely extract a string that may contain invalid character encodings.
@@ -237,6 +259,16 @@ def parse_args(argv, out, err):
         help='promote frames backing DMA pools to large frames where possible')
     parser.add_argument('--realtime', action='store_true',
         help='Target realtime seL4.')
+    parser.add_argument('--render-jobs', '-j', type=int, default=1,
+        help='Render templates that do not allocate capabilities in this many '
+        'worker processes, in parallel with the rest of code generation.')
+    parser.add_argument('--verify-render-jobs', action='store_true',
+        help='Also render templates that would be rendered by --render-jobs '
+        'workers in the main process, and fail if the outputs differ.')
+    parser.add_argument('--profile-out', metavar='FILE',
+        help='Record the wall clock time, CPU time and peak memory use of each '
+        'phase of code generation, template and CapDL filter, and write them '
+        'to this file in Chrome trace-event format.')
     parser.add_argument('--data-structure-cache-dir', type=str,
         help='Directory for storing pickled datastructures for re-use between multiple '
              'invocations of the camkes tool in a single build. The user should delete '
@@ -290,13 +322,111 @@ class ShmemFactory:
     def __call__(self):
         return collections.defaultdict(list)
 
+def capdl_state_digest(argv, inputs):
+    '''
+    Digest identifying what a CapDL state snapshot was derived from: the
+    command line arguments that affect allocation and the contents of the
+    primed input files. Arguments that differ between the invocations that
+    write and read the snapshot are excluded.
+    '''
+    key = []
+    skip = False
+    for arg in argv[1:]:
+        if skip:
+            skip = False
+            continue
+        if arg in ('--item', '-T', '--outfile', '-O', '--elf', '-E',
+                '--makefile-dependencies', '-MD', '--profile-out',
+                '--render-jobs', '-j'):
+            skip = True
+            continue
+        if arg == '--verify-render-jobs':
+            continue
+        key.append(arg)
+    key.extend('%s %s' % (x[0], x[1]) for x in inputs)
+    return binascii.unhexlify(hash_string('\n'.join(key)))
+
+def load_capdl_state(argv, path, read, persistent):
+    '''
+    Retrieve the CapDL state saved by a previous invocation, in the order of
+    `CAPDL_STATE`, or `None` if there is no snapshot or it was derived from
+    different inputs. Only the snapshot's inputs are unpickled before the
+    digest is checked, so a stale snapshot costs no more than reading its
+    directory and inputs.
+    '''
+    try:
+        s = None
+        if persistent is not None:
+            fingerprint, data = persistent.capdl_states.get(path, (None, None))
+            if fingerprint == stat_fingerprint(path):
+                s = Snapshot(data)
+        if s is None:
+            s = Snapshot.open(path)
+        inputs = s['inputs']
+    except (EnvironmentError, SnapshotError, KeyError):
+        return None
+
+    if set(x[0] for x in inputs) != read or not level_a_valid(inputs) or \
+            s.digest != capdl_state_digest(argv, inputs):
+        log.debug('ignoring stale CapDL state snapshot %s' % path)
+        return None
+
+    try:
+        state = s['state']
+    except KeyError:
+        return None
+    assert len(state) == len(CAPDL_STATE)
+    return state
+
+def save_capdl_state(argv, path, read, state, persistent):
+    inputs = level_a_prime(sorted(read))
+    sections = [('inputs', inputs), ('state', tuple(state))]
+    data = snapshot_save(path, sections, capdl_state_digest(argv, inputs))
+    if persistent is not None:
+        persistent.capdl_states[path] = (stat_fingerprint(path), data)
+
+def stat_fingerprint(path):
+    st = os.stat(path)
+    return (st.st_dev, st.st_ino, st.st_size, st.st_mtime)
+
+def item_args(args, item):
+    '''
+    Derive the cache key arguments for a single item from the (already
+    --outfile-stripped) arguments of a possibly batched invocation. All --item
+    parameters are removed and the given item is placed where the first of
+    them appeared. For an invocation that only requested `item`, this is the
+    identity, so entries saved from a batched invocation are hit by
+    single-item invocations and vice versa.
+    '''
+    key = []
+    item_index = None
+    skip = False
+    for arg in args:
+        if skip:
+            skip = False
+            continue
+        if arg in ('--item', '-T'):
+            if item_index is None:
+                item_index = len(key)
+                key.append(arg)
+            skip = True
+            continue
+        key.append(arg)
+    assert item_index is not None, 'failed to find required argument ' \
+        '--item (bug in runner?)'
+    return key[:item_index + 1] + [item] + key[item_index + 1:]
+
 def rendering_error(item, exn):
     '''Helper to format an error message for template rendering errors.'''
     tb = safe_decode(traceback.format_tb(sys.exc_info()[2]))
     return (['While rendering %s: %s' % (item, line) for line in exn.args] +
             ''.join(tb).splitlines())
 
-def main(argv, out, err):
+def main(argv, out, err, persistent=None):
+    '''
+    Run the code generator. `persistent` is optional state retained between
+    calls by a long-lived process (see `camkes.runner.server`).
+    '''
 
     # We need a UTF-8 locale, so bail out if we don't have one. More
     # specifically, things like the version() computation traverse the file
@@ -325,8 +455,36 @@ def main(argv, out, err):
         err.write('Duplicate outfiles requrested through --outfile.\n')
         return -1
 
+    if options.profile_out is None:
+        return generate(argv, options, out, err, persistent)
+
+    profile.enable()
+    try:
+        with profile.phase('runner'):
+            return generate(argv, options, out, err, persistent)
+    finally:
+        try:
+            profile.write(options.profile_out, argv=argv[1:],
+                items=options.item)
+        except EnvironmentError as e:
+            log.warning('failed to write profile to %s: %s' %
+                (options.profile_out, e))
+        profile.disable()
+
+def generate(argv, options, out, err, persistent):
+    '''
+    Generate the items requested in `options`. This is the body of `main`,
+    after argument validation.
+    '''
+
+    # Workers rendering templates in parallel, if any. See below.
+    pool = None
+
     # Save us having to pass debugging everywhere.
-    die = functools.partial(_die, options)
+    def die(message):
+        if pool is not None:
+            pool.close()
+        _die(options, message)
 
     log.set_verbosity(options.verbosity)
 
@@ -348,16 +506,20 @@ def main(argv, out, err):
         # ancillary outputs that we generate along the way to the current
         # output. If we were to include --outfile in the key, future attempts
         # to generate these ancillary outputs would unnecessarily miss the
-        # entries generated by this execution.
+        # entries generated by this execution. Profiling and the number of
+        # render processes do not affect the output either.
         args = []
         skip = False
         for index, arg in enumerate(argv[1:]):
             if skip:
                 skip = False
                 continue
-            if arg in ('--outfile', '-O'):
+            if arg in ('--outfile', '-O', '--profile-out', '--render-jobs',
+                    '-j'):
                 skip = True
                 continue
+            if arg == '--verify-render-jobs':
+                continue
             args.append(arg)
 
         cachea = LevelACache(os.path.join(options.cache_dir, version(), 'cachea'))
@@ -402,25 +564,37 @@ def main(argv, out, err):
         if len(all_items - done_items) == 0:
             sys.exit(ret)
 
-    # Try to find this output in the level A cache if possible. This check will
-    # 'hit' if the source files representing the input spec are identical to
-    # some previously observed execution.
+    # Try to find these outputs in the level A cache if possible. This check
+    # will 'hit' if the source files representing the input spec are identical
+    # to some previously observed execution. Each requested item is keyed
+    # individually, so a batched invocation restores whatever it can and only
+    # generates the remainder.
     if cachea is not None:
         assert 'args' in locals()
-        assert len(options.outfile) == 1, 'level A cache only supported when requestiong ' \
-            'single items'
-        output = cachea.load(args, cwd)
-        if output is not None:
-            log.debug('Retrieved %(platform)s/%(item)s from level A cache' %
-                options.__dict__)
-            done(output, options.outfile[0], options.item[0])
+        for (item, outfile) in sorted(all_items - done_items):
+            with profile.phase('level A cache lookup', 'cache', item=item):
+                output = cachea.load(item_args(args, item), cwd)
+            if output is not None:
+                log.debug('Retrieved %s/%s from level A cache' %
+                    (options.platform, item))
+                done(output, outfile, item)
 
     filename = os.path.abspath(options.file.name)
 
     try:
-        # Build the parser options
-        parse_options = ParserOptions(options.cpp, options.cpp_flag, options.import_path, options.verbosity, options.allow_forward_references)
-        ast, read = parse_file_cached(filename, options.data_structure_cache_dir, parse_options)
+        with profile.phase('parse'):
+            # Build the parser options
+            parse_options = ParserOptions(options.cpp, options.cpp_flag, options.import_path, options.verbosity, options.allow_forward_references,
+                os.path.join(options.cache_dir, version(), 'parser') if options.cache else None)
+            if persistent is None:
+                ast, read = parse_file_cached(filename,
+                    options.data_structure_cache_dir, parse_options)
+            else:
+                ast, read = persistent.parse((filename, options.cpp,
+                    tuple(options.cpp_flag), tuple(options.import_path),
+                    options.allow_forward_references),
+                    lambda: parse_file_cached(filename,
+                        options.data_structure_cache_dir, parse_options))
     except (ASTError, ParseError) as e:
         die(e.args)
 
@@ -461,13 +635,29 @@ def main(argv, out, err):
     kept_symbols = {}
     fill_frames = {}
 
+    # Let the templates determine the sizes of any types they need in one
+    # go, rather than asking the C compiler about them one by one.
+    sizeof_probe.cache_dir = os.path.join(options.cache_dir, version(),
+        'sizeof') if options.cache else None
+    for m in (x for x in ast if isinstance(x, Method)):
+        sizeof_probe.candidates.update([param.type for param in m.parameters] +
+            ([m.return_type] if m.return_type is not None else []))
+    sizeof_probe.candidates.add('void*')
+
     templates = Templates(options.platform)
     [templates.add_root(t) for t in options.templates]
     try:
-        r = Renderer(templates, options.cache, options.cache_dir)
+        with profile.phase('renderer setup'):
+            r = Renderer(templates, options.cache, options.cache_dir,
+                environments=None if persistent is None else
+                    persistent.environments)
     except jinja2.exceptions.TemplateSyntaxError as e:
         die('template syntax error: %s' % e)
 
+    def render(item, me, assembly, template, *args, **kwargs):
+        with profile.phase(item, 'template', template=template):
+            return r.render(me, assembly, template, *args, **kwargs)
+
     # The user may have provided their own connector definitions (with
     # associated) templates, in which case they won't be in the built-in lookup
     # dictionary. Let's add them now. Note, definitions here that conflict with
@@ -476,6 +666,12 @@ def main(argv, out, err):
     # optimisation; the templates module handles connectors without templates
     # just fine.
     extra_templates = set()
+    # The files read by the custom template each connection end renders,
+    # keyed by the prefix of the end's items, and those of the custom
+    # templates that may affect what is rendered after them through allocation
+    # state.
+    end_templates = {}
+    allocating_templates = set()
     for c in (x for x in ast.items if isinstance(x, Connector) and
             (x.from_template is not None or x.to_template is not None)):
         try:
@@ -492,7 +688,29 @@ def main(argv, out, err):
         except StopIteration:
             # No connections use this type. There's no point adding it to the
             # template lookup dictionary.
-            pass
+            continue
+        for end, template in (('from', c.from_template),
+                ('to', c.to_template)):
+            if template is None:
+                continue
+            dependencies = get_dependencies(templates.get_roots(), template)
+            for x in (x for x in ast if isinstance(x, Connection) and
+                    x.type == c):
+                end_templates['%s/%s/' % (x.name, end)] = dependencies
+            if r.allocates(template):
+                allocating_templates |= dependencies
+
+    def item_templates(item):
+        '''
+        The custom template files whose contents `item` depends on. An item of
+        a connection end with a custom template depends on that template and
+        on any custom template that allocates. Other items, such as the CapDL
+        spec, depend on every custom template.
+        '''
+        for prefix, dependencies in end_templates.items():
+            if item.startswith(prefix):
+                return dependencies | allocating_templates
+        return extra_templates
 
     # Check if our current target is in the level B cache. The level A cache
     # will 'miss' and this one will 'hit' when the input spec is identical to
@@ -500,15 +718,17 @@ def main(argv, out, err):
     # element (e.g. an introduced comment).
     ast_hash = None
     if cacheb is not None:
-        ast_hash = level_b_prime(ast)
+        with profile.phase('level B cache hashing', 'cache'):
+            ast_hash = level_b_prime(ast)
         assert 'args' in locals()
-        assert len(options.item) == 1, 'level B cache only supported when requesting ' \
-            'single items'
-        output = cacheb.load(ast_hash, args, set(options.elf) | extra_templates)
-        if output is not None:
-            log.debug('Retrieved %(platform)s/%(item)s from level B cache' %
-                options.__dict__)
-            done(output, options.outfile[0], options.item[0])
+        for (item, outfile) in sorted(all_items - done_items):
+            with profile.phase('level B cache lookup', 'cache', item=item):
+                output = cacheb.load(ast_hash, item_args(args, item),
+                    set(options.elf) | item_templates(item))
+            if output is not None:
+                log.debug('Retrieved %s/%s from level B cache' %
+                    (options.platform, item))
+                done(output, outfile, item)
 
     # Add custom templates.
     read |= extra_templates
@@ -529,25 +749,11 @@ def main(argv, out, err):
 
         assert cachea is not None, 'level A cache not available, though the ' \
             'cache is enabled (bug in runner?)'
-        # The logic of this cache currently only works when a single item is requested
-        # on the command line
-        assert len(options.item) == 1, 'level A cache only supported when requesting ' \
-            'single items'
 
         # Calculate the input files to the level A cache.
-        inputs = level_a_prime(read)
-
-        # Work out the position of the --item argument in the command line
-        # parameters. We will use this to cache not only outputs for this
-        # execution, but also outputs for ones with a different target.
-        item_index = None
+        with profile.phase('level A cache hashing', 'cache'):
+            inputs = level_a_prime(read)
         assert 'args' in locals()
-        for index, arg in enumerate(args[:-1]):
-            if arg in ('--item', '-T'):
-                item_index = index + 1
-                break
-        assert item_index is not None, 'failed to find required argument ' \
-            '--item (bug in runner?)'
 
         # We should already have the necessary inputs for the level B cache.
         assert cacheb is not None, 'level B cache not available, though the ' \
@@ -557,11 +763,19 @@ def main(argv, out, err):
 
         def save(item, value):
             # Juggle the command line arguments to cache the predicted
-            # arguments for a call that would generate this item.
-            new_args = args[:item_index] + [item] + args[item_index + 1:]
+            # arguments for a call that would generate this item. This caches
+            # not only outputs for this execution, but also outputs for ones
+            # with a different target.
+            new_args = item_args(args, item)
+
+            # Leave out the custom templates this item does not depend on, so
+            # that editing one of them does not invalidate it.
+            unrelated = extra_templates - item_templates(item)
+            item_inputs = tuple(i for i in inputs if i[0] not in unrelated)
 
             # Save entries in both caches.
-            cachea.save(new_args, cwd, value, inputs)
+            with profile.phase('level A cache save', 'cache', item=item):
+                cachea.save(new_args, cwd, value, item_inputs)
             if item != 'Makefile' and item != 'camkes-gen.cmake':
                 # We avoid caching the generated Makefile because it is not
                 # safe. The inputs to generation of the Makefile are not only
@@ -579,8 +793,9 @@ def main(argv, out, err):
                 # now introduce something semantically relevant into this file
                 # (e.g. an Assembly block) and it will not be seen by the build
                 # system.
-                cacheb.save(ast_hash, new_args,
-                    set(options.elf) | extra_templates, value)
+                with profile.phase('level B cache save', 'cache', item=item):
+                    cacheb.save(ast_hash, new_args,
+                        set(options.elf) | item_templates(item), value)
     else:
         def save(item, value):
             pass
@@ -593,13 +808,14 @@ def main(argv, out, err):
                 name = os.path.basename(e)
                 if name in elfs:
                     raise Exception('duplicate ELF files of name \'%s\' encountered' % name)
-                elf = ELF(e, name, options.architecture)
-                p = Perspective(phase=RUNNER, elf_name=name)
-                group = p['group']
-                # Avoid inferring a TCB as we've already created our own.
-                elf_spec = elf.get_spec(infer_tcb=False, infer_asid=False,
-                    pd=pds[group], use_large_frames=options.largeframe)
-                obj_space.merge(elf_spec, label=group)
+                with profile.phase('load ELF', 'capdl', elf=name):
+                    elf = ELF(e, name, options.architecture)
+                    p = Perspective(phase=RUNNER, elf_name=name)
+                    group = p['group']
+                    # Avoid inferring a TCB as we've already created our own.
+                    elf_spec = elf.get_spec(infer_tcb=False, infer_asid=False,
+                        pd=pds[group], use_large_frames=options.largeframe)
+                    obj_space.merge(elf_spec, label=group)
                 elfs[name] = (e, elf)
             except Exception as inst:
                 die('While opening \'%s\': %s' % (e, inst))
@@ -609,12 +825,16 @@ def main(argv, out, err):
             options.default_affinity, options.default_period, options.default_budget,
             options.default_data, options.default_size_bits,
             options.debug_fault_handlers, options.fprovide_tcb_caps)
+        # Vspaces shared by the filters, so each is only indexed once.
+        vspaces = VSpaces(lookup_architecture(options.architecture), obj_space)
         for f in CAPDL_FILTERS:
             try:
                 # Pass everything as named arguments to allow filters to
                 # easily ignore what they don't want.
-                f(ast=ast, obj_space=obj_space, cspaces=cspaces, elfs=elfs,
-                    options=filteroptions, shmem=shmem, fill_frames=fill_frames)
+                with profile.phase(f.__name__, 'filter'):
+                    f(ast=ast, obj_space=obj_space, cspaces=cspaces, elfs=elfs,
+                        options=filteroptions, shmem=shmem,
+                        fill_frames=fill_frames, vspaces=vspaces)
             except Exception as inst:
                 die('While forming CapDL spec: %s' % inst)
 
@@ -628,7 +848,7 @@ def main(argv, out, err):
             try:
                 template = templates.lookup(item)
                 if template:
-                    g = r.render(assembly, assembly, template, obj_space, None,
+                    g = render(item, assembly, assembly, template, obj_space, None,
                         shmem, kept_symbols, fill_frames, imported=read, options=renderoptions)
                     save(item, g)
                     done(g, outfile, item)
@@ -640,17 +860,19 @@ def main(argv, out, err):
         # It's possible that data structures required to instantiate the capdl spec
         # were saved during a previous invocation of this script in the current build.
         cache_path = os.path.realpath(options.data_structure_cache_dir)
-        pickle_path = os.path.join(cache_path, CAPDL_STATE_PICKLE)
-
-        if os.path.isfile(pickle_path):
-            with open(pickle_path, 'rb') as pickle_file:
-                # Found a cached version of the necessary data structures
-                obj_space, shmem, cspaces, pds, kept_symbols, fill_frames = pickle.load(pickle_file)
-                apply_capdl_filters()
-                instantiate_misc_template()
+        snapshot_path = os.path.join(cache_path, CAPDL_STATE_SNAPSHOT)
+
+        with profile.phase('load CapDL state', 'capdl'):
+            state = load_capdl_state(argv, snapshot_path,
+                read - set(options.elf), persistent)
+        if state is not None:
+            # Found a cached version of the necessary data structures
+            obj_space, shmem, cspaces, pds, kept_symbols, fill_frames = state
+            apply_capdl_filters()
+            instantiate_misc_template()
 
-                # If a template wasn't instantiated, something went wrong, and we can't recover
-                raise CAmkESError("No template instantiated on capdl generation fastpath")
+            # If a template wasn't instantiated, something went wrong, and we can't recover
+            raise CAmkESError("No template instantiated on capdl generation fastpath")
 
     # We're now ready to instantiate the template the user requested, but there
     # are a few wrinkles in the process. Namely,
@@ -666,6 +888,51 @@ def main(argv, out, err):
     #     allocated are dependent on what allocations have been done prior to a
     #     given allocation call.
 
+    # Not all code templates allocate, however. Those that do not interact with
+    # allocation state at all render identically wherever they fall in the
+    # order. If we were asked to, we farm these out to worker processes now,
+    # leaving only the allocating templates to be rendered in order below. The
+    # outputs of the workers are collected once all component and connection
+    # code templates have been rendered.
+    def component_templates(i):
+        return ('%s/source' % i.name, '%s/header' % i.name,
+            '%s/c_environment_source' % i.name,
+            '%s/cakeml_start_source' % i.name, '%s/cakeml_end_source' % i.name,
+            '%s/linker' % i.name)
+
+    def connection_templates(c):
+        return (('%s/from/source' % c.name, c.from_ends),
+                ('%s/from/header' % c.name, c.from_ends),
+                ('%s/to/source' % c.name, c.to_ends),
+                ('%s/to/header' % c.name, c.to_ends))
+
+    parallel = {} # item -> index of its unit of work
+    expected = {} # item -> output of rendering it in order
+    if options.render_jobs > 1:
+        units = []
+        for i in assembly.composition.instances:
+            if i.type.hardware:
+                continue
+            for t in component_templates(i):
+                template = templates.lookup(t, i)
+                if template and not r.allocates(template):
+                    parallel[t] = len(units)
+                    units.append((i, assembly, template,
+                        {'options':renderoptions}))
+        for c in assembly.composition.connections:
+            for t in connection_templates(c):
+                template = templates.lookup(t[0], c)
+                if template is not None and not r.allocates(template):
+                    for id, e in enumerate(t[1]):
+                        parallel['%s/%d' % (t[0], id)] = len(units)
+                        units.append((e, assembly, template,
+                            {'options':renderoptions}))
+        if len(units) > 0:
+            log.debug('Rendering %d of the code templates in %d worker '
+                'processes' % (len(units), options.render_jobs))
+            with profile.phase('start render workers'):
+                pool = RenderPool(r, units, options.render_jobs)
+
     # Instantiate the per-component source and header files.
     for i in assembly.composition.instances:
         # Don't generate any code for hardware components.
@@ -682,16 +949,18 @@ def main(argv, out, err):
                 label=i.address_space)
             pds[i.address_space] = pd
 
-        for t in ('%s/source' % i.name, '%s/header' % i.name,
-                '%s/c_environment_source' % i.name,
-                '%s/cakeml_start_source' % i.name, '%s/cakeml_end_source' % i.name,
-                '%s/linker' % i.name):
+        for t in component_templates(i):
+            if t in parallel and not options.verify_render_jobs:
+                continue
             try:
                 template = templates.lookup(t, i)
                 g = ''
                 if template:
-                    g = r.render(i, assembly, template, obj_space, cspaces[i.address_space],
+                    g = render(t, i, assembly, template, obj_space, cspaces[i.address_space],
                         shmem, kept_symbols, fill_frames, options=renderoptions, my_pd=pds[i.address_space])
+                if t in parallel:
+                    expected[t] = g
+                    continue
                 save(t, g)
                 for (item, outfile) in (all_items - done_items):
                     if item == t:
@@ -705,19 +974,18 @@ def main(argv, out, err):
     # Instantiate the per-connection files.
     for c in assembly.composition.connections:
 
-        for t in (('%s/from/source' % c.name, c.from_ends),
-                  ('%s/from/header' % c.name, c.from_ends),
-                  ('%s/to/source' % c.name, c.to_ends),
-                  ('%s/to/header' % c.name, c.to_ends)):
+        for t in connection_templates(c):
 
             template = templates.lookup(t[0], c)
 
             if template is not None:
                 for id, e in enumerate(t[1]):
                     item = '%s/%d' % (t[0], id)
+                    if item in parallel and not options.verify_render_jobs:
+                        continue
                     g = ''
                     try:
-                        g = r.render(e, assembly, template, obj_space,
+                        g = render(item, e, assembly, template, obj_space,
                             cspaces[e.instance.address_space], shmem, kept_symbols, fill_frames,
                             options=renderoptions, my_pd=pds[e.instance.address_space])
                     except TemplateError as inst:
@@ -725,6 +993,9 @@ def main(argv, out, err):
                     except jinja2.exceptions.TemplateNotFound:
                         die('While rendering %s: missing template for %s' %
                             (item, c.type.name))
+                    if item in parallel:
+                        expected[item] = g
+                        continue
                     save(item, g)
                     for (target, outfile) in (all_items - done_items):
                         if target == item:
@@ -759,7 +1030,7 @@ def main(argv, out, err):
 
                 for e in t[1]:
                     try:
-                        g = r.render(e, assembly, template, obj_space,
+                        g = render(item, e, assembly, template, obj_space,
                             cspaces[e.instance.address_space], shmem, kept_symbols, fill_frames,
                             options=renderoptions, my_pd=pds[e.instance.address_space])
                         save(item, g)
@@ -767,6 +1038,32 @@ def main(argv, out, err):
                     except TemplateError as inst:
                         die(rendering_error(item, inst))
 
+    # Collect the outputs of the templates rendered in parallel, in the order
+    # they would have been rendered in.
+    if pool is not None:
+        with profile.phase('collect render workers'):
+            results = pool.collect()
+        pool = None
+        for item, index in sorted(parallel.items(), key=lambda x: x[1]):
+            ok, g, timing = results[index]
+            pid, start, wall, cpu, rss = timing
+            profile.record(item, 'template', start, wall, cpu, rss, pid=pid,
+                template=units[index][2])
+            if not ok:
+                messages, tb = g
+                die(['While rendering %s: %s' % (item, line) for line in
+                    messages] + tb)
+            if options.verify_render_jobs and g != expected[item]:
+                die(['Parallel rendering of %s differs from sequential '
+                    'rendering:' % item] + list(difflib.unified_diff(
+                        expected[item].splitlines(), g.splitlines(),
+                        'sequential', 'parallel', lineterm='')))
+            save(item, g)
+            for (target, outfile) in (all_items - done_items):
+                if target == item:
+                    done(g, outfile, item)
+                    break
+
     # Perform any per component special generation. This needs to happen last
     # as these template needs to run after all other capabilities have been
     # allocated
@@ -782,7 +1079,7 @@ def main(argv, out, err):
                     template = templates.lookup(t, i)
                     g = ''
                     if template:
-                        g = r.render(i, assembly, template, obj_space, cspaces[i.address_space],
+                        g = render(t, i, assembly, template, obj_space, cspaces[i.address_space],
                             shmem, kept_symbols, fill_frames, options=renderoptions, my_pd=pds[i.address_space])
                     save(t, g)
                     for (item, outfile) in (all_items - done_items):
@@ -796,12 +1093,14 @@ def main(argv, out, err):
     if options.data_structure_cache_dir is not None:
         # At this point the capdl database is in the state required for applying capdl
         # filters and generating the capdl spec. In case the capdl spec isn't the current
-        # target, we pickle the database here, so when the capdl spec is built, these
+        # target, we snapshot the database here, so when the capdl spec is built, these
         # data structures don't need to be regenerated.
         cache_path = os.path.realpath(options.data_structure_cache_dir)
-        pickle_path = os.path.join(cache_path, CAPDL_STATE_PICKLE)
-        with open(pickle_path, 'wb') as pickle_file:
-            pickle.dump((obj_space, shmem, cspaces, pds, kept_symbols, fill_frames), pickle_file)
+        mkdirp(cache_path)
+        with profile.phase('save CapDL state', 'capdl'):
+            save_capdl_state(argv, os.path.join(cache_path,
+                CAPDL_STATE_SNAPSHOT), read - set(options.elf), (obj_space,
+                shmem, cspaces, pds, kept_symbols, fill_frames), persistent)
 
     for (item, outfile) in (all_items - done_items):
         if item in ('capdl', 'label-mapping'):
@@ -0,0 +1,345 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Persistent code generation server.
+
+Even with the accelerator serving level A cache hits natively, a cache miss
+pays for Python VM start up, importing the runner's dependencies, parsing the
+input specification and constructing the Jinja environment before a single
+template is rendered. This module runs the runner's `main` in a long-lived
+process that keeps the following between requests:
+
+ 1. Parsed ASTs, keyed by the parser options and re-validated against every
+    file the parse read, as for level A cache inputs;
+ 2. Jinja environments, keyed by their template roots. These are constructed
+    with `auto_reload` enabled so edited templates are noticed; and
+ 3. Serialised CapDL allocation state, written in-memory alongside the
+    `--data-structure-cache-dir` snapshot and reused while that file remains
+    unchanged on disk.
+
+Requests arrive over a Unix domain socket, generally from the accelerator
+forwarding a cache miss. A request is a sequence of NUL-terminated UTF-8
+strings, terminated by the client shutting down its write end:
+
+    <CAmkES version> <cwd> <argc> <argv[1]> ... <argv[argc]> <env entries...>
+
+where environment entries are of the form `KEY=VALUE`. The response is the
+runner's exit status in decimal followed by a newline, then any diagnostic
+output the runner produced. If the client's version does not match our own,
+our sources have changed underneath us, so the server closes the connection
+without a response and exits once its outstanding requests are done, leaving
+the client to fall back on running the code generator itself. camkes.sh names
+the socket after the CAmkES checkout it runs from, so servers for different
+checkouts do not meet each other's clients.
+
+Each request is served in a child process forked from the server, up to
+`--jobs` at a time, so the misses of a parallel build are generated in
+parallel. The runner relies on process-wide state (current directory,
+environment, logging configuration and module-level state such as the type
+size probe's candidates and the profiler's events), and the server itself
+never runs it, so every request starts from the same clean state. When a child
+is done it sends back the ASTs and CapDL state it added, and the names of the
+templates it loaded, so the server can retain them for later requests.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+from camkes.internal.seven import cmp, filter, map, zip
+
+import argparse, errno, logging, multiprocessing, os, select, six, socket, \
+    sys
+from camkes.internal.cachea import prime_inputs, valid_inputs
+from camkes.internal.version import version
+from camkes.runner.__main__ import main as runner_main
+from camkes.runner.Renderer import environment
+from six.moves import cPickle as pickle
+
+class Persistent(object):
+    '''
+    State retained by the runner between requests.
+    '''
+
+    def __init__(self):
+        # Parser options -> (AST, read files, primed inputs).
+        self.asts = {}
+
+        # (Template roots, pre-compiled templates) -> Jinja environment. See
+        # `Renderer`.
+        self.environments = {}
+
+        # CapDL state snapshot path -> (stat fingerprint, snapshot bytes).
+        self.capdl_states = {}
+
+    def parse(self, key, parse):
+        '''
+        Return a previously parsed AST for `key` if none of the files it was
+        derived from have changed, otherwise call `parse` and remember its
+        result.
+        '''
+        try:
+            ast, read, inputs = self.asts[key]
+            if valid_inputs(inputs):
+                return ast, set(read)
+        except KeyError:
+            pass
+
+        ast, read = parse()
+        self.asts[key] = (ast, frozenset(read), prime_inputs(sorted(read)))
+        return ast, set(read)
+
+    def changes(self, inherited):
+        '''
+        The state added since this object was a copy of `inherited`, as
+        accepted by `merge`.
+        '''
+        return {
+            'asts':dict((k, v) for k, v in self.asts.items()
+                if inherited.asts.get(k) is not v),
+            'capdl_states':dict((k, v) for k, v in self.capdl_states.items()
+                if inherited.capdl_states.get(k) is not v),
+            'templates':dict((k, sorted(v.loader.loaded)) for k, v in
+                self.environments.items()),
+        }
+
+    def merge(self, changes):
+        '''
+        Adopt the state added by a request served in another process.
+        Environments cannot be transferred, so the ones it used are
+        constructed here and the templates it loaded compiled in them.
+        '''
+        self.asts.update(changes['asts'])
+        self.capdl_states.update(changes['capdl_states'])
+        for key, names in changes['templates'].items():
+            env = self.environments.get(key)
+            if env is None:
+                env = environment(*key, auto_reload=True)
+                self.environments[key] = env
+            for name in names:
+                if name not in env.loader.loaded:
+                    try:
+                        env.get_template(name)
+                    except Exception:
+                        # The child will have reported the problem. It will
+                        # be reported again if this template is used.
+                        pass
+
+def recv_request(conn):
+    data = []
+    while True:
+        chunk = conn.recv(4096)
+        if not chunk:
+            break
+        data.append(chunk)
+    fields = b''.join(data).split(b'\0')
+    if len(fields) < 3 or fields[-1] != b'':
+        raise ValueError('malformed request')
+    fields = [f.decode('utf-8') for f in fields[:-1]]
+    client_version, cwd, argc = fields[:3]
+    argc = int(argc)
+    argv = fields[3:3 + argc]
+    env = dict(e.split('=', 1) for e in fields[3 + argc:] if '=' in e)
+    return client_version, cwd, argv, env
+
+def handle(conn, persistent, cwd, argv, env):
+    '''
+    Serve a single request.
+    '''
+    output = six.StringIO()
+
+    # Juggle the process state the runner depends on.
+    old_cwd = os.getcwd()
+    old_env = os.environ.copy()
+    old_streams = sys.stdout, sys.stderr
+    handlers = [h for h in logging.getLogger().handlers
+        if isinstance(h, logging.StreamHandler)]
+    old_handler_streams = [h.stream for h in handlers]
+    try:
+        os.chdir(cwd)
+        os.environ.clear()
+        os.environ.update(env)
+        sys.stdout = sys.stderr = output
+        for h in handlers:
+            h.stream = output
+        try:
+            status = runner_main(['camkes.runner'] + argv, output, output,
+                persistent=persistent)
+        except SystemExit as e:
+            if e.code is None:
+                status = 0
+            elif isinstance(e.code, six.integer_types):
+                status = e.code
+            else:
+                output.write('%s\n' % e.code)
+                status = -1
+        except Exception as e:
+            output.write('unhandled exception in code generation server: '
+                '%s\n' % e)
+            status = -1
+    finally:
+        for h, s in zip(handlers, old_handler_streams):
+            h.stream = s
+        sys.stdout, sys.stderr = old_streams
+        os.environ.clear()
+        os.environ.update(old_env)
+        os.chdir(old_cwd)
+
+    response = '%d\n%s' % (status & 0xff, output.getvalue())
+    try:
+        conn.sendall(response.encode('utf-8'))
+    except socket.error:
+        # The client went away. Nothing more we can do for it.
+        pass
+
+def bind(path):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.bind(path)
+    except socket.error as e:
+        if e.errno != errno.EADDRINUSE:
+            raise
+        # Either another server is running or a previous one died without
+        # cleaning up. Find out which.
+        probe = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        try:
+            probe.connect(path)
+        except socket.error:
+            os.unlink(path)
+            sock.bind(path)
+        else:
+            probe.close()
+            sock.close()
+            return None
+    sock.listen(16)
+    return sock
+
+def fork_handler(conn, persistent, request):
+    '''
+    Serve a request in a child process. Returns the child's PID and a pipe on
+    which it will send back the state it added to `persistent`.
+    '''
+    r, w = os.pipe()
+    pid = os.fork()
+    if pid != 0:
+        os.close(w)
+        return pid, r
+
+    # Child.
+    status = 0
+    try:
+        os.close(r)
+        inherited = Persistent()
+        inherited.asts = dict(persistent.asts)
+        inherited.capdl_states = dict(persistent.capdl_states)
+        handle(conn, persistent, *request)
+        conn.close()
+        try:
+            data = pickle.dumps(persistent.changes(inherited),
+                pickle.HIGHEST_PROTOCOL)
+        except Exception:
+            # Some state could not be serialised. The server will just have
+            # to recompute it.
+            data = b''
+        with os.fdopen(w, 'wb') as f:
+            f.write(data)
+    except BaseException:
+        status = 1
+    finally:
+        os._exit(status)
+
+def serve(path, idle_timeout, jobs):
+    sock = bind(path)
+    if sock is None:
+        # Someone else is already serving on this socket.
+        return 0
+
+    persistent = Persistent()
+
+    # Pipe from each child -> (PID, data received so far).
+    children = {}
+
+    accepting = True
+    try:
+        while accepting or children:
+            waiting = list(children)
+            if accepting and len(children) < jobs:
+                waiting.append(sock)
+            ready, _, _ = select.select(waiting, [], [],
+                None if children else idle_timeout)
+            if not ready:
+                # Idle for too long. Don't linger after the build is over.
+                break
+
+            for fd in ready:
+                if fd is sock:
+                    continue
+                pid, data = children[fd]
+                chunk = os.read(fd, 65536)
+                if chunk:
+                    data.append(chunk)
+                    continue
+                os.close(fd)
+                del children[fd]
+                os.waitpid(pid, 0)
+                try:
+                    persistent.merge(pickle.loads(b''.join(data)))
+                except Exception:
+                    # The child failed or sent nothing. Any state it had is
+                    # lost, but its client has had its response.
+                    pass
+
+            if sock not in ready:
+                continue
+            conn, _ = sock.accept()
+            try:
+                try:
+                    client_version, cwd, argv, env = recv_request(conn)
+                except (ValueError, UnicodeDecodeError):
+                    continue
+                if client_version != version():
+                    # Our sources have changed underneath us (or the client is
+                    # from a different CAmkES). Either way, we can no longer
+                    # serve requests correctly.
+                    accepting = False
+                    continue
+                pid, fd = fork_handler(conn, persistent, (cwd, argv, env))
+                children[fd] = (pid, [])
+            finally:
+                conn.close()
+    finally:
+        sock.close()
+        try:
+            os.unlink(path)
+        except OSError:
+            pass
+    return 0
+
+def main(argv):
+    parser = argparse.ArgumentParser(prog='python -m camkes.runner.server',
+        description='serve code generation requests from a persistent process')
+    parser.add_argument('--socket', '-s', required=True,
+        help='Path of the Unix domain socket to listen on.')
+    parser.add_argument('--idle-timeout', type=float, default=600,
+        help='Exit after this many seconds without a request.')
+    parser.add_argument('--jobs', '-j', type=int,
+        default=multiprocessing.cpu_count(),
+        help='Maximum number of requests to serve at once.')
+    options = parser.parse_args(argv[1:])
+
+    return serve(os.path.abspath(options.socket), options.idle_timeout,
+        max(1, options.jobs))
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
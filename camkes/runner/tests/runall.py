@@ -22,6 +22,7 @@ ME = os.path.abspath(__file__)
 
 from lint import TestLint
 from lintsource import TestSourceLint
+from testfilters import TestFilters
 from testregression import TestRegression
 
 if __name__ == '__main__':
@@ -0,0 +1,323 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Tests of the CapDL filters that rearrange virtual address spaces. The indexed
+implementation in VSpaceIndex is compared against the path-walking one it
+replaced, on synthetic systems built by tools/filters_benchmark.py.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import os, six, sys, unittest
+
+ME = os.path.abspath(__file__)
+
+# Make CAmkES importable
+sys.path.append(os.path.join(os.path.dirname(ME), '../../..'))
+
+# Make capdl importable
+sys.path.append(os.path.join(os.path.dirname(ME), '../../../../python-capdl'))
+
+# Make the synthetic system builder importable
+sys.path.append(os.path.join(os.path.dirname(ME), '../../../tools'))
+
+from capdl import Cap, Frame, seL4_FrameObject
+from camkes.internal.tests.utils import CAmkESTest
+from camkes.runner import Filters
+from camkes.runner.Filters import PAGE_SIZE, VSpaces, \
+    collapse_shared_frames, make_indices, num_vspace_levels
+import filters_benchmark
+
+# The path-walking implementation of the vspace operations that VSpaceIndex
+# replaced, kept as a reference for it to be compared against.
+
+def lookup_vspace_indices(vspace_root, indices):
+    cap = None
+    object = vspace_root
+    for index in indices:
+        cap = object[index]
+        object = cap.referent
+    return (cap, object)
+
+def delete_small_frames(arch, obj_space, vspace_root, level_num, map_indices):
+    level = num_vspace_levels(arch)
+    while level >= level_num:
+        for indices in map_indices:
+            sub_indices = indices[0:level]
+            parent_indices = sub_indices[0:-1]
+            if len(parent_indices) == 0:
+                parent_object = vspace_root
+            else:
+                (parent_cap, parent_object) = lookup_vspace_indices(vspace_root,
+                    parent_indices)
+            cap = parent_object[sub_indices[-1]]
+            if cap is None:
+                continue
+            object = cap.referent
+            if object is not None:
+                obj_space.remove(object)
+                parent_object[sub_indices[-1]] = None
+        level = level - 1
+
+def make_indices_to_frame(arch, vspace_root, vaddr):
+    level = arch.vspace()
+    levels = []
+    obj = vspace_root
+    cap = None
+    while not isinstance(obj, Frame):
+        index = level.child_index(vaddr)
+        levels.append((level, index))
+        level = level.child
+        cap = obj[index]
+        obj = cap.referent
+    return cap, levels
+
+def replace_frame_with_paging_structure(obj_space, vspace_root, frame_cap,
+        bottom_level, indices):
+    paging_structure = obj_space.alloc(bottom_level.object)
+    child_size = min(p.size for p in bottom_level.pages)
+    for i in range(0, bottom_level.coverage // child_size):
+        new_frame = obj_space.alloc(seL4_FrameObject, size=child_size)
+        paging_structure[i] = Cap(new_frame, frame_cap.read, frame_cap.write,
+            frame_cap.grant)
+    if len(indices) == 1:
+        parent = vspace_root
+    else:
+        _, parent = lookup_vspace_indices(vspace_root, indices[0:-1])
+    parent[indices[-1]] = Cap(paging_structure, frame_cap.read,
+        frame_cap.write, frame_cap.grant)
+    obj_space.remove(frame_cap.referent)
+
+def replace_frame_with_small_frames(obj_space, vspace_root, frame_cap,
+        bottom_level, indices):
+    if len(indices) == 1:
+        paging_structure = vspace_root
+    else:
+        _, paging_structure = lookup_vspace_indices(vspace_root, indices[0:-1])
+    start_index = indices[-1]
+    new_frame_size = min(p.size for p in bottom_level.pages)
+    for i in range(0, frame_cap.referent.size // new_frame_size):
+        new_frame = obj_space.alloc(seL4_FrameObject, size=new_frame_size)
+        paging_structure[start_index + i] = Cap(new_frame, frame_cap.read,
+            frame_cap.write, frame_cap.grant)
+    obj_space.remove(frame_cap.referent)
+
+def replace_large_frames(obj_space, arch, vspace_root, start_vaddr, size,
+        page_size):
+    offset = 0
+    while offset < size:
+        vaddr = start_vaddr + offset
+        frame_cap, levels = make_indices_to_frame(arch, vspace_root, vaddr)
+        if frame_cap.referent.size <= page_size:
+            offset += page_size
+        else:
+            indices = [l[1] for l in levels]
+            (bottom_level, _) = levels[-1]
+            if bottom_level.child is not None and \
+                    bottom_level.child.coverage == frame_cap.referent.size:
+                replace_frame_with_paging_structure(obj_space, vspace_root,
+                    frame_cap, bottom_level.child, indices)
+            else:
+                replace_frame_with_small_frames(obj_space, vspace_root,
+                    frame_cap, bottom_level, indices)
+
+class PathWalk(object):
+    '''The reference implementation behind the interface of VSpaceIndex.'''
+
+    def __init__(self, arch, obj_space, root):
+        self.arch = arch
+        self.obj_space = obj_space
+        self.root = root
+
+    def frame_for_vaddr(self, vaddr, size):
+        cap, object = lookup_vspace_indices(self.root,
+            make_indices(self.arch, vaddr, size))
+        assert isinstance(object, Frame), "Expected to find a frame"
+        return cap, object
+
+    def update_frame_in_vaddr(self, vaddr, size, cap):
+        indices = make_indices(self.arch, vaddr, size)
+        object = self.root
+        for index in indices[0:-1]:
+            object = object[index].referent
+        object[indices[-1]] = cap
+
+    def delete_small_frames(self, vaddr, size, level_num):
+        delete_small_frames(self.arch, self.obj_space, self.root, level_num,
+            [make_indices(self.arch, v, PAGE_SIZE)
+                for v in six.moves.range(vaddr, vaddr + size, PAGE_SIZE)])
+
+    def replace_large_frames(self, start_vaddr, size, page_size):
+        replace_large_frames(self.obj_space, self.arch, self.root, start_vaddr,
+            size, page_size)
+
+class PathWalkVSpaces(VSpaces):
+    def index(self, root):
+        return PathWalk(self.arch, self.obj_space, root)
+
+def build(architecture, size, paddr=False):
+    '''Construct a system of two components sharing two dataports of the given
+    size, optionally backed by device memory.'''
+    arch, obj_space, elfs, shmem = filters_benchmark.build(architecture, 2,
+        size)
+    if paddr:
+        for i, window in enumerate(sorted(shmem)):
+            for cnode, mappings in shmem[window].items():
+                shmem[window][cnode] = [(sym, 'R', 0x80000000 + i * size,
+                    frames, False) for sym, _, _, frames, _ in mappings]
+    return arch, obj_space, elfs, shmem
+
+def collapse(architecture, obj_space, elfs, shmem, largeframe, vspaces):
+    collapse_shared_frames(ast=filters_benchmark.AST(None),
+        obj_space=obj_space, elfs=elfs, shmem=shmem,
+        options=filters_benchmark.Options(architecture, largeframe),
+        vspaces=vspaces)
+
+def dump(obj_space):
+    '''Describe the contents of every vspace in an object space, numbering
+    frames in the order they are reached so that sharing is captured.'''
+    frames = {}
+    out = []
+    def walk(pd, obj, depth):
+        for index in sorted(k for k, v in obj.slots.items() if v is not None):
+            cap = obj.slots[index]
+            if isinstance(cap.referent, Frame):
+                number = frames.setdefault(id(cap.referent), len(frames))
+                out.append((pd.name, depth, index, number, cap.referent.size,
+                    cap.referent.paddr, cap.read, cap.write, cap.grant,
+                    cap.cached))
+            else:
+                out.append((pd.name, depth, index,
+                    type(cap.referent).__name__))
+                walk(pd, cap.referent, depth + 1)
+    for pd in sorted((o for o in obj_space.spec.objs
+            if o.name.endswith('_pd')), key=lambda o: o.name):
+        walk(pd, pd, 1)
+    return out, len(obj_space.spec.objs)
+
+class TestFilters(CAmkESTest):
+    def setUp(self):
+        super(TestFilters, self).setUp()
+
+        # Symbol lookups are memoised, but each test constructs its own ELFs.
+        if hasattr(Filters.get_symbol, 'cache_clear'):
+            Filters.get_symbol.cache_clear()
+        else:
+            Filters.get_symbol.cache.clear()
+
+    def check_collapse(self, architecture):
+        for largeframe in (False, True):
+            for size in (192 * 1024, 4 * 1024 * 1024, 16 * 1024 * 1024):
+                for paddr in (False, True):
+                    results = []
+                    for implementation in (VSpaces, PathWalkVSpaces):
+                        arch, obj_space, elfs, shmem = build(architecture,
+                            size, paddr)
+                        collapse(architecture, obj_space, elfs, shmem,
+                            largeframe, implementation(arch, obj_space))
+                        results.append(dump(obj_space))
+                    self.assertEqual(results[0], results[1],
+                        'collapse_shared_frames differs for %d byte dataports '
+                        '(largeframe=%s, paddr=%s)' % (size, largeframe,
+                        paddr))
+
+    def test_collapse_ia32(self):
+        self.check_collapse('ia32')
+
+    def test_collapse_x86_64(self):
+        self.check_collapse('x86_64')
+
+    def test_collapse_aarch32(self):
+        self.check_collapse('aarch32')
+
+    def check_replace_large_frames(self, architecture):
+        '''
+        Promote the dataports to large frames, then split them back up (as
+        the DMA pool filter does) and punch holes in them (as the guard page
+        filter does).
+        '''
+        size = 16 * 1024 * 1024
+        base = filters_benchmark.BASE
+        results = []
+        for implementation in (VSpaces, PathWalkVSpaces):
+            arch, obj_space, elfs, shmem = build(architecture, size)
+            collapse(architecture, obj_space, elfs, shmem, True,
+                VSpaces(arch, obj_space))
+            vspaces = implementation(arch, obj_space)
+            vspace = vspaces.index(vspaces.lookup('client_group_bin_pd'))
+            vspace.replace_large_frames(base + 3 * PAGE_SIZE, 5 * PAGE_SIZE,
+                PAGE_SIZE)
+            vspace.replace_large_frames(base + size, size, 64 * 1024)
+            for vaddr in (base + 3 * PAGE_SIZE, base + 7 * PAGE_SIZE):
+                _, frame = vspace.frame_for_vaddr(vaddr, PAGE_SIZE)
+                obj_space.remove(frame)
+                vspace.update_frame_in_vaddr(vaddr, PAGE_SIZE, None)
+            results.append(dump(obj_space))
+        self.assertEqual(results[0], results[1])
+
+    def test_replace_large_frames_ia32(self):
+        self.check_replace_large_frames('ia32')
+
+    def test_replace_large_frames_x86_64(self):
+        self.check_replace_large_frames('x86_64')
+
+    def test_replace_large_frames_aarch32(self):
+        self.check_replace_large_frames('aarch32')
+
+    def check_small_frames_in_large_region(self, architecture, size):
+        '''
+        Test that a region that could be backed by large frames, but is not
+        because large frame promotion is off, ends up shared. The second
+        component's mappings used to be cleared down to the large frame level,
+        taking the page tables the shared small frames are then mapped into
+        with them.
+        '''
+        arch, obj_space, elfs, shmem = build(architecture, size)
+        vspaces = VSpaces(arch, obj_space)
+        collapse(architecture, obj_space, elfs, shmem, False, vspaces)
+
+        client = vspaces.index(vspaces.lookup('client_group_bin_pd'))
+        server = vspaces.index(vspaces.lookup('server_group_bin_pd'))
+        frames = set()
+        for vaddr in six.moves.range(filters_benchmark.BASE,
+                filters_benchmark.BASE + 2 * size, PAGE_SIZE):
+            client_cap, frame = client.frame_for_vaddr(vaddr, PAGE_SIZE)
+            server_cap, server_frame = server.frame_for_vaddr(vaddr,
+                PAGE_SIZE)
+            self.assertIs(frame, server_frame)
+            self.assertEqual(frame.size, PAGE_SIZE)
+            self.assertIn(frame, obj_space.spec.objs)
+            self.assertTrue(client_cap.read and client_cap.write)
+            frames.add(frame)
+        self.assertEqual(len(frames), 2 * size // PAGE_SIZE)
+
+        # Nothing but the shared frames and the paging structures that map
+        # them should be left.
+        self.assertEqual(len([x for x in obj_space.spec.objs
+            if isinstance(x, Frame)]), len(frames))
+
+    def test_small_frames_in_large_region_ia32(self):
+        self.check_small_frames_in_large_region('ia32', 4 * 1024 * 1024)
+
+    def test_small_frames_in_large_region_x86_64(self):
+        self.check_small_frames_in_large_region('x86_64', 2 * 1024 * 1024)
+
+    def test_small_frames_in_large_region_aarch32(self):
+        self.check_small_frames_in_large_region('aarch32', 16 * 1024 * 1024)
+
+if __name__ == '__main__':
+    unittest.main()
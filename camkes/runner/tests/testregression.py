@@ -20,7 +20,7 @@ Tests related to preventing regression of previously existing bugs.
 from __future__ import absolute_import, division, print_function, \
     unicode_literals
 
-import os, subprocess, sys, unittest
+import os, re, subprocess, sys, unittest
 
 ME = os.path.abspath(__file__)
 
@@ -113,5 +113,189 @@ class TestRegression(CAmkESTest):
             content = f.read()
         self.assertEqual(content, 'bar')
 
+    def test_batched_items_cache(self):
+        '''
+        Test that a batched invocation with caching enabled keys each item
+        individually, so an item invalidated by a template change is
+        regenerated while the others are restored.
+        '''
+
+        cachedir = self.mkdtemp()
+
+        templates = self.mkdtemp()
+        with open(os.path.join(templates, 'foo'), 'wt') as f:
+            f.write('foo\n')
+        with open(os.path.join(templates, 'bar'), 'wt') as f:
+            f.write('bar\n')
+
+        spec = '''
+            connector Foo {
+                from Event template "foo";
+                to Event template "bar";
+            }
+
+            component A {
+                emits Ev e;
+            }
+
+            component B {
+                consumes Ev e;
+            }
+
+            assembly {
+                composition {
+                    component A a;
+                    component B b;
+
+                    connection Foo f(from a.e, to b.e);
+                }
+            }
+            '''
+        specdir = self.mkdtemp()
+        with open(os.path.join(specdir, 'spec'), 'wt') as f:
+            f.write(spec)
+
+        camkessh = os.path.join(os.path.dirname(ME), '../../../camkes.sh')
+
+        # Rely on the location of the CapDL module.
+        pythoncapdl = os.path.join(os.path.dirname(ME),
+            '../../../../python-capdl')
+        env = os.environ.copy()
+        if 'PYTHONPATH' in env:
+            pythonpath = '%s:' % env['PYTHONPATH']
+        else:
+            pythonpath = ''
+        env['PYTHONPATH'] = '%s%s' % (pythonpath, pythoncapdl)
+
+        builtins = os.path.join(os.path.dirname(ME), '../../../include/builtin')
+
+        outdir = self.mkdtemp()
+
+        def run(*args):
+            '''
+            Run the code generator with debug output, returning the items it
+            reports retrieving from either cache level.
+            '''
+            p = subprocess.Popen([camkessh, '--debug', '--cache',
+                '--cache-dir', cachedir, '--import-path', builtins,
+                '--templates', templates, '--architecture', 'aarch32',
+                '--file', os.path.join(specdir, 'spec'), '--platform',
+                'seL4'] + list(args), stdout=subprocess.PIPE,
+                stderr=subprocess.STDOUT, env=env)
+            stdout, _ = p.communicate()
+            stdout = stdout.decode('utf-8', 'replace')
+            self.assertEqual(p.returncode, 0, stdout)
+            return set(re.findall(r'Retrieved seL4/(\S+) from level [AB] cache',
+                stdout))
+
+        def generate(suffix):
+            hits = run('--item', 'f/from/source/0', '--item', 'f/to/source/0',
+                '--outfile', os.path.join(outdir, 'from%s' % suffix),
+                '--outfile', os.path.join(outdir, 'to%s' % suffix))
+            with open(os.path.join(outdir, 'from%s' % suffix)) as f:
+                from_content = f.read()
+            with open(os.path.join(outdir, 'to%s' % suffix)) as f:
+                to_content = f.read()
+            return from_content, to_content, hits
+
+        # Run the code generator once to populate the cache.
+        self.assertEqual(generate('1'), ('foo', 'bar', set()))
+
+        # Now edit one of the templates.
+        with open(os.path.join(templates, 'foo'), 'wt') as f:
+            f.write('baz\n')
+
+        # Confirm that the change was noticed for the affected item only, and
+        # that the other item was restored from the cache rather than
+        # regenerated.
+        self.assertEqual(generate('2'), ('baz', 'bar',
+            set(['f/to/source/0'])))
+
+        # A single-item invocation should hit the entry saved by the batch.
+        hits = run('--item', 'f/to/source/0', '--outfile',
+            os.path.join(outdir, 'to3'))
+        self.assertEqual(hits, set(['f/to/source/0']))
+        with open(os.path.join(outdir, 'to3')) as f:
+            content = f.read()
+        self.assertEqual(content, 'bar')
+
+    def test_parallel_rendering(self):
+        '''
+        Test that rendering non-allocating templates in worker processes
+        produces the same output as rendering everything in order.
+        '''
+
+        templates = self.mkdtemp()
+        with open(os.path.join(templates, 'foo'), 'wt') as f:
+            f.write('foo /*? me.instance.name ?*/\n')
+        with open(os.path.join(templates, 'bar'), 'wt') as f:
+            f.write('bar /*? alloc(\'ep\', seL4_EndpointObject, read=True) '
+                '?*/\n')
+
+        spec = '''
+            connector Foo {
+                from Event template "foo";
+                to Event template "bar";
+            }
+
+            component A {
+                emits Ev e;
+            }
+
+            component B {
+                consumes Ev e;
+            }
+
+            assembly {
+                composition {
+                    component A a;
+                    component B b;
+
+                    connection Foo f(from a.e, to b.e);
+                }
+            }
+            '''
+        specdir = self.mkdtemp()
+        with open(os.path.join(specdir, 'spec'), 'wt') as f:
+            f.write(spec)
+
+        camkessh = os.path.join(os.path.dirname(ME), '../../../camkes.sh')
+
+        # Rely on the location of the CapDL module.
+        pythoncapdl = os.path.join(os.path.dirname(ME),
+            '../../../../python-capdl')
+        env = os.environ.copy()
+        if 'PYTHONPATH' in env:
+            pythonpath = '%s:' % env['PYTHONPATH']
+        else:
+            pythonpath = ''
+        env['PYTHONPATH'] = '%s%s' % (pythonpath, pythoncapdl)
+
+        builtins = os.path.join(os.path.dirname(ME), '../../../include/builtin')
+
+        outdir = self.mkdtemp()
+
+        items = ('f/from/source/0', 'f/to/source/0', 'a/header', 'b/source')
+
+        def generate(suffix, extra_args):
+            args = [camkessh, '--import-path', builtins, '--templates',
+                templates, '--architecture', 'aarch32', '--file',
+                os.path.join(specdir, 'spec'), '--platform', 'seL4']
+            for index, item in enumerate(items):
+                args.extend(['--item', item, '--outfile',
+                    os.path.join(outdir, '%d%s' % (index, suffix))])
+            subprocess.check_call(args + extra_args, env=env)
+            content = []
+            for index, _ in enumerate(items):
+                with open(os.path.join(outdir, '%d%s' % (index, suffix))) as f:
+                    content.append(f.read())
+            return content
+
+        sequential = generate('.seq', [])
+        parallel = generate('.par', ['--render-jobs', '2',
+            '--verify-render-jobs'])
+        self.assertEqual(sequential[0], 'foo a')
+        self.assertEqual(sequential, parallel)
+
 if __name__ == '__main__':
     unittest.main()
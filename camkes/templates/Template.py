@@ -77,6 +77,26 @@ TEMPLATES = {
                 'header':'seL4SharedData-common.template.h',
             },
         },
+        Guard(lambda x: isinstance(x, Connection) and x.type.name == 'seL4RingBuffer'):{
+            'from':{
+                'source':'seL4RingBuffer-from.template.c',
+                'header':'seL4RingBuffer-common.template.h',
+            },
+            'to':{
+                'source':'seL4RingBuffer-to.template.c',
+                'header':'seL4RingBuffer-common.template.h',
+            },
+        },
+        Guard(lambda x: isinstance(x, Connection) and x.type.name == 'seL4RingBufferQueue'):{
+            'from':{
+                'source':'seL4RingBuffer-from.template.c',
+                'header':'seL4RingBuffer-common.template.h',
+            },
+            'to':{
+                'source':'seL4RingBufferQueue-to.template.c',
+                'header':'seL4RingBuffer-common.template.h',
+            },
+        },
         Guard(lambda x: isinstance(x, Connection) and x.type.name == 'seL4Notification'):{
             'from':{
                 'source':'seL4Notification-from.template.c',
@@ -237,9 +257,26 @@ def get_dependencies(roots, stem, seen=None):
 class Templates(object):
     def __init__(self, platform):
         assert platform in TEMPLATES
+        self.platform = platform
         self.base = TEMPLATES[platform]
         self.roots = [os.path.abspath(os.path.dirname(__file__))]
 
+        # Connectors whose templates were added with `add`, and a connection
+        # of each, so the additions can be replayed when unpickling.
+        self.added = []
+
+    def __getstate__(self):
+        # The lookup dictionary contains guard functions, which cannot be
+        # pickled. Reconstruct it instead.
+        return {'platform':self.platform, 'roots':self.roots,
+            'added':self.added}
+
+    def __setstate__(self, state):
+        self.__init__(state['platform'])
+        self.roots = list(state['roots'])
+        for connector, connection in state['added']:
+            self.add(connector, connection)
+
     def add_root(self, root):
         self.roots.insert(0, root)
 
@@ -256,6 +293,8 @@ class Templates(object):
         if connector.from_template is None and connector.to_template is None:
             return set()
 
+        self.added.append((connector, connection))
+
         # Use the provided connection to try to locate an existing matching
         # key. We do this to allow the caller to replace one of the built-in
         # templates.
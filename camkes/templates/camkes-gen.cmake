@@ -95,6 +95,12 @@ function(CAmkESOutputGenCommand)
         return()
     endif()
     list(LENGTH outfile_list outfile_list_count)
+    set(profile_flags "")
+    if(NOT "${CAmkESProfileDir}" STREQUAL "")
+        # Name the profile after the outputs, which are unique to this invocation
+        string(MD5 profile_name "${outfile_list}")
+        set(profile_flags --profile-out "${CAmkESProfileDir}/${profile_name}.json")
+    endif()
     add_custom_command(
         OUTPUT ${outfile_list}
         COMMAND
@@ -104,6 +110,7 @@ function(CAmkESOutputGenCommand)
                 "--outfile;$<JOIN:${outfile_list},;--outfile;>"
                 "$<$<BOOL:${elfs_list}>:--elf$<SEMICOLON>>$<JOIN:${elfs_list},$<SEMICOLON>--elf$<SEMICOLON>>"
                 ${CAMKES_FLAGS}
+                ${profile_flags}
         ${reflow_commands}
         DEPENDS
             ${CAMKES_ADL_SOURCE}
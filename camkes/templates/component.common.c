@@ -19,6 +19,7 @@
 #include <sync/mutex.h>
 #include <sync/sem.h>
 #include <sync/bin_sem.h>
+#include <sync/bin_sem_bare.h>
 #include <sel4platsupport/platsupport.h>
 #include <camkes/allocator.h>
 #include <camkes/dataport.h>
@@ -119,53 +120,74 @@ static char /*? p['dma_pool_symbol'] ?*/[/*? dma_pool ?*/]
     /*- do dma_frames.append(frame) -*/
 /*- endfor -*/
 
+/*# Frames are looked up by their index in the pool, so translating a pointer
+ *# costs a bounds check and a table load regardless of the size of the pool.
+ #*/
+/*- set dma_frame_bits = int(math.log(page_size[0], 2)) -*/
+/*- set dma_frame_caps = c_symbol('dma_frame_caps') -*/
+/*- set dma_frame_paddrs = c_symbol('dma_frame_paddrs') -*/
+/*- if num_dma_frames > 0 -*/
+static const seL4_CPtr /*? dma_frame_caps ?*/[/*? num_dma_frames ?*/] = {
+    /*- for frame in dma_frames -*/
+        /*? frame ?*/,
+    /*- endfor -*/
+};
+
+/* Physical addresses of the frames above, populated during initialisation. */
+static uintptr_t /*? dma_frame_paddrs ?*/[/*? num_dma_frames ?*/];
+/*- endif -*/
+
 /*- set get_paddr = c_symbol('get_paddr') -*/
 uintptr_t /*? get_paddr ?*/(void *ptr) {
-    uintptr_t base UNUSED = (uintptr_t)ptr & ~MASK(ffs(/*? page_size[0] ?*/) - 1);
-    uintptr_t offset UNUSED = (uintptr_t)ptr & MASK(ffs(/*? page_size[0] ?*/) - 1);
-    /*- for i in six.moves.range(num_dma_frames) -*/
-        /*- if not loop.first -*/
-            else
-        /*- endif -*/
-        if (base == (uintptr_t)/*? p['dma_pool_symbol'] ?*/ + /*? i ?*/ * /*? page_size[0] ?*/) {
-            /*- set frame = dma_frames[i] -*/
-            /*- set paddr_sym = c_symbol('paddr') -*/
-            static uintptr_t /*? paddr_sym ?*/;
-            if (/*? paddr_sym ?*/ == 0) {
-                seL4_ARCH_Page_GetAddress_t res = seL4_ARCH_Page_GetAddress(/*? frame ?*/);
-                ERR_IF(res.error != 0, camkes_error, ((camkes_error_t){
-                        .type = CE_SYSCALL_FAILED,
-                        .instance = "/*? me.name ?*/",
-                        .description = "failed to reverse virtual mapping to a DMA frame",
-                        .syscall = ARCHPageGetAddress,
-                        .error = res.error,
-                    }), ({
-                        return (uintptr_t)NULL;
-                    }));
-                /*? paddr_sym ?*/ = res.paddr;
-            }
-            return /*? paddr_sym ?*/ + offset;
+    /*- if num_dma_frames > 0 -*/
+        uintptr_t offset = (uintptr_t)ptr - (uintptr_t)/*? p['dma_pool_symbol'] ?*/;
+        if (unlikely(offset >= /*? num_dma_frames ?*/ * (uintptr_t)/*? page_size[0] ?*/)) {
+            return (uintptr_t)NULL;
         }
-    /*- endfor -*/
-    return (uintptr_t)NULL;
+        uintptr_t paddr = /*? dma_frame_paddrs ?*/[offset >> /*? dma_frame_bits ?*/];
+        if (unlikely(paddr == 0)) {
+            /* Initialisation failed to reverse this frame's mapping. */
+            return (uintptr_t)NULL;
+        }
+        return paddr + (offset & MASK(/*? dma_frame_bits ?*/));
+    /*- else -*/
+        return (uintptr_t)NULL;
+    /*- endif -*/
 }
 
 /*- set get_cptr = c_symbol('get_cptr') -*/
 seL4_CPtr /*? get_cptr ?*/(void *ptr) {
-    uintptr_t base UNUSED = (uintptr_t)ptr & ~MASK(ffs(/*? page_size[0] ?*/) - 1);
-    uintptr_t offset UNUSED = (uintptr_t)ptr & MASK(ffs(/*? page_size[0] ?*/) - 1);
-    /*- for i in six.moves.range(num_dma_frames) -*/
-        /*- if not loop.first -*/
-            else
-        /*- endif -*/
-        if (base == (uintptr_t)/*? p['dma_pool_symbol'] ?*/ + /*? i ?*/ * /*? page_size[0] ?*/) {
-            /*- set frame = dma_frames[i] -*/
-            return /*? frame ?*/;
+    /*- if num_dma_frames > 0 -*/
+        uintptr_t offset = (uintptr_t)ptr - (uintptr_t)/*? p['dma_pool_symbol'] ?*/;
+        if (unlikely(offset >= /*? num_dma_frames ?*/ * (uintptr_t)/*? page_size[0] ?*/)) {
+            return seL4_CapNull;
         }
-    /*- endfor -*/
-    return seL4_CapNull;
+        return /*? dma_frame_caps ?*/[offset >> /*? dma_frame_bits ?*/];
+    /*- else -*/
+        return seL4_CapNull;
+    /*- endif -*/
 }
 
+/*# The DMA pool is shared by all of our threads. #*/
+/*- if num_dma_frames > 0 -*/
+    /*- set dma_lock = alloc('dma_pool_lock', seL4_NotificationObject, read=True, write=True) -*/
+    /*- set dma_lock_count = c_symbol('dma_lock_count') -*/
+    static volatile int /*? dma_lock_count ?*/ = 1;
+
+    /*- set dma_lock_acquire = c_symbol('dma_lock') -*/
+    static int /*? dma_lock_acquire ?*/(void) {
+        int result = sync_bin_sem_bare_wait(/*? dma_lock ?*/, &/*? dma_lock_count ?*/);
+        __sync_synchronize();
+        return result;
+    }
+
+    /*- set dma_lock_release = c_symbol('dma_unlock') -*/
+    static int /*? dma_lock_release ?*/(void) {
+        __sync_synchronize();
+        return sync_bin_sem_bare_post(/*? dma_lock ?*/, &/*? dma_lock_count ?*/);
+    }
+/*- endif -*/
+
 /* MMIO related functionality for interaction with libplatsupport. */
 void *camkes_io_map(void *cookie UNUSED, uintptr_t paddr UNUSED,
         size_t size UNUSED, int cached UNUSED, ps_mem_flags_t flags UNUSED) {
@@ -338,6 +360,22 @@ static void /*? init ?*/(void) {
     /* The user has actually had no opportunity to install any error handlers at
      * this point, so any error triggered below will certainly be fatal.
      */
+    /*- if num_dma_frames > 0 -*/
+        for (unsigned i = 0; i < /*? num_dma_frames ?*/; i++) {
+            seL4_ARCH_Page_GetAddress_t ret = seL4_ARCH_Page_GetAddress(/*? dma_frame_caps ?*/[i]);
+            ERR_IF(ret.error != 0, camkes_error, ((camkes_error_t){
+                    .type = CE_SYSCALL_FAILED,
+                    .instance = "/*? me.name ?*/",
+                    .description = "failed to reverse virtual mapping to a DMA frame",
+                    .syscall = ARCHPageGetAddress,
+                    .error = ret.error,
+                }), ({
+                    return;
+                }));
+            /*? dma_frame_paddrs ?*/[i] = ret.paddr;
+        }
+        camkes_dma_register_lock(/*? dma_lock_acquire ?*/, /*? dma_lock_release ?*/);
+    /*- endif -*/
     int res = camkes_dma_init(/*? p['dma_pool_symbol'] ?*/, /*? dma_pool ?*/,
         /*? page_size[0] ?*/, /*? get_paddr ?*/, /*? get_cptr ?*/);
     ERR_IF(res != 0, camkes_error, ((camkes_error_t){
@@ -379,41 +417,21 @@ static void /*? init ?*/(void) {
     /*- endfor -*/
 
     /* Initialise cap allocator. */
+    /*- set cap_pool = [] -*/
     /*- set tcb_pool = configuration[me.name].get('tcb_pool', 0) -*/
     /*- for i in six.moves.range(tcb_pool) -*/
         /*- set tcb = alloc('tcb_pool_%d' % i, seL4_TCBObject, read=True, write=True) -*/
-        res = camkes_provide(seL4_TCBObject, /*? tcb ?*/, 0, seL4_CanRead|seL4_CanWrite);
-        ERR_IF(res != 0, camkes_error, ((camkes_error_t){
-                .type = CE_ALLOCATION_FAILURE,
-                .instance = "/*? me.name ?*/",
-                .description = "failed to add TCB /*? tcb + 1 ?*/ to cap allocation pool",
-            }), ({
-                return;
-            }));
+        /*- do cap_pool.append(('seL4_TCBObject', tcb, '0')) -*/
     /*- endfor -*/
     /*- set ep_pool = configuration[me.name].get('ep_pool', 0) -*/
     /*- for i in six.moves.range(ep_pool) -*/
         /*- set ep = alloc('ep_pool_%d' % i, seL4_EndpointObject, read=True, write=True) -*/
-        res = camkes_provide(seL4_EndpointObject, /*? ep ?*/, 0, seL4_CanRead|seL4_CanWrite);
-        ERR_IF(res != 0, camkes_error, ((camkes_error_t){
-                .type = CE_ALLOCATION_FAILURE,
-                .instance = "/*? me.name ?*/",
-                .description = "failed to add EP /*? ep + 1 ?*/ to cap allocation pool",
-            }), ({
-                return;
-            }));
+        /*- do cap_pool.append(('seL4_EndpointObject', ep, '0')) -*/
     /*- endfor -*/
     /*- set notification_pool = configuration[me.name].get('notification_pool', 0) -*/
     /*- for i in six.moves.range(notification_pool) -*/
         /*- set notification = alloc('notification_pool_%d' % i, seL4_NotificationObject, read=True, write=True) -*/
-        res = camkes_provide(seL4_NotificationObject, /*? notification ?*/, 0, seL4_CanRead|seL4_CanWrite);
-        ERR_IF(res != 0, camkes_error, ((camkes_error_t){
-                .type = CE_ALLOCATION_FAILURE,
-                .instance = "/*? me.name ?*/",
-                .description = "failed to add NOTIFICATION /*? notification + 1 ?*/ to cap allocation pool",
-            }), ({
-                return;
-            }));
+        /*- do cap_pool.append(('seL4_NotificationObject', notification, '0')) -*/
     /*- endfor -*/
     /*- set untyped_pool = [] -*/
     /*- for attribute, value in configuration[me.name].items() -*/
@@ -428,16 +446,25 @@ static void /*? init ?*/(void) {
                 /*? raise(TemplateError('illegal untyped size')) ?*/
             /*- endif -*/
             /*- set untyped = alloc('untyped_%s_pool_%d' % (u[0], i), seL4_UntypedObject, size_bits=int(u[0]), read=True, write=True) -*/
-            res = camkes_provide(seL4_UntypedObject, /*? untyped ?*/, 1U << /*? u[0] ?*/, seL4_CanRead|seL4_CanWrite);
-            ERR_IF(res != 0, camkes_error, ((camkes_error_t){
-                    .type = CE_ALLOCATION_FAILURE,
-                    .instance = "/*? me.name ?*/",
-                    .description = "failed to add untyped /*? untyped + 1 ?*/ of size /*? u[0] ?*/ bits to cap allocation pool",
-                }), ({
-                    return;
-                }));
+            /*- do cap_pool.append(('seL4_UntypedObject', untyped, '1U << %s' % u[0])) -*/
         /*- endfor -*/
     /*- endfor -*/
+    /*- if len(cap_pool) > 0 -*/
+        static const camkes_resource_t cap_pool[] = {
+            /*- for type, cap, size in cap_pool -*/
+                { .type = /*? type ?*/, .ptr = /*? cap ?*/, .size = /*? size ?*/,
+                  .attributes = seL4_CanRead|seL4_CanWrite },
+            /*- endfor -*/
+        };
+        res = camkes_provide_all(cap_pool, ARRAY_SIZE(cap_pool));
+        ERR_IF(res != 0, camkes_error, ((camkes_error_t){
+                .type = CE_ALLOCATION_FAILURE,
+                .instance = "/*? me.name ?*/",
+                .description = "failed to add /*? len(cap_pool) ?*/ resources to cap allocation pool",
+            }), ({
+                return;
+            }));
+    /*- endif -*/
 }
 
 #ifndef CONFIG_CAMKES_DEFAULT_STACK_SIZE
@@ -448,7 +475,7 @@ static void /*? init ?*/(void) {
     /*? macros.show_includes(i.type.includes) ?*/
 /*- endfor -*/
 
-/*- set threads = macros.threads(composition, me) -*/
+/*- set threads = macros.threads(composition, me, configuration) -*/
 
 /* Thread stacks */
 /*- set p = Perspective(instance=me.name, control=True) -*/
@@ -990,9 +1017,15 @@ static int post_main(int thread_id) {
                 /*- if options.fsupport_init -*/
                     /* Wait for `pre_init` to complete. */
                     sync_sem_bare_wait(/*? pre_init_ep ?*/, &/*? pre_init_lock ?*/);
-                    if (/*? t.interface.name ?*/__init) {
-                        /*? t.interface.name ?*/__init();
-                    }
+                    /*# An interface served by several worker threads is only
+                     *# initialised once, by its first thread. The others
+                     *# still take part in the handshake below.
+                     #*/
+                    /*- if t.intra_index == 0 -*/
+                        if (/*? t.interface.name ?*/__init) {
+                            /*? t.interface.name ?*/__init();
+                        }
+                    /*- endif -*/
                     /* Notify the control thread that we've completed init. */
                     sync_sem_bare_post(/*? interface_init_ep ?*/, &/*? interface_init_lock ?*/);
                     /* Wait for the `post_init` to complete. */
@@ -140,8 +140,15 @@ const char *get_instance_name(void);
         ;
     int /*? c.name ?*/_acknowledge(void) WARN_UNUSED_RESULT
         /*- if c.optional -*/ WEAK /*- endif -*/;
+    int /*? c.name ?*/_acknowledge_irqs(seL4_Word irqs) WARN_UNUSED_RESULT
+        /*- if c.optional -*/ WEAK /*- endif -*/;
     /* Implemented by user code. */
     void /*? c.name ?*/_handle(void);
+    /* Implemented by user code for interrupt connections that deliver more
+     * than one IRQ, or whose IRQs are polled, respectively.
+     */
+    void /*? c.name ?*/_handle_irqs(seL4_Word irqs);
+    int /*? c.name ?*/_handle_batch(seL4_Word irqs, int budget);
 /*- endfor -*/
 
 /*- for e in me.type.emits -*/
@@ -188,9 +195,20 @@ void post_init(void) WEAK;
 
     void /*? i.name ?*/_timing_get_points(char ***points, size_t *size);
     uint64_t /*? i.name ?*/_timing_get_entry(unsigned iteration, char *point);
+    size_t /*? i.name ?*/_timing_export(uint64_t *buffer, size_t iterations);
+    const struct camkes_timing_histograms */*? i.name ?*/_timing_histograms(void);
+    void /*? i.name ?*/_timing_histograms_reset(void);
     void /*? i.name ?*/_timing_reset(void);
 /*- endfor -*/
 
+/* Arena the parameters of calls to a procedure provided over seL4RPCCall are
+ * unmarshalled into, for inspecting its statistics. NULL if no parameters of
+ * the procedure need one.
+ */
+/*- for i in me.type.provides -*/
+    const struct camkes_arena */*? i.name ?*/_rpc_arena(void);
+/*- endfor -*/
+
 void set_putchar(void (*putchar)(int c));
 
 /*- for i in all_interfaces -*/
@@ -0,0 +1,156 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*# Lock-free callback registration for the "to" side of the seL4Notification
+ *# and seL4NotificationQueue connectors.
+ *#
+ *# When an event arrives, the event thread deregisters and invokes every
+ *# registered callback or, if there are none, posts the event to the `handoff`
+ *# semaphore for `_poll` and `_wait`. Registration first polls for a pending
+ *# event, so that it can invoke the callback immediately, and only then claims
+ *# a slot. An event handed off between the two would leave a registered
+ *# callback waiting while an event is pending, so after registering we check
+ *# for a handed off event, and after handing an event off the event thread
+ *# checks for a registered callback. Sequentially consistent fences between
+ *# each side's write and read ensure that at least one of them sees the other.
+ *# Whichever does then competes for the callback's slot and the event; the
+ *# winner of both invokes the callback, and a loser gives back what it took.
+ *# The protocol is modelled in tests/sel4notification.pml.
+ *#
+ *# Only the event thread ever posts to `handoff`.
+ #*/
+
+/*# Defines the callback slots, `poll`, `take_callbacks`, `reclaim_event` and
+ *# `<interface>_reg_callback`.
+ *#   handoff: Semaphore endpoint for events that no callback took
+ #*/
+/*- macro make_callbacks(handoff) -*/
+    #define CALLBACK_SLOTS /*? macros.callback_slots(configuration, me) ?*/
+
+    /* Each slot holds the address of a registered callback, CALLBACK_FREE or
+     * CALLBACK_BUSY. A thread that moves a slot to CALLBACK_BUSY has exclusive
+     * use of it and its argument until it moves it on.
+     */
+    #define CALLBACK_FREE ((uintptr_t)0)
+    #define CALLBACK_BUSY ((uintptr_t)1)
+    static uintptr_t callbacks[CALLBACK_SLOTS];
+    static void *callback_args[CALLBACK_SLOTS];
+
+    typedef struct {
+        void (*fn)(void*);
+        void *arg;
+    } callback_t;
+
+    static int poll(void) {
+        return sync_sem_bare_trywait(/*? handoff ?*/, &handoff_value) == 0;
+    }
+
+    /* Deregister every registered callback into `taken`, returning how many
+     * there were.
+     */
+    static unsigned take_callbacks(callback_t *taken) {
+        unsigned n = 0;
+        for (unsigned i = 0; i < CALLBACK_SLOTS; i++) {
+            uintptr_t cb = __atomic_load_n(&callbacks[i], __ATOMIC_ACQUIRE);
+            if (cb != CALLBACK_FREE && cb != CALLBACK_BUSY &&
+                    __atomic_compare_exchange_n(&callbacks[i], &cb, CALLBACK_BUSY,
+                        false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                taken[n].fn = (void (*)(void*))cb;
+                taken[n].arg = callback_args[i];
+                __atomic_store_n(&callbacks[i], CALLBACK_FREE, __ATOMIC_RELEASE);
+                n++;
+            }
+        }
+        return n;
+    }
+
+    /* Called by the event thread after posting an event to the handoff
+     * semaphore. If a callback was registered in the meantime, take the event
+     * back and deregister the callbacks into `taken` to be invoked instead.
+     * Returns the number of callbacks taken.
+     */
+    static unsigned reclaim_event(callback_t *taken) {
+        while (true) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            bool registered = false;
+            for (unsigned i = 0; i < CALLBACK_SLOTS; i++) {
+                uintptr_t cb = __atomic_load_n(&callbacks[i], __ATOMIC_RELAXED);
+                registered |= cb != CALLBACK_FREE && cb != CALLBACK_BUSY;
+            }
+            if (!registered || !poll()) {
+                /* Any registration in progress will see the event. */
+                return 0;
+            }
+            unsigned n = take_callbacks(taken);
+            if (n > 0) {
+                return n;
+            }
+            /* The callback's registrant withdrew it to consume the event
+             * itself. Give the event back.
+             */
+            sync_sem_bare_post(/*? handoff ?*/, &handoff_value);
+        }
+    }
+
+    int /*? me.interface.name ?*/_reg_callback(void (*cb)(void*), void *arg) {
+
+        /* First see if there's a pending event, allowing us to immediately
+         * invoke the callback without having to register it.
+         */
+        if (poll()) {
+            cb(arg);
+            return 0;
+        }
+
+        unsigned i;
+        for (i = 0; i < CALLBACK_SLOTS; i++) {
+            uintptr_t expected = CALLBACK_FREE;
+            if (__atomic_compare_exchange_n(&callbacks[i], &expected, CALLBACK_BUSY,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+        }
+        if (i == CALLBACK_SLOTS) {
+            /* Every slot holds a registered callback. */
+            return -1;
+        }
+
+        callback_args[i] = arg;
+        while (true) {
+            __atomic_store_n(&callbacks[i], (uintptr_t)cb, __ATOMIC_RELEASE);
+
+            /* Check whether an event was handed off before the event thread
+             * could see the callback. This fence pairs with the one in
+             * `reclaim_event`.
+             */
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            if (handoff_value <= 0) {
+                return 0;
+            }
+
+            /* Withdraw the callback to consume the event ourselves, unless the
+             * event thread has already taken it.
+             */
+            uintptr_t expected = (uintptr_t)cb;
+            if (!__atomic_compare_exchange_n(&callbacks[i], &expected, CALLBACK_BUSY,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                return 0;
+            }
+            if (poll()) {
+                __atomic_store_n(&callbacks[i], CALLBACK_FREE, __ATOMIC_RELEASE);
+                cb(arg);
+                return 0;
+            }
+            /* Another thread consumed the event first. Register again. */
+        }
+    }
+/*- endmacro -*/
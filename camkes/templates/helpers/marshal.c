@@ -91,6 +91,280 @@
     }));
 /*- endmacro -*/
 
+/*# Emits code to place `bytes` of data at `src` out of line in the transfer
+  # buffer if they are too large to sensibly go in the message, followed by the
+  # location word that tells the receiver where to find them. The location is
+  # 0 if the data follows inline, otherwise 1 + its offset in the transfer
+  # buffer. The caller is expected to marshal the data inline when `location`
+  # is 0.
+  #*/
+/*- macro marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, src, bytes, target_name, parent_name, error_handler) -*/
+    seL4_Word /*? location ?*/ = 0;
+    if (/*? bytes ?*/ > (/*? size ?*/) / 4 ||
+            /*? bytes ?*/ + sizeof(/*? location ?*/) > /*? size ?*/ - /*? offset ?*/) {
+        ERR_IF(ROUND_UP_UNSAFE(/*? bytes ?*/, sizeof(seL4_Word)) > /*? xfer.size ?*/ - * /*? xfer_offset ?*/, /*? error_handler ?*/, ((camkes_error_t){
+            .type = CE_BUFFER_LENGTH_EXCEEDED,
+            .instance = "/*? instance ?*/",
+            .interface = "/*? interface ?*/",
+            .description = "transfer buffer exceeded while marshalling /*? target_name ?*/ in /*? parent_name ?*/",
+            .current_length = * /*? xfer_offset ?*/,
+            .target_length = * /*? xfer_offset ?*/ + /*? bytes ?*/,
+            }), ({
+                return UINT_MAX;
+        }));
+        memcpy((void*)(/*? xfer.base ?*/) + * /*? xfer_offset ?*/, /*? src ?*/, /*? bytes ?*/);
+        /*? location ?*/ = * /*? xfer_offset ?*/ + 1;
+        * /*? xfer_offset ?*/ += ROUND_UP_UNSAFE(/*? bytes ?*/, sizeof(seL4_Word));
+    }
+    /*? err_if_buffer_length_exceeded(instance, interface, size, offset, 'sizeof(%s)' % location, target_name, parent_name, error_handler) ?*/
+    memcpy(/*? base ?*/ + /*? offset ?*/, & /*? location ?*/, sizeof(/*? location ?*/));
+    /*? offset ?*/ += sizeof(/*? location ?*/);
+/*- endmacro -*/
+
+/*# Emits code to read the location word written by `marshal_location`. If the
+  # data is out of line, `src` is left pointing at it and `avail` is set to the
+  # number of bytes of the transfer buffer from there on, which the caller must
+  # check its data against.
+  #*/
+/*- macro unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, target_name, parent_name, error_handler) -*/
+    ERR_IF(/*? offset ?*/ + sizeof(seL4_Word) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
+        .type = CE_MALFORMED_RPC_PAYLOAD,
+        .instance = "/*? instance ?*/",
+        .interface = "/*? interface ?*/",
+        .description = "truncated message encountered while unmarshalling /*? target_name ?*/ in /*? parent_name ?*/",
+        .length = /*? size ?*/,
+        .current_index = /*? offset ?*/ + sizeof(seL4_Word),
+        }), ({
+            return UINT_MAX;
+    }));
+    seL4_Word /*? location ?*/;
+    memcpy(& /*? location ?*/, /*? base ?*/ + /*? offset ?*/, sizeof(/*? location ?*/));
+    /*? offset ?*/ += sizeof(/*? location ?*/);
+    const void * /*? src ?*/ UNUSED = NULL;
+    size_t /*? avail ?*/ UNUSED = 0;
+    if (/*? location ?*/ != 0) {
+        ERR_IF((/*? xfer.base ?*/) == NULL || /*? location ?*/ - 1 >= /*? xfer.size ?*/, /*? error_handler ?*/, ((camkes_error_t){
+            .type = CE_MALFORMED_RPC_PAYLOAD,
+            .instance = "/*? instance ?*/",
+            .interface = "/*? interface ?*/",
+            .description = "invalid transfer buffer location encountered while unmarshalling /*? target_name ?*/ in /*? parent_name ?*/",
+            .length = /*? xfer.size ?*/,
+            .current_index = /*? location ?*/ - 1,
+            }), ({
+                return UINT_MAX;
+        }));
+        /*? src ?*/ = (const void*)(/*? xfer.base ?*/) + /*? location ?*/ - 1;
+        /*? avail ?*/ = /*? xfer.size ?*/ - (/*? location ?*/ - 1);
+    }
+/*- endmacro -*/
+
+/*# Emits code to copy a string that `unmarshal_location` found out of line into
+  # freshly allocated memory at `dest`, from `arena` if it is not none. The
+  # sender can still write to the transfer buffer, so we copy exactly the length
+  # we measured rather than trusting the terminator to still be there.
+  #*/
+/*- macro unmarshal_out_of_line_string(instance, interface, src, avail, dest, target_name, parent_name, error_handler, arena=none) -*/
+    /*- set strlen = c_symbol('strlen') -*/
+    size_t /*? strlen ?*/ = strnlen(/*? src ?*/, /*? avail ?*/);
+    ERR_IF(/*? strlen ?*/ >= /*? avail ?*/, /*? error_handler ?*/, ((camkes_error_t){
+        .type = CE_MALFORMED_RPC_PAYLOAD,
+        .instance = "/*? instance ?*/",
+        .interface = "/*? interface ?*/",
+        .description = "unterminated string in transfer buffer while unmarshalling /*? target_name ?*/ in /*? parent_name ?*/",
+        .length = /*? avail ?*/,
+        .current_index = /*? strlen ?*/,
+        }), ({
+            return UINT_MAX;
+    }));
+    /*- if arena is not none -*/
+        /*? dest ?*/ = camkes_arena_strndup(/*? arena ?*/, /*? src ?*/, /*? strlen ?*/);
+    /*- else -*/
+        /*? dest ?*/ = malloc(/*? strlen ?*/ + 1);
+    /*- endif -*/
+    ERR_IF(/*? dest ?*/ == NULL, /*? error_handler ?*/, ((camkes_error_t){
+        .type = CE_ALLOCATION_FAILURE,
+        .instance = "/*? instance ?*/",
+        .interface = "/*? interface ?*/",
+        .description = "out of memory while unmarshalling /*? target_name ?*/ in /*? parent_name ?*/",
+        .alloc_bytes = /*? strlen ?*/ + 1,
+        }), ({
+            return UINT_MAX;
+    }));
+    /*- if arena is none -*/
+        memcpy(/*? dest ?*/, /*? src ?*/, /*? strlen ?*/);
+        (/*? dest ?*/)[/*? strlen ?*/] = '\0';
+    /*- endif -*/
+/*- endmacro -*/
+
+/*# Generates code for marshalling input parameters that are all of a fixed
+  # size (see macros.fixed_size). The message is laid out exactly as by the
+  # general code, but it is built as a single packed struct whose size is a C
+  # constant, so the bounds check folds away whenever `size` is constant too.
+  # Also emits `<function>_size`, the length of the message, and
+  # `<function>_at`, which takes the buffer and its size as its first
+  # arguments. Arguments are as for make_marshal_input_symbols.
+  #*/
+/*- macro make_fixed_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler) -*/
+    /*- set call = c_symbol('method_index') -*/
+    /*- set empty = methods_len <= 1 and len(input_parameters) == 0 -*/
+    /*- if not empty -*/
+        typedef struct PACKED {
+            /*- if methods_len > 1 -*/
+                /*? macros.type_to_fit_integer(methods_len) ?*/ /*? call ?*/;
+            /*- endif -*/
+            /*- for p in input_parameters -*/
+                /*? macros.show_type(p.type) ?*/ /*? p.name ?*/;
+            /*- endfor -*/
+        } /*? function ?*/_message_t;
+    /*- endif -*/
+
+    enum {
+        /*- if empty -*/
+            /*? function ?*/_size = 0,
+        /*- else -*/
+            /*? function ?*/_size = sizeof(/*? function ?*/_message_t),
+        /*- endif -*/
+    };
+
+    /*- set base = c_symbol('buffer_base') -*/
+    /*- set buffer_size = c_symbol('size') -*/
+    static unsigned /*? function ?*/_at(void * /*? base ?*/ UNUSED, unsigned /*? buffer_size ?*/
+    /*- if len(input_parameters) > 0 -*/
+        ,
+    /*- endif -*/
+    /*? show_input_parameter_list(input_parameters, ['in', 'refin', 'inout']) ?*/
+    ) {
+        /*? err_if_buffer_length_exceeded(instance, interface, buffer_size, '0', '%s_size' % function, name, name, error_handler) ?*/
+        /*- if not empty -*/
+            /*- set message = c_symbol('message') -*/
+            /*? function ?*/_message_t /*? message ?*/ = {
+                /*- if methods_len > 1 -*/
+                    ./*? call ?*/ = /*? method_index ?*/,
+                /*- endif -*/
+                /*- for p in input_parameters -*/
+                    /*- if p.direction == 'in' -*/
+                        ./*? p.name ?*/ = /*? p.name ?*/,
+                    /*- else -*/
+                        ./*? p.name ?*/ = * /*? p.name ?*/,
+                    /*- endif -*/
+                /*- endfor -*/
+            };
+            memcpy(/*? base ?*/, & /*? message ?*/, sizeof(/*? message ?*/));
+        /*- endif -*/
+        return /*? function ?*/_size;
+    }
+
+    static unsigned /*? function ?*/(
+    /*? show_input_parameter_list(input_parameters, ['in', 'refin', 'inout']) ?*/
+    /*- if len(input_parameters) == 0 -*/
+        void
+    /*- endif -*/
+    ) {
+        return /*? function ?*/_at((void*)(/*? buffer ?*/), /*? size ?*/
+        /*- for p in input_parameters -*/
+            , /*? p.name ?*/
+        /*- endfor -*/
+        );
+    }
+/*- endmacro -*/
+
+/*# Generates code for unmarshalling output parameters and a return value that
+  # are all of a fixed size, the counterpart of
+  # make_fixed_marshal_input_symbols. Emits `<function>_size` and
+  # `<function>_at` likewise. Arguments are as for
+  # make_unmarshal_output_symbols.
+  #*/
+/*- macro make_fixed_unmarshal_output_symbols(instance, interface, name, function, buffer, output_parameters, return_type, error_handler, allow_trailing_data) -*/
+    /*- set ret = c_symbol('return') -*/
+    /*- set empty = return_type is none and len(output_parameters) == 0 -*/
+    /*- if not empty -*/
+        typedef struct PACKED {
+            /*- if return_type is not none -*/
+                /*? macros.show_type(return_type) ?*/ /*? ret ?*/;
+            /*- endif -*/
+            /*- for p in output_parameters -*/
+                /*? macros.show_type(p.type) ?*/ /*? p.name ?*/;
+            /*- endfor -*/
+        } /*? function ?*/_message_t;
+    /*- endif -*/
+
+    enum {
+        /*- if empty -*/
+            /*? function ?*/_size = 0,
+        /*- else -*/
+            /*? function ?*/_size = sizeof(/*? function ?*/_message_t),
+        /*- endif -*/
+    };
+
+    /*- set base = c_symbol('buffer_base') -*/
+    /*- set size = c_symbol('size') -*/
+    static int /*? function ?*/_at(const void * /*? base ?*/ UNUSED, unsigned /*? size ?*/
+    /*- if return_type is not none -*/
+        , /*? macros.show_type(return_type) ?*/ * /*? ret ?*/
+    /*- endif -*/
+    /*- if len(output_parameters) > 0 -*/
+        ,
+    /*- endif -*/
+    /*? show_output_parameter_list(output_parameters) ?*/
+    ) {
+        /*- if not empty -*/
+            ERR_IF(/*? function ?*/_size > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
+                .type = CE_MALFORMED_RPC_PAYLOAD,
+                .instance = "/*? instance ?*/",
+                .interface = "/*? interface ?*/",
+                .description = "truncated message encountered while unmarshalling outputs for /*? name ?*/",
+                .length = /*? size ?*/,
+                .current_index = /*? function ?*/_size,
+                }), ({
+                    return -1;
+            }));
+        /*- endif -*/
+        /*- if not allow_trailing_data -*/
+            ERR_IF(ROUND_UP_UNSAFE(/*? function ?*/_size, sizeof(seL4_Word)) != /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
+                .type = CE_MALFORMED_RPC_PAYLOAD,
+                .instance = "/*? instance ?*/",
+                .interface = "/*? interface ?*/",
+                .description = "excess trailing bytes after unmarshalling parameters for /*? name ?*/",
+                .length = /*? size ?*/,
+                .current_index = /*? function ?*/_size,
+                }), ({
+                    return -1;
+            }));
+        /*- endif -*/
+        /*- if not empty -*/
+            /*- set message = c_symbol('message') -*/
+            /*? function ?*/_message_t /*? message ?*/;
+            memcpy(& /*? message ?*/, /*? base ?*/, sizeof(/*? message ?*/));
+            /*- if return_type is not none -*/
+                * /*? ret ?*/ = /*? message ?*/./*? ret ?*/;
+            /*- endif -*/
+            /*- for p in output_parameters -*/
+                * /*? p.name ?*/ = /*? message ?*/./*? p.name ?*/;
+            /*- endfor -*/
+        /*- endif -*/
+        return 0;
+    }
+
+    static int /*? function ?*/(unsigned /*? size ?*/
+    /*- if return_type is not none -*/
+        , /*? macros.show_type(return_type) ?*/ * /*? ret ?*/
+    /*- endif -*/
+    /*- if len(output_parameters) > 0 -*/
+        ,
+    /*- endif -*/
+    /*? show_output_parameter_list(output_parameters) ?*/
+    ) {
+        return /*? function ?*/_at((const void*)(/*? buffer ?*/), /*? size ?*/
+        /*- if return_type is not none -*/
+            , /*? ret ?*/
+        /*- endif -*/
+        /*- for p in output_parameters -*/
+            , /*? p.name ?*/
+        /*- endfor -*/
+        );
+    }
+/*- endmacro -*/
+
 /*# Generates code for marshalling input parameters to an RPC invocation
   #     instance: Name of this component instance
   #     interface: Name of this interface
@@ -103,8 +377,10 @@
   #     input_parameters: All input parameters to this method
   #     error_handler: Handler to invoke on error
   #     threads: List of threads in the interface
+  #     xfer: Transfer buffer for large parameters, as a dict of its 'base' and
+  #       'size' expressions, or None to pass everything in the message
   #*/
-/*- macro make_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler, threads) -*/
+/*- macro make_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler, threads, xfer=none) -*/
     /*# Validate that our arguments are the correct type #*/
     /*? assert(isinstance(instance, six.string_types)) ?*/
     /*? assert(isinstance(interface, six.string_types)) ?*/
@@ -117,7 +393,19 @@
     /*? assert(isinstance(input_parameters, (list, tuple))) ?*/
     /*? assert(isinstance(error_handler, six.string_types)) ?*/
     /*? assert(isinstance(threads, list)) ?*/
+    /*? assert(xfer is none or isinstance(xfer, dict)) ?*/
 
+    /*- if macros.fixed_size(input_parameters, xfer=xfer is not none) -*/
+        /*? make_fixed_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler) ?*/
+    /*- else -*/
+        /*? make_variable_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler, threads, xfer) ?*/
+    /*- endif -*/
+/*- endmacro -*/
+
+/*# Generates code for marshalling input parameters of any size. Arguments are
+  # as for make_marshal_input_symbols.
+  #*/
+/*- macro make_variable_marshal_input_symbols(instance, interface, name, function, buffer, size, method_index, methods_len, input_parameters, error_handler, threads, xfer) -*/
     /*- set name_backup = name -*/
     /*- for p in input_parameters -*/
         /*- if p.direction == 'in' -*/
@@ -133,7 +421,11 @@
     /*- for p in input_parameters -*/
         /*? assert(p.direction in ['in', 'refin', 'inout']) ?*/
         /*- set offset = c_symbol('offset') -*/
+        /*- set xfer_offset = c_symbol('xfer_offset') -*/
         static unsigned /*? function ?*/_/*? p.name ?*/(unsigned /*? offset ?*/,
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                unsigned * /*? xfer_offset ?*/,
+            /*- endif -*/
             /*? show_input_parameter(p) ?*/
         ) {
 
@@ -196,11 +488,26 @@
                 }
             /*- else -*/
                 /*- set target = 'sizeof(%s[0]) * (* %s)' % (ptr_arr, ptr_sz) -*/
+                /*- set location = c_symbol('location') -*/
+                /*- if xfer is not none -*/
+                    /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, ptr_arr, target, p.name, name, error_handler) ?*/
+                    if (/*? location ?*/ == 0) {
+                /*- endif -*/
                 /*? err_if_buffer_length_exceeded(instance, interface, size, offset, target, p.name, name, error_handler) ?*/
                 memcpy(/*? base ?*/ + /*? offset ?*/, /*? ptr_arr ?*/, /*? target ?*/);
                 /*? offset ?*/ += /*? target ?*/;
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- endif -*/
         /*- elif p.type == 'string' -*/
+            /*- set location = c_symbol('location') -*/
+            /*- if xfer is not none -*/
+                /*- set xfer_len = c_symbol('xfer_len') -*/
+                size_t /*? xfer_len ?*/ = strnlen(/*? ptr_str ?*/, /*? xfer.size ?*/) + 1;
+                /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, ptr_str, xfer_len, p.name, name, error_handler) ?*/
+                if (/*? location ?*/ == 0) {
+            /*- endif -*/
             /*- set strlen = c_symbol('strlen') -*/
             size_t /*? strlen ?*/ = strnlen(/*? ptr_str ?*/, /*? size ?*/ - /*? offset ?*/);
             /*- set nulllen = '%s + 1' % strlen -*/
@@ -208,11 +515,22 @@
             /* If we didn't trigger an error, we now know this strcpy is safe. */
             (void)strcpy(/*? base ?*/ + /*? offset ?*/, /*? ptr_str ?*/);
             /*? offset ?*/ += /*? nulllen ?*/;
+            /*- if xfer is not none -*/
+                }
+            /*- endif -*/
         /*- else -*/
             /*- set target = 'sizeof(* %s)' % ptr -*/
+            /*- set location = c_symbol('location') -*/
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, ptr, target, p.name, name, error_handler) ?*/
+                if (/*? location ?*/ == 0) {
+            /*- endif -*/
             /*? err_if_buffer_length_exceeded(instance, interface, size, offset, target, p.name, name, error_handler) ?*/
             memcpy(/*? base ?*/ + /*? offset ?*/, /*? ptr ?*/, /*? target ?*/);
             /*? offset ?*/ += /*? target ?*/;
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                }
+            /*- endif -*/
         /*- endif -*/
         return /*? offset ?*/;
     }
@@ -233,6 +551,11 @@
         /*- set length = c_symbol('length') -*/
         unsigned /*? length ?*/ = 0;
 
+        /*- set xfer_offset = c_symbol('xfer_offset') -*/
+        /*- if xfer is not none -*/
+            unsigned /*? xfer_offset ?*/ UNUSED = 0;
+        /*- endif -*/
+
         /*- set base = c_symbol('buffer_base') -*/
         void * /*? base ?*/ UNUSED = (void*)(/*? buffer ?*/);
 
@@ -248,6 +571,9 @@
         /*- for p in input_parameters -*/
             /*? assert(isinstance(p.type, six.string_types)) ?*/
             /*? length ?*/ = /*? function ?*/_/*? p.name ?*/(/*? length ?*/,
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                & /*? xfer_offset ?*/,
+            /*- endif -*/
             /*- if p.array -*/
                 /*? p.name ?*/_sz,
             /*- endif -*/
@@ -299,9 +625,11 @@
   #     return_type: Return type of this interface
   #     error_handler: Handler to invoke on error
   #     allow_trailing_data: Whether to ignore checks for remaining bytes after a message
+  #     xfer: Transfer buffer the sender may have placed large parameters in,
+  #       as for make_marshal_input_symbols
   #*/
 /*# Whether to ignore checks for remaining bytes after a message #*/
-/*- macro make_unmarshal_output_symbols(instance, interface, name, function, buffer, method_index, output_parameters, return_type, error_handler, allow_trailing_data) -*/
+/*- macro make_unmarshal_output_symbols(instance, interface, name, function, buffer, method_index, output_parameters, return_type, error_handler, allow_trailing_data, xfer=none) -*/
     /*# Validate our argument types #*/
     /*? assert(isinstance(instance, six.string_types)) ?*/
     /*? assert(isinstance(interface, six.string_types)) ?*/
@@ -313,7 +641,19 @@
     /*? assert(return_type is none or isinstance(return_type, six.string_types)) ?*/
     /*? assert(isinstance(error_handler, six.string_types)) ?*/
     /*? assert(isinstance(allow_trailing_data, bool)) ?*/
+    /*? assert(xfer is none or isinstance(xfer, dict)) ?*/
+
+    /*- if macros.fixed_size(output_parameters, return_type, xfer is not none) -*/
+        /*? make_fixed_unmarshal_output_symbols(instance, interface, name, function, buffer, output_parameters, return_type, error_handler, allow_trailing_data) ?*/
+    /*- else -*/
+        /*? make_variable_unmarshal_output_symbols(instance, interface, name, function, buffer, method_index, output_parameters, return_type, error_handler, allow_trailing_data, xfer) ?*/
+    /*- endif -*/
+/*- endmacro -*/
 
+/*# Generates code for unmarshalling output parameters of any size. Arguments
+  # are as for make_unmarshal_output_symbols.
+  #*/
+/*- macro make_variable_unmarshal_output_symbols(instance, interface, name, function, buffer, method_index, output_parameters, return_type, error_handler, allow_trailing_data, xfer) -*/
     /*- set ret_fn = c_symbol('ret_fn') -*/
     /*- if return_type is not none -*/
         /*- set offset = c_symbol('offset') -*/
@@ -329,6 +669,15 @@
 
             /* Unmarshal the return value. */
             /*- if return_type == 'string' -*/
+                /*- set location = c_symbol('location') -*/
+                /*- set src = c_symbol('src') -*/
+                /*- set avail = c_symbol('avail') -*/
+                /*- if xfer is not none -*/
+                    /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, 'return value', name, error_handler) ?*/
+                    if (/*? location ?*/ != 0) {
+                        /*? unmarshal_out_of_line_string(instance, interface, src, avail, '* %s' % ret, 'return value', name, error_handler) ?*/
+                    } else {
+                /*- endif -*/
                 /*- set strlen = c_symbol('strlen') -*/
                 size_t /*? strlen ?*/ = strnlen(/*? base ?*/ + /*? offset ?*/, /*? size ?*/ - /*? offset ?*/);
                 ERR_IF(/*? strlen ?*/ >= /*? size ?*/ - /*? offset ?*/, /*? error_handler ?*/, ((camkes_error_t){
@@ -352,6 +701,9 @@
                         return UINT_MAX;
                 }));
                 /*? offset ?*/ += /*? strlen ?*/ + 1;
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- else -*/
                 ERR_IF(/*? offset ?*/ + sizeof(* /*? ret ?*/) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_MALFORMED_RPC_PAYLOAD,
@@ -393,6 +745,22 @@
                 }));
                 memcpy(/*? p.name ?*/_sz, /*? base ?*/ + /*? offset ?*/, sizeof(* /*? p.name ?*/_sz));
                 /*? offset ?*/ += sizeof(* /*? p.name ?*/_sz);
+                /*- set location = c_symbol('location') -*/
+                /*- set src = c_symbol('src') -*/
+                /*- set avail = c_symbol('avail') -*/
+                /*- if xfer is not none and p.type != 'string' -*/
+                    /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                    ERR_IF(/*? location ?*/ != 0 && * /*? p.name ?*/_sz > /*? avail ?*/ / sizeof((* /*? p.name ?*/)[0]), /*? error_handler ?*/, ((camkes_error_t){
+                        .type = CE_MALFORMED_RPC_PAYLOAD,
+                        .instance = "/*? instance ?*/",
+                        .interface = "/*? interface ?*/",
+                        .description = "transfer buffer exceeded while unmarshalling /*? p.name ?*/ in /*? name ?*/",
+                        .length = /*? avail ?*/,
+                        .current_index = * /*? p.name ?*/_sz,
+                        }), ({
+                            return UINT_MAX;
+                    }));
+                /*- endif -*/
                 /*- if p.direction == 'inout' -*/
                     /*- if p.type == 'string' -*/
                         /*- set mcount = c_symbol() -*/
@@ -464,6 +832,11 @@
                         /*? offset ?*/ += /*? strlen ?*/ + 1;
                     }
                 /*- else -*/
+                    /*- if xfer is not none -*/
+                        if (/*? location ?*/ != 0) {
+                            memcpy(* /*? p.name ?*/, /*? src ?*/, sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
+                        } else {
+                    /*- endif -*/
                     ERR_IF(/*? offset ?*/ + sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                         .type = CE_MALFORMED_RPC_PAYLOAD,
                         .instance = "/*? instance ?*/",
@@ -477,11 +850,23 @@
                     }));
                     memcpy((* /*? p.name ?*/), /*? base ?*/ + /*? offset ?*/, sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
                     /*? offset ?*/ += sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz);
+                    /*- if xfer is not none -*/
+                        }
+                    /*- endif -*/
                 /*- endif -*/
             /*- elif p.type == 'string' -*/
                 /*- if p.direction == 'inout' -*/
                     free(* /*? p.name ?*/);
                 /*- endif -*/
+                /*- set location = c_symbol('location') -*/
+                /*- set src = c_symbol('src') -*/
+                /*- set avail = c_symbol('avail') -*/
+                /*- if xfer is not none -*/
+                    /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                    if (/*? location ?*/ != 0) {
+                        /*? unmarshal_out_of_line_string(instance, interface, src, avail, '* %s' % p.name, p.name, name, error_handler) ?*/
+                    } else {
+                /*- endif -*/
                 /*- set strlen = c_symbol('strlen') -*/
                 size_t /*? strlen ?*/ = strnlen(/*? base ?*/ + /*? offset ?*/, /*? size ?*/ - /*? offset ?*/);
                 ERR_IF(/*? strlen ?*/ >= /*? size ?*/ - /*? offset ?*/, /*? error_handler ?*/, ((camkes_error_t){
@@ -505,7 +890,29 @@
                         return UINT_MAX;
                 }));
                 /*? offset ?*/ += /*? strlen ?*/ + 1;
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- else -*/
+                /*- set location = c_symbol('location') -*/
+                /*- set src = c_symbol('src') -*/
+                /*- set avail = c_symbol('avail') -*/
+                /*- if xfer is not none and macros.out_of_line(p) -*/
+                    /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                    if (/*? location ?*/ != 0) {
+                        ERR_IF(sizeof(* /*? p.name ?*/) > /*? avail ?*/, /*? error_handler ?*/, ((camkes_error_t){
+                            .type = CE_MALFORMED_RPC_PAYLOAD,
+                            .instance = "/*? instance ?*/",
+                            .interface = "/*? interface ?*/",
+                            .description = "transfer buffer exceeded while unmarshalling /*? p.name ?*/ in /*? name ?*/",
+                            .length = /*? avail ?*/,
+                            .current_index = sizeof(* /*? p.name ?*/),
+                            }), ({
+                                return UINT_MAX;
+                        }));
+                        memcpy(/*? p.name ?*/, /*? src ?*/, sizeof(* /*? p.name ?*/));
+                    } else {
+                /*- endif -*/
                 ERR_IF(/*? offset ?*/ + sizeof(* /*? p.name ?*/) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_MALFORMED_RPC_PAYLOAD,
                     .instance = "/*? instance ?*/",
@@ -518,6 +925,9 @@
                 }));
                 memcpy(/*? p.name ?*/, /*? base ?*/ + /*? offset ?*/, sizeof(* /*? p.name ?*/));
                 /*? offset ?*/ += sizeof(* /*? p.name ?*/);
+                /*- if xfer is not none and macros.out_of_line(p) -*/
+                    }
+                /*- endif -*/
             /*- endif -*/
 
             return /*? offset ?*/;
@@ -669,8 +1079,14 @@
   #     input_parameters: All input parameters to this method
   #     error_handler: Handler to invoke on error
   #     allow_trailing_data: Whether to ignore checks for remaining bytes after a message
+  #     xfer: Transfer buffer the sender may have placed large parameters in,
+  #       as for make_marshal_input_symbols
+  #     arena: C expression for a camkes_arena_t pointer to allocate `in` and
+  #       `refin` strings and arrays from, or none to malloc them. The caller
+  #       must reset the arena after the call rather than free them, even
+  #       when unmarshalling fails.
   #*/
-/*- macro make_unmarshal_input_symbols(instance, interface, name, function, buffer, methods_len, input_parameters, error_handler, allow_trailing_data) -*/
+/*- macro make_unmarshal_input_symbols(instance, interface, name, function, buffer, methods_len, input_parameters, error_handler, allow_trailing_data, xfer=none, arena=none) -*/
     /*# Validate the types of our arguments #*/
     /*? assert(isinstance(instance, six.string_types)) ?*/
     /*? assert(isinstance(interface, six.string_types)) ?*/
@@ -679,6 +1095,8 @@
     /*? assert(isinstance(buffer, six.string_types)) ?*/
     /*? assert(isinstance(methods_len, six.integer_types)) ?*/
     /*? assert(isinstance(input_parameters, (list, tuple))) ?*/
+    /*? assert(xfer is none or isinstance(xfer, dict)) ?*/
+    /*? assert(arena is none or isinstance(arena, six.string_types)) ?*/
 
     /*- for p in input_parameters -*/
     /*- set size = c_symbol('size') -*/
@@ -690,6 +1108,11 @@
         /*- set base = c_symbol('buffer_base') -*/
         void * /*? base ?*/ UNUSED = (void*)(/*? buffer ?*/);
 
+        /*- set p_arena = c_symbol('arena') if arena is not none and macros.arena_allocated(p) else none -*/
+        /*- if p_arena is not none -*/
+            camkes_arena_t * /*? p_arena ?*/ = /*? arena ?*/;
+        /*- endif -*/
+
         /*- if p.array -*/
             ERR_IF(/*? offset ?*/ + sizeof(* /*? p.name ?*/_sz) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                 .type = CE_MALFORMED_RPC_PAYLOAD,
@@ -703,8 +1126,28 @@
             }));
             memcpy(/*? p.name ?*/_sz, /*? base ?*/ + /*? offset ?*/, sizeof(* /*? p.name ?*/_sz));
             /*? offset ?*/ += sizeof(* /*? p.name ?*/_sz);
+            /*- set location = c_symbol('location') -*/
+            /*- set src = c_symbol('src') -*/
+            /*- set avail = c_symbol('avail') -*/
+            /*- if xfer is not none and p.type != 'string' -*/
+                /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                ERR_IF(/*? location ?*/ != 0 && * /*? p.name ?*/_sz > /*? avail ?*/ / sizeof((* /*? p.name ?*/)[0]), /*? error_handler ?*/, ((camkes_error_t){
+                    .type = CE_MALFORMED_RPC_PAYLOAD,
+                    .instance = "/*? instance ?*/",
+                    .interface = "/*? interface ?*/",
+                    .description = "transfer buffer exceeded while unmarshalling /*? p.name ?*/ in /*? name ?*/",
+                    .length = /*? avail ?*/,
+                    .current_index = * /*? p.name ?*/_sz,
+                    }), ({
+                        return UINT_MAX;
+                }));
+            /*- endif -*/
             /*- if p.type == 'string' -*/
-                * /*? p.name ?*/ = malloc(sizeof(char*) * (* /*? p.name ?*/_sz));
+                /*- if p_arena is not none -*/
+                    * /*? p.name ?*/ = camkes_arena_alloc(/*? p_arena ?*/, sizeof(char*) * (* /*? p.name ?*/_sz), __alignof__(char*));
+                /*- else -*/
+                    * /*? p.name ?*/ = malloc(sizeof(char*) * (* /*? p.name ?*/_sz));
+                /*- endif -*/
                 ERR_IF(* /*? p.name ?*/ == NULL, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_ALLOCATION_FAILURE,
                     .instance = "/*? instance ?*/",
@@ -715,7 +1158,11 @@
                         return UINT_MAX;
                 }));
             /*- else -*/
-                * /*? p.name ?*/ = malloc(sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
+                /*- if p_arena is not none -*/
+                    * /*? p.name ?*/ = camkes_arena_alloc(/*? p_arena ?*/, sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz), __alignof__((* /*? p.name ?*/)[0]));
+                /*- else -*/
+                    * /*? p.name ?*/ = malloc(sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
+                /*- endif -*/
                 ERR_IF(* /*? p.name ?*/ == NULL, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_ALLOCATION_FAILURE,
                     .instance = "/*? instance ?*/",
@@ -739,15 +1186,21 @@
                         .length = /*? size ?*/,
                         .current_index = /*? offset ?*/ + /*? strlen ?*/ + 1,
                         }), ({
-                            /*- set mcount = c_symbol() -*/
-                            for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < /*? lcount ?*/; /*? mcount ?*/ ++) {
-                                free((* /*? p.name ?*/)[/*? mcount ?*/]);
-                            }
-                            free(* /*? p.name ?*/);
+                            /*- if p_arena is none -*/
+                                /*- set mcount = c_symbol() -*/
+                                for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < /*? lcount ?*/; /*? mcount ?*/ ++) {
+                                    free((* /*? p.name ?*/)[/*? mcount ?*/]);
+                                }
+                                free(* /*? p.name ?*/);
+                            /*- endif -*/
                             return UINT_MAX;
                     }));
-                    /* If we didn't trigger an error, we now know this strdup is safe. */
-                    (* /*? p.name ?*/)[/*? lcount ?*/] = strdup(/*? base ?*/ + /*? offset ?*/);
+                    /*- if p_arena is not none -*/
+                        (* /*? p.name ?*/)[/*? lcount ?*/] = camkes_arena_strndup(/*? p_arena ?*/, /*? base ?*/ + /*? offset ?*/, /*? strlen ?*/);
+                    /*- else -*/
+                        /* If we didn't trigger an error, we now know this strdup is safe. */
+                        (* /*? p.name ?*/)[/*? lcount ?*/] = strdup(/*? base ?*/ + /*? offset ?*/);
+                    /*- endif -*/
                     ERR_IF((* /*? p.name ?*/)[/*? lcount ?*/] == NULL, /*? error_handler ?*/, ((camkes_error_t){
                         .type = CE_ALLOCATION_FAILURE,
                         .instance = "/*? instance ?*/",
@@ -755,16 +1208,23 @@
                         .description = "out of memory while unmarshalling /*? p.name ?*/ in /*? name ?*/",
                         .alloc_bytes = /*? strlen ?*/ + 1,
                         }), ({
-                            /*- set mcount = c_symbol() -*/
-                            for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < /*? lcount ?*/; /*? mcount ?*/ ++) {
-                                free((* /*? p.name ?*/)[/*? mcount ?*/]);
-                            }
-                            free(* /*? p.name ?*/);
+                            /*- if p_arena is none -*/
+                                /*- set mcount = c_symbol() -*/
+                                for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < /*? lcount ?*/; /*? mcount ?*/ ++) {
+                                    free((* /*? p.name ?*/)[/*? mcount ?*/]);
+                                }
+                                free(* /*? p.name ?*/);
+                            /*- endif -*/
                             return UINT_MAX;
                     }));
                     /*? offset ?*/ += /*? strlen ?*/ + 1;
                 }
             /*- else -*/
+                /*- if xfer is not none -*/
+                    if (/*? location ?*/ != 0) {
+                        memcpy(* /*? p.name ?*/, /*? src ?*/, sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
+                    } else {
+                /*- endif -*/
                 ERR_IF(/*? offset ?*/ + sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_MALFORMED_RPC_PAYLOAD,
                     .instance = "/*? instance ?*/",
@@ -773,13 +1233,27 @@
                     .length = /*? size ?*/,
                     .current_index = /*? offset ?*/ + sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz),
                     }), ({
-                        free(* /*? p.name ?*/);
+                        /*- if p_arena is none -*/
+                            free(* /*? p.name ?*/);
+                        /*- endif -*/
                         return UINT_MAX;
                 }));
                 memcpy(* /*? p.name ?*/, /*? base ?*/ + /*? offset ?*/, sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz));
                 /*? offset ?*/ += sizeof((* /*? p.name ?*/)[0]) * (* /*? p.name ?*/_sz);
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- endif -*/
         /*- elif p.type == 'string' -*/
+            /*- set location = c_symbol('location') -*/
+            /*- set src = c_symbol('src') -*/
+            /*- set avail = c_symbol('avail') -*/
+            /*- if xfer is not none -*/
+                /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                if (/*? location ?*/ != 0) {
+                    /*? unmarshal_out_of_line_string(instance, interface, src, avail, '* %s' % p.name, p.name, name, error_handler, p_arena) ?*/
+                } else {
+            /*- endif -*/
             /*- set strlen = c_symbol('strlen') -*/
             size_t /*? strlen ?*/ = strnlen(/*? base ?*/ + /*? offset ?*/, /*? size ?*/ - /*? offset ?*/);
             ERR_IF(/*? strlen ?*/ >= /*? size ?*/ - /*? offset ?*/, /*? error_handler ?*/, ((camkes_error_t){
@@ -792,7 +1266,11 @@
                 }), ({
                     return UINT_MAX;
             }));
-            * /*? p.name ?*/ = strdup(/*? base ?*/ + /*? offset ?*/);
+            /*- if p_arena is not none -*/
+                * /*? p.name ?*/ = camkes_arena_strndup(/*? p_arena ?*/, /*? base ?*/ + /*? offset ?*/, /*? strlen ?*/);
+            /*- else -*/
+                * /*? p.name ?*/ = strdup(/*? base ?*/ + /*? offset ?*/);
+            /*- endif -*/
             ERR_IF(* /*? p.name ?*/ == NULL, /*? error_handler ?*/, ((camkes_error_t){
                 .type = CE_ALLOCATION_FAILURE,
                 .instance = "/*? instance ?*/",
@@ -803,7 +1281,29 @@
                     return UINT_MAX;
             }));
             /*? offset ?*/ += /*? strlen ?*/ + 1;
+            /*- if xfer is not none -*/
+                }
+            /*- endif -*/
         /*- else -*/
+            /*- set location = c_symbol('location') -*/
+            /*- set src = c_symbol('src') -*/
+            /*- set avail = c_symbol('avail') -*/
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                /*? unmarshal_location(instance, interface, base, size, offset, xfer, location, src, avail, p.name, name, error_handler) ?*/
+                if (/*? location ?*/ != 0) {
+                    ERR_IF(sizeof(* /*? p.name ?*/) > /*? avail ?*/, /*? error_handler ?*/, ((camkes_error_t){
+                        .type = CE_MALFORMED_RPC_PAYLOAD,
+                        .instance = "/*? instance ?*/",
+                        .interface = "/*? interface ?*/",
+                        .description = "transfer buffer exceeded while unmarshalling /*? p.name ?*/ in /*? name ?*/",
+                        .length = /*? avail ?*/,
+                        .current_index = sizeof(* /*? p.name ?*/),
+                        }), ({
+                            return UINT_MAX;
+                    }));
+                    memcpy(/*? p.name ?*/, /*? src ?*/, sizeof(* /*? p.name ?*/));
+                } else {
+            /*- endif -*/
             ERR_IF(/*? offset ?*/ + sizeof(* /*? p.name ?*/) > /*? size ?*/, /*? error_handler ?*/, ((camkes_error_t){
                 .type = CE_MALFORMED_RPC_PAYLOAD,
                 .instance = "/*? instance ?*/",
@@ -816,6 +1316,9 @@
             }));
             memcpy(/*? p.name ?*/, /*? base ?*/ + /*? offset ?*/, sizeof(* /*? p.name ?*/));
             /*? offset ?*/ += sizeof(* /*? p.name ?*/);
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                }
+            /*- endif -*/
         /*- endif -*/
 
         return /*? offset ?*/;
@@ -853,7 +1356,9 @@
             );
             if (unlikely(/*? length ?*/ == UINT_MAX)) {
             /*- for q in itertools.islice(input_parameters, index) -*/
-                /*- if q.array -*/
+                /*- if arena is not none and macros.arena_allocated(q) -*/
+                    /*# Reclaimed when the caller resets the arena. #*/
+                /*- elif q.array -*/
                     /*- if q.type == 'string' -*/
                         /*- set mcount = c_symbol() -*/
                         for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < * /*? q.name ?*/_sz; /*? mcount ?*/ ++) {
@@ -879,7 +1384,9 @@
                 .current_index = /*? length ?*/,
                 }), ({
                     /*- for p in input_parameters -*/
-                        /*- if p.array -*/
+                        /*- if arena is not none and macros.arena_allocated(p) -*/
+                            /*# Reclaimed when the caller resets the arena. #*/
+                        /*- elif p.array -*/
                             /*- if p.type == 'string' -*/
                                 /*- set mcount = c_symbol() -*/
                                 for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < * /*? p.name ?*/_sz; /*? mcount ?*/ ++) {
@@ -937,8 +1444,10 @@
   #     output_parameters: All output parameters to this method
   #     return_type: Return type of this interface
   #     error_handler: Handler to invoke on error
+  #     xfer: Transfer buffer for large parameters, as for
+  #       make_marshal_input_symbols
   #*/
-/*- macro make_marshal_output_symbols(instance, interface, name, function, buffer, size, output_parameters, return_type, error_handler) -*/
+/*- macro make_marshal_output_symbols(instance, interface, name, function, buffer, size, output_parameters, return_type, error_handler, xfer=none) -*/
     /*# Validate our arguments are the correct type #*/
     /*? assert(isinstance(instance, six.string_types)) ?*/
     /*? assert(isinstance(interface, six.string_types)) ?*/
@@ -949,12 +1458,17 @@
     /*? assert(isinstance(output_parameters, (list, tuple))) ?*/
     /*? assert(return_type is none or isinstance(return_type, six.string_types)) ?*/
     /*? assert(isinstance(error_handler, six.string_types)) ?*/
+    /*? assert(xfer is none or isinstance(xfer, dict)) ?*/
 
     /*- set ret_fn = c_symbol('ret_fn') -*/
     /*- if return_type is not none -*/
         /*- set offset = c_symbol('offset') -*/
+        /*- set xfer_offset = c_symbol('xfer_offset') -*/
         /*- set ret = c_symbol('return') -*/
         static unsigned /*? function ?*/_/*? ret_fn ?*/(unsigned /*? offset ?*/,
+        /*- if xfer is not none and return_type == 'string' -*/
+            unsigned * /*? xfer_offset ?*/,
+        /*- endif -*/
         /*- if return_type == 'string' -*/
             char ** /*? ret ?*/
         /*- else -*/
@@ -967,6 +1481,13 @@
 
             /* Marshal the return value. */
             /*- if return_type == 'string' -*/
+                /*- set location = c_symbol('location') -*/
+                /*- if xfer is not none -*/
+                    /*- set xfer_len = c_symbol('xfer_len') -*/
+                    size_t /*? xfer_len ?*/ = strnlen(* /*? ret ?*/, /*? xfer.size ?*/) + 1;
+                    /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, '* %s' % ret, xfer_len, name, name, error_handler) ?*/
+                    if (/*? location ?*/ == 0) {
+                /*- endif -*/
                 /*- set strlen = c_symbol('strlen') -*/
                 size_t /*? strlen ?*/ = strnlen(* /*? ret ?*/, /*? size ?*/ - /*? offset ?*/);
                 /*- set nulllen = '%s + 1' % strlen -*/
@@ -974,6 +1495,9 @@
                 /* If we didn't trigger an error, we now know this strcpy is safe. */
                 (void)strcpy(/*? base ?*/ + /*? offset ?*/, (* /*? ret ?*/));
                 /*? offset ?*/ += /*? nulllen ?*/;
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- else -*/
                 /*- set target = 'sizeof(* %s)' % ret -*/
                 /*? err_if_buffer_length_exceeded(instance, interface, size, offset, target, name, name, error_handler) ?*/
@@ -986,7 +1510,11 @@
     /*- endif -*/
     /*- for p in output_parameters -*/
         /*- set offset = c_symbol('offset') -*/
+        /*- set xfer_offset = c_symbol('xfer_offset') -*/
         static unsigned /*? function ?*/_/*? p.name ?*/(unsigned /*? offset ?*/,
+        /*- if xfer is not none and macros.out_of_line(p) -*/
+            unsigned * /*? xfer_offset ?*/,
+        /*- endif -*/
         /*? show_input_parameter(p) ?*/
         ) {
 
@@ -1011,11 +1539,26 @@
                     }
                 /*- else -*/
                     /*- set target = 'sizeof((* %s)[0]) * (* %s_sz)' % (p.name, p.name) -*/
+                    /*- set location = c_symbol('location') -*/
+                    /*- if xfer is not none -*/
+                        /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, '* %s' % p.name, target, p.name, name, error_handler) ?*/
+                        if (/*? location ?*/ == 0) {
+                    /*- endif -*/
                     /*? err_if_buffer_length_exceeded(instance, interface, size, offset, target, p.name, name, error_handler) ?*/
                     memcpy(/*? base ?*/ + /*? offset ?*/, * /*? p.name ?*/, /*? target ?*/);
                     /*? offset ?*/ += /*? target ?*/;
+                    /*- if xfer is not none -*/
+                        }
+                    /*- endif -*/
                 /*- endif -*/
             /*- elif p.type == 'string' -*/
+                /*- set location = c_symbol('location') -*/
+                /*- if xfer is not none -*/
+                    /*- set xfer_len = c_symbol('xfer_len') -*/
+                    size_t /*? xfer_len ?*/ = strnlen(* /*? p.name ?*/, /*? xfer.size ?*/) + 1;
+                    /*? marshal_location(instance, interface, base, size, offset, xfer, xfer_offset, location, '* %s' % p.name, xfer_len, p.name, name, error_handler) ?*/
+                    if (/*? location ?*/ == 0) {
+                /*- endif -*/
                 /*- set strlen = c_symbol('strlen') -*/
                 size_t /*? strlen ?*/ = strnlen(* /*? p.name ?*/, /*? size ?*/ - /*? offset ?*/);
                 /*- set nulllen = '%s + 1' % strlen -*/
@@ -1023,6 +1566,9 @@
                 /* If we didn't trigger an error, we now know this strcpy is safe. */
                 (void)strcpy(/*? base ?*/ + /*? offset ?*/, * /*? p.name ?*/);
                 /*? offset ?*/ += /*? nulllen ?*/;
+                /*- if xfer is not none -*/
+                    }
+                /*- endif -*/
             /*- else -*/
                 /*- set target = 'sizeof(* %s)' % p.name -*/
                 /*? err_if_buffer_length_exceeded(instance, interface, size, offset, target, p.name, name, error_handler) ?*/
@@ -1055,8 +1601,16 @@
         /*- set length = c_symbol('length') -*/
         unsigned /*? length ?*/ = 0;
 
+        /*- set xfer_offset = c_symbol('xfer_offset') -*/
+        /*- if xfer is not none -*/
+            unsigned /*? xfer_offset ?*/ UNUSED = 0;
+        /*- endif -*/
+
         /*- if return_type is not none -*/
             /*? length ?*/ = /*? function ?*/_/*? ret_fn ?*/(/*? length ?*/,
+            /*- if xfer is not none and return_type == 'string' -*/
+                & /*? xfer_offset ?*/,
+            /*- endif -*/
             /*? ret ?*/
             );
             if (unlikely(/*? length ?*/ == UINT_MAX)) {
@@ -1068,6 +1622,9 @@
         /*- for p in output_parameters -*/
             /*? assert(isinstance(p.type, six.string_types)) ?*/
             /*? length ?*/ = /*? function ?*/_/*? p.name ?*/(/*? length ?*/,
+            /*- if xfer is not none and macros.out_of_line(p) -*/
+                & /*? xfer_offset ?*/,
+            /*- endif -*/
             /*- if p.array -*/
                 /*? p.name ?*/_sz,
             /*- endif -*/
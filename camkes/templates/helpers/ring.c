@@ -0,0 +1,141 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*# Single-producer, single-consumer rings in shared memory, used by the
+ *# seL4RingBuffer and seL4RingBufferQueue connectors.
+ *#
+ *# The producer and consumer each own one index, which they advance
+ *# continuously and reduce modulo the capacity only to find a slot. The ring is
+ *# empty when they are equal and full when they are a capacity apart. Each side
+ *# keeps a private copy of the other's index, which can only understate how far
+ *# the other side has got, so it only needs to read the other side's cache line
+ *# when the ring looks full (or empty).
+ *#
+ *# Both indices live in memory the other side can write. An index more than a
+ *# capacity away from ours can only come from a misbehaving peer, and would
+ *# have us copy past the end of the ring, so the free space and the number of
+ *# available elements are clamped to the capacity.
+ *#
+ *# The producer signals the consumer only when it finds that the ring was empty
+ *# before its batch. The consumer re-checks every ring it reads after a fence
+ *# before it sleeps. The fences pair so that either the producer sees that the
+ *# consumer has drained the ring, and signals, or the consumer sees the new
+ *# elements and does not sleep.
+ #*/
+
+/*# Declares the type `ring_type` of a ring of `capacity` elements of type
+ *# `elem_type`. Each index has a cache line to itself, so that publishing it
+ *# does not evict the line the other side is writing, and the slots begin on a
+ *# fresh line.
+ #*/
+/*- macro make_ring_type(ring_type, elem_type, capacity) -*/
+    typedef struct {
+        /* Written by the producer ("from" end). */
+        uint32_t tail ALIGN(64);
+        /* Written by the consumer ("to" end). */
+        uint32_t head ALIGN(64);
+        /*? elem_type ?*/ slots[/*? capacity ?*/] ALIGN(64);
+    } /*? ring_type ?*/;
+/*- endmacro -*/
+
+/*# Defines the page-aligned ring `symbol`, placed in its own section and
+ *# shared with the other end under `shared_name`.
+ #*/
+/*- macro make_ring(ring_type, symbol, shared_name) -*/
+    union {
+        /*? ring_type ?*/ ring;
+        char content[ROUND_UP_UNSAFE(sizeof(/*? ring_type ?*/), PAGE_SIZE_4K)];
+    } /*? symbol ?*/ ALIGN(PAGE_SIZE_4K)
+            __attribute__((section("shared_/*? symbol ?*/")));
+    /*- do register_shared_variable(shared_name, symbol, 'RW') -*/
+    /*- do keep_symbol(symbol) -*/
+/*- endmacro -*/
+
+/*# Defines `size_t name(const elem_type *elems, size_t count)`, which copies up
+ *# to `count` elements into the ring `ring` (a `ring_type *`) without blocking
+ *# and signals `notification` if the ring was empty.
+ #*/
+/*- macro make_enqueue(name, ring, elem_type, capacity, notification) -*/
+    /*- set head_cache = c_symbol('head_cache') -*/
+    static uint32_t /*? head_cache ?*/;
+
+    size_t /*? name ?*/(const /*? elem_type ?*/ *elems, size_t count) {
+        uint32_t tail = /*? ring ?*/->tail;
+        uint32_t space = /*? capacity ?*/u - (tail - /*? head_cache ?*/);
+        if (space < count) {
+            /*? head_cache ?*/ = __atomic_load_n(&/*? ring ?*/->head, __ATOMIC_ACQUIRE);
+            space = /*? capacity ?*/u - (tail - /*? head_cache ?*/);
+        }
+        size_t n = MIN(count, (size_t)MIN(space, /*? capacity ?*/u));
+        if (n == 0) {
+            return 0;
+        }
+
+        uint32_t start = tail & /*? capacity - 1 ?*/u;
+        size_t first = MIN(n, (size_t)(/*? capacity ?*/u - start));
+        memcpy(&/*? ring ?*/->slots[start], elems, first * sizeof(elems[0]));
+        memcpy(&/*? ring ?*/->slots[0], elems + first, (n - first) * sizeof(elems[0]));
+        __atomic_store_n(&/*? ring ?*/->tail, tail + (uint32_t)n, __ATOMIC_RELEASE);
+
+        /* Only signal if the ring was empty before this batch, as otherwise the
+         * consumer has yet to take the earlier elements and will find these
+         * before it sleeps. If our copy of the consumer's index says the ring
+         * was empty then it was; otherwise re-read the index.
+         */
+        if (tail != /*? head_cache ?*/) {
+            __atomic_thread_fence(__ATOMIC_SEQ_CST);
+            /*? head_cache ?*/ = __atomic_load_n(&/*? ring ?*/->head, __ATOMIC_RELAXED);
+        }
+        if (tail == /*? head_cache ?*/) {
+            seL4_Signal(/*? notification ?*/);
+        }
+        return n;
+    }
+/*- endmacro -*/
+
+/*# Defines consumer functions for rings of type `ring_type`, each of which
+ *# comes with the consumer's copy of the producer's index:
+ *#   size_t name_dequeue(ring_type *ring, uint32_t *tail_cache,
+ *#                       elem_type *elems, size_t count)
+ *#     copies up to `count` elements out of the ring without blocking.
+ *#   bool name_pending(ring_type *ring, uint32_t *tail_cache)
+ *#     re-reads the producer's index and returns whether the ring is non-empty.
+ *#     Callers deciding whether to sleep must first issue a sequentially
+ *#     consistent fence.
+ #*/
+/*- macro make_dequeue(name, ring_type, elem_type, capacity) -*/
+    static size_t UNUSED /*? name ?*/_dequeue(/*? ring_type ?*/ *ring, uint32_t *tail_cache,
+            /*? elem_type ?*/ *elems, size_t count) {
+        uint32_t head = ring->head;
+        uint32_t available = *tail_cache - head;
+        if (available < count) {
+            *tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+            available = *tail_cache - head;
+        }
+        size_t n = MIN(count, (size_t)MIN(available, /*? capacity ?*/u));
+        if (n == 0) {
+            return 0;
+        }
+
+        uint32_t start = head & /*? capacity - 1 ?*/u;
+        size_t first = MIN(n, (size_t)(/*? capacity ?*/u - start));
+        memcpy(elems, &ring->slots[start], first * sizeof(elems[0]));
+        memcpy(elems + first, &ring->slots[0], (n - first) * sizeof(elems[0]));
+        __atomic_store_n(&ring->head, head + (uint32_t)n, __ATOMIC_RELEASE);
+        return n;
+    }
+
+    static bool UNUSED /*? name ?*/_pending(/*? ring_type ?*/ *ring, uint32_t *tail_cache) {
+        *tail_cache = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        return *tail_cache != ring->head;
+    }
+/*- endmacro -*/
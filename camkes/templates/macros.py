@@ -21,6 +21,7 @@ from camkes.internal.seven import cmp, filter, map, zip
 
 from camkes.ast import Composition, Instance, Parameter, Struct
 from camkes.templates import sizeof_probe
+from camkes.templates.exception import TemplateError
 from capdl import ASIDPool, CNode, Endpoint, Frame, IODevice, IOPageTable, \
     Notification, page_sizes, PageDirectory, PageTable, TCB, Untyped, \
     calculate_cnode_size
@@ -157,9 +158,11 @@ def show_includes(xs, prefix=''):
 def format_list_of_strings(string, list, seperator):
     return seperator.join(string % elem for elem in list)
 
-def threads(composition, instance):
+def threads(composition, instance, configuration=None):
     '''
-    Compute the threads for a given instance.
+    Compute the threads for a given instance. If the configuration is given,
+    procedures provided over seL4RPCCall connections have as many threads as
+    their `<interface>_worker_threads` setting asks for.
 
     This function could be written more efficiently as a generator, but it is
     assumed that most callers (in the template context) will need to repeatedly
@@ -179,10 +182,42 @@ def threads(composition, instance):
                     six.moves.range(connection.type.from_threads))
         for end in connection.to_ends:
             if end.instance == instance:
+                count = connection.type.to_threads
+                if configuration is not None:
+                    count *= worker_threads(configuration, end)
                 ts.extend(Thread(end.interface, x) for x in
-                    six.moves.range(connection.type.to_threads))
+                    six.moves.range(count))
     return ts
 
+def worker_threads(configuration, end):
+    '''
+    The number of threads serving a procedure provided over an seL4RPCCall
+    connection, set with the `<interface>_worker_threads` attribute of its
+    instance.
+    '''
+    attribute = '%s_worker_threads' % end.interface.name
+    workers = configuration[end.instance.name].get(attribute)
+    if workers is None:
+        return 1
+    if end.parent.type.name != 'seL4RPCCall':
+        raise TemplateError('%s.%s is only supported for procedures provided '
+            'over seL4RPCCall connections' % (end.instance.name, attribute),
+            configuration.settings_dict[end.instance.name][attribute])
+    if not isinstance(workers, six.integer_types) or workers < 1:
+        raise TemplateError('%s.%s must be a positive integer' %
+            (end.instance.name, attribute),
+            configuration.settings_dict[end.instance.name][attribute])
+    return workers
+
+def worker_pool_threads(composition, configuration, instance):
+    '''
+    The number of threads an instance has beyond one per interface thread
+    because of `<interface>_worker_threads` settings. Templates that size
+    thread-local storage by the instance's interfaces add these.
+    '''
+    return len(threads(composition, instance, configuration)) - \
+        len(threads(composition, instance))
+
 def dataport_size(type):
     assert isinstance(type, six.string_types)
     m = re.match(r'Buf\((\d+)\)$', type)
@@ -196,6 +231,203 @@ def dataport_type(type):
         return 'void'
     return show_type(type)
 
+def rpc_badges(configuration, connection):
+    '''
+    Compute the badges of each 'from' end of an RPC connection. Ends can be
+    given a badge with an `<interface>_attributes` setting. Otherwise they are
+    numbered in order, dodging any badges that have been explicitly assigned.
+    '''
+    explicit = []
+    for e in connection.from_ends:
+        attribute = '%s_attributes' % e.interface.name
+        badge = configuration[e.instance.name].get(attribute)
+        if isinstance(badge, six.string_types) and \
+                re.match(r'\d+$', badge) is not None:
+            badge = int(badge)
+        elif badge is not None and not isinstance(badge, six.integer_types):
+            raise TemplateError('%s.%s must be either an integer or string '
+                'encoding an integer' % (e.instance.name, attribute),
+                configuration.settings_dict[e.instance.name][attribute])
+        explicit.append(badge)
+
+    used = set(b for b in explicit if b is not None)
+    badges = []
+    default = 0
+    for badge in explicit:
+        while default in used:
+            default += 1
+        badges.append(default if badge is None else badge)
+        default += 1
+    return badges
+
+def ring_capacity(configuration, connection):
+    '''
+    The number of elements in each ring of a ring buffer connection, set with
+    its `ring_size` attribute. This must be a power of 2 that the rings'
+    32-bit indices can represent.
+    '''
+    capacity = configuration[connection.name].get('ring_size', 256)
+    if not isinstance(capacity, six.integer_types) or capacity <= 0 or \
+            capacity > 2 ** 31 or capacity & (capacity - 1) != 0:
+        raise TemplateError('%s.ring_size must be a power of 2 no greater '
+            'than 2^31' % connection.name,
+            configuration.settings_dict[connection.name]['ring_size'])
+    return capacity
+
+def ring_element_type(end):
+    '''
+    The type of the elements of a ring buffer, which is the type of the
+    dataports it connects.
+    '''
+    type = dataport_type(end.interface.type)
+    if type == 'void':
+        raise TemplateError('%s.%s is connected with %s, so its type must be '
+            'the type of the ring\'s elements rather than %s' %
+            (end.instance.name, end.interface.name, end.parent.type.name,
+            end.interface.type), end.parent)
+    return type
+
+def callback_slots(configuration, end, default=1):
+    '''
+    The number of callbacks that can be registered at once for an event
+    consumed over an seL4Notification, seL4NotificationQueue or
+    seL4IOAPICHardwareInterrupt connection, set with the
+    `<interface>_callback_slots` attribute of its instance.
+    '''
+    attribute = '%s_callback_slots' % end.interface.name
+    slots = configuration[end.instance.name].get(attribute, default)
+    if not isinstance(slots, six.integer_types) or slots < 1:
+        raise TemplateError('%s.%s must be a positive integer' %
+            (end.instance.name, attribute),
+            configuration.settings_dict[end.instance.name][attribute])
+    return slots
+
+# Each IRQ delivered by an interrupt connection is identified by a bit of the
+# notification's badge, of which seL4 guarantees 28 on every platform.
+MAX_CONNECTION_IRQS = 28
+
+def hardware_irqs(configuration, connection):
+    '''
+    The IRQs delivered by an seL4HardwareInterrupt connection, as keyword
+    arguments for allocating the handler of each. Any of the hardware
+    instance's `<interface>_irq_*` settings may be a list, giving one IRQ per
+    element, in which case every other setting must be either a list of the
+    same length or a single value shared by all of the IRQs.
+    '''
+    instance = connection.from_instance.name
+    interface = connection.from_interface.name
+    settings = configuration[instance]
+
+    def setting(name, description):
+        attr = '%s_irq_%s' % (interface, name)
+        value = settings.get(attr)
+        if value is None:
+            raise TemplateError('Setting %s.%s that should specify %s is not '
+                'defined' % (instance, attr, description), connection)
+        values = value if isinstance(value, (list, tuple)) else [value]
+        if not all(isinstance(v, six.integer_types) for v in values):
+            raise TemplateError('Setting %s.%s that should specify %s is not '
+                'an integer' % (instance, attr, description),
+                configuration.settings_dict[instance][attr])
+        return value
+
+    type_attr = '%s_irq_type' % interface
+    type = settings.get(type_attr, 'simple')
+    if type == 'simple':
+        irq = {'number':setting('number', 'an IRQ number')}
+    elif type in ('ioapic', 'isa', 'pci'):
+        if type == 'isa':
+            irq = {'level':0, 'polarity':0}
+        elif type == 'pci':
+            irq = {'level':1, 'polarity':1}
+        else:
+            irq = {
+                'level':setting('level', 'an IOAPIC interrupt level'),
+                'polarity':setting('polarity', 'an IOAPIC interrupt polarity'),
+            }
+        irq['ioapic'] = setting('ioapic', 'an IOAPIC controller number')
+        irq['ioapic_pin'] = setting('ioapic_pin', 'an IOAPIC pin number')
+        irq['vector'] = setting('vector', 'an IRQ vector')
+    elif type == 'msi':
+        irq = {
+            'handle':setting('handle', 'an MSI handle'),
+            'pci_bus':setting('pci_bus', 'a PCI bus'),
+            'pci_dev':setting('pci_dev', 'a PCI device'),
+            'pci_fun':setting('pci_fun', 'a PCI function'),
+            'vector':setting('vector', 'an IRQ vector'),
+        }
+    else:
+        raise TemplateError('Unknown irq type specified by %s.%s' %
+            (instance, type_attr), connection)
+
+    lengths = set(len(v) for v in irq.values() if isinstance(v, (list, tuple)))
+    if len(lengths) > 1:
+        raise TemplateError('Settings %s.%s_irq_* that are lists must all have '
+            'the same length' % (instance, interface), connection)
+    count = lengths.pop() if lengths else 1
+    if count < 1 or count > MAX_CONNECTION_IRQS:
+        raise TemplateError('Settings %s.%s_irq_* must specify between 1 and '
+            '%d IRQs' % (instance, interface, MAX_CONNECTION_IRQS), connection)
+
+    return [dict((k, v[i] if isinstance(v, (list, tuple)) else v)
+        for k, v in irq.items()) for i in range(count)]
+
+def irq_poll_budget(configuration, end):
+    '''
+    The number of items of work a driver handles per round when its interrupts
+    are polled, set with the `<interface>_poll_budget` attribute of the
+    instance consuming them. None if they are not polled.
+    '''
+    attribute = '%s_poll_budget' % end.interface.name
+    budget = configuration[end.instance.name].get(attribute)
+    if budget is not None and (not isinstance(budget, six.integer_types) or
+            budget < 1):
+        raise TemplateError('%s.%s must be a positive integer' %
+            (end.instance.name, attribute),
+            configuration.settings_dict[end.instance.name][attribute])
+    return budget
+
+def out_of_line(parameter):
+    '''
+    Whether an RPC parameter is potentially large enough that it may be passed
+    in a transfer buffer instead of the message itself: arrays, strings and
+    the referents of refin parameters. Arrays of strings always go in the
+    message.
+    '''
+    assert isinstance(parameter, Parameter)
+    if parameter.array:
+        return parameter.type != 'string'
+    return parameter.type == 'string' or parameter.direction == 'refin'
+
+def uses_transfer_buffer(interface):
+    '''
+    Whether any method of an RPC interface may pass data in a transfer buffer.
+    '''
+    return any(m.return_type == 'string' or
+        any(out_of_line(p) for p in m.parameters) for m in interface.methods)
+
+def fixed_size(parameters, return_type=None, xfer=False):
+    '''
+    Whether the marshalled form of some RPC parameters (and return value) is
+    the same size for every call, and hence known when the glue code is
+    compiled. This is the case when none of them are arrays or strings and,
+    if a transfer buffer is in use, none of them may be passed in it.
+    '''
+    return return_type != 'string' and all(not p.array and
+        p.type != 'string' and not (xfer and out_of_line(p))
+        for p in parameters)
+
+def arena_allocated(parameter):
+    '''
+    Whether an RPC server unmarshals a parameter into its per-thread arena
+    rather than the heap. Only strings and arrays are allocated at all, and
+    those of direction `inout` stay on the heap because the implementation may
+    free and replace them.
+    '''
+    assert isinstance(parameter, Parameter)
+    return parameter.direction in ('in', 'refin') and \
+        (parameter.array or parameter.type == 'string')
+
 # The following macros are for when you require generation-time constant
 # folding. These are not robust and for cases when a generation-time constant
 # is not required, you should simply emit the C equivalent and let the C
@@ -218,6 +450,10 @@ _sizes = {
     'int64_t':8,
     'uint64_t':8,
 }
+
+# Sizes we have asked the C compiler for, keyed by (compiler, flags, type).
+_probed = {}
+
 def sizeof(arch, t):
     assert isinstance(t, (Parameter,) + six.string_types)
 
@@ -238,11 +474,24 @@ def sizeof(arch, t):
         elif arch == 'x86_64' and platform.machine() == 'i386':
             extra_flags.append('-m64')
 
-        # Determine the size by invoking the c compiler
-        size = sizeof_probe.probe_sizeof(t, compiler, extra_flags)
-
-        # Cache the result for next time.
-        _sizes[t] = size
+        key = (compiler, tuple(extra_flags))
+        size = _probed.get(key + (t,))
+        if size is None:
+            # Determine the size of this and every other type we may be asked
+            # about by invoking the c compiler once.
+            batch = set(x for x in sizeof_probe.candidates if x not in _sizes and
+                key + (x,) not in _probed)
+            batch.add(t)
+            for x, s in sizeof_probe.probe_sizeofs(batch, compiler,
+                    extra_flags).items():
+                _probed[key + (x,)] = s
+            size = _probed.get(key + (t,))
+
+        if size is None:
+            # The batch could not determine the size of this type. Fall back
+            # to probing it in isolation.
+            size = sizeof_probe.probe_sizeof(t, compiler, extra_flags)
+            _probed[key + (t,)] = size
 
     assert size is not None
     return size
@@ -32,6 +32,7 @@
 #include <sync/sem-bare.h>
 #include <camkes/dataport.h>
 #include <camkes/error.h>
+#include <camkes/timing.h>
 #include <camkes/tls.h>
 
 /*? macros.show_includes(me.instance.type.includes) ?*/
@@ -40,52 +41,12 @@
 /*- set ep_obj = alloc_obj('ep', seL4_EndpointObject) -*/
 /*- set ep = alloc_cap('ep_%s' % me.interface.name, ep_obj, write=True, grant=True) -*/
 
-/*# Find any badges that have been explicitly assigned for this connection. That
- *# is, any badge identifiers that are not valid for us to assign automatically
- *# to other ends.
+/*# Determine the badge for this end. This dodges any badges that have been
+ *# explicitly assigned to other ends.
  #*/
-/*- set used_badges = set() -*/
-/*- for e in me.parent.from_ends -*/
-  /*- set badge_attribute = '%s_attributes' % e.interface.name -*/
-  /*- set badge = configuration[e.instance.name].get(badge_attribute) -*/
-  /*- if isinstance(badge, six.integer_types) -*/
-    /*- do used_badges.add(badge) -*/
-  /*- elif isinstance(badge, six.string_types) and re.match('\\d+$', badge) is not none -*/
-    /*- do used_badges.add(int(badge)) -*/
-  /*- elif badge is not none -*/
-    /*? raise(TemplateError('%s.%s must be either an integer or string encoding an integer' % (e.instance.name, badge_attribute), configuration.settings_dict[e.instance.name][badge_attribute])) ?*/
-  /*- endif -*/
-/*- endfor -*/
-
-/*# Work out what badge each 'from' end of this connection would be given if no
- *# badges were specified with attributes. Note that we need to dodge any
- *# explicitly assigned badges.
- #*/
-/*- set default_allocated_badges = [] -*/
-/*- set next = [0] -*/
-/*- for _ in me.parent.from_ends -*/
-  /*- for _ in used_badges -*/
-    /*- if next[0] in used_badges -*/
-      /*- do next.__setitem__(0, next[0] + 1) -*/
-    /*- endif -*/
-  /*- endfor -*/
-  /*? assert(next[0] not in used_badges) ?*/
-  /*- do default_allocated_badges.append(next[0]) -*/
-  /*- do next.__setitem__(0, next[0] + 1) -*/
-/*- endfor -*/
-
-/*# Now we're ready to determine the actual badge for this end. #*/
-/*- set badge_attribute = '%s_attributes' % me.interface.name -*/
-/*- set badge = configuration[me.instance.name].get(badge_attribute) -*/
-/*- if isinstance(badge, six.integer_types) -*/
-  /*- do cap_space.cnode[ep].set_badge(badge) -*/
-/*- elif isinstance(badge, six.string_types) and re.match('\\d+$', badge) is not none -*/
-  /*- do cap_space.cnode[ep].set_badge(int(badge)) -*/
-/*- elif badge is none -*/
-  /*- do cap_space.cnode[ep].set_badge(default_allocated_badges[me.parent.from_ends.index(me)]) -*/
-/*- else -*/
-  /*? raise(TemplateError('%s.%s must be either an integer or string encoding an integer' % (me.instance.name, badge_attribute), configuration.settings_dict[me.instance.name][badge_attribute])) ?*/
-/*- endif -*/
+/*- set badges = macros.rpc_badges(configuration, me.parent) -*/
+/*- set client = me.parent.from_ends.index(me) -*/
+/*- do cap_space.cnode[ep].set_badge(badges[client]) -*/
 
 /*- set BUFFER_BASE = c_symbol('BUFFER_BASE') -*/
 #define /*? BUFFER_BASE ?*/ /*? base ?*/
@@ -93,20 +54,39 @@
 /*- set methods_len = len(me.interface.type.methods) -*/
 /*- set instance = me.instance.name -*/
 /*- set interface = me.interface.name -*/
-/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes))) -*/
+/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes) + macros.worker_pool_threads(composition, configuration, me.instance))) -*/
 
 /* Interface-specific error handling */
 /*- set error_handler = '%s_error_handler' % me.interface.name -*/
 /*? error.make_error_handler(interface, error_handler) ?*/
 
 /*# Conservative calculation of the numbers of threads in this component. #*/
-/*- set thread_count = (1 if me.instance.type.control else 0) + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes) -*/
+/*- set thread_count = (1 if me.instance.type.control else 0) + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes) + macros.worker_pool_threads(composition, configuration, me.instance) -*/
+
+/*# If the connection asks for one, large parameters are passed in a transfer
+ *# buffer shared with the server, rather than copied through the IPC buffer,
+ *# unless the whole message is already in a userspace buffer. Each client has
+ *# its own.
+ #*/
+/*- set xfer = none -*/
+/*- set xfer_size = configuration[me.parent.name].get('transfer_buffer_size', 0) -*/
+/*- if not isinstance(xfer_size, six.integer_types) or xfer_size < 0 -*/
+  /*? raise(TemplateError('%s.transfer_buffer_size must be a non-negative integer' % me.parent.name, configuration.settings_dict[me.parent.name]['transfer_buffer_size'])) ?*/
+/*- endif -*/
+/*- if not userspace_ipc and xfer_size > 0 and macros.uses_transfer_buffer(me.interface.type) -*/
+  /*- set xfer_symbol = 'from_%d_%s_xfer' % (client, me.interface.name) -*/
+  char /*? xfer_symbol ?*/[ROUND_UP_UNSAFE(/*? xfer_size ?*/, PAGE_SIZE_4K)] ALIGN(PAGE_SIZE_4K);
+  /*- do register_shared_variable('%s_xfer_%d' % (me.parent.name, client), xfer_symbol, 'RW') -*/
+  /*- do keep_symbol(xfer_symbol) -*/
+  /*- set xfer = {'base':xfer_symbol, 'size':'sizeof(%s)' % xfer_symbol} -*/
+/*- endif -*/
 
 /*- set userspace_buffer_sem_value = c_symbol() -*/
-/*- if thread_count > 1 and userspace_ipc -*/
+/*- if thread_count > 1 and (userspace_ipc or xfer is not none) -*/
   /*# If we have more than one thread and we're using a userspace memory window
-   *# in lieu of the IPC buffer, multiple threads can end up racing on accesses
-   *# to this window. To prevent this, we use a lock built on an endpoint.
+   *# in lieu of (or alongside) the IPC buffer, multiple threads can end up
+   *# racing on accesses to this window. To prevent this, we use a lock built on
+   *# an endpoint.
    #*/
   /*- set userspace_buffer_ep = alloc('userspace_buffer_ep', seL4_EndpointObject, write=True, read=True) -*/
   static volatile int /*? userspace_buffer_sem_value ?*/ = 1;
@@ -114,6 +94,26 @@
   /*- set userspace_buffer_ep = None -*/
 /*- endif -*/
 
+/* Timing points, in the order they are passed. */
+enum {
+    TIMING_GLUE_CODE_ENTRY,
+    TIMING_LOCK_ACQUIRED,
+    TIMING_MARSHALLING_DONE,
+    TIMING_COMMUNICATION_DONE,
+    TIMING_UNMARSHALLING_DONE,
+    TIMING_LOCK_RELEASED,
+};
+#define TIMING_POINT_NAMES "glue code entry", "lock acquired", "marshalling done", "communication done", "unmarshalling done", "lock released"
+/*- set timing_threads = len(macros.threads(composition, me.instance, configuration)) + 1 -*/
+TIMING_DEFS(/*? me.interface.name ?*/, /*? timing_threads ?*/, TIMING_POINT_NAMES)
+/*- if methods_len > 0 -*/
+TIMING_HISTOGRAM_DEFS(/*? me.interface.name ?*/, "/*? me.interface.name[:31] ?*/", /*? timing_threads ?*/, TIMING_POINT_NAMES
+    /*- for m in me.interface.type.methods -*/
+        , "/*? m.name[:31] ?*/"
+    /*- endfor -*/
+    )
+/*- endif -*/
+
 /*? array_check.make_array_typedef_check_symbols(me.interface.type) ?*/
 
 int /*? me.interface.name ?*/__run(void) {
@@ -127,13 +127,34 @@ int /*? me.interface.name ?*/__run(void) {
     return 0;
 }
 
+/*# Find the method (if any) that has been marked to be instrumented with
+ *# timing points.
+ #*/
+/*- set timing_method = configuration[me.instance.name].get('%s_timing' % me.interface.name) -*/
+
 /*- for i, m in enumerate(me.interface.type.methods) -*/
 
+/*# As in seL4RPC-from.template.c, only the method being timed records into
+ *# the timing ring buffers, while every method feeds the latency histograms.
+ #*/
+/*- if timing_method == m.name -*/
+    #define _TIMESTAMP(x) do { TIMESTAMP(x); TIMING_HISTOGRAM_POINT(/*? i ?*/, x); } while (0)
+/*- else -*/
+    #define _TIMESTAMP(x) TIMING_HISTOGRAM_POINT(/*? i ?*/, x)
+/*- endif -*/
+
 /*- set input_parameters = list(filter(lambda('x: x.direction in [\'refin\', \'in\', \'inout\']'), m.parameters)) -*/
-/*? marshal.make_marshal_input_symbols(instance, interface, m.name, '%s_marshal_inputs' % m.name, base, buffer_size, i, methods_len, input_parameters, error_handler, threads) ?*/
+/*? marshal.make_marshal_input_symbols(instance, interface, m.name, '%s_marshal_inputs' % m.name, base, buffer_size, i, methods_len, input_parameters, error_handler, threads, xfer) ?*/
 
 /*- set output_parameters = list(filter(lambda('x: x.direction in [\'out\', \'inout\']'), m.parameters)) -*/
-/*? marshal.make_unmarshal_output_symbols(instance, interface, m.name, '%s_unmarshal_outputs' % m.name, base, i, output_parameters, m.return_type, error_handler, userspace_ipc) ?*/
+/*? marshal.make_unmarshal_output_symbols(instance, interface, m.name, '%s_unmarshal_outputs' % m.name, base, i, output_parameters, m.return_type, error_handler, userspace_ipc, xfer) ?*/
+
+/*# Only calls that may use the window need to hold the lock. #*/
+/*- if userspace_ipc or (xfer is not none and (m.return_type == 'string' or len(list(filter(macros.out_of_line, m.parameters))) > 0)) -*/
+  /*- set buffer_ep = userspace_buffer_ep -*/
+/*- else -*/
+  /*- set buffer_ep = none -*/
+/*- endif -*/
 
 /*- set ret_tls_var = c_symbol('ret_tls_var_from') -*/
 /*- if m.return_type is not none -*/
@@ -193,15 +214,18 @@ int /*? me.interface.name ?*/__run(void) {
 #endif
     /*- endif -*/
 
+    _TIMESTAMP(TIMING_GLUE_CODE_ENTRY);
+
     /*# We're about to start writing to the buffer. If relevant, protect our
      *# access.
      #*/
-    /*- if userspace_buffer_ep is not none -*/
+    /*- if buffer_ep is not none -*/
         /*- if not options.realtime -*/
             camkes_protect_reply_cap();
         /*- endif -*/
-      sync_sem_bare_wait(/*? userspace_buffer_ep ?*/,
+      sync_sem_bare_wait(/*? buffer_ep ?*/,
         &/*? userspace_buffer_sem_value ?*/);
+      _TIMESTAMP(TIMING_LOCK_ACQUIRED);
     /*- endif -*/
 
     /*- set ret_val = c_symbol('return') -*/
@@ -211,8 +235,8 @@ int /*? me.interface.name ?*/__run(void) {
       /*? macros.show_type(m.return_type) ?*/ * /*? ret_ptr ?*/ = TLS_PTR(/*? ret_tls_var ?*/, /*? ret_val ?*/);
     /*- endif -*/
 
-    /*- if userspace_buffer_ep is none -*/
-      /*# If `userspace_buffer_ep` is not `None` we've already protected the
+    /*- if buffer_ep is none -*/
+      /*# If `buffer_ep` is not `None` we've already protected the
        *# reply cap.
        #*/
       /* Save any pending reply cap as we'll eventually call seL4_Call which
@@ -225,11 +249,63 @@ int /*? me.interface.name ?*/__run(void) {
         /*- endif -*/
     /*- endif -*/
 
+    /*- if not userspace_ipc and macros.fixed_size(input_parameters, xfer=xfer is not none) and macros.fixed_size(output_parameters, m.return_type) -*/
+#if seL4_FastMessageRegisters == 4
+    /*- set mrs = c_symbol('mrs') -*/
+    if (/*? m.name ?*/_marshal_inputs_size <= 4 * sizeof(seL4_Word) &&
+            /*? m.name ?*/_unmarshal_outputs_size <= 4 * sizeof(seL4_Word)) {
+        /* The call and its reply fit in the message registers the kernel
+         * transfers in physical registers, so pass them directly and leave
+         * the IPC buffer alone.
+         */
+        seL4_Word /*? mrs ?*/[4] = { 0 };
+        /*- set mrs_length = c_symbol('length') -*/
+        unsigned /*? mrs_length ?*/ = /*? m.name ?*/_marshal_inputs_at(/*? mrs ?*/, sizeof(/*? mrs ?*/)
+        /*- for p in input_parameters -*/
+            , /*? p.name ?*/
+        /*- endfor -*/
+        );
+        _TIMESTAMP(TIMING_MARSHALLING_DONE);
+        /*- set mrs_info = c_symbol('info') -*/
+        seL4_MessageInfo_t /*? mrs_info ?*/ = seL4_CallWithMRs(/*? ep ?*/,
+            seL4_MessageInfo_new(0, 0, 0, ROUND_UP_UNSAFE(/*? mrs_length ?*/, sizeof(seL4_Word)) / sizeof(seL4_Word)),
+            &/*? mrs ?*/[0], &/*? mrs ?*/[1], &/*? mrs ?*/[2], &/*? mrs ?*/[3]);
+        _TIMESTAMP(TIMING_COMMUNICATION_DONE);
+        /*- set mrs_err = c_symbol('error') -*/
+        int /*? mrs_err ?*/ = /*? m.name ?*/_unmarshal_outputs_at(/*? mrs ?*/,
+            seL4_MessageInfo_get_length(/*? mrs_info ?*/) * sizeof(seL4_Word)
+        /*- if m.return_type is not none -*/
+            , /*? ret_ptr ?*/
+        /*- endif -*/
+        /*- for p in output_parameters -*/
+            , /*? p.name ?*/
+        /*- endfor -*/
+        );
+        if (likely(/*? mrs_err ?*/ == 0)) {
+            _TIMESTAMP(TIMING_UNMARSHALLING_DONE);
+        }
+        /*- if m.return_type is not none -*/
+            if (unlikely(/*? mrs_err ?*/ != 0)) {
+                /* Error in unmarshalling; bail out. */
+                memset(/*? ret_ptr ?*/, 0, sizeof(* /*? ret_ptr ?*/));
+            }
+            return * /*? ret_ptr ?*/;
+        /*- else -*/
+            return;
+        /*- endif -*/
+    }
+#endif
+    /*- endif -*/
+
     /* Marshal all the parameters */
     /*- set length = c_symbol('length') -*/
     unsigned /*? length ?*/ = /*? marshal.call_marshal_input('%s_marshal_inputs' % m.name, input_parameters) ?*/;
     if (unlikely(/*? length ?*/ == UINT_MAX)) {
         /* Error in marshalling; bail out. */
+        /*- if buffer_ep is not none -*/
+          sync_sem_bare_post(/*? buffer_ep ?*/,
+            &/*? userspace_buffer_sem_value ?*/);
+        /*- endif -*/
         /*- if m.return_type is not none -*/
             /*- if m.return_type == 'string' -*/
                 return NULL;
@@ -242,6 +318,8 @@ int /*? me.interface.name ?*/__run(void) {
         /*- endif -*/
     }
 
+    _TIMESTAMP(TIMING_MARSHALLING_DONE);
+
     /* Call the endpoint */
     /*- set info = c_symbol('info') -*/
     seL4_MessageInfo_t /*? info ?*/ = seL4_MessageInfo_new(0, 0, 0,
@@ -253,6 +331,8 @@ int /*? me.interface.name ?*/__run(void) {
         );
     /*? info ?*/ = seL4_Call(/*? ep ?*/, /*? info ?*/);
 
+    _TIMESTAMP(TIMING_COMMUNICATION_DONE);
+
     /*- set size = c_symbol('size') -*/
     unsigned /*? size ?*/ =
     /*- if userspace_ipc -*/
@@ -267,6 +347,10 @@ int /*? me.interface.name ?*/__run(void) {
     int /*? err ?*/ = /*? marshal.call_unmarshal_output('%s_unmarshal_outputs' % m.name, size, output_parameters, m.return_type, ret_ptr) ?*/;
     if (unlikely(/*? err ?*/ != 0)) {
         /* Error in unmarshalling; bail out. */
+        /*- if buffer_ep is not none -*/
+          sync_sem_bare_post(/*? buffer_ep ?*/,
+            &/*? userspace_buffer_sem_value ?*/);
+        /*- endif -*/
         /*- if m.return_type is not none -*/
             /*- if m.return_type == 'string' -*/
                 return NULL;
@@ -279,13 +363,17 @@ int /*? me.interface.name ?*/__run(void) {
         /*- endif -*/
     }
 
-    /*- if userspace_buffer_ep is not none -*/
-      sync_sem_bare_post(/*? userspace_buffer_ep ?*/,
+    _TIMESTAMP(TIMING_UNMARSHALLING_DONE);
+
+    /*- if buffer_ep is not none -*/
+      sync_sem_bare_post(/*? buffer_ep ?*/,
         &/*? userspace_buffer_sem_value ?*/);
+      _TIMESTAMP(TIMING_LOCK_RELEASED);
     /*- endif -*/
 
     /*- if m.return_type is not none -*/
         return * /*? ret_ptr ?*/;
     /*- endif -*/
 }
+#undef _TIMESTAMP
 /*- endfor -*/
@@ -29,7 +29,9 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <string.h>
+#include <camkes/arena.h>
 #include <camkes/error.h>
+#include <camkes/timing.h>
 #include <camkes/tls.h>
 #include <sel4/sel4.h>
 #include <camkes/dataport.h>
@@ -44,12 +46,114 @@
 /*- set methods_len = len(me.interface.type.methods) -*/
 /*- set instance = me.instance.name -*/
 /*- set interface = me.interface.name -*/
-/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes))) -*/
+/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes) + macros.worker_pool_threads(composition, configuration, me.instance))) -*/
 
 /* Interface-specific error handling */
 /*- set error_handler = '%s_error_handler' % me.interface.name -*/
 /*? error.make_error_handler(interface, error_handler) ?*/
 
+/*# The procedure may be served by a pool of worker threads, all waiting on the
+ *# connection's endpoint. Each claims an index when it starts and has its own
+ *# reply cap slot, sender badge, transfer buffer and arena.
+ #*/
+/*- set workers = macros.worker_threads(configuration, me) -*/
+/*- if workers > 1 -*/
+  #define WORKER_THREADS /*? workers ?*/
+  /*- set next_worker = c_symbol('next_worker') -*/
+  static unsigned /*? next_worker ?*/;
+/*- endif -*/
+
+/*# Transfer buffers for large parameters, one shared with each client. See
+ *# rpc-connector-common-from.c.
+ #*/
+/*- set xfer = none -*/
+/*- set xfer_size = configuration[me.parent.name].get('transfer_buffer_size', 0) -*/
+/*- if not isinstance(xfer_size, six.integer_types) or xfer_size < 0 -*/
+  /*? raise(TemplateError('%s.transfer_buffer_size must be a non-negative integer' % me.parent.name, configuration.settings_dict[me.parent.name]['transfer_buffer_size'])) ?*/
+/*- endif -*/
+/*- if not userspace_ipc and xfer_size > 0 and macros.uses_transfer_buffer(me.interface.type) -*/
+  /*- set badges = macros.rpc_badges(configuration, me.parent) -*/
+  /*- if len(set(badges)) != len(badges) -*/
+    /*? raise(TemplateError('clients of %s share badges, so cannot be given separate transfer buffers; leave %s.transfer_buffer_size unset' % (me.parent.name, me.parent.name), me.parent)) ?*/
+  /*- endif -*/
+  /*- for client in six.moves.range(len(badges)) -*/
+    /*- set xfer_symbol = 'to_%s_xfer_%d' % (me.interface.name, client) -*/
+    char /*? xfer_symbol ?*/[ROUND_UP_UNSAFE(/*? xfer_size ?*/, PAGE_SIZE_4K)] ALIGN(PAGE_SIZE_4K);
+    /*- do register_shared_variable('%s_xfer_%d' % (me.parent.name, client), xfer_symbol, 'RW') -*/
+    /*- do keep_symbol(xfer_symbol) -*/
+  /*- endfor -*/
+
+  /* The transfer buffer of the client whose call we are handling. */
+  /*- set xfer_current = c_symbol('xfer_current') -*/
+  /*- if workers > 1 -*/
+    /*? make_tls_symbols('void*', xfer_current, threads, False) ?*/
+    /*- set xfer_current = '(*get_%s())' % xfer_current -*/
+  /*- else -*/
+    static void * /*? xfer_current ?*/;
+  /*- endif -*/
+
+  /*- set xfer_lookup = c_symbol('xfer_lookup') -*/
+  static void * /*? xfer_lookup ?*/(seL4_Word badge) {
+      switch (badge) {
+      /*- for client, badge in enumerate(badges) -*/
+          case /*? badge ?*/:
+              return to_/*? me.interface.name ?*/_xfer_/*? client ?*/;
+      /*- endfor -*/
+          default:
+              return NULL;
+      }
+  }
+
+  /*- set xfer = {'base':xfer_current, 'size':'ROUND_UP_UNSAFE(%d, PAGE_SIZE_4K)' % xfer_size} -*/
+/*- endif -*/
+
+/*# String and array parameters are unmarshalled into an arena in the TLS of
+ *# the thread serving the call, which is reset once the call is complete.
+ *# Its buffer is sized by CAmkESRPCArenaSize.
+ #*/
+/*- set arena = none -*/
+/*- set arena_buffer = c_symbol('arena_buffer') -*/
+/*- set arena_ptr = c_symbol('arena_ptr') -*/
+/*- set arena_params = [] -*/
+/*- for m in me.interface.type.methods -*/
+  /*- do arena_params.extend(filter(macros.arena_allocated, m.parameters)) -*/
+/*- endfor -*/
+/*- if len(arena_params) > 0 -*/
+  #if CONFIG_CAMKES_RPC_ARENA_SIZE > 0
+    static char /*? arena_buffer ?*/[/*? workers ?*/][CONFIG_CAMKES_RPC_ARENA_SIZE];
+  #endif
+  static camkes_arena_t * /*? arena_ptr ?*/[/*? workers ?*/];
+  /*- set arena = '(&camkes_get_tls()->rpc_arena)' -*/
+/*- endif -*/
+
+const struct camkes_arena * /*? me.interface.name ?*/_rpc_arena(void) {
+    /*- if arena is none -*/
+        return NULL;
+    /*- elif workers == 1 -*/
+        return /*? arena_ptr ?*/[0];
+    /*- else -*/
+        /* Summarise the workers' arenas: the highest of their high-water marks
+         * and the total number of fallbacks. The workers' `used` and
+         * `fallback_bytes` belong to whichever calls they are serving, so are
+         * left at 0. The summary is overwritten by the next call.
+         */
+        /*- set summary = c_symbol('arena_summary') -*/
+        static camkes_arena_t /*? summary ?*/;
+        /*? summary ?*/ = (camkes_arena_t){ 0 };
+        for (unsigned i = 0; i < /*? workers ?*/; i++) {
+            const camkes_arena_t *a = /*? arena_ptr ?*/[i];
+            if (a == NULL) {
+                /* This worker has not started yet. */
+                continue;
+            }
+            /*? summary ?*/.size = a->size;
+            /*? summary ?*/.high_water = MAX(/*? summary ?*/.high_water, a->high_water);
+            /*? summary ?*/.fallbacks += a->fallbacks;
+        }
+        return &/*? summary ?*/;
+    /*- endif -*/
+}
+
 /*- for m in me.interface.type.methods -*/
     extern
     /*- if m.return_type is not none -*/
@@ -65,10 +169,10 @@
     );
 
 /*- set input_parameters = list(filter(lambda('x: x.direction in [\'refin\', \'in\', \'inout\']'), m.parameters)) -*/
-/*? marshal.make_unmarshal_input_symbols(instance, interface, m.name, '%s_unmarshal_inputs' % m.name, base, methods_len, input_parameters, error_handler, userspace_ipc) ?*/
+/*? marshal.make_unmarshal_input_symbols(instance, interface, m.name, '%s_unmarshal_inputs' % m.name, base, methods_len, input_parameters, error_handler, userspace_ipc, xfer, arena) ?*/
 
 /*- set output_parameters = list(filter(lambda('x: x.direction in [\'out\', \'inout\']'), m.parameters)) -*/
-/*? marshal.make_marshal_output_symbols(instance, interface, m.name, '%s_marshal_outputs' % m.name, base, buffer_size, output_parameters, m.return_type, error_handler) ?*/
+/*? marshal.make_marshal_output_symbols(instance, interface, m.name, '%s_marshal_outputs' % m.name, base, buffer_size, output_parameters, m.return_type, error_handler, xfer) ?*/
 
 /*- if m.return_type is not none -*/
   /*? make_tls_symbols(macros.show_type(m.return_type), '%s_ret_to' % m.name, threads, False) ?*/
@@ -87,11 +191,50 @@
 /*- set ep_obj = alloc_obj('ep', seL4_EndpointObject) -*/
 /*- set ep = alloc_cap('ep', ep_obj, read=True, write=True) -*/
 
-static seL4_Word /*? me.interface.name ?*/_badge = 0;
+/*- if workers > 1 -*/
+  /*- set badge_tls = c_symbol('badge') -*/
+  /*? make_tls_symbols('seL4_Word', badge_tls, threads, False) ?*/
+  /*- set badge_ptr = c_symbol('badge_ptr') -*/
+  /*- set badge_ref = badge_ptr -*/
+  /*- set badge_value = '*%s' % badge_ptr -*/
 
-seL4_Word /*? me.interface.name ?*/_get_sender_id(void) {
-    return /*? me.interface.name ?*/_badge;
-}
+  seL4_Word /*? me.interface.name ?*/_get_sender_id(void) {
+      return *get_/*? badge_tls ?*/();
+  }
+/*- else -*/
+  static seL4_Word /*? me.interface.name ?*/_badge = 0;
+  /*- set badge_ref = '&%s_badge' % me.interface.name -*/
+  /*- set badge_value = '%s_badge' % me.interface.name -*/
+
+  seL4_Word /*? me.interface.name ?*/_get_sender_id(void) {
+      return /*? me.interface.name ?*/_badge;
+  }
+/*- endif -*/
+
+/* Timing points, in the order they are passed. The first is passed once a
+ * call has been received and its method determined.
+ */
+enum {
+    TIMING_CALL_RECEIVED,
+    TIMING_UNMARSHALLING_DONE,
+    TIMING_IMPLEMENTATION_DONE,
+    TIMING_MARSHALLING_DONE,
+};
+#define TIMING_POINT_NAMES "call received", "unmarshalling done", "implementation done", "marshalling done"
+/*- set timing_threads = len(macros.threads(composition, me.instance, configuration)) + 1 -*/
+TIMING_DEFS(/*? me.interface.name ?*/, /*? timing_threads ?*/, TIMING_POINT_NAMES)
+/*- if methods_len > 0 -*/
+TIMING_HISTOGRAM_DEFS(/*? me.interface.name ?*/, "/*? me.interface.name[:31] ?*/", /*? timing_threads ?*/, TIMING_POINT_NAMES
+    /*- for m in me.interface.type.methods -*/
+        , "/*? m.name[:31] ?*/"
+    /*- endfor -*/
+    )
+/*- endif -*/
+
+/*# Find the method (if any) that has been marked to be instrumented with
+ *# timing points.
+ #*/
+/*- set timing_method = configuration[me.instance.name].get('%s_timing' % me.interface.name) -*/
 
 /*- set call_tls_var = c_symbol('call_tls_var_to') -*/
 /*- set type = macros.type_to_fit_integer(methods_len) -*/
@@ -117,18 +260,56 @@ int
     /*# Check any typedefs we have been given are not arrays. #*/
     /*? array_check.perform_array_typedef_check(me.interface.type) ?*/
 
+    /*- if workers > 1 -*/
+        /*- set worker = c_symbol('worker') -*/
+        unsigned /*? worker ?*/ = __atomic_fetch_add(&/*? next_worker ?*/, 1, __ATOMIC_RELAXED);
+        assert(/*? worker ?*/ < WORKER_THREADS);
+        seL4_Word * /*? badge_ptr ?*/ = get_/*? badge_tls ?*/();
+    /*- else -*/
+        /*- set worker = '0' -*/
+    /*- endif -*/
+
+    /*- set reply_cap_slots = [] -*/
     /*- if options.realtime -*/
-            /*- set reply_cap_slot = alloc('reply_cap_slot', seL4_RTReplyObject) -*/
+        /*- for i in six.moves.range(workers) -*/
+            /*- do reply_cap_slots.append(alloc('reply_cap_slot' if i == 0 else 'reply_cap_slot_%d' % i, seL4_RTReplyObject)) -*/
+        /*- endfor -*/
     /*- else -*/
         /*- if me.might_block() -*/
             /* We're going to need a CNode cap in order to save our pending reply
              * caps in the future.
              */
             /*- set cnode = alloc_cap('cnode', my_cnode, write=True) -*/
-            /*- set reply_cap_slot = alloc_cap('reply_cap_slot', None) -*/
+            /*- for i in six.moves.range(workers) -*/
+                /*- do reply_cap_slots.append(alloc_cap('reply_cap_slot' if i == 0 else 'reply_cap_slot_%d' % i, None)) -*/
+            /*- endfor -*/
             camkes_get_tls()->cnode_cap = /*? cnode ?*/;
         /*- endif -*/
     /*- endif -*/
+    /*- if workers == 1 and len(reply_cap_slots) > 0 -*/
+        /*- set reply_cap_slot = reply_cap_slots[0] -*/
+    /*- elif len(reply_cap_slots) > 0 -*/
+        /* Each worker has a reply cap slot of its own. */
+        /*- set worker_reply_cap_slots = c_symbol('reply_cap_slots') -*/
+        static const seL4_CPtr /*? worker_reply_cap_slots ?*/[] = {
+            /*- for slot in reply_cap_slots -*/
+                /*? slot ?*/,
+            /*- endfor -*/
+        };
+        /*- set reply_cap_slot = c_symbol('reply_cap_slot') -*/
+        seL4_CPtr /*? reply_cap_slot ?*/ = /*? worker_reply_cap_slots ?*/[/*? worker ?*/];
+    /*- endif -*/
+
+    /*- set thread_arena = c_symbol('arena') -*/
+    /*- if arena is not none -*/
+        camkes_arena_t * /*? thread_arena ?*/ = /*? arena ?*/;
+        #if CONFIG_CAMKES_RPC_ARENA_SIZE > 0
+            camkes_arena_init(/*? thread_arena ?*/, /*? arena_buffer ?*/[/*? worker ?*/], sizeof(/*? arena_buffer ?*/[/*? worker ?*/]));
+        #else
+            camkes_arena_init(/*? thread_arena ?*/, NULL, 0);
+        #endif
+        /*? arena_ptr ?*/[/*? worker ?*/] = /*? thread_arena ?*/;
+    /*- endif -*/
 
     /*- set info = c_symbol('info') -*/
     /*- if passive -*/
@@ -136,12 +317,12 @@ int
         seL4_MessageInfo_t /*? info ?*/ = /*? generate_seL4_SignalRecv(options,
                                                                        init_ntfn,
                                                                        info, ep,
-                                                                       '&%s_badge' % me.interface.name,
+                                                                       badge_ref,
                                                                        reply_cap_slot) ?*/;
     /*- else -*/
        /* This interface has an active thread, just wait for an RPC */
         seL4_MessageInfo_t /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                                 '&%s_badge' % me.interface.name,
+                                                                 badge_ref,
                                                                  reply_cap_slot) ?*/;
     /*- endif -*/
 
@@ -150,6 +331,10 @@ int
         /*- set buffer = c_symbol('buffer') -*/
         void * /*? buffer ?*/ UNUSED = (void*)/*? BUFFER_BASE ?*/;
 
+        /*- if xfer is not none -*/
+            /*? xfer_current ?*/ = /*? xfer_lookup ?*/(/*? badge_value ?*/);
+        /*- endif -*/
+
         /*- set size = c_symbol('size') -*/
         unsigned /*? size ?*/ UNUSED =
         /*- if userspace_ipc -*/
@@ -180,7 +365,7 @@ int
                     .current_index = sizeof(* /*? call_ptr ?*/),
                 }), ({
                     /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                          '&%s_badge' % me.interface.name,
+                                                          badge_ref,
                                                           reply_cap_slot) ?*/;
                     continue;
                 }));
@@ -190,7 +375,15 @@ int
 
         switch (* /*? call_ptr ?*/) {
             /*- for i, m in enumerate(me.interface.type.methods) -*/
+                /*# See rpc-connector-common-from.c. #*/
+                /*- if timing_method == m.name -*/
+                    #define _TIMESTAMP(x) do { TIMESTAMP(x); TIMING_HISTOGRAM_POINT(/*? i ?*/, x); } while (0)
+                /*- else -*/
+                    #define _TIMESTAMP(x) TIMING_HISTOGRAM_POINT(/*? i ?*/, x)
+                /*- endif -*/
                 case /*? i ?*/: { /*? '%s%s%s%s%s' % ('/', '* ', m.name, ' *', '/') ?*/
+                    _TIMESTAMP(TIMING_CALL_RECEIVED);
+
                     /*# Declare parameters. #*/
                     /*- for p in m.parameters -*/
 
@@ -218,19 +411,24 @@ int
                     /*- set err = c_symbol('error') -*/
                     int /*? err ?*/ = /*? marshal.call_unmarshal_input('%s_unmarshal_inputs' % m.name, size, input_parameters) ?*/;
                     if (unlikely(/*? err ?*/ != 0)) {
+                        /*- if arena is not none and len(list(filter(macros.arena_allocated, input_parameters))) > 0 -*/
+                            camkes_arena_reset(/*? thread_arena ?*/);
+                        /*- endif -*/
                         /* Error in unmarshalling; return to event loop. */
                         /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                              '&%s_badge' % me.interface.name,
+                                                              badge_ref,
                                                               reply_cap_slot) ?*/;
                         continue;
                     }
 
+                    _TIMESTAMP(TIMING_UNMARSHALLING_DONE);
+
                     /*- if not options.realtime and me.might_block() -*/
                         /* We need to save the reply cap because the user's implementation may
                          * perform operations that overwrite or discard it.
                          */
                         /*- set result = c_symbol() -*/
-                        /*? assert(reply_cap_slot is defined and reply_cap_slot > 0) ?*/
+                        /*? assert(reply_cap_slot is defined and (workers > 1 or reply_cap_slot > 0)) ?*/
                         int /*? result ?*/ UNUSED = camkes_declare_reply_cap(/*? reply_cap_slot ?*/);
                         ERR_IF(/*? result ?*/ != 0, /*? error_handler ?*/, ((camkes_error_t){
                                 .type = CE_ALLOCATION_FAILURE,
@@ -240,7 +438,7 @@ int
                                 .alloc_bytes = sizeof(seL4_CPtr),
                             }), ({
                                 /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                                      '&%s_badge' % me.interface.name,
+                                                                      badge_ref,
                                                                       reply_cap_slot) ?*/;
                                 continue;
                             }));
@@ -277,6 +475,8 @@ int
                         /*- endfor -*/
                     );
 
+                    _TIMESTAMP(TIMING_IMPLEMENTATION_DONE);
+
                     /*- set tls = c_symbol() -*/
                     camkes_tls_t * /*? tls ?*/ UNUSED = camkes_get_tls();
 
@@ -290,7 +490,9 @@ int
                       free(* /*? ret_ptr ?*/);
                     /*- endif -*/
                     /*- for p in m.parameters -*/
-                      /*- if p.array -*/
+                      /*- if arena is not none and macros.arena_allocated(p) -*/
+                        /*# Released by resetting the arena below. #*/
+                      /*- elif p.array -*/
                         /*- if p.type == 'string' -*/
                           /*- set mcount = c_symbol() -*/
                           for (int /*? mcount ?*/ = 0; /*? mcount ?*/ < * /*? p.name ?*/_sz_ptr; /*? mcount ?*/ ++) {
@@ -302,6 +504,9 @@ int
                         free(* /*? p.name ?*/_ptr);
                       /*- endif -*/
                     /*- endfor -*/
+                    /*- if arena is not none and len(list(filter(macros.arena_allocated, m.parameters))) > 0 -*/
+                      camkes_arena_reset(/*? thread_arena ?*/);
+                    /*- endif -*/
 
                     /* Check if there was an error during marshalling. We do
                      * this after freeing internal parameter variables to avoid
@@ -310,11 +515,13 @@ int
                     if (unlikely(/*? length ?*/ == UINT_MAX)) {
                         /* Error occurred; return to event loop. */
                         /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                              '&%s_badge' % me.interface.name,
+                                                              badge_ref,
                                                               reply_cap_slot) ?*/;
                         continue;
                     }
 
+                    _TIMESTAMP(TIMING_MARSHALLING_DONE);
+
                     /*? info ?*/ = seL4_MessageInfo_new(0, 0, 0, /* length */
                         /*- if userspace_ipc -*/
                             0
@@ -330,7 +537,7 @@ int
                             /*? tls ?*/->reply_cap_in_tcb = false;
                             /*? info ?*/ = /*? generate_seL4_ReplyRecv(options, ep,
                                                                        info,
-                                                                       '&%s_badge' % me.interface.name,
+                                                                       badge_ref,
                                                                        reply_cap_slot) ?*/;
                         } else {
                             /*- set error = c_symbol() -*/
@@ -345,20 +552,20 @@ int
                                 }), ({
                                     /*? info ?*/ = /*? generate_seL4_Recv(options,
                                                                           ep,
-                                                                          '&%s_badge' % me.interface.name,
+                                                                          badge_ref,
                                                                           reply_cap_slot) ?*/;
                                     continue;
                                 }));
 
                             seL4_Send(/*? reply_cap_slot ?*/, /*? info ?*/);
                             /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                                  '&%s_badge' % me.interface.name,
+                                                                  badge_ref,
                                                                   reply_cap_slot) ?*/;
                         }
                     /*- elif options.realtime -*/
                         /*? info ?*/ = /*? generate_seL4_ReplyRecv(options, ep,
                                                                    info,
-                                                                   '&%s_badge' % me.interface.name,
+                                                                   badge_ref,
                                                                    reply_cap_slot) ?*/;
                     /*- else -*/
 
@@ -402,12 +609,13 @@ int
                         /*- endif -*/
                         /*? info ?*/ = /*? generate_seL4_ReplyRecv(options, ep,
                                                                    info,
-                                                                   '&%s_badge' % me.interface.name,
+                                                                   badge_ref,
                                                                    reply_cap_slot) ?*/;
                     /*- endif -*/
 
                     break;
                 }
+                #undef _TIMESTAMP
             /*- endfor -*/
             default: {
                 ERR(/*? error_handler ?*/, ((camkes_error_t){
@@ -420,7 +628,7 @@ int
                         .invalid_index = * /*? call_ptr ?*/,
                     }), ({
                         /*? info ?*/ = /*? generate_seL4_Recv(options, ep,
-                                                              '&%s_badge' % me.interface.name,
+                                                              badge_ref,
                                                               reply_cap_slot) ?*/;
                         continue;
                     }));
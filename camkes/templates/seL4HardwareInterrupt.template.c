@@ -10,8 +10,11 @@
  * @TAG(DATA61_BSD)
  */
 
+/*- import 'helpers/error.c' as error with context -*/
+
 #include <assert.h>
 #include <camkes.h>
+#include <camkes/error.h>
 #include <sel4/sel4.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -21,119 +24,87 @@
 /*- set ntfn_obj = alloc_obj('ntfn', seL4_NotificationObject) -*/
 /*- set ntfn = alloc_cap('ntfn', ntfn_obj, read=True) -*/
 
-/*- set type_attr = '%s_irq_type' % me.parent.from_interface.name -*/
-/*- set type = configuration[me.parent.from_instance.name].get(type_attr, 'simple') -*/
-
-/*- if type == 'simple' -*/
-    /*- set attr = '%s_irq_number' % me.parent.from_interface.name -*/
-    /*- set _irq = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if _irq is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ number is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(_irq, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ number is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set irq = alloc('irq', seL4_IRQControl, number=_irq, notification=my_cnode[ntfn]) -*/
-/*- elif type in ['ioapic','isa','pci'] -*/
-    /*- if type == 'isa' -*/
-        /*- set level = 0 -*/
-        /*- set polarity = 0 -*/
-    /*- elif type == 'pci' -*/
-        /*- set level = 1 -*/
-        /*- set polarity = 1 -*/
+/*# Every IRQ the connection delivers is bound to the same notification. When
+ *# there is more than one, each is bound with a badge bit of its own, so one
+ *# thread can wait for all of them and learn which have fired.
+ #*/
+/*- set irqs = macros.hardware_irqs(configuration, me.parent) -*/
+/*- set irq_handlers = [] -*/
+/*- for irq in irqs -*/
+    /*- if len(irqs) == 1 -*/
+        /*- set irq_ntfn = ntfn -*/
     /*- else -*/
-        /*- set attr = '%s_irq_level' % me.parent.from_interface.name -*/
-        /*- set level = configuration[me.parent.from_instance.name].get(attr) -*/
-        /*- if level is none -*/
-            /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC interrupt level is not defined' % (me.parent.from_instance.name, attr))) ?*/
-        /*- endif -*/
-        /*- if not isinstance(level, numbers.Integral) -*/
-            /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC interrupt level is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-        /*- endif -*/
-        /*- set attr = '%s_irq_polarity' % me.parent.from_interface.name -*/
-        /*- set polarity = configuration[me.parent.from_instance.name].get(attr) -*/
-        /*- if polarity is none -*/
-            /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC interrupt polarity is not defined' % (me.parent.from_instance.name, attr))) ?*/
-        /*- endif -*/
-        /*- if not isinstance(polarity, numbers.Integral) -*/
-            /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC interrupt polarity is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-        /*- endif -*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_ioapic' % me.parent.from_interface.name -*/
-    /*- set ioapic = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if ioapic is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC controller number is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(ioapic, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC controller number is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_ioapic_pin' % me.parent.from_interface.name -*/
-    /*- set ioapic_pin = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if ioapic_pin is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC pin number is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(ioapic_pin, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IOAPIC pin number is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_vector' % me.parent.from_interface.name -*/
-    /*- set vector = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if vector is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ vector is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(vector, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ vector is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set irq = alloc('irq', seL4_IRQControl, vector=vector, ioapic=ioapic, ioapic_pin=ioapic_pin, level=level, polarity=polarity, notification=my_cnode[ntfn]) -*/
-/*- elif type == 'msi' -*/
-    /*- set attr = '%s_irq_handle' % me.parent.from_interface.name -*/
-    /*- set handle = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if handle is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an MSI handle is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(handle, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an MSI handle is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_pci_bus' % me.parent.from_interface.name -*/
-    /*- set pci_bus = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if pci_bus is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI bus is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(pci_bus, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI bus is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_pci_dev' % me.parent.from_interface.name -*/
-    /*- set pci_dev = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if pci_dev is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI device is not defined' % (me.parent.from_instance.name, attr))) ?*/
+        /*- set irq_ntfn = alloc_cap('ntfn_irq_%d' % loop.index0, ntfn_obj, write=True) -*/
+        /*- do cap_space.cnode[irq_ntfn].set_badge(2 ** loop.index0) -*/
     /*- endif -*/
-    /*- if not isinstance(pci_dev, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI device is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_pci_fun' % me.parent.from_interface.name -*/
-    /*- set pci_fun = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if pci_fun is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI function is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(pci_fun, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify a PCI function is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set attr = '%s_irq_vector' % me.parent.from_interface.name -*/
-    /*- set vector = configuration[me.parent.from_instance.name].get(attr) -*/
-    /*- if vector is none -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ vector is not defined' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- if not isinstance(vector, numbers.Integral) -*/
-        /*? raise(TemplateError('Setting %s.%s that should specify an IRQ vector is not an integer' % (me.parent.from_instance.name, attr))) ?*/
-    /*- endif -*/
-    /*- set irq = alloc('irq', seL4_IRQControl, vector=vector, handle=handle, pci_bus=pci_bus, pci_dev=pci_dev, pci_fun=pci_fun, notification=my_cnode[ntfn]) -*/
-/*- else -*/
-    /*? raise(TemplateError('Unknown irq type specified by %s.%s' % (me.parent.from_instance.name, type_attr))) ?*/
-/*- endif -*/
+    /*- set name = 'irq' if loop.first else 'irq_%d' % loop.index0 -*/
+    /*- do irq_handlers.append(alloc(name, seL4_IRQControl, notification=my_cnode[irq_ntfn], **irq)) -*/
+/*- endfor -*/
+/*- set budget = macros.irq_poll_budget(configuration, me) -*/
+
+/* Interface-specific error handling */
+/*- set error_handler = '%s_error_handler' % me.interface.name -*/
+/*? error.make_error_handler(me.interface.name, error_handler) ?*/
+
+/* The bits of the IRQs in this connection, as passed to
+ * `/*? me.interface.name ?*/_handle_irqs` and
+ * `/*? me.interface.name ?*/_acknowledge_irqs`.
+ */
+#define ALL_IRQS ((seL4_Word)/*? 2 ** len(irqs) - 1 ?*/)
+
+static const seL4_CPtr irq_handlers[] = {
+    /*- for handler in irq_handlers -*/
+        /*? handler ?*/,
+    /*- endfor -*/
+};
 
 int /*? me.interface.name ?*/__run(void) {
     while (true) {
-        seL4_Wait(/*? ntfn ?*/, NULL);
-        /*? me.interface.name ?*/_handle();
+        /*- if len(irqs) == 1 -*/
+            seL4_Wait(/*? ntfn ?*/, NULL);
+        /*- else -*/
+            seL4_Word irqs;
+            seL4_Wait(/*? ntfn ?*/, &irqs);
+        /*- endif -*/
+
+        /*- if budget is none -*/
+            /*- if len(irqs) == 1 -*/
+                /*? me.interface.name ?*/_handle();
+            /*- else -*/
+                /*? me.interface.name ?*/_handle_irqs(irqs);
+            /*- endif -*/
+        /*- else -*/
+            /*- if len(irqs) == 1 -*/
+                seL4_Word irqs = ALL_IRQS;
+            /*- endif -*/
+
+            /* The IRQs that have fired stay masked until we acknowledge them,
+             * so the driver can handle their work in batches without being
+             * interrupted. Keep going while it has a full batch, letting other
+             * threads run in between, and only then re-enable the IRQs.
+             */
+            while (/*? me.interface.name ?*/_handle_batch(irqs, /*? budget ?*/) >= /*? budget ?*/) {
+                /*- if len(irqs) > 1 -*/
+                    /* Fold in any other IRQs that have fired since. */
+                    seL4_Word more;
+                    seL4_Poll(/*? ntfn ?*/, &more);
+                    irqs |= more;
+                /*- endif -*/
+                seL4_Yield();
+            }
+
+            int error = /*? me.interface.name ?*/_acknowledge_irqs(irqs);
+            ERR_IF(error != 0, /*? error_handler ?*/, ((camkes_error_t){
+                    .type = CE_SYSCALL_FAILED,
+                    .instance = "/*? me.instance.name ?*/",
+                    .interface = "/*? me.interface.name ?*/",
+                    .description = "failed to acknowledge IRQ",
+                    .syscall = IRQAckIRQ,
+                    .error = error,
+                }), ({
+                    continue;
+                }));
+        /*- endif -*/
     }
 
     UNREACHABLE();
@@ -155,6 +126,19 @@ int /*? me.interface.name ?*/_reg_callback(void (*callback)(void*) UNUSED,
     return -1;
 }
 
+int /*? me.interface.name ?*/_acknowledge_irqs(seL4_Word irqs) {
+    irqs &= ALL_IRQS;
+    while (irqs != 0) {
+        unsigned i = __builtin_ctzl(irqs);
+        irqs &= irqs - 1;
+        int error = seL4_IRQHandler_Ack(irq_handlers[i]);
+        if (unlikely(error != 0)) {
+            return error;
+        }
+    }
+    return 0;
+}
+
 int /*? me.interface.name ?*/_acknowledge(void) {
-    return seL4_IRQHandler_Ack(/*? irq ?*/);
+    return /*? me.interface.name ?*/_acknowledge_irqs(ALL_IRQS);
 }
@@ -14,7 +14,9 @@
 
 #include <assert.h>
 #include <camkes/error.h>
+#include <limits.h>
 #include <sel4/sel4.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <utils/util.h>
@@ -24,26 +26,67 @@
 /*- set instance = me.instance.name -*/
 /*- set interface = me.interface.name -*/
 
+/*# The attribute is a string "irq,level,trigger", or a list of them to deliver
+ *# several IRQs over the connection. Each IRQ is then bound to the notification
+ *# with a badge bit of its own.
+ #*/
 /*- set attr = "%s_attributes" % me.parent.from_interface.name -*/
-/*- set irq= [] -*/
+/*- set irq = [] -*/
 /*- set notification_obj = alloc_obj('notification', seL4_NotificationObject) -*/
 /*- set notification = alloc_cap('notification', notification_obj, read=True) -*/
-/*- set _irq = configuration[me.parent.from_instance.name].get(attr) -*/
-/*- if _irq is not none -*/
+/*- set _irqs = configuration[me.parent.from_instance.name].get(attr) -*/
+/*- if _irqs is none -*/
+    /*? raise(TemplateError('Setting %s.%s that should specify an IRQ is not defined' % (me.parent.from_instance.name, attr))) ?*/
+/*- elif _irqs is string -*/
+    /*- set _irqs = [_irqs] -*/
+/*- endif -*/
+/*- if len(_irqs) < 1 or len(_irqs) > macros.MAX_CONNECTION_IRQS -*/
+    /*? raise(TemplateError('Setting %s.%s must specify between 1 and %d IRQs' % (me.parent.from_instance.name, attr, macros.MAX_CONNECTION_IRQS))) ?*/
+/*- endif -*/
+/*- for _irq in _irqs -*/
     /*- set attr_irq, attr_level, attr_trig = _irq.strip('"').split(',') -*/
-    /*- set irq_handler = alloc('irq', seL4_IRQControl, number=int(attr_irq, 0), notification=my_cnode[notification]) -*/
+    /*- if len(_irqs) == 1 -*/
+        /*- set irq_notification = notification -*/
+    /*- else -*/
+        /*- set irq_notification = alloc_cap('notification_irq_%d' % loop.index0, notification_obj, write=True) -*/
+        /*- do cap_space.cnode[irq_notification].set_badge(2 ** loop.index0) -*/
+    /*- endif -*/
+    /*- set name = 'irq' if loop.first else 'irq_%d' % loop.index0 -*/
+    /*- set irq_handler = alloc(name, seL4_IRQControl, number=int(attr_irq, 0), notification=my_cnode[irq_notification]) -*/
     /*- do irq.append((irq_handler, int(attr_level, 0), int(attr_trig, 0))) -*/
-/*- endif -*/
+/*- endfor -*/
 /*- set lock = alloc('lock', seL4_NotificationObject, read=True, write=True) -*/
 
 /* Interface-specific error handling */
 /*- set error_handler = '%s_error_handler' % me.interface.name -*/
 /*? error.make_error_handler(interface, error_handler) ?*/
 
-#define MAX_CALLBACKS 10
+#define CALLBACK_SLOTS /*? macros.callback_slots(configuration, me, 10) ?*/
+#define CALLBACK_WORD_BITS (sizeof(unsigned long) * CHAR_BIT)
+#define CALLBACK_WORDS ((CALLBACK_SLOTS + CALLBACK_WORD_BITS - 1) / CALLBACK_WORD_BITS)
+
+/* Registered callbacks are kept in a dense array. A slot's bit in `claimed` is
+ * set while a registrant or the interrupt thread is using it, and its bit in
+ * `armed` while it holds a callback waiting for an interrupt, so an interrupt
+ * only visits the callbacks that are registered.
+ */
+static void (*callbacks[CALLBACK_SLOTS])(void*);
+static void *callback_args[CALLBACK_SLOTS];
+static unsigned long claimed[CALLBACK_WORDS];
+static unsigned long armed[CALLBACK_WORDS];
+
+/* The IRQs that have fired but not yet been acknowledged, as badge bits. They
+ * are all acknowledged when the first callback is registered.
+ */
+#define ALL_IRQS ((seL4_Word)/*? 2 ** len(irq) - 1 ?*/)
+static seL4_Word unacked = ALL_IRQS;
+
+static const seL4_CPtr irq_handlers[] = {
+    /*- for i in irq -*/
+        /*? i[0] ?*/,
+    /*- endfor -*/
+};
 
-static void (*volatile callbacks[MAX_CALLBACKS])(void*);
-static void *callback_args[MAX_CALLBACKS];
 static volatile int event_pending;
 static volatile int sleepers;
 
@@ -64,21 +107,36 @@ static volatile int sleepers;
 
 int /*? me.interface.name ?*/__run(void) {
     /* Set trigger mode */
-    seL4_IRQHandler_SetMode(/*? irq[0][0] ?*/, /*? irq[0][1] ?*/, /*? irq[0][2] ?*/);
+    /*- for i in irq -*/
+        seL4_IRQHandler_SetMode(/*? i[0] ?*/, /*? i[1] ?*/, /*? i[2] ?*/);
+    /*- endfor -*/
     while (1) {
         int handled = 0;
 
-        seL4_Wait(/*? notification ?*/, NULL);
+        /*- if len(irq) == 1 -*/
+            seL4_Wait(/*? notification ?*/, NULL);
+            __atomic_fetch_or(&unacked, ALL_IRQS, __ATOMIC_RELAXED);
+        /*- else -*/
+            seL4_Word badge;
+            seL4_Wait(/*? notification ?*/, &badge);
+            __atomic_fetch_or(&unacked, badge, __ATOMIC_RELAXED);
+        /*- endif -*/
 
         /* First preference: callbacks. */
-        if (!handled) {
-            for (int i = 0; i < MAX_CALLBACKS; ++i) {
+        for (unsigned w = 0; w < CALLBACK_WORDS; ++w) {
+            unsigned long registered = __atomic_exchange_n(&armed[w], 0, __ATOMIC_ACQUIRE);
+            while (registered != 0) {
+                unsigned long bit = registered & -registered;
+                unsigned i = w * CALLBACK_WORD_BITS + __builtin_ctzl(registered);
+                registered &= registered - 1;
                 void (*callback)(void*) = callbacks[i];
-                if (callback != NULL) {
-                    callbacks[i] = NULL; /* No need for CAS. */
-                    callback(callback_args[i]);
-                    handled = 1;
-                }
+                void *arg = callback_args[i];
+                /* Free the slot before invoking the callback, which may
+                 * register itself again.
+                 */
+                __atomic_fetch_and(&claimed[w], ~bit, __ATOMIC_RELEASE);
+                callback(arg);
+                handled = 1;
             }
         }
 
@@ -111,21 +169,50 @@ void /*? me.interface.name ?*/_wait(void) {
 }
 
 int /*? me.interface.name ?*/_reg_callback(void (*callback)(void*), void *arg) {
-    int error;
-    for (int i = 0; i < MAX_CALLBACKS; ++i) {
-        if (CAS(&callbacks[i], NULL, callback) == NULL) {
+    for (unsigned w = 0; w < CALLBACK_WORDS; ++w) {
+        unsigned long used = __atomic_load_n(&claimed[w], __ATOMIC_RELAXED);
+        while (~used != 0) {
+            unsigned long bit = ~used & -~used;
+            unsigned i = w * CALLBACK_WORD_BITS + __builtin_ctzl(~used);
+            if (i >= CALLBACK_SLOTS) {
+                break;
+            }
+            if (!__atomic_compare_exchange_n(&claimed[w], &used, used | bit,
+                    false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                /* `used` now holds the slots claimed in the meantime. */
+                continue;
+            }
+
+            callbacks[i] = callback;
             callback_args[i] = arg;
-            error = seL4_IRQHandler_Ack(/*? irq[0][0] ?*/);
-            ERR_IF(error != 0, /*? error_handler ?*/, ((camkes_error_t){
-                    .type = CE_SYSCALL_FAILED,
-                    .instance = "/*? instance ?*/",
-                    .interface = "/*? interface ?*/",
-                    .description = "failed to acknowledge IRQ",
-                    .syscall = IRQAckIRQ,
-                    .error = error,
-                }), ({
-                    return -1;
-                }));
+            __atomic_fetch_or(&armed[w], bit, __ATOMIC_RELEASE);
+
+            seL4_Word irqs = __atomic_exchange_n(&unacked, 0, __ATOMIC_RELAXED);
+            while (irqs != 0) {
+                int error = seL4_IRQHandler_Ack(irq_handlers[__builtin_ctzl(irqs)]);
+                ERR_IF(error != 0, /*? error_handler ?*/, ((camkes_error_t){
+                        .type = CE_SYSCALL_FAILED,
+                        .instance = "/*? instance ?*/",
+                        .interface = "/*? interface ?*/",
+                        .description = "failed to acknowledge IRQ",
+                        .syscall = IRQAckIRQ,
+                        .error = error,
+                    }), ({
+                        /* Leave this IRQ and the ones after it for the next
+                         * registrant to acknowledge, and withdraw the
+                         * callback. If an interrupt from an IRQ acknowledged
+                         * above has already taken it, the interrupt thread
+                         * frees the slot and invokes the callback.
+                         */
+                        __atomic_fetch_or(&unacked, irqs, __ATOMIC_RELAXED);
+                        if (__atomic_fetch_and(&armed[w], ~bit, __ATOMIC_ACQUIRE) & bit) {
+                            __atomic_fetch_and(&claimed[w], ~bit, __ATOMIC_RELEASE);
+                            return -1;
+                        }
+                        return 0;
+                    }));
+                irqs &= irqs - 1;
+            }
             return 0;
         }
     }
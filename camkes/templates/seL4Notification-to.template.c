@@ -11,21 +11,23 @@
  */
 
 /*- import 'helpers/error.c' as error with context -*/
+/*- import 'helpers/callback.c' as callback with context -*/
 
 /* The basic design of this connector is to wait for an incoming event on the
  * notification, `notification`, and then forward any events to the secondary
- * notiifaciton, `handoff`. We also preference any registered callback
+ * notification, `handoff`. We also preference any registered callbacks
  * over this forwarding. The callback registration checks to see if there is a
  * pending event and, if so, invokes the callback immediately to short circuit
- * the process of registering it, deregistering it and then invoking it. Note
- * that we only operate on the callback slot while holding an internal lock.
+ * the process of registering it, deregistering it and then invoking it.
  *
  * This design is intended to avoid race conditions when operating on a single
  * endpoint in multiple modes. The intent is to also avoid reaching a state
  * where there is both a registered callback and a pending notification on the
- * `handoff` endpoint. We also strive to never invoke the caller's callback
- * function while holding the internal lock as it may inadvertently cause a
- * deadlock.
+ * `handoff` endpoint. Callback slots are claimed and released with atomic
+ * operations rather than under a lock (see helpers/callback.c), so delivering
+ * an event to a callback takes no more than a compare-and-swap, and we never
+ * invoke the caller's callback function from within the registration
+ * protocol.
  */
 
 #include <assert.h>
@@ -35,7 +37,7 @@
 #include <sel4/sel4.h>
 #include <stdbool.h>
 #include <stddef.h>
-#include <sync/bin_sem_bare.h>
+#include <stdint.h>
 #include <sync/sem-bare.h>
 #include <utils/util.h>
 
@@ -52,40 +54,17 @@
 /*- set handoff = alloc('handoff_%d' % id, seL4_EndpointObject, read=True, write=True) -*/
 static volatile int handoff_value;
 
-/*- set lock = alloc('lock_%d' % id, seL4_NotificationObject, read=True, write=True) -*/
-static volatile int lock_count = 1;
-
-static int lock(void) {
-    int result = sync_bin_sem_bare_wait(/*? lock ?*/, &lock_count);
-    __sync_synchronize();
-    return result;
-}
-
-static int unlock(void) {
-    __sync_synchronize();
-    return sync_bin_sem_bare_post(/*? lock ?*/, &lock_count);
-}
-
-static void (*callback)(void*);
-static void *callback_arg;
+/*? callback.make_callbacks(handoff) ?*/
 
 int /*? me.interface.name ?*/__run(void) {
     while (true) {
         seL4_Wait(/*? notification ?*/, NULL);
 
-        if (lock() != 0) {
-            /* Failed to acquire the lock (`INT_MAX` threads in `register`?).
-             * It's unsafe to go on at this point, so just drop the event.
-             */
-            continue;
-        }
-
-        /* Read and deregister any callback. */
-        void (*cb)(void*) = callback;
-        callback = NULL;
-        void *arg = callback_arg;
+        /* Read and deregister any callbacks. */
+        callback_t taken[CALLBACK_SLOTS];
+        unsigned n = take_callbacks(taken);
 
-        if (cb == NULL) {
+        if (n == 0) {
             /* No callback was registered. */
 
             /* Check that we're not about to overflow the handoff semaphore. If
@@ -94,25 +73,21 @@ int /*? me.interface.name ?*/__run(void) {
              * condition here because we are the only thread incrementing the
              * semaphore.
              */
-            if (handoff_value != INT_MAX) {
-                sync_sem_bare_post(/*? handoff ?*/, &handoff_value);
+            if (handoff_value == INT_MAX) {
+                continue;
             }
-        }
+            sync_sem_bare_post(/*? handoff ?*/, &handoff_value);
 
-        int result UNUSED = unlock();
-        assert(result == 0);
-
-        if (cb != NULL) {
-            /* A callback was registered. Note that `cb` is a local variable
-             * and thus we know that the semaphore post above was not executed.
+            /* A callback registered while we were posting may have missed
+             * the event.
              */
-            cb(arg);
+            n = reclaim_event(taken);
         }
-    }
-}
 
-static int poll(void) {
-    return sync_sem_bare_trywait(/*? handoff ?*/, &handoff_value) == 0;
+        for (unsigned i = 0; i < n; i++) {
+            taken[i].fn(taken[i].arg);
+        }
+    }
 }
 
 int /*? me.interface.name ?*/_poll(void) {
@@ -134,43 +109,3 @@ void /*? me.interface.name ?*/_wait(void) {
             }));
     }
 }
-
-int /*? me.interface.name ?*/_reg_callback(void (*cb)(void*), void *arg) {
-
-    /* First see if there's a pending event, allowing us to immediately invoke
-     * the callback without having to register it.
-     */
-    if (poll()) {
-        cb(arg);
-        return 0;
-    }
-
-    if (lock() != 0) {
-        /* Failed to acquire the lock (`INT_MAX` threads in this function?). */
-        return -1;
-    }
-
-    if (poll()) {
-        /* An event arrived in between us checking previously and acquiring the
-         * lock.
-         */
-        int result UNUSED = unlock();
-        assert(result == 0);
-        cb(arg);
-        return 0;
-
-    } else if (callback != NULL) {
-        /* There is already a registered callback. */
-        int result UNUSED = unlock();
-        assert(result == 0);
-        return -1;
-
-    } else {
-        /* Register the callback. Expected case. */
-        callback = cb;
-        callback_arg = arg;
-        int result UNUSED = unlock();
-        assert(result == 0);
-        return 0;
-    }
-}
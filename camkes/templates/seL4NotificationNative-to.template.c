@@ -31,7 +31,7 @@ int /*? me.interface.name ?*/__run(void) {
     return 0;
 }
 
-/*- set threads = [1] + list(map(lambda('x: x + 2'), six.moves.range(len(me.instance.type.provides + me.instance.type.uses + me.instance.type.emits + me.instance.type.consumes + me.instance.type.dataports)))) -*/
+/*- set threads = [1] + list(map(lambda('x: x + 2'), six.moves.range(len(me.instance.type.provides + me.instance.type.uses + me.instance.type.emits + me.instance.type.consumes + me.instance.type.dataports) + macros.worker_pool_threads(composition, configuration, me.instance)))) -*/
 /*? make_tls_symbols('seL4_Word', 'badge', threads, False) ?*/
 
 int /*? me.interface.name ?*/_poll(void) {
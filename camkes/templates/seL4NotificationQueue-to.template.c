@@ -11,14 +11,15 @@
  */
 
 /*- import 'helpers/error.c' as error with context -*/
+/*- import 'helpers/callback.c' as callback with context -*/
 
 #include <camkes/error.h>
 #include <camkes/tls.h>
 #include <limits.h>
 #include <sel4/sel4.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
-#include <sync/bin_sem_bare.h>
 #include <sync/sem-bare.h>
 #include <utils/util.h>
 
@@ -38,22 +39,7 @@ char to_/*? id ?*/_/*? me.interface.name ?*/_data[ROUND_UP_UNSAFE(sizeof(int), P
 static volatile int *value = (volatile int*)to_/*? id ?*/_/*? me.interface.name ?*/_data;
 /*? register_shared_variable('%s_%d_data' % (me.parent.name, id), 'to_%d_%s_data' % (id, me.interface.name), 'RW') ?*/
 
-/*- set lock = alloc('lock_%d' % id, seL4_NotificationObject, read=True, write=True) -*/
-static volatile int lock_count = 1;
-
-static int lock(void) {
-    int result = sync_bin_sem_bare_wait(/*? lock ?*/, &lock_count);
-    __sync_synchronize();
-    return result;
-}
-
-static int unlock(void) {
-    __sync_synchronize();
-    return sync_bin_sem_bare_post(/*? lock ?*/, &lock_count);
-}
-
-static void (*volatile callback)(void*);
-static void *callback_arg;
+/*? callback.make_callbacks(handoff) ?*/
 
 int /*? me.interface.name ?*/__run(void) {
     while (true) {
@@ -68,48 +54,28 @@ restart:;
                 goto restart;
             }));
 
-        if (lock() != 0) {
-            ERR(/*? error_handler ?*/, ((camkes_error_t){
-                    .type = CE_OVERFLOW,
-                    .instance = "/*? me.instance.name ?*/",
-                    .interface = "/*? me.interface.name ?*/",
-                    .description = "lock acquisition failed due to too many outstanding lock holders",
-                }), ({
-                    goto restart;
-                }));
-        }
-
-        void (*cb)(void*) = callback;
-        callback = NULL;
-        void *arg = callback_arg;
+        callback_t taken[CALLBACK_SLOTS];
+        unsigned n = take_callbacks(taken);
 
-        if (cb == NULL) {
+        if (n == 0) {
             ERR_IF(handoff_value == INT_MAX, /*? error_handler ?*/, ((camkes_error_t){
                     .type = CE_OVERFLOW,
                     .instance = "/*? me.instance.name ?*/",
                     .interface = "/*? me.interface.name ?*/",
                     .description = "handoff to internal endpoint not possible due to counter overflow",
                 }), ({
-                    int result UNUSED = unlock();
-                    assert(result == 0);
                     goto restart;
                 }));
             sync_sem_bare_post(/*? handoff ?*/, &handoff_value);
+            n = reclaim_event(taken);
         }
 
-        result = unlock();
-        assert(result == 0);
-
-        if (cb != NULL) {
-            cb(arg);
+        for (unsigned i = 0; i < n; i++) {
+            taken[i].fn(taken[i].arg);
         }
     }
 }
 
-static int poll(void) {
-    return sync_sem_bare_trywait(/*? handoff ?*/, &handoff_value) == 0;
-}
-
 int /*? me.interface.name ?*/_poll(void) {
     return poll();
 }
@@ -129,34 +95,3 @@ void /*? me.interface.name ?*/_wait(void) {
             }));
     }
 }
-
-int /*? me.interface.name ?*/_reg_callback(void (*cb)(void*), void *arg) {
-
-    if (poll()) {
-        cb(arg);
-        return 0;
-    }
-
-    if (lock() != 0) {
-        return -1;
-    }
-
-    if (poll()) {
-        int result UNUSED = unlock();
-        assert(result == 0);
-        cb(arg);
-        return 0;
-
-    } else if (callback != NULL) {
-        int result UNUSED = unlock();
-        assert(result == 0);
-        return -1;
-
-    } else {
-        callback = cb;
-        callback_arg = arg;
-        int result UNUSED = unlock();
-        assert(result == 0);
-        return 0;
-    }
-}
@@ -57,7 +57,7 @@
 /*- set methods_len = len(me.interface.type.methods) -*/
 /*- set instance = me.instance.name -*/
 /*- set interface = me.interface.name -*/
-/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes))) -*/
+/*- set threads = list(six.moves.range(1, 2 + len(me.instance.type.provides) + len(me.instance.type.uses) + len(me.instance.type.emits) + len(me.instance.type.consumes) + macros.worker_pool_threads(composition, configuration, me.instance))) -*/
 
 /* Interface-specific error handling */
 /*- set error_handler = '%s_error_handler' % me.interface.name -*/
@@ -70,7 +70,25 @@
     static volatile int /*? lock ?*/ = 1;
 /*- endif -*/
 
-TIMING_DEFS(/*? me.interface.name ?*/, "glue code entry", "lock acquired", "marshalling done", "communication done", "lock released", "unmarshalling done")
+/* Timing points, in the order they are passed. */
+enum {
+    TIMING_GLUE_CODE_ENTRY,
+    TIMING_LOCK_ACQUIRED,
+    TIMING_MARSHALLING_DONE,
+    TIMING_COMMUNICATION_DONE,
+    TIMING_LOCK_RELEASED,
+    TIMING_UNMARSHALLING_DONE,
+};
+#define TIMING_POINT_NAMES "glue code entry", "lock acquired", "marshalling done", "communication done", "lock released", "unmarshalling done"
+/*- set timing_threads = len(macros.threads(composition, me.instance, configuration)) + 1 -*/
+TIMING_DEFS(/*? me.interface.name ?*/, /*? timing_threads ?*/, TIMING_POINT_NAMES)
+/*- if len(me.interface.type.methods) > 0 -*/
+TIMING_HISTOGRAM_DEFS(/*? me.interface.name ?*/, "/*? me.interface.name[:31] ?*/", /*? timing_threads ?*/, TIMING_POINT_NAMES
+    /*- for m in me.interface.type.methods -*/
+        , "/*? m.name[:31] ?*/"
+    /*- endfor -*/
+    )
+/*- endif -*/
 
 /*? array_check.make_array_typedef_check_symbols(me.interface.type) ?*/
 
@@ -96,12 +114,13 @@ int /*? me.interface.name ?*/__run(void) {
 /*- set output_parameters = list(filter(lambda('x: x.direction in [\'out\', \'inout\']'), m.parameters)) -*/
 
 /*# If we're meant to be timing this method, map its timestamps to the real
- *# measurement functionality. Otherwise, make this a no-op.
+ *# measurement functionality. Otherwise, only feed the latency histograms,
+ *# which are a no-op unless enabled.
  #*/
 /*- if timing_method == m.name -*/
-    #define _TIMESTAMP(x) TIMESTAMP(x)
+    #define _TIMESTAMP(x) do { TIMESTAMP(x); TIMING_HISTOGRAM_POINT(/*? i ?*/, x); } while (0)
 /*- else -*/
-    #define _TIMESTAMP(x) /* nothing */
+    #define _TIMESTAMP(x) TIMING_HISTOGRAM_POINT(/*? i ?*/, x)
 /*- endif -*/
 
 /*? marshal.make_marshal_input_symbols(instance, interface, m.name, '%s_marshal_inputs' % m.name, BUFFER_BASE, 'seL4_MsgMaxLength * sizeof(seL4_Word)', i, methods_len, input_parameters, error_handler, threads) ?*/
@@ -166,7 +185,7 @@ int /*? me.interface.name ?*/__run(void) {
   void
 /*- endif -*/
 ) {
-    _TIMESTAMP("glue code entry");
+    _TIMESTAMP(TIMING_GLUE_CODE_ENTRY);
 
     /*- if not options.frpc_lock_elision or 1 + len(me.instance.type.provides) + len(me.instance.type.consumes) > 1 -*/
         /* We need to surround the send/wait sequence with a lock because this code
@@ -186,7 +205,7 @@ int /*? me.interface.name ?*/__run(void) {
         sync_sem_bare_wait(/*? lock_ep ?*/, &/*? lock ?*/);
     /*- endif -*/
 
-    _TIMESTAMP("lock acquired");
+    _TIMESTAMP(TIMING_LOCK_ACQUIRED);
 
     /*- set ret_val = c_symbol('return') -*/
     /*- set ret_ptr = c_symbol('return_ptr') -*/
@@ -216,7 +235,7 @@ int /*? me.interface.name ?*/__run(void) {
         /*- endif -*/
     }
 
-    _TIMESTAMP("marshalling done");
+    _TIMESTAMP(TIMING_MARSHALLING_DONE);
 
     /* Call the endpoint */
     /*- set info = c_symbol('info') -*/
@@ -229,7 +248,7 @@ int /*? me.interface.name ?*/__run(void) {
     /*- endif -*/
     /*? info ?*/ = seL4_Recv(/*? ep ?*/, NULL);
 
-    _TIMESTAMP("communication done");
+    _TIMESTAMP(TIMING_COMMUNICATION_DONE);
 
     /*- if not options.frpc_lock_elision or 1 + len(me.instance.type.provides) + len(me.instance.type.consumes) > 1 -*/
         /* It's safe to release the lock here because releasing does not touch our
@@ -238,7 +257,7 @@ int /*? me.interface.name ?*/__run(void) {
         sync_sem_bare_post(/*? lock_ep ?*/, &/*? lock ?*/);
     /*- endif -*/
 
-    _TIMESTAMP("lock released");
+    _TIMESTAMP(TIMING_LOCK_RELEASED);
 
     /* Unmarshal the response */
     /*- set size = c_symbol('size') -*/
@@ -260,7 +279,7 @@ int /*? me.interface.name ?*/__run(void) {
         /*- endif -*/
     }
 
-    _TIMESTAMP("unmarshalling done");
+    _TIMESTAMP(TIMING_UNMARSHALLING_DONE);
 
     /*- if m.return_type is not none -*/
         return * /*? ret_ptr ?*/;
@@ -61,7 +61,7 @@
 /*- endif -*/
 
 /*# Necessary TLS variables #*/
-/*- set threads = [1] + list(map(lambda('x: x + 2'), range(len(me.instance.type.provides + me.instance.type.uses + me.instance.type.emits + me.instance.type.consumes + me.instance.type.dataports)))) -*/
+/*- set threads = [1] + list(map(lambda('x: x + 2'), range(len(me.instance.type.provides + me.instance.type.uses + me.instance.type.emits + me.instance.type.consumes + me.instance.type.dataports) + macros.worker_pool_threads(composition, configuration, me.instance)))) -*/
 /*- for m in me.interface.type.methods -*/
     /*- for p in m.parameters -*/
         /*? make_tls_symbols(macros.show_type(p.type), '%s_%s' % (m.name, p.name), threads, p.array) ?*/
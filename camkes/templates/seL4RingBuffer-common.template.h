@@ -0,0 +1,39 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/*- set elem_type = macros.dataport_type(me.interface.type) -*/
+/*- if me in me.parent.from_ends -*/
+/* Copy up to `count` elements into the ring. Returns the number copied, which
+ * is less than `count` if the ring fills. Does not block.
+ */
+size_t /*? me.interface.name ?*/_enqueue_batch(const /*? elem_type ?*/ *elems, size_t count);
+/*- elif me.parent.type.name == 'seL4RingBufferQueue' -*/
+/* Copy up to `max` elements out of the producers' rings. Returns the number
+ * copied, which is 0 if every ring is empty. Does not block.
+ */
+size_t /*? me.interface.name ?*/_drain(/*? elem_type ?*/ *elems, size_t max);
+
+/* Block until a producer's ring is non-empty. */
+void /*? me.interface.name ?*/_wait(void);
+/*- else -*/
+/* Copy up to `count` elements out of the ring. Returns the number copied,
+ * which is 0 if the ring is empty. Does not block.
+ */
+size_t /*? me.interface.name ?*/_dequeue_batch(/*? elem_type ?*/ *elems, size_t count);
+
+/* Block until the ring is non-empty. */
+void /*? me.interface.name ?*/_wait(void);
+/*- endif -*/
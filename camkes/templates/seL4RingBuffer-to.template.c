@@ -0,0 +1,84 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*- import 'helpers/ring.c' as ring with context -*/
+
+#include <camkes/dataport.h>
+#include <sel4/sel4.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+
+/*? macros.show_includes(me.instance.type.includes) ?*/
+
+/*- set id = composition.connections.index(me.parent) -*/
+/*- set elem_type = macros.ring_element_type(me) -*/
+/*- set capacity = macros.ring_capacity(configuration, me.parent) -*/
+
+/*- set ring_type = c_symbol('ring_t') -*/
+/*? ring.make_ring_type(ring_type, elem_type, capacity) ?*/
+
+/*- set ring_symbol = 'to_0_%s_ring' % me.interface.name -*/
+/*? ring.make_ring(ring_type, ring_symbol, '%s_ring_0' % me.parent.name) ?*/
+
+/*- set notification = alloc('notification', seL4_NotificationObject, read=True) -*/
+
+/*- set ring_ptr = c_symbol('ring') -*/
+static /*? ring_type ?*/ *const /*? ring_ptr ?*/ = &/*? ring_symbol ?*/.ring;
+
+/*- set consumer = c_symbol('ring') -*/
+/*? ring.make_dequeue(consumer, ring_type, elem_type, capacity) ?*/
+
+/* The producer's index as of when we last read it. */
+static uint32_t tail_cache;
+
+size_t /*? me.interface.name ?*/_dequeue_batch(/*? elem_type ?*/ *elems, size_t count) {
+    return /*? consumer ?*/_dequeue(/*? ring_ptr ?*/, &tail_cache, elems, count);
+}
+
+void /*? me.interface.name ?*/_wait(void) {
+    while (true) {
+        /* Check again before sleeping, as producers only signal when they
+         * find their ring empty. See helpers/ring.c.
+         */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (/*? consumer ?*/_pending(/*? ring_ptr ?*/, &tail_cache)) {
+            return;
+        }
+        seL4_Wait(/*? notification ?*/, NULL);
+    }
+}
+
+/* The slots are exposed as the dataport itself, but accesses through this
+ * pointer are not synchronised with the producer.
+ */
+/*? elem_type ?*/ * /*? me.interface.name ?*/ = /*? ring_symbol ?*/.ring.slots;
+
+int /*? me.interface.name ?*/_wrap_ptr(dataport_ptr_t *p, void *ptr) {
+    if ((uintptr_t)ptr < (uintptr_t)/*? ring_ptr ?*/->slots ||
+            (uintptr_t)ptr >= (uintptr_t)/*? ring_ptr ?*/->slots + sizeof(/*? ring_ptr ?*/->slots)) {
+        return -1;
+    }
+    p->id = /*? id ?*/;
+    p->offset = (off_t)((uintptr_t)ptr - (uintptr_t)/*? ring_ptr ?*/->slots);
+    return 0;
+}
+
+void * /*? me.interface.name ?*/_unwrap_ptr(dataport_ptr_t *p) {
+    if (p->id == /*? id ?*/) {
+        return (void*)((uintptr_t)/*? ring_ptr ?*/->slots + (uintptr_t)p->offset);
+    } else {
+        return NULL;
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/*# The consumer end of the seL4RingBufferQueue connector. Each producer has a
+ *# ring of its own, so producers never contend with each other, and they share
+ *# the notification that wakes the consumer. As the notification is a single
+ *# word, signals from producers that fill their rings at about the same time
+ *# are delivered as one wake-up.
+ #*/
+
+/*- import 'helpers/ring.c' as ring with context -*/
+
+#include <camkes/dataport.h>
+#include <sel4/sel4.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+
+/*? macros.show_includes(me.instance.type.includes) ?*/
+
+/*- set elem_type = macros.ring_element_type(me) -*/
+/*- set capacity = macros.ring_capacity(configuration, me.parent) -*/
+
+/*- set ring_type = c_symbol('ring_t') -*/
+/*? ring.make_ring_type(ring_type, elem_type, capacity) ?*/
+
+/*- set ring_symbols = [] -*/
+/*- for index in six.moves.range(len(me.parent.from_ends)) -*/
+  /*- set ring_symbol = 'to_%d_%s_ring' % (index, me.interface.name) -*/
+  /*? ring.make_ring(ring_type, ring_symbol, '%s_ring_%d' % (me.parent.name, index)) ?*/
+  /*- do ring_symbols.append(ring_symbol) -*/
+/*- endfor -*/
+
+/*- set notification = alloc('notification', seL4_NotificationObject, read=True) -*/
+
+/*- set consumer = c_symbol('ring') -*/
+/*? ring.make_dequeue(consumer, ring_type, elem_type, capacity) ?*/
+
+#define RINGS /*? len(ring_symbols) ?*/
+
+static /*? ring_type ?*/ *const rings[RINGS] = {
+/*- for s in ring_symbols -*/
+    &/*? s ?*/.ring,
+/*- endfor -*/
+};
+
+/* The producers' indices as of when we last read them. */
+static uint32_t tail_caches[RINGS];
+
+/* The ring to start the next drain at, so that when the caller's buffer is
+ * smaller than the number of pending elements every producer gets a turn.
+ */
+static unsigned next_ring;
+
+/* Each ring's dequeue takes at most its capacity, however far ahead its
+ * producer claims to be (see helpers/ring.c), so a misbehaving producer can
+ * neither overrun `elems` nor starve the rings after it of more than one
+ * ring's worth of space per drain.
+ */
+size_t /*? me.interface.name ?*/_drain(/*? elem_type ?*/ *elems, size_t max) {
+    size_t n = 0;
+    unsigned i = next_ring;
+    for (unsigned j = 0; j < RINGS && n < max; j++) {
+        n += /*? consumer ?*/_dequeue(rings[i], &tail_caches[i], elems + n, max - n);
+        i = (i + 1) % RINGS;
+    }
+    next_ring = i;
+    return n;
+}
+
+void /*? me.interface.name ?*/_wait(void) {
+    while (true) {
+        /* Check again before sleeping, as producers only signal when they
+         * find their ring empty. See helpers/ring.c.
+         */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        for (unsigned i = 0; i < RINGS; i++) {
+            if (/*? consumer ?*/_pending(rings[i], &tail_caches[i])) {
+                return;
+            }
+        }
+        seL4_Wait(/*? notification ?*/, NULL);
+    }
+}
+
+/* The rings are only accessible through `_drain`. */
+/*? elem_type ?*/ * /*? me.interface.name ?*/ = NULL;
+
+int /*? me.interface.name ?*/_wrap_ptr(dataport_ptr_t *p UNUSED, void *ptr UNUSED) {
+    return -1;
+}
+
+void * /*? me.interface.name ?*/_unwrap_ptr(dataport_ptr_t *p UNUSED) {
+    return NULL;
+}
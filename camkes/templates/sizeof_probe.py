@@ -12,9 +12,18 @@
 
 '''
 Helpers for invoking a c compiler to determine the size of a type
+
+Sizes can be determined one type at a time (`probe_sizeof`), by a binary
+search over static assertions, or for many types at once (`probe_sizeofs`),
+by compiling a single translation unit that declares an object of each type's
+size and reading the sizes back from the symbol table of the resulting object
+file. Results of the latter can be retained across runs in an on-disk cache.
 '''
 
-import os, six, subprocess
+import os, re, shutil, six, subprocess, tempfile
+from camkes.internal.mkdirp import mkdirp
+from camkes.internal.shelf import Shelf
+from camkes.internal.strhash import hash_string
 
 def probe_sizeof(type_name, compiler_name, extra_flags):
     '''
@@ -109,3 +118,168 @@ def try_compile(program, compiler_name, extra_flags):
     _, err = p.communicate(program)
 
     return (p.returncode == 0, err)
+
+# Directory in which to persist probed sizes, or None to disable persistence.
+cache_dir = None
+
+# Types whose sizes the templates may ask for. When the C compiler needs to be
+# consulted about one type, it is asked about all of these at once.
+candidates = set()
+
+def compiler_identity(compiler_name):
+    '''
+    A string that changes when the compiler found in PATH for `compiler_name`
+    does.
+    '''
+    for d in os.environ.get('PATH', '').split(os.pathsep):
+        path = os.path.join(d, compiler_name)
+        if os.path.isfile(path) and os.access(path, os.X_OK):
+            path = os.path.realpath(path)
+            st = os.stat(path)
+            return '%s|%d|%d' % (path, st.st_size, st.st_mtime)
+    return compiler_name
+
+def probe_sizeofs(type_names, compiler_name, extra_flags):
+    '''
+    Returns a dictionary of the sizes in bytes of the given c types when
+    compiled with a given compiler. Types whose size cannot be determined
+    (e.g. because they are not defined) are omitted from the result.
+    '''
+    # Consult the on-disk cache first.
+    shelf = None
+    keys = {}
+    if cache_dir is not None:
+        try:
+            mkdirp(cache_dir)
+            shelf = Shelf(os.path.join(cache_dir, 'sizes.db'))
+        except Exception:
+            pass
+    if shelf is not None:
+        prefix = '\n'.join([compiler_identity(compiler_name)] + extra_flags)
+        keys = dict((t, hash_string('%s\n%s' % (prefix, t)))
+            for t in type_names)
+
+    sizes = {}
+    missing = []
+    for t in sorted(set(type_names)):
+        if shelf is None:
+            missing.append(t)
+            continue
+        try:
+            value = shelf[keys[t]]
+            if value != '':
+                sizes[t] = int(value)
+        except (KeyError, ValueError):
+            missing.append(t)
+
+    try:
+        probed = probe_batch(missing, compiler_name, extra_flags)
+    except ImportError:
+        # Without elftools we cannot read the sizes back. Leave the caller to
+        # fall back on `probe_sizeof`.
+        return sizes
+    sizes.update(probed)
+
+    if shelf is not None:
+        try:
+            for t in missing:
+                # Types we failed to probe are remembered as well, so we don't
+                # attempt them again.
+                shelf[keys[t]] = six.text_type(probed.get(t, ''))
+        except Exception:
+            # Failing to cache is not fatal.
+            pass
+
+    return sizes
+
+def probe_batch(type_names, compiler_name, extra_flags):
+    '''
+    Determine the sizes of the given types with as few compiler invocations as
+    possible. Returns a dictionary as for `probe_sizeofs`.
+    '''
+    type_names = list(type_names)
+    while len(type_names) > 0:
+        program = ''.join('char camkes_sizeof_probe_%d[sizeof(%s)];\n' %
+            (index, t) for index, t in enumerate(type_names))
+
+        (success, err, symbols) = try_compile_symbols(program, compiler_name,
+            extra_flags)
+
+        if success:
+            sizes = {}
+            for index, t in enumerate(type_names):
+                size = symbols.get('camkes_sizeof_probe_%d' % index)
+                if size is not None:
+                    sizes[t] = size
+            return sizes
+
+        # Drop any types the compiler complained about and try again. Each
+        # type is on its own line, starting at line 1.
+        bad = set(int(m.group(1)) - 1 for m in
+            re.finditer(r'^<stdin>:(\d+):(?:\d+:)?\s*error', err,
+                flags=re.MULTILINE))
+        if len(bad) == 0:
+            # We could not work out what went wrong. Fall back to splitting
+            # the batch.
+            if len(type_names) == 1:
+                return {}
+            mid = len(type_names) // 2
+            sizes = probe_batch(type_names[:mid], compiler_name, extra_flags)
+            sizes.update(probe_batch(type_names[mid:], compiler_name,
+                extra_flags))
+            return sizes
+        type_names = [t for index, t in enumerate(type_names)
+            if index not in bad]
+
+    return {}
+
+def try_compile_symbols(program, compiler_name, extra_flags):
+    '''
+    Invokes a given c compiler on a program specified as a string, as for
+    `try_compile`, retaining the output. Returns a tuple (success, error,
+    symbols), where "symbols" maps the names of the data objects defined in
+    the compiled program to their sizes in bytes.
+    '''
+    d = tempfile.mkdtemp()
+    try:
+        output = os.path.join(d, 'probe.o')
+        flags = [
+            '-c',               # compile only
+            '-x', 'c',          # specifies the language as c
+            '-fno-common',      # give uninitialised objects a symbol size
+            '-',                # read the program from stdin
+            '-o', output,
+        ]
+
+        try:
+            p = subprocess.Popen([compiler_name] + flags + extra_flags,
+                stdin=subprocess.PIPE, stdout=subprocess.PIPE,
+                stderr=subprocess.PIPE, universal_newlines=True)
+        except OSError:
+            raise Exception("Compiler not found")
+
+        _, err = p.communicate(program)
+        if p.returncode != 0:
+            return (False, err, {})
+
+        return (True, err, read_symbol_sizes(output))
+    finally:
+        shutil.rmtree(d)
+
+def read_symbol_sizes(path):
+    '''
+    Returns a dictionary from the names of the data objects in an ELF file to
+    their sizes.
+    '''
+    from elftools.elf.elffile import ELFFile
+    from elftools.elf.sections import SymbolTableSection
+
+    sizes = {}
+    with open(path, 'rb') as f:
+        elf = ELFFile(f)
+        for section in elf.iter_sections():
+            if isinstance(section, SymbolTableSection):
+                for symbol in section.iter_symbols():
+                    if symbol['st_info']['type'] == 'STT_OBJECT':
+                        sizes[symbol.name] = symbol['st_size']
+    return sizes
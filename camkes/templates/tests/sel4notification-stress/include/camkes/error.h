@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* Any error reported by the connector fails the test. */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+typedef enum {
+    CE_NO_ERROR,
+    CE_OVERFLOW,
+} camkes_error_type_t;
+
+typedef struct {
+    camkes_error_type_t type;
+    const char *instance;
+    const char *interface;
+    const char *description;
+    const char *filename;
+    int lineno;
+} camkes_error_t;
+
+typedef enum {
+    CEA_DISCARD,
+    CEA_IGNORE,
+    CEA_HALT,
+} camkes_error_action_t;
+
+typedef camkes_error_action_t (*camkes_error_handler_t)(camkes_error_t *);
+
+static inline camkes_error_action_t camkes_error(camkes_error_t *e) {
+    (void)e;
+    abort();
+}
+
+#define ERR(handler, edata, action) ({ abort(); })
+#define ERR_IF(cond, handler, edata, action) ({ if (cond) abort(); })
@@ -0,0 +1,29 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* Host stand-ins for the parts of libsel4 used by the rendered connector. Cap
+ * 1 is a binary notification and any other cap is an endpoint on which each
+ * signal wakes one waiter. See stress.c.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+typedef unsigned long seL4_CPtr;
+typedef unsigned long seL4_Word;
+
+void fake_wait(seL4_CPtr cap);
+void fake_signal(seL4_CPtr cap);
+
+#define seL4_Wait(cap, badge) fake_wait(cap)
+#define seL4_Signal(cap) fake_signal(cap)
@@ -0,0 +1,47 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* Host model of libsel4sync's bare semaphore. The counter goes negative with
+ * blocked waiters, who sleep on the endpoint.
+ */
+
+#pragma once
+
+#include <sel4/sel4.h>
+
+static inline int sync_sem_bare_wait(seL4_CPtr ep, volatile int *value) {
+    int v = __atomic_sub_fetch(value, 1, __ATOMIC_ACQUIRE);
+    if (v < 0) {
+        fake_wait(ep);
+    }
+    return 0;
+}
+
+static inline int sync_sem_bare_trywait(seL4_CPtr ep, volatile int *value) {
+    (void)ep;
+    int v = *value;
+    while (v > 0) {
+        if (__atomic_compare_exchange_n(value, &v, v - 1, 1, __ATOMIC_ACQUIRE,
+                __ATOMIC_RELAXED)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static inline int sync_sem_bare_post(seL4_CPtr ep, volatile int *value) {
+    int v = __atomic_add_fetch(value, 1, __ATOMIC_RELEASE);
+    if (v <= 0) {
+        fake_signal(ep);
+    }
+    return 0;
+}
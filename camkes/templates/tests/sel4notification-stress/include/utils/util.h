@@ -0,0 +1,18 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#pragma once
+
+#define UNUSED __attribute__((unused))
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define PAGE_SIZE_4K 4096
+#define ROUND_UP_UNSAFE(x, n) (((x) + (n) - 1) / (n) * (n))
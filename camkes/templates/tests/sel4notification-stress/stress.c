@@ -0,0 +1,236 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* A host stress test of the lock-free callback registration in the
+ * seL4Notification and seL4NotificationQueue to-side templates, the same
+ * protocol modelled in sel4notification.pml. The rendered template is
+ * included as SRC, with its kernel objects replaced by the fakes below. Each
+ * round races two registrations against one event, waits for the event thread
+ * to go back to sleep and then checks that:
+ *
+ *  - a registered callback and a pending event never coexist (a lost wakeup);
+ *  - no callback fires twice; and
+ *  - every callback whose registration succeeded eventually fires.
+ *
+ * Compile with -DSRC='"<rendered template>"' and -DSRC_CAP=<cap the event
+ * thread sleeps on>, adding -DQUEUE for seL4NotificationQueue, and run with
+ * the number of rounds as the only argument.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sel4/sel4.h>
+
+/* Cap 1 is a binary notification and any other cap is an endpoint, where each
+ * signal wakes one waiter.
+ */
+static pthread_mutex_t kernel_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kernel_cond = PTHREAD_COND_INITIALIZER;
+static int pending[4];
+
+/* Whether the event thread is blocked on SRC_CAP with nothing pending. */
+static int idle_in_wait;
+
+void fake_wait(seL4_CPtr cap) {
+    pthread_mutex_lock(&kernel_lock);
+    while (!pending[cap]) {
+        if (cap == SRC_CAP) {
+            idle_in_wait = 1;
+        }
+        pthread_cond_wait(&kernel_cond, &kernel_lock);
+    }
+    if (cap == SRC_CAP) {
+        idle_in_wait = 0;
+    }
+    if (cap == 1) {
+        pending[cap] = 0;
+    } else {
+        pending[cap]--;
+    }
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+void fake_signal(seL4_CPtr cap) {
+    pthread_mutex_lock(&kernel_lock);
+    if (cap == 1) {
+        pending[cap] = 1;
+    } else {
+        pending[cap]++;
+    }
+    idle_in_wait = 0;
+    pthread_cond_broadcast(&kernel_cond);
+    pthread_mutex_unlock(&kernel_lock);
+}
+
+#include <sync/sem-bare.h>
+
+/* Widen the windows between the protocol's steps so that a few thousand rounds
+ * cover most of the interleavings.
+ */
+static __thread unsigned seed = 1;
+
+static inline void jitter(void) {
+    seed = seed * 1103515245 + 12345;
+    unsigned r = (seed >> 16) % 8;
+    if (r == 0) {
+        sched_yield();
+    } else {
+        for (volatile unsigned i = 0; i < r * 50; i++);
+    }
+}
+
+#define __atomic_thread_fence(m) (jitter(), __atomic_thread_fence(m), jitter())
+#define sync_sem_bare_post(e, v) (jitter(), sync_sem_bare_post(e, v))
+#define __atomic_load_n(p, m) ({ jitter(); __atomic_load_n(p, m); })
+
+#include SRC
+
+#ifdef QUEUE
+#define EMIT() sync_sem_bare_post(SRC_CAP, value)
+#else
+#define EMIT() fake_signal(SRC_CAP)
+#endif
+
+#define REGISTRANTS 2
+
+static volatile int fired[REGISTRANTS];
+static volatile int registered[REGISTRANTS];
+
+/* Releases the registrants and the emitter together, after which each waits a
+ * random time so that the event lands anywhere within the registrations.
+ */
+static pthread_barrier_t start;
+
+static void start_round(void) {
+    pthread_barrier_wait(&start);
+    for (volatile unsigned i = 0, n = rand() % 2000; i < n; i++);
+}
+
+static void callback(void *arg) {
+    int id = (int)(long)arg;
+    if (fired[id]) {
+        printf("FAIL: callback %d fired twice\n", id);
+        exit(1);
+    }
+    __atomic_store_n(&fired[id], 1, __ATOMIC_RELEASE);
+}
+
+static void *registrant(void *arg) {
+    int id = (int)(long)arg;
+    seed = rand();
+    start_round();
+    registered[id] = ev_reg_callback(callback, arg);
+    return NULL;
+}
+
+static void *emitter(void *arg UNUSED) {
+    start_round();
+    EMIT();
+    return NULL;
+}
+
+static void *event_thread(void *arg UNUSED) {
+    seed = 7;
+    ev__run();
+    return NULL;
+}
+
+/* Wait for the event thread to finish delivering and go back to sleep. */
+static void quiesce(void) {
+    while (true) {
+        pthread_mutex_lock(&kernel_lock);
+        bool idle = idle_in_wait && !pending[SRC_CAP];
+        pthread_mutex_unlock(&kernel_lock);
+        if (idle) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+static bool armed(void) {
+    for (int i = 0; i < CALLBACK_SLOTS; i++) {
+        if (callbacks[i] > CALLBACK_BUSY) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "usage: %s rounds\n", argv[0]);
+        return 1;
+    }
+    int rounds = atoi(argv[1]);
+
+    pthread_barrier_init(&start, NULL, REGISTRANTS + 1);
+
+    pthread_t ev;
+    pthread_create(&ev, NULL, event_thread, NULL);
+    quiesce();
+
+    unsigned long fires = 0, queued = 0, rejected = 0;
+    for (int r = 0; r < rounds; r++) {
+        for (int i = 0; i < REGISTRANTS; i++) {
+            fired[i] = 0;
+        }
+
+        pthread_t t[REGISTRANTS + 1];
+        for (int i = 0; i < REGISTRANTS; i++) {
+            pthread_create(&t[i], NULL, registrant, (void*)(long)i);
+        }
+        pthread_create(&t[REGISTRANTS], NULL, emitter, NULL);
+        for (int i = 0; i <= REGISTRANTS; i++) {
+            pthread_join(t[i], NULL);
+        }
+        quiesce();
+
+        if (armed() && handoff_value > 0) {
+            printf("FAIL: lost wakeup in round %d\n", r);
+            return 1;
+        }
+        if (handoff_value > 0) {
+            queued++;
+        }
+
+        /* Consume the pending event, if any, and fire the remaining
+         * callbacks.
+         */
+        while (ev_poll());
+        for (int i = 0; i < REGISTRANTS; i++) {
+            if (registered[i] != 0) {
+                rejected++;
+            }
+        }
+        while (armed()) {
+            EMIT();
+            quiesce();
+        }
+
+        for (int i = 0; i < REGISTRANTS; i++) {
+            if (registered[i] == 0 && !fired[i]) {
+                printf("FAIL: callback %d never fired in round %d\n", i, r);
+                return 1;
+            }
+            fires += fired[i];
+        }
+    }
+
+    printf("%d rounds OK (%lu callbacks fired, %lu rounds left an event "
+        "queued, %lu registrations rejected)\n", rounds, fires, queued,
+        rejected);
+    return 0;
+}
@@ -33,7 +33,15 @@ sys.path.append(os.path.join(MY_DIR, '../../../../python-capdl'))
 sys.path.append(os.path.join(MY_DIR, '../../..'))
 
 from camkes.internal.tests.utils import CAmkESTest, which
-from camkes.templates.macros import sizeof
+from camkes.templates import sizeof_probe, TemplateError
+from camkes.templates.macros import callback_slots, hardware_irqs, \
+    irq_poll_budget, MAX_CONNECTION_IRQS, sizeof, worker_threads
+
+try:
+    import elftools
+    ELFTOOLS_AVAILABLE = True
+except ImportError:
+    ELFTOOLS_AVAILABLE = False
 
 def uname():
     '''
@@ -48,6 +56,32 @@ def uname():
         return 'x86'
     return machine
 
+class Mock(object):
+    def __init__(self, **kwargs):
+        self.__dict__.update(kwargs)
+
+class Configuration(dict):
+    '''
+    A configuration of instance settings, as the macros see it. Errors point
+    at the setting's entry in `settings_dict`, which here is just its name.
+    '''
+    def __init__(self, settings):
+        super(Configuration, self).__init__(settings)
+        self.settings_dict = dict((instance, dict((k, k) for k in values))
+            for instance, values in settings.items())
+
+    def __getitem__(self, key):
+        return self.get(key, {})
+
+def end(connector='seL4RPCCall'):
+    '''
+    The end of a connection for interface `i` of instance `server`.
+    '''
+    return Mock(instance=Mock(name='server'), interface=Mock(name='i'),
+        parent=Mock(type=Mock(name=connector)))
+
+HARDWARE = Mock(from_instance=Mock(name='hw'), from_interface=Mock(name='irq'))
+
 class TestMacros(CAmkESTest):
 
     @unittest.skipIf(which('g++') is None or uname() not in ('x86', 'x86_64'),
@@ -65,6 +99,130 @@ class TestMacros(CAmkESTest):
 
         self.assertEqual(sz, 4)
 
+    @unittest.skipIf(which('gcc') is None or not ELFTOOLS_AVAILABLE,
+        'gcc or elftools not available')
+    def test_sizeof_batch(self):
+        '''
+        Test that probing the sizes of several types at once gives the same
+        results as probing them individually, that types that cannot be
+        compiled are omitted, and that persisted results are reused.
+        '''
+        types = ['char', 'short', 'int', 'long long', 'void*',
+            'struct camkes_undefined', 'char[17]']
+
+        tmp = self.mkdtemp()
+        old_cache_dir = sizeof_probe.cache_dir
+        sizeof_probe.cache_dir = tmp
+        try:
+            sizes = sizeof_probe.probe_sizeofs(types, 'gcc', [])
+
+            self.assertNotIn('struct camkes_undefined', sizes)
+            for t in (x for x in types if x != 'struct camkes_undefined'):
+                self.assertEqual(sizes[t],
+                    sizeof_probe.probe_sizeof(t, 'gcc', []))
+
+            # A second probe should be answered from the cache without
+            # consulting the compiler.
+            old_try = sizeof_probe.try_compile_symbols
+            def fail(*_):
+                raise Exception('compiler invoked')
+            sizeof_probe.try_compile_symbols = fail
+            try:
+                self.assertEqual(sizeof_probe.probe_sizeofs(types, 'gcc', []),
+                    sizes)
+            finally:
+                sizeof_probe.try_compile_symbols = old_try
+        finally:
+            sizeof_probe.cache_dir = old_cache_dir
+
+    def test_hardware_irqs(self):
+        '''
+        Test that lists of IRQ settings give one IRQ each, sharing any settings
+        that are single values.
+        '''
+        config = Configuration({'hw':{
+            'irq_irq_type':'ioapic',
+            'irq_irq_ioapic':0,
+            'irq_irq_ioapic_pin':[1, 2],
+            'irq_irq_level':1,
+            'irq_irq_polarity':0,
+            'irq_irq_vector':[17, 18],
+        }})
+
+        irqs = hardware_irqs(config, HARDWARE)
+
+        self.assertEqual(irqs, [
+            {'ioapic':0, 'ioapic_pin':1, 'level':1, 'polarity':0, 'vector':17},
+            {'ioapic':0, 'ioapic_pin':2, 'level':1, 'polarity':0, 'vector':18},
+        ])
+
+    def test_hardware_irqs_length_mismatch(self):
+        config = Configuration({'hw':{
+            'irq_irq_type':'isa',
+            'irq_irq_ioapic':0,
+            'irq_irq_ioapic_pin':[1, 2],
+            'irq_irq_vector':[17, 18, 19],
+        }})
+
+        with self.assertRaises(TemplateError):
+            hardware_irqs(config, HARDWARE)
+
+    def test_hardware_irqs_too_many(self):
+        config = Configuration({'hw':{
+            'irq_irq_number':list(range(MAX_CONNECTION_IRQS + 1)),
+        }})
+
+        with self.assertRaises(TemplateError):
+            hardware_irqs(config, HARDWARE)
+
+        config['hw']['irq_irq_number'] = list(range(MAX_CONNECTION_IRQS))
+        self.assertLen(hardware_irqs(config, HARDWARE), MAX_CONNECTION_IRQS)
+
+    def test_hardware_irqs_non_integer(self):
+        for number in ('3', [1, '2'], [1, 2.0]):
+            config = Configuration({'hw':{'irq_irq_number':number}})
+            with self.assertRaises(TemplateError):
+                hardware_irqs(config, HARDWARE)
+
+    def test_irq_poll_budget(self):
+        self.assertIsNone(irq_poll_budget(Configuration({}), end()))
+        self.assertEqual(irq_poll_budget(
+            Configuration({'server':{'i_poll_budget':16}}), end()), 16)
+        for budget in (0, -1, '16'):
+            config = Configuration({'server':{'i_poll_budget':budget}})
+            with self.assertRaises(TemplateError):
+                irq_poll_budget(config, end())
+
+    def test_callback_slots(self):
+        self.assertEqual(callback_slots(Configuration({}), end()), 1)
+        self.assertEqual(callback_slots(Configuration({}), end(), 10), 10)
+        self.assertEqual(callback_slots(
+            Configuration({'server':{'i_callback_slots':4}}), end()), 4)
+        for slots in (0, -1, '4'):
+            config = Configuration({'server':{'i_callback_slots':slots}})
+            with self.assertRaises(TemplateError):
+                callback_slots(config, end())
+
+    def test_worker_threads(self):
+        self.assertEqual(worker_threads(Configuration({}), end()), 1)
+        self.assertEqual(worker_threads(
+            Configuration({'server':{'i_worker_threads':3}}), end()), 3)
+
+    def test_worker_threads_unsupported_connector(self):
+        config = Configuration({'server':{'i_worker_threads':3}})
+
+        with self.assertRaises(TemplateError):
+            worker_threads(config, end('seL4RPC'))
+
+        # Without the setting, any connector has one thread.
+        self.assertEqual(worker_threads(Configuration({}), end('seL4RPC')), 1)
+
+    def test_worker_threads_non_positive(self):
+        for workers in (0, -2, '3'):
+            config = Configuration({'server':{'i_worker_threads':workers}})
+            with self.assertRaises(TemplateError):
+                worker_threads(config, end())
+
     def test_find_unused_macros(self):
         '''
         Find macros intended for the templates that are never actually used in
@@ -14,6 +14,7 @@
 #define _CAMKES_ALLOCATOR_H_
 
 #include <sel4/sel4.h>
+#include <stddef.h>
 #include <stdlib.h>
 
 /* Provide a resource to the (initially empty) cap allocator. You are expected
@@ -23,6 +24,22 @@
 int camkes_provide(seL4_ObjectType type, seL4_CPtr ptr, size_t size,
     unsigned attributes);
 
+/* A resource, as passed to `camkes_provide`. */
+typedef struct {
+    seL4_ObjectType type;
+    seL4_CPtr ptr;
+    size_t size;
+    unsigned attributes;
+} camkes_resource_t;
+
+/* Provide a batch of resources to the cap allocator. This is equivalent to,
+ * but cheaper than, calling `camkes_provide` for each element of `resources`,
+ * which is not referred to after this returns. Returns 0 on success. On
+ * failure (e.g. a cap pointer that has already been provided), none of
+ * `resources` are provided.
+ */
+int camkes_provide_all(const camkes_resource_t *resources, size_t count);
+
 /* Allocate a seL4 object. Flags should be specified as a bitmask of the
  * attributes the caller requires of the object. Returns a pointer to a cap to
  * the object on success or seL4_CapNull on failure.
@@ -34,4 +51,23 @@ seL4_CPtr camkes_alloc(seL4_ObjectType type, size_t size, unsigned flags);
  */
 void camkes_free(seL4_CPtr ptr);
 
+/* Occupancy of the resources of a particular type, size and attributes that
+ * have been provided to the allocator.
+ */
+typedef struct {
+    seL4_ObjectType type;
+    size_t size;
+    unsigned attributes;
+
+    /* Number of resources provided and currently allocated. */
+    size_t total;
+    size_t used;
+} camkes_alloc_bucket_stats_t;
+
+/* Retrieve the occupancy of the allocator. Fills in up to `count` elements of
+ * `stats` and returns the total number of buckets, which may be more than
+ * `count`.
+ */
+size_t camkes_alloc_stats(camkes_alloc_bucket_stats_t *stats, size_t count);
+
 #endif
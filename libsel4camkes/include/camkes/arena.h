@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#ifndef _CAMKES_ARENA_H_
+#define _CAMKES_ARENA_H_
+
+/* A bump allocator for short-lived memory, such as the parameters an RPC
+ * server unmarshals for a single call. Allocations are never freed
+ * individually; `camkes_arena_reset` releases all of them at once. Requests
+ * that do not fit in the arena's buffer are passed to malloc and freed on the
+ * next reset, so an arena can be smaller than the largest request it serves,
+ * or have no buffer at all.
+ *
+ * An arena is not thread safe, but its statistics may be read by other
+ * threads. `high_water` only changes on `camkes_arena_reset` and `fallbacks`
+ * only grows, so these can be read at any time. `used` and `fallback_bytes`
+ * change with every allocation and describe only the allocations since the
+ * last reset.
+ */
+
+#include <assert.h>
+#include <stdalign.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <utils/util.h>
+
+struct camkes_arena_fallback;
+
+typedef struct camkes_arena {
+    char *base;
+    size_t size;
+
+    /* Bytes of the buffer in use since the last reset. */
+    size_t used;
+
+    /* Allocations that did not fit in the buffer and their total size. */
+    struct camkes_arena_fallback *fallback;
+    size_t fallback_bytes;
+
+    /* The most memory requested between two resets, including padding and
+     * requests that fell back to malloc. If this exceeds `size`, a larger
+     * buffer would avoid calling malloc.
+     */
+    size_t high_water;
+
+    /* Number of allocations that fell back to malloc. */
+    size_t fallbacks;
+} camkes_arena_t;
+
+/* Initialise an arena allocating from the `size` bytes at `base`. `base` may
+ * be NULL if `size` is 0, in which case every allocation falls back to malloc.
+ */
+void camkes_arena_init(camkes_arena_t *arena, void *base, size_t size);
+
+/* Allocate memory that does not fit in the arena's buffer. Used by
+ * `camkes_arena_alloc`; there is no need to call this directly.
+ */
+void *camkes_arena_alloc_fallback(camkes_arena_t *arena, size_t bytes);
+
+/* Release everything allocated from the arena since the last reset. */
+void camkes_arena_reset(camkes_arena_t *arena);
+
+/* Allocate `bytes` aligned to `align`, which must be a power of 2 no greater
+ * than that of any standard type. Returns NULL if the buffer is exhausted and
+ * malloc fails.
+ */
+static inline void * UNUSED camkes_arena_alloc(camkes_arena_t *arena,
+        size_t bytes, size_t align) {
+    assert(arena != NULL);
+    assert(align != 0 && (align & (align - 1)) == 0);
+    assert(align <= alignof(max_align_t));
+
+    uintptr_t base = (uintptr_t)arena->base;
+    uintptr_t start = (base + arena->used + align - 1) & ~((uintptr_t)align - 1);
+    size_t offset = start - base;
+    if (arena->base != NULL && offset <= arena->size &&
+            bytes <= arena->size - offset) {
+        arena->used = offset + bytes;
+        return (void*)start;
+    }
+    return camkes_arena_alloc_fallback(arena, bytes);
+}
+
+/* Copy the `length` bytes of `s` into the arena as a NUL-terminated string. */
+static inline char * UNUSED camkes_arena_strndup(camkes_arena_t *arena,
+        const char *s, size_t length) {
+    if (length == SIZE_MAX) {
+        return NULL;
+    }
+    char *copy = camkes_arena_alloc(arena, length + 1, 1);
+    if (copy != NULL) {
+        memcpy(copy, s, length);
+        copy[length] = '\0';
+    }
+    return copy;
+}
+
+#endif
@@ -29,6 +29,13 @@ int camkes_dma_init(void *dma_pool, size_t dma_pool_sz, size_t page_size,
     uintptr_t (*get_paddr)(void *ptr), seL4_CPtr (*get_cptr)(void *ptr))
     NONNULL(1, 4) WARN_UNUSED_RESULT;
 
+/* Register functions serialising access to the DMA pool, which is shared by all
+ * threads of a component. Until this is called, the functions below are not
+ * thread safe. The generated component code does this before calling
+ * `camkes_dma_init`.
+ */
+void camkes_dma_register_lock(int (*lock)(void), int (*unlock)(void));
+
 /**
  * Allocate memory to be used for DMA.
  *
@@ -60,6 +67,50 @@ uintptr_t camkes_dma_get_paddr(void *ptr);
  * if passed a pointer into memory that is not part of a DMA buffer. */
 seL4_CPtr camkes_dma_get_cptr(void *ptr);
 
+/* A pool of fixed-size DMA objects (e.g. ring descriptors or packet buffers),
+ * carved out of the DMA pool when it is created. The physical address of each
+ * object is determined once, up front, and objects are allocated and freed
+ * without locking or searching the DMA pool's free list. Allocation and free
+ * are safe to call concurrently from any thread.
+ */
+typedef struct camkes_dma_pool camkes_dma_pool_t;
+
+/**
+ * Create a pool of DMA objects. Objects are physically contiguous, so the
+ * object size rounded up to the alignment may not exceed the page size of the
+ * DMA pool. Pools are never destroyed; create them during initialisation.
+ *
+ * @param obj_size Size of each object in bytes
+ * @param align Alignment of each object in bytes (0 == none). Must be a power
+ *    of 2
+ * @param count Number of objects in the pool
+ *
+ * @return A new pool or NULL if the DMA pool (or heap) is exhausted or the
+ *    arguments are invalid
+ */
+camkes_dma_pool_t *camkes_dma_pool_create(size_t obj_size, int align,
+    size_t count) WARN_UNUSED_RESULT;
+
+/**
+ * Allocate an object from a DMA object pool.
+ *
+ * @param pool Pool to allocate from
+ * @param paddr If not NULL, receives the physical address of the object
+ *
+ * @return Virtual address of the object or NULL if the pool is empty
+ */
+void *camkes_dma_pool_alloc(camkes_dma_pool_t *pool, uintptr_t *paddr)
+    NONNULL(1) WARN_UNUSED_RESULT;
+
+/**
+ * Return an object to the DMA object pool it was allocated from.
+ *
+ * @param pool Pool the object was allocated from
+ * @param ptr Virtual address of the object (passing NULL is treated as a
+ *    no-op)
+ */
+void camkes_dma_pool_free(camkes_dma_pool_t *pool, void *ptr) NONNULL(1);
+
 /* Initialise a DMA manager for use with libplatsupport. This manager will be
  * backed by the (generated) CAmkES DMA pool. Returns 0 on success.
  *
@@ -84,7 +135,8 @@ typedef struct {
 
     /* The current live (allocated) heap space in bytes. Note that the
      * currently available bytes in the heap can be calculated as
-     * `heap_size - current_outstanding`
+     * `heap_size - current_outstanding`. Buffers held in per-thread caches
+     * (see `cached_allocations`) are included.
      */
     size_t current_outstanding;
 
@@ -95,7 +147,8 @@ typedef struct {
     uint64_t defragmentations;
 
     /* Number of coalescing operations that were performed during
-     * defragmentations.
+     * defragmentations, or, with the segregated allocator, as regions were
+     * freed.
      */
     uint64_t coalesces;
 
@@ -132,6 +185,37 @@ typedef struct {
     /* Minimum alignment constraint (succeeded or failed) in bytes. */
     int minimum_alignment;
 
+    /* Name of the allocator backend in use, "list" or "segregated". See the
+     * CAmkESDMAAllocator build option.
+     */
+    const char *allocator;
+
+    /* Total number of free requests (excluding frees of NULL). */
+    uint64_t total_frees;
+
+    /* Number of free regions examined while searching for space for
+     * allocations. Relative to `total_allocations`, this indicates the
+     * average cost of an allocation under the current workload.
+     */
+    uint64_t regions_searched;
+
+    /* Number of allocations that were carved out of a larger free region. */
+    uint64_t splits;
+
+    /* The current number of free regions and the size in bytes of the largest
+     * of these. Many small regions indicate a fragmented heap. These are
+     * computed on each call to `camkes_dma_stats`.
+     */
+    size_t free_regions;
+    size_t largest_free_region;
+
+    /* Number of allocations and frees served by per-thread caches, without
+     * touching the shared pool. These are not included in the counters
+     * above. Only non-zero with the CAmkESDMAThreadCache build option.
+     */
+    uint64_t cached_allocations;
+    uint64_t cached_frees;
+
 } camkes_dma_stats_t;
 
 /* Retrieve the above statistics for the current DMA heap. This function is
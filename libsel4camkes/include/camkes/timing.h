@@ -14,82 +14,286 @@
 #define _LIBSEL4CAMKES_TIMING_H_
 
 #include <autoconf.h>
-#ifdef CONFIG_CAMKES_CONNECTOR_TIMING
-
 #include <assert.h>
-#include <sel4bench/sel4bench.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+
+#ifdef CONFIG_CAMKES_CONNECTOR_TIMING
+
+#include <camkes/tls.h>
+#include <sel4bench/sel4bench.h>
 #include <utils/util.h>
 
+/* Timing points are identified by their index in the list given to
+ * `TIMING_DEFS`, which the connector templates make available as compile-time
+ * constants. Passing point 0 starts a new iteration. Each thread records into
+ * its own ring buffer of the most recent `TIMING_ITERATIONS` iterations, so
+ * `TIMESTAMP` takes no locks and long-running systems keep recording, with
+ * older iterations overwritten.
+ */
 
 /* This size is arbitrary. */
-#define TIMING_ENTRIES 4096
+#ifndef TIMING_ITERATIONS
+#define TIMING_ITERATIONS 256
+#endif
+
+/* Copy every iteration recorded by each of `threads` threads into `buffer`,
+ * one thread after the other and oldest first, stopping after `max`
+ * iterations. Iterations overwritten while being copied are dropped. Returns
+ * the number of iterations copied.
+ */
+static inline size_t libsel4camkes_timing_export(unsigned long *iterations,
+        const ccnt_t *entries, size_t threads, size_t points, uint64_t *buffer,
+        size_t max) {
+    size_t copied = 0;
+    for (size_t t = 0; t < threads; t++) {
+        unsigned long end = __atomic_load_n(&iterations[t], __ATOMIC_ACQUIRE);
+        unsigned long start = end > TIMING_ITERATIONS ? end - TIMING_ITERATIONS : 0;
+        size_t first = copied;
+        for (unsigned long i = start; i < end && copied < max; i++, copied++) {
+            const ccnt_t *e = &entries[(t * TIMING_ITERATIONS + i % TIMING_ITERATIONS) * points];
+            for (size_t p = 0; p < points; p++) {
+                buffer[copied * points + p] = (uint64_t)e[p];
+            }
+        }
+        /* The slot of iteration i is reused when iteration
+         * i + TIMING_ITERATIONS starts.
+         */
+        unsigned long now = __atomic_load_n(&iterations[t], __ATOMIC_ACQUIRE);
+        if (now > start + TIMING_ITERATIONS) {
+            size_t stale = MIN(now - TIMING_ITERATIONS - start, copied - first);
+            memmove(&buffer[first * points], &buffer[(first + stale) * points],
+                (copied - first - stale) * points * sizeof(*buffer));
+            copied -= stale;
+        }
+    }
+    return copied;
+}
 
-#define TIMING_DEFS(pref, pts...) \
-    static int libsel4camkes_timing_buffer_iteration = -1; \
-    static ccnt_t libsel4camkes_timing_buffer[TIMING_ENTRIES]; \
+/* Rings are indexed by thread index (see `camkes_tls_t`), which starts at 1.
+ * `pref_timing_get_entry` reads the ring of the first thread that has
+ * recorded anything.
+ */
+#define TIMING_DEFS(pref, threads, pts...) \
     static char *libsel4camkes_timing_points[] = { \
         pts \
     }; \
+    static bool libsel4camkes_timing_initialised[(threads) + 1]; \
+    static unsigned long libsel4camkes_timing_iterations[(threads) + 1]; \
+    static ccnt_t libsel4camkes_timing_buffer[(threads) + 1][TIMING_ITERATIONS][ARRAY_SIZE(libsel4camkes_timing_points)]; \
     void pref##_timing_get_points(char ***points, size_t *size) { \
         *points = libsel4camkes_timing_points; \
         *size = ARRAY_SIZE(libsel4camkes_timing_points); \
     } \
     uint64_t pref##_timing_get_entry(unsigned iteration, char *point) { \
-        assert(iteration * ARRAY_SIZE(libsel4camkes_timing_points) < TIMING_ENTRIES); \
-        for (unsigned offset = 0; offset < ARRAY_SIZE(libsel4camkes_timing_points); offset++) { \
-            if (!strcmp(libsel4camkes_timing_points[offset], point)) { \
-                return (uint64_t)libsel4camkes_timing_buffer[iteration * ARRAY_SIZE(libsel4camkes_timing_points) + offset]; \
+        for (unsigned t = 0; t < ARRAY_SIZE(libsel4camkes_timing_iterations); t++) { \
+            unsigned long end = __atomic_load_n(&libsel4camkes_timing_iterations[t], __ATOMIC_ACQUIRE); \
+            if (end == 0) { \
+                continue; \
+            } \
+            if (iteration >= end || iteration + TIMING_ITERATIONS < end) { \
+                /* Not yet recorded or already overwritten. */ \
+                return 0; \
+            } \
+            for (unsigned offset = 0; offset < ARRAY_SIZE(libsel4camkes_timing_points); offset++) { \
+                if (!strcmp(libsel4camkes_timing_points[offset], point)) { \
+                    return (uint64_t)libsel4camkes_timing_buffer[t][iteration % TIMING_ITERATIONS][offset]; \
+                } \
             } \
+            /* Named point not found. */ \
+            return 0; \
         } \
-        /* Named point not found. */ \
         return 0; \
     } \
+    size_t pref##_timing_export(uint64_t *buffer, size_t iterations) { \
+        return libsel4camkes_timing_export(libsel4camkes_timing_iterations, \
+            &libsel4camkes_timing_buffer[0][0][0], \
+            ARRAY_SIZE(libsel4camkes_timing_iterations), \
+            ARRAY_SIZE(libsel4camkes_timing_points), buffer, iterations); \
+    } \
     void pref##_timing_reset(void) { \
-        libsel4camkes_timing_buffer_iteration = -1; \
-        memset(libsel4camkes_timing_buffer, 0, sizeof(ccnt_t) * TIMING_ENTRIES); \
+        memset(libsel4camkes_timing_iterations, 0, sizeof(libsel4camkes_timing_iterations)); \
+        memset(libsel4camkes_timing_buffer, 0, sizeof(libsel4camkes_timing_buffer)); \
     }
 
 #define TIMESTAMP(point) \
     do { \
-        static bool noted = false; \
-        static int index; \
-        if (!noted) { \
-            for (index = 0; index < ARRAY_SIZE(libsel4camkes_timing_points); index++) { \
-                if (!strcmp(libsel4camkes_timing_points[index], point)) { \
-                    break; \
+        static_assert((point) < ARRAY_SIZE(libsel4camkes_timing_points), \
+            "invalid timing point"); \
+        unsigned _thread = camkes_get_tls()->thread_index; \
+        if (_thread < ARRAY_SIZE(libsel4camkes_timing_iterations)) { \
+            unsigned long _iterations = libsel4camkes_timing_iterations[_thread]; \
+            if ((point) == 0) { \
+                if (unlikely(!libsel4camkes_timing_initialised[_thread])) { \
+                    sel4bench_init(); \
+                    libsel4camkes_timing_initialised[_thread] = true; \
                 } \
+                _iterations++; \
+                __atomic_store_n(&libsel4camkes_timing_iterations[_thread], _iterations, __ATOMIC_RELEASE); \
+            } \
+            if (_iterations > 0) { \
+                libsel4camkes_timing_buffer[_thread][(_iterations - 1) % TIMING_ITERATIONS][(point)] = sel4bench_get_cycle_count(); \
             } \
-            assert(index < ARRAY_SIZE(libsel4camkes_timing_points)); \
-            noted = true; \
-        } \
-        if (index == 0) { \
-            sel4bench_init(); \
-            libsel4camkes_timing_buffer_iteration++; \
-        } \
-        if (libsel4camkes_timing_buffer_iteration * ARRAY_SIZE(libsel4camkes_timing_points) + index < TIMING_ENTRIES) { \
-            libsel4camkes_timing_buffer[libsel4camkes_timing_buffer_iteration * ARRAY_SIZE(libsel4camkes_timing_points) + index] = sel4bench_get_cycle_count(); \
         } \
     } while (0)
 
 #else
 
-#define TIMING_DEFS(pref, pts...) \
-    void pref##timing_get_points(char ***points, size_t *size) { \
+#define TIMING_DEFS(pref, threads, pts...) \
+    void pref##_timing_get_points(char ***points, size_t *size) { \
         *points = NULL; \
         *size = 0; \
     } \
-    uint64_t pref##timing_get_entry(unsigned iteration, char *point) { \
+    uint64_t pref##_timing_get_entry(unsigned iteration, char *point) { \
         return 0; \
     } \
-    void pref##timing_reset(void) { \
+    size_t pref##_timing_export(uint64_t *buffer, size_t iterations) { \
+        return 0; \
+    } \
+    void pref##_timing_reset(void) { \
     }
 
 #define TIMESTAMP(point) /* nothing */
 
 #endif
 
+/* Latency histograms. With CONFIG_CAMKES_CONNECTOR_TIMING_HISTOGRAMS, the
+ * time between each pair of consecutive timing points (a phase) of every
+ * method of an interface is counted in a log-linear histogram, as in
+ * HdrHistogram. Values below 2^TIMING_HISTOGRAM_SUB_BITS cycles have a bucket
+ * each. Above that, each power of 2 is split into 2^TIMING_HISTOGRAM_SUB_BITS
+ * buckets, so the recorded value of a sample is within 1/16 of its true value.
+ * Values of 2^32 cycles or more are counted in the last bucket. Memory use is
+ * constant: one array of counts per method and phase.
+ *
+ * The histograms of an interface are laid out contiguously after a header,
+ * and can be decoded from a memory dump with tools/timing_histograms.py. The
+ * header is found by its magic and records the byte order and layout of what
+ * follows:
+ *
+ *   camkes_timing_histograms_t  header
+ *   char[methods][32]           method names
+ *   char[points][32]            point names
+ *   uint32_t[methods][points - 1][buckets]
+ *                               counts, at `counts_offset` from the header
+ */
+
+#define CAMKES_TIMING_HISTOGRAMS_MAGIC "CAmkEStH"
+#define CAMKES_TIMING_HISTOGRAMS_BYTE_ORDER 0x01020304
+#define CAMKES_TIMING_HISTOGRAM_NAME 32
+
+#define TIMING_HISTOGRAM_SUB_BITS 4
+#define TIMING_HISTOGRAM_BUCKETS ((32 - TIMING_HISTOGRAM_SUB_BITS + 1) << TIMING_HISTOGRAM_SUB_BITS)
+
+typedef struct camkes_timing_histograms {
+    char magic[8];
+    uint32_t byte_order;
+    uint32_t sub_bucket_bits;
+    uint32_t buckets;
+    uint32_t methods;
+    uint32_t points;
+    uint32_t counts_offset;
+    char interface[CAMKES_TIMING_HISTOGRAM_NAME];
+} camkes_timing_histograms_t;
+
+/* Counts of phase `phase` (between points `phase` and `phase + 1`) of method
+ * `method`.
+ */
+static inline const uint32_t *camkes_timing_histogram(
+        const camkes_timing_histograms_t *histograms, unsigned method,
+        unsigned phase) {
+    assert(method < histograms->methods && phase + 1 < histograms->points);
+    const uint32_t *counts = (const void*)histograms + histograms->counts_offset;
+    return &counts[(method * (histograms->points - 1) + phase) * histograms->buckets];
+}
+
+#ifdef CONFIG_CAMKES_CONNECTOR_TIMING_HISTOGRAMS
+
+#include <camkes/tls.h>
+#include <sel4bench/sel4bench.h>
+#include <utils/util.h>
+
+static inline unsigned libsel4camkes_timing_histogram_bucket(ccnt_t cycles) {
+    uint32_t value = cycles > UINT32_MAX ? UINT32_MAX : (uint32_t)cycles;
+    if (value < BIT(TIMING_HISTOGRAM_SUB_BITS)) {
+        return value;
+    }
+    unsigned shift = 31 - __builtin_clz(value) - TIMING_HISTOGRAM_SUB_BITS;
+    return ((shift + 1) << TIMING_HISTOGRAM_SUB_BITS) + (value >> shift) -
+        BIT(TIMING_HISTOGRAM_SUB_BITS);
+}
+
+/* `point_names` is a macro expanding to the names of the timing points, as
+ * given to `TIMING_DEFS`, and `method_names` are the names of the methods of
+ * the interface.
+ * As for the ring buffers, each thread's last timestamp is kept by thread
+ * index.
+ */
+#define TIMING_HISTOGRAM_DEFS(pref, name, threads, point_names, method_names...) \
+    static const char *libsel4camkes_timing_histogram_points[] = { point_names }; \
+    static const char *libsel4camkes_timing_histogram_methods[] = { method_names }; \
+    static struct { \
+        camkes_timing_histograms_t header; \
+        char methods[ARRAY_SIZE(libsel4camkes_timing_histogram_methods)][CAMKES_TIMING_HISTOGRAM_NAME]; \
+        char points[ARRAY_SIZE(libsel4camkes_timing_histogram_points)][CAMKES_TIMING_HISTOGRAM_NAME]; \
+        uint32_t counts[ARRAY_SIZE(libsel4camkes_timing_histogram_methods)][ARRAY_SIZE(libsel4camkes_timing_histogram_points) - 1][TIMING_HISTOGRAM_BUCKETS]; \
+    } libsel4camkes_timing_histograms = { \
+        .header = { \
+            .magic = CAMKES_TIMING_HISTOGRAMS_MAGIC, \
+            .byte_order = CAMKES_TIMING_HISTOGRAMS_BYTE_ORDER, \
+            .sub_bucket_bits = TIMING_HISTOGRAM_SUB_BITS, \
+            .buckets = TIMING_HISTOGRAM_BUCKETS, \
+            .methods = ARRAY_SIZE(libsel4camkes_timing_histogram_methods), \
+            .points = ARRAY_SIZE(libsel4camkes_timing_histogram_points), \
+            .counts_offset = offsetof(typeof(libsel4camkes_timing_histograms), counts), \
+            .interface = name, \
+        }, \
+        .methods = { method_names }, \
+        .points = { point_names }, \
+    }; \
+    static bool libsel4camkes_timing_histogram_initialised[(threads) + 1]; \
+    static ccnt_t libsel4camkes_timing_histogram_last[(threads) + 1]; \
+    const camkes_timing_histograms_t *pref##_timing_histograms(void) { \
+        return &libsel4camkes_timing_histograms.header; \
+    } \
+    void pref##_timing_histograms_reset(void) { \
+        memset(libsel4camkes_timing_histograms.counts, 0, sizeof(libsel4camkes_timing_histograms.counts)); \
+    }
+
+#define TIMING_HISTOGRAM_POINT(method, point) \
+    do { \
+        static_assert((point) < ARRAY_SIZE(libsel4camkes_timing_histogram_points), \
+            "invalid timing point"); \
+        unsigned _thread = camkes_get_tls()->thread_index; \
+        if (_thread < ARRAY_SIZE(libsel4camkes_timing_histogram_last)) { \
+            if ((point) == 0 && unlikely(!libsel4camkes_timing_histogram_initialised[_thread])) { \
+                sel4bench_init(); \
+                libsel4camkes_timing_histogram_initialised[_thread] = true; \
+            } \
+            ccnt_t _now = sel4bench_get_cycle_count(); \
+            if ((point) != 0 && libsel4camkes_timing_histogram_initialised[_thread]) { \
+                unsigned _bucket = libsel4camkes_timing_histogram_bucket(_now - libsel4camkes_timing_histogram_last[_thread]); \
+                __atomic_fetch_add(&libsel4camkes_timing_histograms.counts[(method)][(point) == 0 ? 0 : (point) - 1][_bucket], \
+                    1, __ATOMIC_RELAXED); \
+            } \
+            libsel4camkes_timing_histogram_last[_thread] = _now; \
+        } \
+    } while (0)
+
+#else
+
+#define TIMING_HISTOGRAM_DEFS(pref, name, threads, point_names, method_names...) \
+    const camkes_timing_histograms_t *pref##_timing_histograms(void) { \
+        return NULL; \
+    } \
+    void pref##_timing_histograms_reset(void) { \
+    }
+
+#define TIMING_HISTOGRAM_POINT(method, point) /* nothing */
+
+#endif
+
 #endif
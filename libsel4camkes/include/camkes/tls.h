@@ -15,13 +15,26 @@
 
 /* Thread-local storage functionality for CAmkES. */
 
+#include <autoconf.h>
 #include <assert.h>
+#include <camkes/arena.h>
 #include <sel4/sel4.h>
 #include <stdalign.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <utils/util.h>
 
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+/* Per-thread caches of free DMA buffers, one per size class. See dma.c. */
+#define CAMKES_DMA_MAGAZINES 7
+#define CAMKES_DMA_MAGAZINE_SIZE 8
+
+typedef struct {
+    unsigned count;
+    void *objects[CAMKES_DMA_MAGAZINE_SIZE];
+} camkes_dma_magazine_t;
+#endif
+
 /* Extend this struct as required. */
 typedef struct camkes_tls_t {
     seL4_CPtr tcb_cap;
@@ -38,6 +51,15 @@ typedef struct camkes_tls_t {
     bool reply_cap_in_tcb;
     seL4_Error reply_cap_save_error;
 
+    /* Memory for the parameters of the RPC call this thread is serving, reset
+     * after each reply. See rpc-connector-common-to.c.
+     */
+    camkes_arena_t rpc_arena;
+
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+    camkes_dma_magazine_t dma_magazines[CAMKES_DMA_MAGAZINES];
+#endif
+
 } camkes_tls_t;
 
 static inline camkes_tls_t * UNUSED camkes_get_tls(void) {
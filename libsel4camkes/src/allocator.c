@@ -14,42 +14,200 @@
 #include <camkes/allocator.h>
 #include <sel4/sel4.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <utils/util.h>
 
-/* Super dumb (and simple) bookkeeping where we keep everything in a single
- * linked-list and search this every time we need to alloc/free.
+/* Resources are kept in buckets of identical type, size and attributes. Each
+ * bucket has a free list, so allocation only has to find a suitable bucket, of
+ * which there are generally a handful. Freeing finds a resource through a hash
+ * table indexed by its cap pointer.
  */
+typedef struct _bucket bucket_t;
+
 typedef struct _node {
-    seL4_ObjectType type;
-    size_t size;
     seL4_CPtr ptr;
     bool used;
-    unsigned attributes;
+    bucket_t *bucket;
 
+    /* Next free resource in the bucket. */
     struct _node *next;
 } node_t;
-static node_t *resources;
 
-int camkes_provide(seL4_ObjectType type, seL4_CPtr ptr, size_t size,
+struct _bucket {
+    seL4_ObjectType type;
+    size_t size;
+    unsigned attributes;
+
+    node_t *free;
+    size_t total;
+    size_t used;
+
+    bucket_t *next;
+};
+static bucket_t *buckets;
+static size_t bucket_count;
+
+/* Open-addressed table of every resource, keyed by cap pointer. Its capacity
+ * is a power of 2 and it is kept at most half full.
+ */
+static node_t **table;
+static size_t table_capacity;
+static size_t table_count;
+
+static size_t hash(seL4_CPtr ptr) {
+    /* Fibonacci hashing. Cap pointers are generally allocated sequentially, so
+     * make sure consecutive ones are spread across the table.
+     */
+    return (size_t)((uint64_t)ptr * 0x9e3779b97f4a7c15ull >> 32);
+}
+
+static node_t **table_slot(node_t **t, size_t capacity, seL4_CPtr ptr) {
+    for (size_t i = hash(ptr) & (capacity - 1); ; i = (i + 1) & (capacity - 1)) {
+        if (t[i] == NULL || t[i]->ptr == ptr) {
+            return &t[i];
+        }
+    }
+}
+
+static int table_reserve(size_t extra) {
+    if ((table_count + extra) * 2 <= table_capacity) {
+        return 0;
+    }
+    size_t capacity = table_capacity == 0 ? 16 : table_capacity;
+    while ((table_count + extra) * 2 > capacity) {
+        capacity *= 2;
+    }
+    node_t **new_table = calloc(capacity, sizeof(*new_table));
+    if (new_table == NULL) {
+        return -1;
+    }
+    for (size_t i = 0; i < table_capacity; i++) {
+        if (table[i] != NULL) {
+            *table_slot(new_table, capacity, table[i]->ptr) = table[i];
+        }
+    }
+    free(table);
+    table = new_table;
+    table_capacity = capacity;
+    return 0;
+}
+
+static void table_remove(seL4_CPtr ptr) {
+    node_t **slot = table_slot(table, table_capacity, ptr);
+    assert(*slot != NULL);
+    *slot = NULL;
+    table_count--;
+
+    /* Re-insert the rest of the probe sequence, so lookups passing over the
+     * hole we just left still find it.
+     */
+    size_t mask = table_capacity - 1;
+    for (size_t i = (slot - table + 1) & mask; table[i] != NULL;
+            i = (i + 1) & mask) {
+        node_t *n = table[i];
+        table[i] = NULL;
+        *table_slot(table, table_capacity, n->ptr) = n;
+    }
+}
+
+static bucket_t *find_bucket(seL4_ObjectType type, size_t size,
         unsigned attributes) {
-    node_t *n = calloc(1, sizeof(*n));
-    if (n == NULL) {
+    for (bucket_t *b = buckets; b != NULL; b = b->next) {
+        if (b->type == type && b->size == size && b->attributes == attributes) {
+            return b;
+        }
+    }
+    bucket_t *b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        return NULL;
+    }
+    b->type = type;
+    b->size = size;
+    b->attributes = attributes;
+    b->next = buckets;
+    buckets = b;
+    bucket_count++;
+    return b;
+}
+
+int camkes_provide_all(const camkes_resource_t *resources, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    /* Reserve everything we need up front, so we never leave the allocator
+     * with some of these resources but not others.
+     */
+    if (table_reserve(count) != 0) {
         return -1;
     }
+    node_t *nodes = calloc(count, sizeof(*nodes));
+    if (nodes == NULL) {
+        return -1;
+    }
+    bucket_t *old_buckets = buckets;
 
-    n->type = type;
-    n->size = size;
-    n->ptr = ptr;
-    n->attributes = attributes;
-    n->next = resources;
-    resources = n;
+    for (size_t i = 0; i < count; i++) {
+        const camkes_resource_t *r = &resources[i];
+        node_t **slot = table_slot(table, table_capacity, r->ptr);
+        bucket_t *b = *slot != NULL ? NULL :
+            find_bucket(r->type, r->size, r->attributes);
+        if (b == NULL) {
+            /* A duplicate cap pointer or we are out of memory. Unwind the
+             * resources of this batch we have already linked, most recent
+             * first so each is at the head of its bucket's free list, and
+             * then any buckets we created for them.
+             */
+            while (i-- > 0) {
+                node_t *n = &nodes[i];
+                table_remove(n->ptr);
+                assert(n->bucket->free == n);
+                n->bucket->free = n->next;
+                n->bucket->total--;
+            }
+            while (buckets != old_buckets) {
+                bucket_t *created = buckets;
+                assert(created->total == 0);
+                buckets = created->next;
+                bucket_count--;
+                free(created);
+            }
+            free(nodes);
+            return -1;
+        }
+        node_t *n = &nodes[i];
+        n->ptr = r->ptr;
+        n->bucket = b;
+        n->next = b->free;
+        b->free = n;
+        b->total++;
+        *slot = n;
+        table_count++;
+    }
     return 0;
 }
 
+int camkes_provide(seL4_ObjectType type, seL4_CPtr ptr, size_t size,
+        unsigned attributes) {
+    camkes_resource_t r = {
+        .type = type,
+        .ptr = ptr,
+        .size = size,
+        .attributes = attributes,
+    };
+    return camkes_provide_all(&r, 1);
+}
+
 seL4_CPtr camkes_alloc(seL4_ObjectType type, size_t size, unsigned flags) {
-    for (node_t *n = resources; n != NULL; n = n->next) {
-        if (n->type == type && !n->used && (n->attributes & flags) == flags &&
-                (size == 0 || size == n->size)) {
+    for (bucket_t *b = buckets; b != NULL; b = b->next) {
+        if (b->type == type && b->free != NULL &&
+                (b->attributes & flags) == flags &&
+                (size == 0 || size == b->size)) {
+            node_t *n = b->free;
+            b->free = n->next;
+            b->used++;
             n->used = true;
             return n->ptr;
         }
@@ -58,12 +216,32 @@ seL4_CPtr camkes_alloc(seL4_ObjectType type, size_t size, unsigned flags) {
 }
 
 void camkes_free(seL4_CPtr ptr) {
-    for (node_t *n = resources; n != NULL; n = n->next) {
-        if (n->ptr == ptr) {
-            assert(n->used && "double free of a cap pointer");
-            n->used = false;
-            return;
-        }
+    node_t *n = table_capacity == 0 ? NULL :
+        *table_slot(table, table_capacity, ptr);
+    if (n == NULL) {
+        assert(!"free of a cap pointer that was never allocated");
+        return;
+    }
+    assert(n->used && "double free of a cap pointer");
+    if (!n->used) {
+        return;
+    }
+    n->used = false;
+    n->next = n->bucket->free;
+    n->bucket->free = n;
+    n->bucket->used--;
+}
+
+size_t camkes_alloc_stats(camkes_alloc_bucket_stats_t *stats, size_t count) {
+    size_t i = 0;
+    for (bucket_t *b = buckets; b != NULL && i < count; b = b->next, i++) {
+        stats[i] = (camkes_alloc_bucket_stats_t){
+            .type = b->type,
+            .size = b->size,
+            .attributes = b->attributes,
+            .total = b->total,
+            .used = b->used,
+        };
     }
-    assert(!"free of a cap pointer that was never allocated");
+    return bucket_count;
 }
@@ -0,0 +1,73 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#include <assert.h>
+#include <camkes/arena.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+/* Header of an allocation that did not fit in an arena's buffer. The data
+ * follows it, aligned for any standard type.
+ */
+struct camkes_arena_fallback {
+    struct camkes_arena_fallback *next;
+    max_align_t data[];
+};
+
+void camkes_arena_init(camkes_arena_t *arena, void *base, size_t size) {
+    assert(arena != NULL);
+    assert(base != NULL || size == 0);
+    arena->base = base;
+    arena->size = size;
+    arena->used = 0;
+    arena->fallback = NULL;
+    arena->fallback_bytes = 0;
+    arena->high_water = 0;
+    arena->fallbacks = 0;
+}
+
+void *camkes_arena_alloc_fallback(camkes_arena_t *arena, size_t bytes) {
+    assert(arena != NULL);
+
+    if (bytes > SIZE_MAX - sizeof(struct camkes_arena_fallback)) {
+        return NULL;
+    }
+    struct camkes_arena_fallback *f =
+        malloc(sizeof(struct camkes_arena_fallback) + bytes);
+    if (f == NULL) {
+        return NULL;
+    }
+
+    f->next = arena->fallback;
+    arena->fallback = f;
+    arena->fallback_bytes += bytes;
+    arena->fallbacks++;
+    return f->data;
+}
+
+void camkes_arena_reset(camkes_arena_t *arena) {
+    assert(arena != NULL);
+
+    size_t requested = arena->used + arena->fallback_bytes;
+    if (requested > arena->high_water) {
+        arena->high_water = requested;
+    }
+
+    while (arena->fallback != NULL) {
+        struct camkes_arena_fallback *next = arena->fallback->next;
+        free(arena->fallback);
+        arena->fallback = next;
+    }
+    arena->fallback_bytes = 0;
+    arena->used = 0;
+}
@@ -14,6 +14,7 @@
  * generated code to provide complete functionality.
  */
 
+#include <autoconf.h>
 #include <assert.h>
 #include <limits.h>
 #include <platsupport/io.h>
@@ -23,22 +24,37 @@
 #include <stdlib.h>
 #include <string.h>
 #include <camkes/dma.h>
+#include <camkes/tls.h>
 #include <utils/util.h>
 #include <sel4/sel4.h>
 
-/* NOT THREAD SAFE. The code could be made thread safe relatively easily by
- * operating atomically on the free list.
- */
-
-/* We store the free list as a linked-list. If 'head' is NULL that implies we
- * have exhausted our allocation pool.
+/* The free list(s) are shared by all threads of a component and are only
+ * thread safe if the generated code has registered a lock (see
+ * `camkes_dma_register_lock`). With CONFIG_CAMKES_DMA_THREAD_CACHE, each
+ * thread additionally caches recently freed small buffers in its TLS region,
+ * so that a thread that frees and re-allocates buffers of the same size does
+ * not touch the shared pool or its lock at all.
+ *
+ * There are two allocator backends, selected at build time:
+ *
+ *  list       A single unsorted free list, searched first-fit. Adjacent free
+ *             regions are only coalesced when an allocation fails. This is the
+ *             default.
+ *  segregated Free regions are kept in size-class bins and coalesced with
+ *             their neighbours as they are freed. See the
+ *             CONFIG_CAMKES_DMA_ALLOCATOR_SEGREGATED section below.
  */
-static void *head;
 
 /* This function will be supplied to us at initialisation of the DMA pool. */
 static uintptr_t (*to_paddr)(void *ptr);
 static seL4_CPtr (*to_cptr)(void *ptr);
 
+/* Size of the largest aligned blocks of the DMA pool that are known to be
+ * physically contiguous. This is the page size given at initialisation, or
+ * the smallest page size if none was given.
+ */
+static size_t contiguous_size;
+
 /* A node in the free list. Note that the free list is stored as a linked-list
  * of such nodes *within* the DMA pages themselves. This struct is deliberately
  * arranged to be tightly packed (the non-word sized member at the end) so that
@@ -65,6 +81,13 @@ typedef struct {
     /* The next node in the list. */
     void *next;
 
+#ifdef CONFIG_CAMKES_DMA_ALLOCATOR_SEGREGATED
+    /* The previous node in the list, so a region can be unlinked from its bin
+     * without a search when its neighbour is freed.
+     */
+    void *prev;
+#endif
+
     /* The upper bits of the physical address of this region. We don't need to
      * store the lower bits (the offset into the physical frame) because we can
      * reconstruct these from the offset into the page, obtainable as described
@@ -102,6 +125,44 @@ static uintptr_t extract_paddr(region_t *r) {
     return paddr;
 }
 
+#ifdef NDEBUG
+    #define STATS(arg) do { } while (0)
+#else
+    /* Statistics functionality. */
+
+    #define STATS(arg) do { arg; } while (0)
+
+    static camkes_dma_stats_t stats;
+
+    static size_t total_allocation_bytes;
+
+    static void count_free_regions(size_t *count, size_t *largest);
+    static void lock(void);
+    static void unlock(void);
+
+    const camkes_dma_stats_t *camkes_dma_stats(void) {
+        /* Walking the free regions races with other threads allocating and
+         * freeing, so take the pool lock.
+         */
+        lock();
+        if (stats.total_allocations > 0) {
+            stats.average_allocation = total_allocation_bytes / stats.total_allocations;
+        } else {
+            stats.average_allocation = 0;
+        }
+        count_free_regions(&stats.free_regions, &stats.largest_free_region);
+        unlock();
+        return (const camkes_dma_stats_t*)&stats;
+    }
+#endif
+
+#ifndef CONFIG_CAMKES_DMA_ALLOCATOR_SEGREGATED
+
+/* We store the free list as a linked-list. If 'head' is NULL that implies we
+ * have exhausted our allocation pool.
+ */
+static void *head;
+
 /* Various helpers for dealing with the above data structure layout. */
 static void prepend_node(region_t *node) {
     assert(node != NULL);
@@ -198,27 +259,6 @@ static void check_consistency(void) {
     }
 }
 
-#ifdef NDEBUG
-    #define STATS(arg) do { } while (0)
-#else
-    /* Statistics functionality. */
-
-    #define STATS(arg) do { arg; } while (0)
-
-    static camkes_dma_stats_t stats;
-
-    static size_t total_allocation_bytes;
-
-    const camkes_dma_stats_t *camkes_dma_stats(void) {
-        if (stats.total_allocations > 0) {
-            stats.average_allocation = total_allocation_bytes / stats.total_allocations;
-        } else {
-            stats.average_allocation = 0;
-        }
-        return (const camkes_dma_stats_t*)&stats;
-    }
-#endif
-
 /* Defragment the free list. Can safely be called at any time. The complexity
  * of this function is at least O(n²).
  *
@@ -321,120 +361,6 @@ static void defrag(void) {
     check_consistency();
 }
 
-int camkes_dma_init(void *dma_pool, size_t dma_pool_sz, size_t page_size,
-        uintptr_t (*get_paddr)(void *ptr), seL4_CPtr (*get_cptr)(void *ptr)) {
-    /* We should not have already initialised our bookkeeping. */
-    assert(head == NULL);
-
-    /* The caller should have passed us a valid DMA pool. */
-    if (page_size != 0 && (page_size <= sizeof(region_t) ||
-                           (uintptr_t)dma_pool % page_size != 0))  {
-        return -1;
-    }
-
-    /* Bail out if the caller gave us an insufficiently aligned pool. */
-    if (dma_pool == NULL || (uintptr_t)dma_pool % alignof(region_t) != 0) {
-        return -1;
-    }
-
-    /* We're going to store bookkeeping in the DMA pages, that we expect to be
-     * power-of-2-sized, so the bookkeeping struct better be
-     * power-of-2-aligned. Your compiler should always guarantee this.
-     */
-    static_assert(IS_POWER_OF_2(alignof(region_t)),
-        "region_t is not power-of-2-aligned");
-
-    /* The page size the caller has given us should be a power of 2 and at least
-     * the alignment of `region_t`.
-     */
-    if (page_size != 0 && (!IS_POWER_OF_2(page_size) ||
-                           page_size < alignof(region_t))) {
-        return -1;
-    }
-
-    to_paddr = get_paddr;
-    to_cptr = get_cptr;
-
-    STATS(stats.heap_size = dma_pool_sz);
-    STATS(stats.minimum_heap_size = dma_pool_sz);
-    STATS(stats.minimum_allocation = SIZE_MAX);
-    STATS(stats.minimum_alignment = INT_MAX);
-
-    if (page_size != 0) {
-        /* The caller specified a page size. Excellent; we don't have to work
-         * it out for ourselves.
-         */
-        for (void *base = dma_pool; base < dma_pool + dma_pool_sz;
-                base += page_size) {
-            assert((uintptr_t)base % alignof(region_t) == 0 &&
-                "we misaligned the DMA pool base address during "
-                "initialisation");
-            camkes_dma_free(base, page_size);
-        }
-    } else {
-        /* The lazy caller didn't bother giving us a page size. Manually scan
-         * for breaks in physical contiguity.
-         */
-        for (void *base = dma_pool; base < dma_pool + dma_pool_sz;) {
-            uintptr_t base_paddr = get_paddr(base);
-            if (base_paddr == 0) {
-                /* The caller gave us a region backed by non-reversible frames. */
-                return -1;
-            }
-            void *limit = base + 1;
-            uintptr_t next_expected_paddr = base_paddr + 1;
-            while (limit < dma_pool + dma_pool_sz) {
-                if (limit == NULL) {
-                    /* The user gave us a region that wraps virtual memory. */
-                    return -1;
-                }
-                uintptr_t limit_paddr = get_paddr(limit);
-                if (limit_paddr == 0) {
-                    /* The user gave us a region that wraps physical memory. */
-                    return -1;
-                }
-                if (limit_paddr != next_expected_paddr) {
-                    /* We've hit a physical contiguity break (== frame
-                     * boundary).
-                     */
-                    break;
-                }
-                limit++;
-                next_expected_paddr++;
-            }
-            /* Only add the region if it's large enough to actually contain the
-             * necessary metadata.
-             */
-            if (base + sizeof(region_t) >= limit) {
-                assert((uintptr_t)base % alignof(region_t) == 0 &&
-                    "we misaligned the DMA pool base address during "
-                    "initialisation");
-                camkes_dma_free(base, limit - base);
-            }
-
-            /* Move to the next region. We always need to be considering a
-             * region aligned for bookkeeping, so bump the address up if
-             * necessary.
-             */
-            base = (void*)ALIGN_UP((uintptr_t)limit, alignof(region_t));
-        }
-    }
-
-    check_consistency();
-
-    return 0;
-}
-
-uintptr_t camkes_dma_get_paddr(void *ptr) {
-    assert(to_paddr != NULL);
-    return to_paddr(ptr);
-}
-
-seL4_CPtr camkes_dma_get_cptr(void *ptr) {
-    assert(to_cptr != NULL);
-    return to_cptr(ptr);
-}
-
 /* Allocate a DMA region. This is refactored out of camkes_dma_alloc simply so
  * we can more eloquently express reattempting allocations.
  */
@@ -458,6 +384,8 @@ static void *alloc(size_t size, int align) {
     /* For each region in the free list... */
     for (region_t *prev = NULL, *p = head; p != NULL; prev = p, p = p->next) {
 
+        STATS(stats.regions_searched++);
+
         if (p->size >= size) {
             /* This region or a subinterval of it may satisfy this request. */
 
@@ -504,12 +432,14 @@ static void *alloc(size_t size, int align) {
                             }
                             r->size = p->size - size;
                             replace_node(prev, p, r);
+                            STATS(stats.splits++);
                         }
                     } else if (q + size == (void*)p + p->size) {
                         /* 3. We're giving them the end of the chunk. We need
                          * to shrink the existing node.
                          */
                         shrink_node(p, size);
+                        STATS(stats.splits++);
                     } else {
                         /* 4. We're giving them the middle of a chunk. We need
                          * to shrink the existing node and extract the end as a
@@ -526,6 +456,7 @@ static void *alloc(size_t size, int align) {
                         end->size = p->size - size - start_size;
                         prepend_node(end);
                         p->size = start_size;
+                        STATS(stats.splits++);
                     }
 
                     return q;
@@ -538,30 +469,21 @@ static void *alloc(size_t size, int align) {
     return NULL;
 }
 
-void *camkes_dma_alloc(size_t size, int align) {
+static int init_pool(void *dma_pool UNUSED, size_t dma_pool_sz UNUSED,
+        size_t page_size UNUSED) {
+    /* We should not have already initialised our bookkeeping. */
+    assert(head == NULL);
+    return 0;
+}
 
-    STATS(({
-        stats.total_allocations++;
-        if (size < stats.minimum_allocation) {
-            stats.minimum_allocation = size;
-        }
-        if (size > stats.maximum_allocation) {
-            stats.maximum_allocation = size;
-        }
-        if (align < stats.minimum_alignment) {
-            stats.minimum_alignment = align;
-        }
-        if (align > stats.maximum_alignment) {
-            stats.maximum_alignment = align;
-        }
-        total_allocation_bytes += size;
-    }));
+static bool pool_empty(void) {
+    return head == NULL;
+}
 
-    if (head == NULL) {
-        /* Nothing in the free list. */
-        STATS(stats.failed_allocations_out_of_memory++);
-        return NULL;
-    }
+/* Allocate a DMA region on behalf of `camkes_dma_alloc`. On success, `size` is
+ * updated to the number of bytes actually consumed from the pool.
+ */
+static void *allocate(size_t *size, int align) {
 
     if (align == 0) {
         /* No alignment requirements. */
@@ -577,30 +499,30 @@ void *camkes_dma_alloc(size_t size, int align) {
         align = alignof(region_t);
     }
 
-    if (size < sizeof(region_t)) {
+    if (*size < sizeof(region_t)) {
         /* We need to bump up smaller allocations because they may be freed at
          * a point when they cannot be conjoined with another chunk in the heap
          * and therefore need to become host to region_t metadata.
          */
-        size = sizeof(region_t);
+        *size = sizeof(region_t);
     }
 
-    if (size % alignof(region_t) != 0) {
+    if (*size % alignof(region_t) != 0) {
         /* We need to ensure that 'size' is aligned to the bookkeeping
          * struct, so that the remainder chunk of a region is aligned.
          */
-        size = ROUND_UP(size, alignof(region_t));
+        *size = ROUND_UP(*size, alignof(region_t));
     }
 
-    void *p = alloc(size, align);
+    void *p = alloc(*size, align);
 
-    if (p == NULL && size > sizeof(region_t)) {
+    if (p == NULL && *size > sizeof(region_t)) {
         /* We failed to allocate a matching region, but we may be able to
          * satisfy this allocation by defragmenting the free list and
          * re-attempting.
          */
         defrag();
-        p = alloc(size, align);
+        p = alloc(*size, align);
 
         if (p != NULL) {
             STATS(stats.succeeded_allocations_on_defrag++);
@@ -609,26 +531,13 @@ void *camkes_dma_alloc(size_t size, int align) {
 
     check_consistency();
 
-    if (p == NULL) {
-        STATS(stats.failed_allocations_other++);
-    } else {
-        STATS(({
-            stats.current_outstanding += size;
-            if (stats.heap_size - stats.current_outstanding < stats.minimum_heap_size) {
-                stats.minimum_heap_size = stats.heap_size - stats.current_outstanding;
-            }
-        }));
-    }
-
     return p;
 }
 
-void camkes_dma_free(void *ptr, size_t size) {
-
-    /* Allow the user to free NULL. */
-    if (ptr == NULL) {
-        return;
-    }
+/* Return a region to the free list on behalf of `camkes_dma_free`. Returns
+ * the number of bytes returned to the pool.
+ */
+static size_t release(void *ptr, size_t size) {
 
     /* If the user allocated a region that was too small, we would have rounded
      * up the size during allocation.
@@ -649,20 +558,1011 @@ void camkes_dma_free(void *ptr, size_t size) {
      */
     assert((uintptr_t)ptr % alignof(region_t) == 0);
 
-    STATS(({
-            if (size >= stats.current_outstanding) {
-                stats.current_outstanding = 0;
-            } else {
-                stats.current_outstanding -= size;
-            }
-        }));
-
     region_t *p = ptr;
     p->paddr_upper = 0;
     p->size = size;
     prepend_node(p);
 
     check_consistency();
+
+    return size;
+}
+
+static void add_region(void *base, size_t size) {
+    release(base, size);
+}
+
+#ifndef NDEBUG
+static void count_free_regions(size_t *count, size_t *largest) {
+    *count = 0;
+    *largest = 0;
+    for (region_t *r = head; r != NULL; r = r->next) {
+        (*count)++;
+        if (r->size > *largest) {
+            *largest = r->size;
+        }
+    }
+}
+#endif
+
+#define ALLOCATOR_NAME "list"
+
+#else /* CONFIG_CAMKES_DMA_ALLOCATOR_SEGREGATED */
+
+/* Segregated-fit allocator. Every free region is a multiple of GRANULE bytes,
+ * starts on a GRANULE boundary relative to the pool and is filed in one of a
+ * two-level array of bins by its size:
+ *
+ *  - Regions smaller than SL_COUNT granules are filed in first-level bin 0,
+ *    indexed exactly by their size in granules. Requests for these sizes are
+ *    served from the bin of exactly that size if it is non-empty.
+ *  - Larger regions are filed by the position of their most significant bit
+ *    (first level) and the SL_BITS bits below it (second level), so each
+ *    power-of-two range of sizes is split into SL_COUNT bins.
+ *
+ * A bitmap over each level tracks the non-empty bins, so the smallest bin
+ * guaranteed to satisfy a request is found with two find-first-set
+ * operations, regardless of how many regions are free.
+ *
+ * Freed regions are coalesced immediately with free neighbours that are
+ * contiguous in both virtual and physical memory. To find these neighbours,
+ * a bitmap with one bit per granule in the pool marks the first and last
+ * granule of every free region, and the last word of every free region holds
+ * its size:
+ *
+ *    ┌──────────────────┬─────────────────────────┬──────┐
+ *    │region_t          │                         │ size │
+ *    └──────────────────┴─────────────────────────┴──────┘
+ *     ↑ boundary bit set                             ↑ boundary bit set
+ *
+ * A set bit immediately after a region being freed is therefore the start of
+ * a free region and a set bit immediately before it is the end of one.
+ */
+
+#if UINTPTR_MAX > UINT32_MAX
+    #define GRANULE_BITS 6
+#else
+    #define GRANULE_BITS 5
+#endif
+#define GRANULE BIT(GRANULE_BITS)
+
+static_assert(sizeof(region_t) + sizeof(size_t) <= GRANULE,
+    "a minimal region cannot host its bookkeeping");
+
+#define SL_BITS 4
+#define SL_COUNT BIT(SL_BITS)
+
+/* This many first-level bins admit pools of fewer than 2^(FL_COUNT + SL_BITS -
+ * 1) = 2^27 granules (8GiB on 64-bit platforms, 4GiB on 32-bit platforms).
+ */
+#define FL_COUNT 24
+
+#define BITS_PER_WORD (sizeof(unsigned long) * CHAR_BIT)
+
+static region_t *bins[FL_COUNT][SL_COUNT];
+static uint32_t fl_bitmap;
+static uint32_t sl_bitmap[FL_COUNT];
+
+/* Bounds of the managed pool, in GRANULE-aligned virtual addresses. */
+static uintptr_t pool_base;
+static uintptr_t pool_end;
+
+/* The size of the frames backing the pool, if known. Neighbouring regions
+ * within the same frame are known to be physically contiguous.
+ */
+static size_t frame_size;
+
+/* Bitmap marking the first and last granule of each free region. */
+static unsigned long *boundaries;
+
+static size_t granule_index(void *p) {
+    assert((uintptr_t)p >= pool_base && (uintptr_t)p < pool_end);
+    return ((uintptr_t)p - pool_base) >> GRANULE_BITS;
+}
+static bool test_boundary(size_t index) {
+    return (boundaries[index / BITS_PER_WORD] & BIT(index % BITS_PER_WORD)) != 0;
+}
+static void set_boundary(size_t index) {
+    boundaries[index / BITS_PER_WORD] |= BIT(index % BITS_PER_WORD);
+}
+static void clear_boundary(size_t index) {
+    boundaries[index / BITS_PER_WORD] &= ~BIT(index % BITS_PER_WORD);
+}
+static size_t *footer(region_t *r) {
+    return (void*)r + r->size - sizeof(size_t);
+}
+
+static unsigned floor_log2(size_t x) {
+    assert(x != 0);
+    return sizeof(unsigned long) * CHAR_BIT - 1 - __builtin_clzl(x);
+}
+
+/* Determine the bin a region of the given number of granules is filed in. */
+static void mapping(size_t granules, unsigned *fl, unsigned *sl) {
+    assert(granules > 0);
+    if (granules < SL_COUNT) {
+        *fl = 0;
+        *sl = granules;
+    } else {
+        unsigned msb = floor_log2(granules);
+        *fl = msb - SL_BITS + 1;
+        *sl = (granules >> (msb - SL_BITS)) - SL_COUNT;
+    }
+}
+
+/* Check certain assumptions hold on a free region. This function is intended
+ * to be a no-op when NDEBUG is defined.
+ */
+static void check_region(region_t *r UNUSED) {
+    assert(r != NULL && "a region includes NULL");
+
+    assert((uintptr_t)r >= pool_base && (uintptr_t)r + r->size <= pool_end &&
+        "a region lies outside the pool");
+
+    assert((uintptr_t)r % GRANULE == 0 && r->size % GRANULE == 0 &&
+        r->size > 0 && "a region is not a multiple of the granule");
+
+    assert(test_boundary(granule_index(r)) &&
+        test_boundary(granule_index((void*)r + r->size - GRANULE)) &&
+        "a region's boundaries are not marked");
+
+    assert(*footer(r) == r->size && "a region's footer is corrupted");
+}
+
+static void insert_region(region_t *r) {
+    size_t granules = r->size >> GRANULE_BITS;
+    unsigned fl, sl;
+    mapping(granules, &fl, &sl);
+    assert(fl < FL_COUNT);
+
+    r->prev = NULL;
+    r->next = bins[fl][sl];
+    if (r->next != NULL) {
+        ((region_t*)r->next)->prev = r;
+    }
+    bins[fl][sl] = r;
+    fl_bitmap |= BIT(fl);
+    sl_bitmap[fl] |= BIT(sl);
+
+    size_t index = granule_index(r);
+    set_boundary(index);
+    set_boundary(index + granules - 1);
+    *footer(r) = r->size;
+
+    check_region(r);
+}
+
+static void remove_region(region_t *r) {
+    check_region(r);
+
+    size_t granules = r->size >> GRANULE_BITS;
+    unsigned fl, sl;
+    mapping(granules, &fl, &sl);
+
+    if (r->prev == NULL) {
+        assert(bins[fl][sl] == r);
+        bins[fl][sl] = r->next;
+        if (bins[fl][sl] == NULL) {
+            sl_bitmap[fl] &= ~BIT(sl);
+            if (sl_bitmap[fl] == 0) {
+                fl_bitmap &= ~BIT(fl);
+            }
+        }
+    } else {
+        ((region_t*)r->prev)->next = r->next;
+    }
+    if (r->next != NULL) {
+        ((region_t*)r->next)->prev = r->prev;
+    }
+
+    size_t index = granule_index(r);
+    clear_boundary(index);
+    clear_boundary(index + granules - 1);
+}
+
+/* Find a free region of at least the given number of granules, or NULL. */
+static region_t *find_region(size_t granules) {
+    if (granules >= SL_COUNT) {
+        /* Round up to the next bin boundary, so that any region in the bin we
+         * pick is large enough without searching it.
+         */
+        granules += BIT(floor_log2(granules) - SL_BITS) - 1;
+    }
+    unsigned fl, sl;
+    mapping(granules, &fl, &sl);
+    if (fl >= FL_COUNT) {
+        return NULL;
+    }
+
+    uint32_t sl_map = sl_bitmap[fl] & (UINT32_MAX << sl);
+    if (sl_map == 0) {
+        /* Nothing in this size range. Take the smallest larger range. */
+        uint32_t fl_map = fl + 1 >= FL_COUNT ? 0 :
+            fl_bitmap & (UINT32_MAX << (fl + 1));
+        if (fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = sl_bitmap[fl];
+    }
+    sl = __builtin_ctz(sl_map);
+
+    assert(bins[fl][sl] != NULL);
+    return bins[fl][sl];
+}
+
+/* Whether the free region `b`, which immediately follows `a` in virtual
+ * memory, also immediately follows it in physical memory.
+ */
+static bool contiguous(region_t *a, region_t *b) {
+    assert((void*)a + a->size == (void*)b);
+    if (frame_size != 0 && (uintptr_t)b % frame_size != 0) {
+        /* The end of 'a' and start of 'b' are in the same frame. */
+        return true;
+    }
+    return extract_paddr(a) + a->size == extract_paddr(b);
+}
+
+static void free_region(region_t *r, size_t size) {
+    r->size = size;
+    r->paddr_upper = 0;
+
+    /* Coalesce with the following region... */
+    region_t *next = (void*)r + r->size;
+    if ((uintptr_t)next < pool_end && test_boundary(granule_index(next)) &&
+            contiguous(r, next)) {
+        remove_region(next);
+        r->size += next->size;
+        STATS(stats.coalesces++);
+    }
+
+    /* ...and the preceding one. */
+    if ((uintptr_t)r > pool_base && test_boundary(granule_index(r) - 1)) {
+        region_t *prev = (void*)r - *(size_t*)((void*)r - sizeof(size_t));
+        if (contiguous(prev, r)) {
+            remove_region(prev);
+            prev->size += r->size;
+            r = prev;
+            STATS(stats.coalesces++);
+        }
+    }
+
+    insert_region(r);
+}
+
+/* Check certain assumptions hold on all bins. This walks every free region,
+ * so is only done at initialisation. This function is intended to be a no-op
+ * when NDEBUG is defined.
+ */
+static void check_consistency(void) {
+    for (unsigned fl = 0; fl < FL_COUNT; fl++) {
+        assert(((fl_bitmap & BIT(fl)) != 0) == (sl_bitmap[fl] != 0) &&
+            "first-level bitmap out of sync with second-level bitmap");
+        for (unsigned sl = 0; sl < SL_COUNT; sl++) {
+            assert(((sl_bitmap[fl] & BIT(sl)) != 0) == (bins[fl][sl] != NULL) &&
+                "second-level bitmap out of sync with bins");
+            for (region_t *r = bins[fl][sl]; r != NULL; r = r->next) {
+                unsigned rfl UNUSED, rsl UNUSED;
+                mapping(r->size >> GRANULE_BITS, &rfl, &rsl);
+                assert(rfl == fl && rsl == sl && "a region is in the wrong bin");
+                assert((r->next == NULL ||
+                        ((region_t*)r->next)->prev == r) &&
+                    "bin links are inconsistent");
+                check_region(r);
+                assert(extract_paddr(r) != 0 &&
+                    "a region includes physical frame 0");
+            }
+        }
+    }
+}
+
+static int init_pool(void *dma_pool, size_t dma_pool_sz, size_t page_size) {
+    /* We should not have already initialised our bookkeeping. */
+    assert(boundaries == NULL);
+
+    pool_base = ALIGN_UP((uintptr_t)dma_pool, GRANULE);
+    pool_end = ((uintptr_t)dma_pool + dma_pool_sz) & ~MASK(GRANULE_BITS);
+    if (pool_end <= pool_base) {
+        /* Nothing to manage. Every allocation will fail. */
+        pool_end = pool_base;
+        return 0;
+    }
+
+    size_t granules = (pool_end - pool_base) >> GRANULE_BITS;
+    if (granules >= BIT(FL_COUNT + SL_BITS - 1)) {
+        /* Too large to be binned. */
+        return -1;
+    }
+
+    boundaries = calloc((granules + BITS_PER_WORD - 1) / BITS_PER_WORD,
+        sizeof(*boundaries));
+    if (boundaries == NULL) {
+        return -1;
+    }
+
+    frame_size = page_size;
+    return 0;
+}
+
+static void add_region(void *base, size_t size) {
+    /* Only whole granules are usable. */
+    uintptr_t start = ALIGN_UP((uintptr_t)base, GRANULE),
+              end = ((uintptr_t)base + size) & ~MASK(GRANULE_BITS);
+    if (start < end) {
+        free_region((region_t*)start, end - start);
+    }
+}
+
+static bool pool_empty(void) {
+    return fl_bitmap == 0;
+}
+
+static void *allocate(size_t *size, int align) {
+
+    if (align == 0) {
+        /* No alignment requirements. */
+        align = 1;
+    }
+
+    if (!IS_POWER_OF_2(align)) {
+        /* Regions are only ever carved on power-of-2 boundaries. */
+        return NULL;
+    }
+
+    if (align < (int)GRANULE) {
+        /* Every allocation must be able to host bookkeeping when it is freed. */
+        align = GRANULE;
+    }
+
+    if (*size > pool_end - pool_base || (size_t)align > pool_end - pool_base) {
+        /* This could never be satisfied. */
+        return NULL;
+    }
+
+    /* Round the size up to a whole number of granules. */
+    *size = *size == 0 ? GRANULE : ALIGN_UP(*size, GRANULE);
+
+    /* Find a region that can accommodate the request wherever the aligned
+     * start falls within it.
+     */
+    region_t *r = find_region((*size + align - GRANULE) >> GRANULE_BITS);
+    if (r == NULL) {
+        return NULL;
+    }
+    STATS(stats.regions_searched++);
+    remove_region(r);
+
+    uintptr_t base_paddr = try_extract_paddr(r);
+    void *p = (void*)ALIGN_UP((uintptr_t)r, align);
+    size_t lead = p - (void*)r,
+           trail = r->size - lead - *size;
+
+    if (lead > 0 || trail > 0) {
+        STATS(stats.splits++);
+    }
+
+    if (lead > 0) {
+        /* Return the unaligned prefix to the pool, retaining its physical
+         * address if we know it.
+         */
+        r->size = lead;
+        insert_region(r);
+    }
+
+    if (trail > 0) {
+        region_t *t = p + *size;
+        if (base_paddr != 0) {
+            /* PERF: The original region had a physical address. Save the
+             * overhead of a future lookup by reusing this information now.
+             */
+            save_paddr(t, base_paddr + lead + *size);
+        } else {
+            t->paddr_upper = 0;
+        }
+        t->size = trail;
+        insert_region(t);
+    }
+
+    return p;
+}
+
+static size_t release(void *ptr, size_t size) {
+
+    /* Round the size up as it would have been during allocation. */
+    size = size == 0 ? GRANULE : ALIGN_UP(size, GRANULE);
+
+    /* We should have never allocated memory outside the pool or that is
+     * insufficiently aligned to host bookkeeping data.
+     */
+    assert((uintptr_t)ptr >= pool_base && (uintptr_t)ptr + size <= pool_end);
+    assert((uintptr_t)ptr % GRANULE == 0);
+
+    free_region(ptr, size);
+
+    return size;
+}
+
+#ifndef NDEBUG
+static void count_free_regions(size_t *count, size_t *largest) {
+    *count = 0;
+    *largest = 0;
+    for (unsigned fl = 0; fl < FL_COUNT; fl++) {
+        for (unsigned sl = 0; sl < SL_COUNT; sl++) {
+            for (region_t *r = bins[fl][sl]; r != NULL; r = r->next) {
+                (*count)++;
+                if (r->size > *largest) {
+                    *largest = r->size;
+                }
+            }
+        }
+    }
+}
+#endif
+
+#define ALLOCATOR_NAME "segregated"
+
+#endif /* CONFIG_CAMKES_DMA_ALLOCATOR_SEGREGATED */
+
+int camkes_dma_init(void *dma_pool, size_t dma_pool_sz, size_t page_size,
+        uintptr_t (*get_paddr)(void *ptr), seL4_CPtr (*get_cptr)(void *ptr)) {
+    /* The caller should have passed us a valid DMA pool. */
+    if (page_size != 0 && (page_size <= sizeof(region_t) ||
+                           (uintptr_t)dma_pool % page_size != 0))  {
+        return -1;
+    }
+
+    /* Bail out if the caller gave us an insufficiently aligned pool. */
+    if (dma_pool == NULL || (uintptr_t)dma_pool % alignof(region_t) != 0) {
+        return -1;
+    }
+
+    /* We're going to store bookkeeping in the DMA pages, that we expect to be
+     * power-of-2-sized, so the bookkeeping struct better be
+     * power-of-2-aligned. Your compiler should always guarantee this.
+     */
+    static_assert(IS_POWER_OF_2(alignof(region_t)),
+        "region_t is not power-of-2-aligned");
+
+    /* The page size the caller has given us should be a power of 2 and at least
+     * the alignment of `region_t`.
+     */
+    if (page_size != 0 && (!IS_POWER_OF_2(page_size) ||
+                           page_size < alignof(region_t))) {
+        return -1;
+    }
+
+    to_paddr = get_paddr;
+    to_cptr = get_cptr;
+    contiguous_size = page_size == 0 ? PAGE_SIZE_4K : page_size;
+
+    if (init_pool(dma_pool, dma_pool_sz, page_size) != 0) {
+        return -1;
+    }
+
+    STATS(stats.allocator = ALLOCATOR_NAME);
+    STATS(stats.heap_size = dma_pool_sz);
+    STATS(stats.minimum_heap_size = dma_pool_sz);
+    STATS(stats.minimum_allocation = SIZE_MAX);
+    STATS(stats.minimum_alignment = INT_MAX);
+
+    if (page_size != 0) {
+        /* The caller specified a page size. Excellent; we don't have to work
+         * it out for ourselves.
+         */
+        for (void *base = dma_pool; base < dma_pool + dma_pool_sz;
+                base += page_size) {
+            assert((uintptr_t)base % alignof(region_t) == 0 &&
+                "we misaligned the DMA pool base address during "
+                "initialisation");
+            add_region(base, page_size);
+        }
+    } else {
+        /* The lazy caller didn't bother giving us a page size. Manually scan
+         * for breaks in physical contiguity.
+         */
+        for (void *base = dma_pool; base < dma_pool + dma_pool_sz;) {
+            uintptr_t base_paddr = get_paddr(base);
+            if (base_paddr == 0) {
+                /* The caller gave us a region backed by non-reversible frames. */
+                return -1;
+            }
+            void *limit = base + 1;
+            uintptr_t next_expected_paddr = base_paddr + 1;
+            while (limit < dma_pool + dma_pool_sz) {
+                if (limit == NULL) {
+                    /* The user gave us a region that wraps virtual memory. */
+                    return -1;
+                }
+                uintptr_t limit_paddr = get_paddr(limit);
+                if (limit_paddr == 0) {
+                    /* The user gave us a region that wraps physical memory. */
+                    return -1;
+                }
+                if (limit_paddr != next_expected_paddr) {
+                    /* We've hit a physical contiguity break (== frame
+                     * boundary).
+                     */
+                    break;
+                }
+                limit++;
+                next_expected_paddr++;
+            }
+            /* Only add the region if it's large enough to actually contain the
+             * necessary metadata.
+             */
+            if (base + sizeof(region_t) >= limit) {
+                assert((uintptr_t)base % alignof(region_t) == 0 &&
+                    "we misaligned the DMA pool base address during "
+                    "initialisation");
+                add_region(base, limit - base);
+            }
+
+            /* Move to the next region. We always need to be considering a
+             * region aligned for bookkeeping, so bump the address up if
+             * necessary.
+             */
+            base = (void*)ALIGN_UP((uintptr_t)limit, alignof(region_t));
+        }
+    }
+
+    check_consistency();
+
+    return 0;
+}
+
+uintptr_t camkes_dma_get_paddr(void *ptr) {
+    assert(to_paddr != NULL);
+    return to_paddr(ptr);
+}
+
+seL4_CPtr camkes_dma_get_cptr(void *ptr) {
+    assert(to_cptr != NULL);
+    return to_cptr(ptr);
+}
+
+static int (*lock_fn)(void);
+static int (*unlock_fn)(void);
+
+void camkes_dma_register_lock(int (*lock)(void), int (*unlock)(void)) {
+    lock_fn = lock;
+    unlock_fn = unlock;
+}
+
+static void lock(void) {
+    if (lock_fn != NULL) {
+        int result UNUSED = lock_fn();
+        assert(result == 0 && "failed to acquire DMA pool lock");
+    }
+}
+
+static void unlock(void) {
+    if (unlock_fn != NULL) {
+        int result UNUSED = unlock_fn();
+        assert(result == 0 && "failed to release DMA pool lock");
+    }
+}
+
+/* Allocate from and free to the shared pool. The lock must be held. */
+static void *shared_alloc(size_t size, int align);
+static void shared_free(void *ptr, size_t size);
+
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+
+/* Per-thread caches of free buffers, based on Bonwick's magazine allocator.
+ * Requests of up to 4KiB are rounded up to one of CAMKES_DMA_MAGAZINES power
+ * of 2 size classes, starting at 64 bytes, and are always allocated from the
+ * shared pool at this size and at least naturally aligned. Freed buffers of a
+ * size class are pushed onto the calling thread's magazine for that class
+ * (see `camkes_tls_t`) and allocations pop from it, without locking.
+ *
+ * A thread that only frees buffers of a class (e.g. one returning buffers
+ * allocated by another thread) fills its magazine. A full magazine is moved
+ * wholesale into a bounded, shared depot, from which a thread with an empty
+ * magazine reloads. When the depot is also full, the magazine's contents are
+ * returned to the shared pool.
+ */
+
+#define CACHE_MIN_BITS 6
+
+/* Number of full magazines the depot holds per size class. */
+#define DEPOT_SIZE 4
+
+static camkes_dma_magazine_t depot[CAMKES_DMA_MAGAZINES][DEPOT_SIZE];
+static unsigned depot_count[CAMKES_DMA_MAGAZINES];
+
+static size_t class_size(int class) {
+    return BIT(CACHE_MIN_BITS + class);
+}
+
+/* The size class of a request, or -1 if it is too large to be cached. */
+static int size_class(size_t size) {
+    if (size > class_size(CAMKES_DMA_MAGAZINES - 1)) {
+        return -1;
+    }
+    if (size <= class_size(0)) {
+        return 0;
+    }
+    return sizeof(unsigned long) * CHAR_BIT - __builtin_clzl(size - 1) -
+        CACHE_MIN_BITS;
+}
+
+static void *magazine_alloc(int class) {
+    camkes_dma_magazine_t *m = &camkes_get_tls()->dma_magazines[class];
+    if (m->count == 0) {
+        /* Try to reload from the depot. */
+        lock();
+        if (depot_count[class] > 0) {
+            depot_count[class]--;
+            *m = depot[class][depot_count[class]];
+        }
+        unlock();
+        if (m->count == 0) {
+            return NULL;
+        }
+    }
+    return m->objects[--m->count];
+}
+
+static void magazine_free(int class, void *ptr) {
+    camkes_dma_magazine_t *m = &camkes_get_tls()->dma_magazines[class];
+    if (m->count == CAMKES_DMA_MAGAZINE_SIZE) {
+        /* Make room by moving the full magazine to the depot or, failing
+         * that, emptying it into the shared pool.
+         */
+        lock();
+        if (depot_count[class] < DEPOT_SIZE) {
+            depot[class][depot_count[class]] = *m;
+            depot_count[class]++;
+        } else {
+            for (unsigned i = 0; i < m->count; i++) {
+                shared_free(m->objects[i], class_size(class));
+            }
+        }
+        unlock();
+        m->count = 0;
+    }
+    m->objects[m->count++] = ptr;
+}
+
+/* Return every buffer in the depot and the calling thread's magazines to the
+ * shared pool, so they can be coalesced to satisfy a request the pool could
+ * not. Buffers cached by other threads are out of our reach. The lock must be
+ * held. Returns the number of buffers returned.
+ */
+static unsigned flush_caches(void) {
+    unsigned flushed = 0;
+    camkes_dma_magazine_t *ms = camkes_get_tls()->dma_magazines;
+    for (int class = 0; class < CAMKES_DMA_MAGAZINES; class++) {
+        for (; depot_count[class] > 0; depot_count[class]--) {
+            camkes_dma_magazine_t *m = &depot[class][depot_count[class] - 1];
+            for (unsigned i = 0; i < m->count; i++) {
+                shared_free(m->objects[i], class_size(class));
+            }
+            flushed += m->count;
+        }
+        for (unsigned i = 0; i < ms[class].count; i++) {
+            shared_free(ms[class].objects[i], class_size(class));
+        }
+        flushed += ms[class].count;
+        ms[class].count = 0;
+    }
+    return flushed;
+}
+
+#endif
+
+static void *shared_alloc(size_t size, int align) {
+
+    STATS(({
+        stats.total_allocations++;
+        if (size < stats.minimum_allocation) {
+            stats.minimum_allocation = size;
+        }
+        if (size > stats.maximum_allocation) {
+            stats.maximum_allocation = size;
+        }
+        if (align < stats.minimum_alignment) {
+            stats.minimum_alignment = align;
+        }
+        if (align > stats.maximum_alignment) {
+            stats.maximum_alignment = align;
+        }
+        total_allocation_bytes += size;
+    }));
+
+    void *p = NULL;
+    if (!pool_empty()) {
+        p = allocate(&size, align);
+    }
+
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+    if (p == NULL && flush_caches() > 0) {
+        /* The memory we needed may have been sitting in a cache. */
+        p = allocate(&size, align);
+    }
+#endif
+
+    if (p == NULL) {
+        if (pool_empty()) {
+            /* Nothing in the free list. */
+            STATS(stats.failed_allocations_out_of_memory++);
+        } else {
+            STATS(stats.failed_allocations_other++);
+        }
+    } else {
+        STATS(({
+            stats.current_outstanding += size;
+            if (stats.heap_size - stats.current_outstanding < stats.minimum_heap_size) {
+                stats.minimum_heap_size = stats.heap_size - stats.current_outstanding;
+            }
+        }));
+    }
+
+    return p;
+}
+
+static void shared_free(void *ptr, size_t size) {
+
+    STATS(stats.total_frees++);
+
+    size = release(ptr, size);
+
+    STATS(({
+            if (size >= stats.current_outstanding) {
+                stats.current_outstanding = 0;
+            } else {
+                stats.current_outstanding -= size;
+            }
+        }));
+}
+
+void *camkes_dma_alloc(size_t size, int align) {
+
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+    int class = size_class(size);
+    if (class >= 0) {
+        /* Cacheable buffers are always allocated at the size of their class,
+         * so that any buffer of the class can later satisfy any request of the
+         * class.
+         */
+        size = class_size(class);
+        if (align <= (int)size) {
+            void *p = magazine_alloc(class);
+            if (p != NULL) {
+                STATS(__atomic_fetch_add(&stats.cached_allocations, 1,
+                    __ATOMIC_RELAXED));
+                return p;
+            }
+            align = size;
+        }
+    }
+#endif
+
+    lock();
+    void *p = shared_alloc(size, align);
+    unlock();
+
+    return p;
+}
+
+void camkes_dma_free(void *ptr, size_t size) {
+
+    /* Allow the user to free NULL. */
+    if (ptr == NULL) {
+        return;
+    }
+
+#ifdef CONFIG_CAMKES_DMA_THREAD_CACHE
+    int class = size_class(size);
+    if (class >= 0) {
+        STATS(__atomic_fetch_add(&stats.cached_frees, 1, __ATOMIC_RELAXED));
+        magazine_free(class, ptr);
+        return;
+    }
+#endif
+
+    lock();
+    shared_free(ptr, size);
+    unlock();
+}
+
+/* Fixed-size object pools. Objects are laid out in chunks, each of which is
+ * allocated from the shared pool at the start of a physically contiguous
+ * block (see `contiguous_size`) and holds as many objects as will fit in the
+ * block. Objects therefore never span a physical discontiguity, the physical
+ * address of every object can be determined once when the pool is created,
+ * and the object a pointer refers to can be found from the block it lies in.
+ *
+ * Free objects are kept in a lock-free stack of indices. To avoid the ABA
+ * problem, the head of the stack is tagged with a counter that is incremented
+ * on every update. The index of the top of the stack is in the lower half of
+ * the head and the tag in the upper half, which limits the number of objects
+ * in a pool to 65534 on 32-bit platforms.
+ */
+
+#define HEAD_INDEX_BITS (sizeof(uintptr_t) * CHAR_BIT / 2)
+#define HEAD_EMPTY MASK(HEAD_INDEX_BITS)
+
+typedef struct {
+    void *vaddr;
+    uintptr_t paddr;
+} object_t;
+
+struct camkes_dma_pool {
+    uintptr_t head;
+
+    /* The index of the object beneath each free object on the stack. */
+    unsigned *next;
+
+    object_t *objects;
+    size_t count;
+    size_t stride;
+
+    /* The index of the first object in each physically contiguous block of
+     * the range of the DMA pool the pool's chunks lie within, or UINT_MAX if
+     * the block does not hold a chunk.
+     */
+    unsigned *chunk_start;
+    uintptr_t chunks_base;
+    size_t chunks_span;
+};
+
+camkes_dma_pool_t *camkes_dma_pool_create(size_t obj_size, int align,
+        size_t count) {
+
+    if (obj_size == 0 || count == 0 || count >= HEAD_EMPTY) {
+        return NULL;
+    }
+    if (align == 0) {
+        align = 1;
+    }
+    if (align < 0 || !IS_POWER_OF_2(align) || (size_t)align > contiguous_size) {
+        return NULL;
+    }
+    size_t stride = ALIGN_UP(obj_size, (size_t)align);
+    if (stride > contiguous_size) {
+        /* Objects of this size may not be physically contiguous. */
+        return NULL;
+    }
+
+    size_t per_chunk = contiguous_size / stride;
+    size_t chunks = (count + per_chunk - 1) / per_chunk;
+
+    camkes_dma_pool_t *pool = calloc(1, sizeof(*pool));
+    void **chunk_bases = calloc(chunks, sizeof(*chunk_bases));
+    if (pool == NULL || chunk_bases == NULL) {
+        goto fail;
+    }
+    pool->count = count;
+    pool->stride = stride;
+    pool->next = calloc(count, sizeof(*pool->next));
+    pool->objects = calloc(count, sizeof(*pool->objects));
+    if (pool->next == NULL || pool->objects == NULL) {
+        goto fail;
+    }
+
+    /* Carve out the chunks. Aligning each to a contiguous block ensures no
+     * two lie in the same block.
+     */
+    lock();
+    for (size_t i = 0; i < chunks; i++) {
+        size_t n = MIN(per_chunk, count - i * per_chunk);
+        chunk_bases[i] = shared_alloc(n * stride, contiguous_size);
+        if (chunk_bases[i] == NULL) {
+            unlock();
+            goto fail;
+        }
+    }
+    unlock();
+
+    uintptr_t lowest = UINTPTR_MAX, highest = 0;
+    for (size_t i = 0; i < chunks; i++) {
+        lowest = MIN(lowest, (uintptr_t)chunk_bases[i]);
+        highest = MAX(highest, (uintptr_t)chunk_bases[i]);
+    }
+    pool->chunks_base = lowest;
+    pool->chunks_span = (highest - lowest) / contiguous_size + 1;
+    pool->chunk_start = malloc(pool->chunks_span * sizeof(*pool->chunk_start));
+    if (pool->chunk_start == NULL) {
+        goto fail;
+    }
+    for (size_t i = 0; i < pool->chunks_span; i++) {
+        pool->chunk_start[i] = UINT_MAX;
+    }
+
+    /* Resolve the physical address of every object. */
+    for (size_t i = 0; i < chunks; i++) {
+        uintptr_t paddr = camkes_dma_get_paddr(chunk_bases[i]);
+        if (paddr == 0) {
+            goto fail;
+        }
+        size_t first = i * per_chunk;
+        pool->chunk_start[((uintptr_t)chunk_bases[i] - lowest) /
+            contiguous_size] = first;
+        for (size_t j = first; j < MIN(first + per_chunk, count); j++) {
+            size_t offset = (j - first) * stride;
+            pool->objects[j].vaddr = chunk_bases[i] + offset;
+            pool->objects[j].paddr = paddr + offset;
+        }
+    }
+    free(chunk_bases);
+
+    /* Stack every object, lowest index on top. */
+    for (size_t i = 0; i < count; i++) {
+        pool->next[i] = i + 1 == count ? HEAD_EMPTY : i + 1;
+    }
+    pool->head = 0;
+
+    return pool;
+
+fail:
+    if (pool != NULL) {
+        if (chunk_bases != NULL) {
+            lock();
+            for (size_t i = 0; i < chunks && chunk_bases[i] != NULL; i++) {
+                size_t n = MIN(per_chunk, count - i * per_chunk);
+                shared_free(chunk_bases[i], n * stride);
+            }
+            unlock();
+        }
+        free(pool->chunk_start);
+        free(pool->objects);
+        free(pool->next);
+    }
+    free(chunk_bases);
+    free(pool);
+    return NULL;
+}
+
+void *camkes_dma_pool_alloc(camkes_dma_pool_t *pool, uintptr_t *paddr) {
+    assert(pool != NULL);
+
+    uintptr_t head = __atomic_load_n(&pool->head, __ATOMIC_ACQUIRE);
+    uintptr_t index, new_head;
+    do {
+        index = head & HEAD_EMPTY;
+        if (index == HEAD_EMPTY) {
+            return NULL;
+        }
+        /* If another thread pops this object before us, this read may be
+         * stale, but then the tag has changed and the exchange below fails.
+         */
+        uintptr_t next = __atomic_load_n(&pool->next[index], __ATOMIC_RELAXED);
+        new_head = (((head >> HEAD_INDEX_BITS) + 1) << HEAD_INDEX_BITS) | next;
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, new_head, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+    if (paddr != NULL) {
+        *paddr = pool->objects[index].paddr;
+    }
+    return pool->objects[index].vaddr;
+}
+
+void camkes_dma_pool_free(camkes_dma_pool_t *pool, void *ptr) {
+    assert(pool != NULL);
+
+    /* Allow the user to free NULL. */
+    if (ptr == NULL) {
+        return;
+    }
+
+    uintptr_t offset = (uintptr_t)ptr - pool->chunks_base;
+    size_t block = offset / contiguous_size;
+    assert(block < pool->chunks_span && pool->chunk_start[block] != UINT_MAX &&
+        "freeing an object that is not from this pool");
+    uintptr_t index = pool->chunk_start[block] +
+        offset % contiguous_size / pool->stride;
+    assert(index < pool->count && pool->objects[index].vaddr == ptr &&
+        "freeing a pointer that is not the start of an object");
+
+    uintptr_t head = __atomic_load_n(&pool->head, __ATOMIC_RELAXED);
+    uintptr_t new_head;
+    do {
+        __atomic_store_n(&pool->next[index], head & HEAD_EMPTY,
+            __ATOMIC_RELAXED);
+        new_head = (((head >> HEAD_INDEX_BITS) + 1) << HEAD_INDEX_BITS) | index;
+    } while (!__atomic_compare_exchange_n(&pool->head, &head, new_head, true,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
 /* The remaining functions are to comply with the ps_io_ops-related interface
@@ -59,6 +59,30 @@
  * Note that the code generator itself still contains a check of the level A
  * cache. It is assumed that you may not have the accelerator enabled but still
  * want to get some benefit from cached results.
+ *
+ * If the environment variable CAMKES_SERVER names the socket of a running
+ * code generation server (camkes/runner/server.py), cache misses are forwarded
+ * to it rather than reported to the caller. The server retains parsed
+ * specifications and template environments in memory, so this avoids Python
+ * start up even when we need to generate code. If the server cannot be
+ * reached, we exit with failure as before.
+ *
+ * An invocation that requests several items (multiple --item/--outfile pairs)
+ * is looked up one item at a time, using the same per-item keys CAmkES saves
+ * under. All items must hit for the invocation to succeed.
+ *
+ * Build systems that want to check many invocations at once can instead run
+ * `camkes-accelerator --batch FILE` (or `--batch -` to read standard input).
+ * FILE contains one block per invocation, separated by blank lines. The first
+ * line of a block is the working directory of the invocation and each
+ * subsequent line is one of its arguments. Every item that hits is restored to
+ * its output file as usual, and a report line of the form
+ *
+ *     hit|miss <TAB> item <TAB> outfile
+ *
+ * is written to standard output for each item. Cache databases are opened and
+ * inputs stat-ed or hashed at most once for the whole batch. The exit status
+ * is 0 if every item hit, 1 if some missed, and -1 on error.
  */
 
 #define _GNU_SOURCE
@@ -69,6 +93,7 @@
 #include <openssl/sha.h>
 #include "select_inputs.h" /* generated */
 #include "select_output.h" /* generated */
+#include "select_schema_version.h" /* generated */
 #include <sqlite3.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -76,8 +101,10 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/sendfile.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include "version.h" /* generated */
 
@@ -103,6 +130,11 @@
 /* Chunk size used for allocation at various points. */
 static const unsigned CHUNK_SIZE = 1024;
 
+/* Version of the level A cache database schema. This needs to match
+ * SCHEMA_VERSION in camkes/internal/cachea.py.
+ */
+#define SCHEMA_VERSION 2
+
 static int copy_file(const char *source, const char *destination) {
     assert(source != NULL);
     assert(destination != NULL);
@@ -249,6 +281,119 @@ fail2: close(fd);
 fail1: return result;
 }
 
+/* Memoisation of per-path state across all lookups in this process. Cache
+ * entries generated from the same specification share nearly all of their
+ * inputs, so in batch mode each input is stat-ed, and if necessary hashed, at
+ * most once. Similarly, each database is opened at most once.
+ */
+#define MEMO_BUCKETS 1024
+
+struct input_memo {
+    char *path;
+    bool exists;
+    struct stat st;
+    char *sha256; /* computed on demand */
+    struct input_memo *next;
+};
+
+struct db_memo {
+    char *path;
+    sqlite3 *db; /* NULL if the database could not be opened */
+    struct db_memo *next;
+};
+
+static struct input_memo *input_memos[MEMO_BUCKETS];
+static struct db_memo *db_memos[MEMO_BUCKETS];
+
+/* FNV-1a. */
+static unsigned memo_bucket(const char *s) {
+    uint32_t h = 2166136261u;
+    for (; *s != '\0'; s++) {
+        h ^= (unsigned char)*s;
+        h *= 16777619u;
+    }
+    return h % MEMO_BUCKETS;
+}
+
+/* Find or create the memoised state of an (absolute) path. Returns NULL only
+ * when out of memory.
+ */
+static struct input_memo *lookup_input(const char *path) {
+    unsigned bucket = memo_bucket(path);
+    for (struct input_memo *m = input_memos[bucket]; m != NULL; m = m->next) {
+        if (strcmp(m->path, path) == 0)
+            return m;
+    }
+
+    struct input_memo *m = calloc(1, sizeof(*m));
+    if (unlikely(m == NULL))
+        return NULL;
+    m->path = strdup(path);
+    if (unlikely(m->path == NULL)) {
+        free(m);
+        return NULL;
+    }
+    m->exists = stat(path, &m->st) == 0;
+    m->next = input_memos[bucket];
+    input_memos[bucket] = m;
+    return m;
+}
+
+/* Return the SHA256 hex digest of a memoised input, or NULL on failure. */
+static const char *input_sha256(struct input_memo *m) {
+    if (m->sha256 == NULL && m->exists) {
+        const char *sha256 = hash_file(m->path);
+        if (sha256 != NULL)
+            m->sha256 = strdup(sha256);
+    }
+    return m->sha256;
+}
+
+/* Open a database read-only, or return the handle from a previous call. */
+static sqlite3 *open_db(const char *path) {
+    unsigned bucket = memo_bucket(path);
+    for (struct db_memo *m = db_memos[bucket]; m != NULL; m = m->next) {
+        if (strcmp(m->path, path) == 0)
+            return m->db;
+    }
+
+    struct db_memo *m = calloc(1, sizeof(*m));
+    if (unlikely(m == NULL))
+        return NULL;
+    m->path = strdup(path);
+    if (unlikely(m->path == NULL)) {
+        free(m);
+        return NULL;
+    }
+    if (sqlite3_open_v2(path, &m->db, SQLITE_OPEN_READONLY, NULL) != 0) {
+        ERR("failed to open database %s\n", path);
+        sqlite3_close(m->db);
+        m->db = NULL;
+    }
+    m->next = db_memos[bucket];
+    db_memos[bucket] = m;
+    return m->db;
+}
+
+static void free_memos(void) {
+    for (unsigned i = 0; i < MEMO_BUCKETS; i++) {
+        while (input_memos[i] != NULL) {
+            struct input_memo *m = input_memos[i];
+            input_memos[i] = m->next;
+            free(m->sha256);
+            free(m->path);
+            free(m);
+        }
+        while (db_memos[i] != NULL) {
+            struct db_memo *m = db_memos[i];
+            db_memos[i] = m->next;
+            sqlite3_close(m->db);
+            free(m->path);
+            free(m);
+        }
+    }
+}
+
 /* The CAmkES default to --cache-dir. */
 static char *default_cache_prefix(void) {
     static char dir[PATH_MAX];
@@ -356,12 +501,60 @@ end:
     return id;
 }
 
+/* Check whether the opened database uses the schema we understand. */
+static bool valid_schema(sqlite3 *db) {
+    bool result = false;
+
+    sqlite3_stmt *stmt = sqlite_prepare(db, select_schema_version_sql);
+    if (unlikely(stmt == NULL))
+        goto end;
+
+    if (sqlite3_step(stmt) != SQLITE_ROW) {
+        ERR("failed to retrieve schema version");
+        goto end;
+    }
+
+    int version = sqlite3_column_int(stmt, 0);
+    if (version != SCHEMA_VERSION) {
+        /* A cache written by a different layout (anticipated scenario). */
+        ERR("mismatched schema version (%d != %d)", version, SCHEMA_VERSION);
+        goto end;
+    }
+    result = true;
+
+end:
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+static int64_t timespec_to_ns(const struct timespec *ts) {
+    return (int64_t)ts->tv_sec * 1000000000 + (int64_t)ts->tv_nsec;
+}
+
+/* Whether the stat fingerprint recorded for an input, in columns 2 onwards of
+ * the current row, matches the file's current state. Inputs that were
+ * modified too recently when they were recorded have no fingerprint and never
+ * match.
+ */
+static bool fingerprint_matches(sqlite3_stmt *stmt, const struct stat *st) {
+    for (int i = 2; i <= 6; i++) {
+        if (sqlite3_column_type(stmt, i) != SQLITE_INTEGER)
+            return false;
+    }
+    return sqlite3_column_int64(stmt, 2) == (int64_t)st->st_dev &&
+           sqlite3_column_int64(stmt, 3) == (int64_t)st->st_ino &&
+           sqlite3_column_int64(stmt, 4) == (int64_t)st->st_size &&
+           sqlite3_column_int64(stmt, 5) == timespec_to_ns(&st->st_mtim) &&
+           sqlite3_column_int64(stmt, 6) == timespec_to_ns(&st->st_ctim);
+}
+
 /* Check whether a set of inputs in the level A cache database are still valid.
  * That is, do the hashes of their current on-disk content match the hashes in
  * the database? If not, the cache entry is stale and cannot be used. Returns
- * true if the entry is still valid.
+ * true if the entry is still valid. As in CAmkES, inputs whose stat
+ * fingerprint is unchanged are trusted without being hashed.
  */
-static bool valid_inputs(sqlite3 *db, int id, FILE *deps) {
+static bool valid_inputs(sqlite3 *db, int id, const char *cwd, FILE *deps) {
     int result = false;
 
     /* Again, this query needs to *exactly* match the one used by CAmkES in
@@ -404,7 +597,35 @@ static bool valid_inputs(sqlite3 *db, int id, FILE *deps) {
             goto fail;
         }
 
-        const char *current_sha256 = hash_file(path);
+        /* As in CAmkES, relative paths are relative to the working directory
+         * of the invocation.
+         */
+        char abspath[PATH_MAX];
+        if (path[0] == '/') {
+            strncpy(abspath, path, sizeof(abspath) - 1);
+            abspath[sizeof(abspath) - 1] = '\0';
+        } else {
+            snprintf(abspath, sizeof(abspath), "%s/%s", cwd, path);
+        }
+
+        struct input_memo *input = lookup_input(abspath);
+        if (unlikely(input == NULL)) {
+            ERR("out of memory while checking %s", path);
+            goto fail;
+        }
+        if (!input->exists) {
+            /* Maybe it doesn't exist. */
+            ERR("failed to stat %s", path);
+            goto fail;
+        }
+        if (fingerprint_matches(stmt, &input->st)) {
+            /* Unchanged since it was recorded. */
+            if (deps != NULL)
+                write_dependency(deps, path);
+            continue;
+        }
+
+        const char *current_sha256 = input_sha256(input);
         if (current_sha256 == NULL) {
             /* Can't hash current file. Maybe it doesn't exist. */
             ERR("failed to hash %s", path);
@@ -430,9 +651,8 @@ fail:
 /* Find the cache entry for a given set of parameters. Returns NULL if there is
  * no valid matching entry.
  */
-static char *find_entry(char *cache_dir, char *args, char *cwd, FILE *deps) {
-    sqlite3 *db;
-
+static char *find_entry(const char *cache_dir, char *args, char *cwd,
+        FILE *deps) {
     char *ret = NULL;
 
     char args_hexdigest[SHA256_DIGEST_LENGTH * 2 + 1];
@@ -448,10 +668,9 @@ static char *find_entry(char *cache_dir, char *args, char *cwd, FILE *deps) {
             args_hexdigest, cwd_hexdigest) == -1))
         goto fail1;
 
-    if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != 0) {
-        ERR("failed to open database %s\n", path);
+    sqlite3 *db = open_db(path);
+    if (db == NULL)
         goto fail2;
-    }
 
     int res __attribute__((unused)) = sqlite3_exec(db, "begin transaction;",
         NULL, NULL, NULL);
@@ -461,11 +680,13 @@ static char *find_entry(char *cache_dir, char *args, char *cwd, FILE *deps) {
     assert(res == SQLITE_OK && "failed to begin transaction");
 
     char *output;
-    int id = find_output(&output, db, args, cwd);
+    int id = -1;
+    if (valid_schema(db))
+        id = find_output(&output, db, args, cwd);
     if (id == -1)
         goto fail3;
 
-    if (valid_inputs(db, id, deps)) {
+    if (valid_inputs(db, id, cwd, deps)) {
         ret = output;
     } else {
         free(output);                                                           /* goanna: suppress=MEM-free-no-alloc */
@@ -478,180 +699,534 @@ fail3: sqlite3_exec(db,
         ret == NULL ? "rollback transaction" : "commit transaction",
         NULL, NULL, NULL);
 fail2: free(path);                                                              /* goanna: suppress=MEM-free-no-alloc */
-       sqlite3_close(db);
 fail1: return ret;
 }
 
-/* Allow the unit tests to suppress `main`. */
-#ifndef MAIN
-    #define MAIN main
-#endif
+static int write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written == -1) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += written;
+        len -= (size_t)written;
+    }
+    return 0;
+}
 
-int MAIN(int argc, char **argv) {
+/* Write a NUL-terminated string, including its terminator. */
+static int write_field(int fd, const char *field) {
+    return write_all(fd, field, strlen(field) + 1);
+}
 
-    assert(argc >= 1);
-    if (unlikely(argc == 1)) {
-        fprintf(stderr, "no arguments provided\n");
-        return -1;
+/* Forward a request we could not satisfy from the cache to the code generation
+ * server listening on the given socket. See camkes/runner/server.py for a
+ * description of the protocol. Returns the exit status of the code generator
+ * or -1 if the server could not be reached or declined the request.
+ */
+static int forward_to_server(const char *socket_path, int argc, char **argv,
+        const char *cwd) {
+    int ret = -1;
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        ERR("server socket path %s is too long", socket_path);
+        goto fail1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (unlikely(sock == -1)) {
+        ERR("failed to create socket");
+        goto fail1;
+    }
+
+    if (connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+        /* No server running (anticipated scenario). */
+        ERR("failed to connect to %s", socket_path);
+        goto fail2;
     }
 
-    char *cache_prefix = NULL;
-    char *output = NULL;
-    char *deps_file = NULL;
+    char argc_str[32];
+    sprintf(argc_str, "%d", argc - 1);
+    if (unlikely(write_field(sock, VERSION) != 0 ||
+                 write_field(sock, cwd) != 0 ||
+                 write_field(sock, argc_str) != 0)) {
+        ERR("failed to send request header");
+        goto fail2;
+    }
+    for (unsigned i = 1; i < (unsigned)argc; i++) {
+        if (unlikely(write_field(sock, argv[i]) != 0)) {
+            ERR("failed to send request arguments");
+            goto fail2;
+        }
+    }
+    for (char **env = environ; *env != NULL; env++) {
+        if (unlikely(write_field(sock, *env) != 0)) {
+            ERR("failed to send request environment");
+            goto fail2;
+        }
+    }
+    shutdown(sock, SHUT_WR);
+
+    /* Read the exit status line, then pass any diagnostics through to our
+     * caller.
+     */
+    char status[32];
+    size_t status_len = 0;
+    bool have_status = false;
+    char buffer[4096];
+    ssize_t len;
+    while ((len = read(sock, buffer, sizeof(buffer))) != 0) {
+        if (len == -1) {
+            if (errno == EINTR)
+                continue;
+            ERR("failed to read response");
+            goto fail2;
+        }
+        size_t offset = 0;
+        while (!have_status && offset < (size_t)len) {
+            char c = buffer[offset++];
+            if (c == '\n') {
+                have_status = true;
+            } else if (status_len + 1 < sizeof(status)) {
+                status[status_len++] = c;
+            }
+        }
+        if (have_status && offset < (size_t)len)
+            fwrite(&buffer[offset], 1, (size_t)len - offset, stderr);
+    }
+
+    if (!have_status) {
+        /* The server closed the connection without responding. */
+        ERR("server declined request");
+        goto fail2;
+    }
+    status[status_len] = '\0';
+    ret = atoi(status);
+
+fail2: close(sock);
+fail1: return ret;
+}
 
-    /* Collect all the command line arguments in a \n-separated string. This is
-     * the manner in which CAmkES stores command-line arguments in the level A
-     * cache.
+/* The parts of a code generator invocation relevant to cache lookups. */
+struct query {
+    char *cache_prefix;
+    char *deps_file;
+
+    /* Arguments forming the cache key, with --outfile, --item,
+     * --profile-out, --render-jobs and --verify-render-jobs (and their
+     * parameters) removed.
+     */
+    char **key_argv;
+    unsigned key_argc;
+
+    /* Where, and with which spelling, the --item argument is reinserted to
+     * form the key for a single item. This mirrors `item_args` in the runner.
      */
-    size_t args_sz = CHUNK_SIZE;
-    char *args = malloc(sizeof(char) * args_sz);
-    if (unlikely(args == NULL)) {
+    unsigned item_index;
+    const char *item_flag;
+
+    char **items;
+    unsigned items_len;
+    char **outfiles;
+    unsigned outfiles_len;
+};
+
+static void free_query(struct query *q) {
+    free(q->key_argv);
+    free(q->items);
+    free(q->outfiles);
+}
+
+/* Split an invocation's arguments into a query. Returns 0 on success. */
+static int parse_query(struct query *q, int argc, char **argv) {
+    memset(q, 0, sizeof(*q));
+
+    /* We never need more slots than arguments. */
+    q->key_argv = calloc(argc + 1, sizeof(char*));
+    q->items = calloc(argc + 1, sizeof(char*));
+    q->outfiles = calloc(argc + 1, sizeof(char*));
+    if (unlikely(q->key_argv == NULL || q->items == NULL ||
+                 q->outfiles == NULL)) {
         fputs("out of memory\n", stderr);
+        free_query(q);
         return -1;
     }
-    size_t args_len = 0;
-    args[0] = '\0';
-    for (unsigned i = 1; i < (unsigned)argc; i++) {
-        size_t len = strlen(argv[i]);
+
+    for (unsigned i = 0; i < (unsigned)argc; i++) {
 
         /* Parse command line arguments. We could do this with getopt, but
          * since we need to iterate over the arguments and would like to accept
          * arbitrary future arguments, just do it inline here.
          */
-        if (str_eq(argv[i], "--help")) {
-            fprintf(stderr, "CAmkES cache accelerator\n"
-                            "  usage: %s arguments...\n", argv[0]);
-            free(args);
-            return -1;
-        } else if (str_eq(argv[i], "--version")) {
-            fprintf(stderr, "CAmkES cache accelerator %s\n", VERSION);
-            free(args);
-            return 0;
-        } else if (str_eq(argv[i], "--cache-dir") &&
+        if (str_eq(argv[i], "--cache-dir") &&
                    i + 1 < (unsigned)argc) {
-            cache_prefix = argv[i + 1];
+            q->cache_prefix = argv[i + 1];
         } else if ((str_eq(argv[i], "--outfile") ||
                     str_eq(argv[i], "-O")) &&                                   /* goanna: suppress=ARR-inv-index-ptr-pos */
                    i + 1 < (unsigned)argc) {
-            output = argv[i + 1];
+            q->outfiles[q->outfiles_len++] = argv[i + 1];
             /* Skip --outfile and its parameter. */
             i++;
             continue;
+        } else if ((str_eq(argv[i], "--item") ||
+                    str_eq(argv[i], "-T")) &&
+                   i + 1 < (unsigned)argc) {
+            if (q->item_flag == NULL) {
+                q->item_flag = argv[i];
+                q->item_index = q->key_argc;
+            }
+            q->items[q->items_len++] = argv[i + 1];
+            /* Skip --item and its parameter. */
+            i++;
+            continue;
+        } else if (str_eq(argv[i], "--profile-out") &&
+                   i + 1 < (unsigned)argc) {
+            /* Profiling does not affect the output. Skip --profile-out and its
+             * parameter.
+             */
+            i++;
+            continue;
+        } else if ((str_eq(argv[i], "--render-jobs") ||
+                    str_eq(argv[i], "-j")) &&
+                   i + 1 < (unsigned)argc) {
+            /* Neither does the number of render processes. */
+            i++;
+            continue;
+        } else if (str_eq(argv[i], "--verify-render-jobs")) {
+            continue;
         } else if ((str_eq(argv[i], "--makefile-dependencies") ||
                     str_eq(argv[i], "-MD")) &&
                    i + 1 < (unsigned)argc) {
-            deps_file = argv[i + 1];
-        }
-
-        /* Do we need to expand the argument buffer? */
-        if (args_len + 1 + len + 1 > args_sz) {
-            args_sz += CHUNK_SIZE;
-            char *args_ = realloc(args, args_sz);                               /* goanna: suppress=MEM-leak-alias */
-            if (unlikely(args_ == NULL)) {
-                fputs("out of memory\n", stderr);
-                free(args);
-                return -1;
-            }
-            args = args_;
-        }
-
-        /* Separate arguments with new line. */
-        if (args_len > 0) {
-            args[args_len] = '\n';
-            args_len++;
+            q->deps_file = argv[i + 1];
         }
 
-        strncpy(&args[args_len], argv[i], len);
-        args_len += len;
+        q->key_argv[q->key_argc++] = argv[i];
     }
-    args[args_len] = '\0';
 
-    if (unlikely(output == NULL)) {
+    if (unlikely(q->outfiles_len == 0)) {
         fprintf(stderr, "no output path provided\n");
-        free(args);
+        free_query(q);
         return -1;
     }
 
-    char cwd[PATH_MAX];
-    if (unlikely(getcwd(cwd, PATH_MAX) == NULL)) {
-        fprintf(stderr, "failed to retrieve current directory\n");
-        free(args);
+    if (q->items_len == 0) {
+        /* No explicit item. There is then a single lookup, keyed by all the
+         * remaining arguments, and the code generator would write the last
+         * output path given.
+         */
+        q->outfiles[0] = q->outfiles[q->outfiles_len - 1];
+        q->outfiles_len = 1;
+    } else if (unlikely(q->items_len != q->outfiles_len)) {
+        fprintf(stderr, "different number of items and outfiles\n");
+        free_query(q);
         return -1;
     }
 
-    /* At this point, we have the inputs we need. Now time to locate and open
-     * the cache.
-     */
+    return 0;
+}
+
+/* Construct the \n-separated key for the given item of a query (or the only
+ * lookup of a query without items). This is the manner in which CAmkES stores
+ * command-line arguments in the level A cache.
+ */
+static char *make_key(const struct query *q, unsigned item) {
+    size_t len = 1;
+    for (unsigned i = 0; i < q->key_argc; i++)
+        len += strlen(q->key_argv[i]) + 1;
+    if (q->items_len > 0)
+        len += strlen(q->item_flag) + 1 + strlen(q->items[item]) + 1;
+
+    char *key = malloc(len);
+    if (unlikely(key == NULL))
+        return NULL;
+
+    char *p = key;
+    for (unsigned i = 0; i <= q->key_argc; i++) {
+        if (q->items_len > 0 && i == q->item_index) {
+            p += sprintf(p, "%s%s\n%s", p == key ? "" : "\n", q->item_flag,
+                q->items[item]);
+        }
+        if (i < q->key_argc)
+            p += sprintf(p, "%s%s", p == key ? "" : "\n", q->key_argv[i]);
+    }
+    *p = '\0';
+    return key;
+}
+
+/* Look up every item of a query, restoring those that hit to their output
+ * paths. If `report` is non-NULL, a hit/miss line is written to it per item.
+ * Returns the number of items that missed, or -1 on error.
+ */
+static int run_query(const struct query *q, char *cwd, FILE *report) {
+    int misses = 0;
 
-    char *cache_dir = get_cache_dir(cache_prefix);
-    assert(cache_dir != NULL);
+    char *cache_dir = get_cache_dir(q->cache_prefix);
+    if (unlikely(cache_dir == NULL))
+        return -1;
 
     /* If we are supposed to write Make dependencies, set up a temporary file
      * we can write these into. On success we'll move this to the intended
      * location.
      */
-    const char *tmp_deps_file = NULL;
+    char *tmp_deps_file = NULL;
     FILE *deps = NULL;
-    if (deps_file != NULL) {
+    if (q->deps_file != NULL) {
         tmp_deps_file = make_temp();
         if (unlikely(tmp_deps_file == NULL)) {
             fputs("failed to create temporary file\n", stderr);
             free(cache_dir);
-            free(args);
             return -1;
         }
         deps = fopen(tmp_deps_file, "w");
         if (unlikely(deps == NULL)) {
             fputs("failed to open temporary file\n", stderr);
-            free((void*)tmp_deps_file);
+            unlink(tmp_deps_file);
+            free(tmp_deps_file);                                                /* goanna: suppress=MEM-free-no-alloc */
             free(cache_dir);
-            free(args);
             return -1;
         }
-        fprintf(deps, "%s: ", output);
+        fprintf(deps, "%s: ", q->outfiles[0]);
     }
 
-    char *entry = find_entry(cache_dir, args, cwd, deps);
-    free(args);
-    /* We no longer need the dependency file handle. */
+    for (unsigned i = 0; i < q->outfiles_len; i++) {
+        bool hit = false;
+
+        char *key = make_key(q, i);
+        if (unlikely(key == NULL)) {
+            fputs("out of memory\n", stderr);
+            misses = -1;
+            break;
+        }
+        char *entry = find_entry(cache_dir, key, cwd, deps);
+        free(key);
+
+        if (entry != NULL) {
+            /* Find the path to the entry. */
+            char *source;
+            int result = asprintf(&source, "%s/data/%s", cache_dir, entry);
+            free(entry);
+            if (unlikely(result == -1)) {
+                fprintf(stderr, "failed to construct cache entry path\n");
+                misses = -1;
+                break;
+            }
+            hit = copy_file(source, q->outfiles[i]) == 0;
+            free(source);                                                       /* goanna: suppress=MEM-free-no-alloc */
+        }
+
+        if (!hit)
+            misses++;
+        if (report != NULL)
+            fprintf(report, "%s\t%s\t%s\n", hit ? "hit" : "miss",
+                q->items_len > 0 ? q->items[i] : "-", q->outfiles[i]);
+    }
+
+    /* Move the dependency file into its intended location, if all the items
+     * hit. Otherwise, the code generator will write it.
+     */
     if (deps != NULL) {
         fprintf(deps, "\n");
         fclose(deps);
-    }
-    if (entry == NULL) {
-        /* Cache miss. */
-        if (tmp_deps_file != NULL) {
+        if (misses == 0) {
+            if (unlikely(move_file(tmp_deps_file, q->deps_file) != 0)) {
+                fputs("failed to create dependency file\n", stderr);
+                misses = -1;
+            }
+        } else {
             unlink(tmp_deps_file);
-            free((void*)tmp_deps_file);                                         /* goanna: suppress=MEM-free-no-alloc */
         }
-        free(cache_dir);
+        free(tmp_deps_file);                                                    /* goanna: suppress=MEM-free-no-alloc */
+    }
+
+    free(cache_dir);
+    return misses;
+}
+
+static char *read_stream(FILE *f) {
+    size_t sz = CHUNK_SIZE;
+    size_t len = 0;
+    char *buffer = malloc(sz);
+    if (unlikely(buffer == NULL))
+        return NULL;
+    while (true) {
+        len += fread(&buffer[len], 1, sz - len - 1, f);
+        if (len < sz - 1)
+            break;
+        sz += CHUNK_SIZE * 64;
+        char *buffer_ = realloc(buffer, sz);                                    /* goanna: suppress=MEM-leak-alias */
+        if (unlikely(buffer_ == NULL)) {
+            free(buffer);
+            return NULL;
+        }
+        buffer = buffer_;
+    }
+    if (ferror(f)) {
+        free(buffer);
+        return NULL;
+    }
+    buffer[len] = '\0';
+    return buffer;
+}
+
+/* Answer every query in a batch file. See the description at the top of this
+ * file for the format.
+ */
+static int run_batch(const char *path) {
+    FILE *f = str_eq(path, "-") ? stdin : fopen(path, "r");
+    if (unlikely(f == NULL)) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return -1;
+    }
+    char *content = read_stream(f);
+    if (f != stdin)
+        fclose(f);
+    if (unlikely(content == NULL)) {
+        fprintf(stderr, "failed to read %s\n", path);
         return -1;
     }
 
-    /* Move the dependency file into its intended location. */
-    if (deps_file != NULL) {
-        assert(tmp_deps_file != NULL);
-        int result = move_file(tmp_deps_file, deps_file);
-        free((void*)tmp_deps_file);                                             /* goanna: suppress=MEM-free-no-alloc */
-        if (unlikely(result != 0)) {
-            fputs("failed to create dependency file\n", stderr);
-            free(entry);
-            free(cache_dir);
+    /* Split the content into lines in-place. */
+    size_t lines_sz = CHUNK_SIZE;
+    size_t lines_len = 0;
+    char **lines = malloc(sizeof(char*) * lines_sz);
+    if (unlikely(lines == NULL)) {
+        fputs("out of memory\n", stderr);
+        free(content);
+        return -1;
+    }
+    for (char *line = content, *next; *line != '\0'; line = next) {
+        next = strchr(line, '\n');
+        if (next == NULL) {
+            next = line + strlen(line);
+        } else {
+            *next = '\0';
+            next++;
+        }
+        if (lines_len == lines_sz) {
+            lines_sz += CHUNK_SIZE;
+            char **lines_ = realloc(lines, sizeof(char*) * lines_sz);          /* goanna: suppress=MEM-leak-alias */
+            if (unlikely(lines_ == NULL)) {
+                fputs("out of memory\n", stderr);
+                free(lines);
+                free(content);
+                return -1;
+            }
+            lines = lines_;
+        }
+        lines[lines_len++] = line;
+    }
+
+    char start_cwd[PATH_MAX];
+    if (unlikely(getcwd(start_cwd, PATH_MAX) == NULL)) {
+        fprintf(stderr, "failed to retrieve current directory\n");
+        free(lines);
+        free(content);
+        return -1;
+    }
+
+    int ret = 0;
+    size_t i = 0;
+    while (i < lines_len) {
+        /* Skip blank lines between blocks. */
+        if (lines[i][0] == '\0') {
+            i++;
+            continue;
+        }
+
+        char *cwd = lines[i++];
+        size_t start = i;
+        while (i < lines_len && lines[i][0] != '\0')
+            i++;
+
+        /* Queries name paths relative to their own working directory. */
+        if (unlikely(chdir(cwd) != 0)) {
+            fprintf(stderr, "failed to change directory to %s\n", cwd);
+            ret = -1;
+            break;
+        }
+
+        struct query q;
+        if (unlikely(parse_query(&q, (int)(i - start), &lines[start]) != 0)) {
+            ret = -1;
+            break;
+        }
+        int misses = run_query(&q, cwd, stdout);
+        free_query(&q);
+        if (unlikely(misses < 0)) {
+            ret = -1;
+            break;
+        }
+        if (misses > 0)
+            ret = 1;
+    }
+
+    if (unlikely(chdir(start_cwd) != 0))
+        ret = -1;
+    free(lines);
+    free(content);
+    return ret;
+}
+
+/* Allow the unit tests to suppress `main`. */
+#ifndef MAIN
+    #define MAIN main
+#endif
+
+int MAIN(int argc, char **argv) {
+
+    assert(argc >= 1);
+    if (unlikely(argc == 1)) {
+        fprintf(stderr, "no arguments provided\n");
+        return -1;
+    }
+
+    for (unsigned i = 1; i < (unsigned)argc; i++) {
+        if (str_eq(argv[i], "--help")) {
+            fprintf(stderr, "CAmkES cache accelerator\n"
+                            "  usage: %s arguments...\n"
+                            "         %s --batch FILE\n", argv[0], argv[0]);
             return -1;
+        } else if (str_eq(argv[i], "--version")) {
+            fprintf(stderr, "CAmkES cache accelerator %s\n", VERSION);
+            return 0;
         }
     }
 
-    /* Find the path to the entry. */
-    char *source;
-    int result = asprintf(&source, "%s/data/%s", cache_dir, entry);
-    free(entry);
-    free(cache_dir);
-    if (unlikely(result == -1)) {
-        fprintf(stderr, "failed to construct cache entry path\n");
+    if (str_eq(argv[1], "--batch")) {
+        if (unlikely(argc != 3)) {
+            fprintf(stderr, "--batch takes a single file argument\n");
+            return -1;
+        }
+        int result = run_batch(argv[2]);
+        free_memos();
+        return result;
+    }
+
+    struct query q;
+    if (parse_query(&q, argc - 1, &argv[1]) != 0)
+        return -1;
+
+    char cwd[PATH_MAX];
+    if (unlikely(getcwd(cwd, PATH_MAX) == NULL)) {
+        fprintf(stderr, "failed to retrieve current directory\n");
+        free_query(&q);
         return -1;
     }
 
-    result = copy_file(source, output);
-    free(source);                                                               /* goanna: suppress=MEM-free-no-alloc */
-    return result;
+    int misses = run_query(&q, cwd, NULL);
+    free_query(&q);
+    free_memos();
+    if (misses == 0)
+        return 0;
+    if (misses > 0) {
+        /* Cache miss. */
+        const char *server = getenv("CAMKES_SERVER");
+        if (server != NULL && *server != '\0')
+            return forward_to_server(server, argc, argv, cwd);
+    }
+    return -1;
 }
@@ -29,7 +29,8 @@ behaviour.
 from __future__ import absolute_import, division, print_function, \
     unicode_literals
 
-import os, re, six, sys, tempfile, unittest
+import glob, os, re, six, socket, sqlite3, sys, tempfile, threading, \
+    unittest
 
 ME = os.path.abspath(__file__)
 MY_DIR = os.path.dirname(ME)
@@ -37,7 +38,7 @@ MY_DIR = os.path.dirname(ME)
 # Make CAmkES importable
 sys.path.append(os.path.join(MY_DIR, '../..'))
 
-from camkes.internal.cachea import Cache, prime_inputs
+from camkes.internal.cachea import Cache, prime_inputs, SCHEMA_VERSION
 from camkes.internal.tests.utils import CAmkESTest, which
 from camkes.internal.version import version
 
@@ -304,6 +305,46 @@ class TestCacheAInterop(CAmkESTest):
         self.assertEqual(stdout, '')
         self.assertEqual(stderr, '')
 
+    def test_cache_miss_schema_version(self):
+        '''
+        Test that we miss on a database with a different schema version.
+        '''
+        root = self.mkdtemp()
+
+        internal_root = os.path.join(root, version(), 'cachea')
+        c = Cache(internal_root)
+
+        input1 = self.mkstemp()
+        with open(input1, 'wt') as f:
+            f.write('hello world')
+        inputs = prime_inputs([input1])
+
+        cwd = self.mkdtemp()
+
+        output = self.mkstemp()
+
+        args = ['--cache-dir', root, '--outfile', output]
+
+        c.save(args[:-2], cwd, 'moo cow', inputs)
+        c.flush()
+
+        del c
+
+        # Mark the database as coming from an older CAmkES.
+        for db in glob.glob(os.path.join(internal_root, 'dbs', '*', '*',
+                'cache.db')):
+            conn = sqlite3.connect(db)
+            conn.execute('pragma user_version = %d' % (SCHEMA_VERSION - 1))
+            conn.commit()
+            conn.close()
+
+        ret, stdout, stderr = self.execute([self.accelerator] + args, cwd=cwd)
+
+        # It should have missed (== non-zero return value with no output).
+        self.assertNotEqual(ret, 0)
+        self.assertEqual(stdout, '')
+        self.assertEqual(stderr, '')
+
     def test_cache_hit_truncate(self):
         '''
         A previous accelerator bug resulted in the output file not being
@@ -364,6 +405,192 @@ class TestCacheAInterop(CAmkESTest):
             data = f.read()
         self.assertEqual(data, content)
 
+    def test_server_forwarding(self):
+        '''
+        Test that a cache miss is forwarded to a code generation server when
+        one is configured, and that its exit status and diagnostics are passed
+        back to the caller.
+        '''
+        root = self.mkdtemp()
+        cwd = self.mkdtemp()
+        output = self.mkstemp()
+        path = os.path.join(self.mkdtemp(), 'server.sock')
+
+        # Stand in for the server with a socket that records the request and
+        # sends a canned response.
+        sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        sock.bind(path)
+        sock.listen(1)
+        request = []
+        def serve():
+            conn, _ = sock.accept()
+            data = b''
+            while True:
+                chunk = conn.recv(4096)
+                if not chunk:
+                    break
+                data += chunk
+            request.append(data)
+            conn.sendall(b'7\nhello from the server\n')
+            conn.close()
+        t = threading.Thread(target=serve)
+        t.start()
+
+        args = ['--cache-dir', root, '--outfile', output]
+        env = os.environ.copy()
+        env['CAMKES_SERVER'] = path
+        ret, stdout, stderr = self.execute([self.accelerator] + args, cwd=cwd,
+            env=env)
+        t.join()
+        sock.close()
+
+        self.assertEqual(ret, 7)
+        self.assertEqual(stdout, '')
+        self.assertEqual(stderr, 'hello from the server\n')
+
+        fields = request[0].decode('utf-8').split('\0')
+        self.assertEqual(fields[0], version())
+        self.assertEqual(os.path.realpath(fields[1]), os.path.realpath(cwd))
+        self.assertEqual(fields[2:3 + len(args)], ['%d' % len(args)] + args)
+        self.assertIn('CAMKES_SERVER=%s' % path, fields[3 + len(args):])
+
+    def test_server_unavailable(self):
+        '''
+        Test that a configured but absent server is treated as a plain cache
+        miss.
+        '''
+        root = self.mkdtemp()
+        cwd = self.mkdtemp()
+        output = self.mkstemp()
+
+        args = ['--cache-dir', root, '--outfile', output]
+        env = os.environ.copy()
+        env['CAMKES_SERVER'] = os.path.join(self.mkdtemp(), 'server.sock')
+        ret, stdout, stderr = self.execute([self.accelerator] + args, cwd=cwd,
+            env=env)
+
+        self.assertNotEqual(ret, 0)
+        self.assertEqual(stdout, '')
+        self.assertEqual(stderr, '')
+
+    def test_multiple_items(self):
+        '''
+        Test that an invocation with several items is answered using the
+        per-item keys the runner saves under.
+        '''
+        root = self.mkdtemp()
+        internal_root = os.path.join(root, version(), 'cachea')
+        c = Cache(internal_root)
+
+        input = self.mkstemp()
+        with open(input, 'wt') as f:
+            f.write('hello world')
+        inputs = prime_inputs([input])
+
+        cwd = self.mkdtemp()
+        output1 = self.mkstemp()
+        output2 = self.mkstemp()
+
+        c.save(['--cache-dir', root, '--item', 'a'], cwd, 'moo', inputs)
+        c.save(['--cache-dir', root, '--item', 'b'], cwd, 'cow', inputs)
+        c.flush()
+
+        args = ['--cache-dir', root, '--item', 'a', '--outfile', output1,
+            '--item', 'b', '--outfile', output2]
+        ret, stdout, stderr = self.execute([self.accelerator] + args, cwd=cwd)
+        if ret != 0:
+            self.fail('accelerator failed on multiple items:\n%s' % stderr)
+        self.assertEqual(stdout, '')
+        with open(output1, 'rt') as f:
+            self.assertEqual(f.read(), 'moo')
+        with open(output2, 'rt') as f:
+            self.assertEqual(f.read(), 'cow')
+
+        # If any item is missing the invocation as a whole is a miss.
+        args += ['--item', 'c', '--outfile', self.mkstemp()]
+        ret, _, _ = self.execute([self.accelerator] + args, cwd=cwd)
+        self.assertNotEqual(ret, 0)
+
+    def test_render_jobs_ignored(self):
+        '''
+        Test that the number of render processes is not part of the key, as
+        it does not affect the output.
+        '''
+        root = self.mkdtemp()
+        internal_root = os.path.join(root, version(), 'cachea')
+        c = Cache(internal_root)
+
+        input = self.mkstemp()
+        with open(input, 'wt') as f:
+            f.write('hello world')
+        inputs = prime_inputs([input])
+
+        cwd = self.mkdtemp()
+        output = self.mkstemp()
+
+        c.save(['--cache-dir', root, '--item', 'a'], cwd, 'moo', inputs)
+        c.flush()
+
+        args = ['--cache-dir', root, '--render-jobs', '4',
+            '--verify-render-jobs', '--item', 'a', '--outfile', output]
+        ret, stdout, stderr = self.execute([self.accelerator] + args, cwd=cwd)
+        if ret != 0:
+            self.fail('accelerator missed with --render-jobs:\n%s' % stderr)
+        with open(output, 'rt') as f:
+            self.assertEqual(f.read(), 'moo')
+
+    def test_batch(self):
+        '''
+        Test answering several invocations from a batch file.
+        '''
+        root = self.mkdtemp()
+        internal_root = os.path.join(root, version(), 'cachea')
+        c = Cache(internal_root)
+
+        input = self.mkstemp()
+        with open(input, 'wt') as f:
+            f.write('hello world')
+        inputs = prime_inputs([input])
+
+        cwd1 = self.mkdtemp()
+        cwd2 = self.mkdtemp()
+        output1 = self.mkstemp()
+        output2 = self.mkstemp()
+        output3 = self.mkstemp()
+
+        c.save(['--cache-dir', root, '--item', 'a'], cwd1, 'moo', inputs)
+        c.save(['--cache-dir', root], cwd2, 'cow', inputs)
+        c.flush()
+
+        batch = self.mkstemp()
+        with open(batch, 'wt') as f:
+            f.write('\n'.join([cwd1, '--cache-dir', root, '--item', 'a',
+                '--outfile', output1, '--item', 'b', '--outfile', output2, '',
+                cwd2, '--cache-dir', root, '--outfile', output3, '']))
+
+        ret, stdout, stderr = self.execute([self.accelerator, '--batch',
+            batch])
+        self.assertEqual(ret, 1)
+        self.assertEqual(stdout.splitlines(), [
+            'hit\ta\t%s' % output1,
+            'miss\tb\t%s' % output2,
+            'hit\t-\t%s' % output3,
+        ])
+        with open(output1, 'rt') as f:
+            self.assertEqual(f.read(), 'moo')
+        with open(output3, 'rt') as f:
+            self.assertEqual(f.read(), 'cow')
+
+        # The same query with only the saved items should be a full hit.
+        with open(batch, 'wt') as f:
+            f.write('\n'.join([cwd2, '--cache-dir', root, '--outfile',
+                output3]))
+        ret, stdout, stderr = self.execute([self.accelerator, '--batch',
+            batch])
+        if ret != 0:
+            self.fail('accelerator failed on batch:\n%s' % stderr)
+        self.assertEqual(stdout, 'hit\t-\t%s\n' % output3)
+
     # Various Valgrind tests of the above follow. Note that they try to trigger
     # any problems in the debug version of the accelerator first because we get
     # more precise backtraces in the Valgrind output when debugging symbols are
@@ -0,0 +1,130 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Time the CapDL filters that rearrange virtual address spaces on a synthetic
+system. Two components share a configurable amount of memory through
+dataports, each backed by small frames as the ELF loader would have created
+them, and the shared memory filter then collapses these into a single set of
+frames. Pass --help for usage instructions.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import argparse, collections, os, sys, time
+
+MY_DIR = os.path.abspath(os.path.dirname(__file__))
+
+# Make CapDL importable. Note that we just assume where it is in relation to
+# our own directory.
+sys.path.append(os.path.join(MY_DIR, '../../python-capdl'))
+
+# Make CAmkES importable.
+sys.path.append(os.path.join(MY_DIR, '..'))
+
+from capdl import Cap, ObjectAllocator, lookup_architecture, \
+    seL4_FrameObject
+from camkes.runner.Filters import PAGE_SIZE, VSpaces, \
+    collapse_shared_frames, make_indices
+
+GROUPS = ('client', 'server')
+
+# Virtual address at which the dataports start in each component.
+BASE = 0x40000000
+
+AST = collections.namedtuple('AST', ('assembly',))
+Options = collections.namedtuple('Options', ('architecture', 'largeframe'))
+
+class SyntheticELF(object):
+    def __init__(self, symbols):
+        self.symbols = symbols
+
+    def get_symbol_vaddr(self, symbol):
+        return self.symbols.get(symbol, (None, None))[0]
+
+    def get_symbol_size(self, symbol):
+        return self.symbols.get(symbol, (None, None))[1]
+
+def map_small_frame(arch, obj_space, pd, vaddr):
+    '''Back a page with a small frame, creating paging structures as needed.'''
+    level = arch.vspace()
+    obj = pd
+    for index in make_indices(arch, vaddr, PAGE_SIZE)[:-1]:
+        level = level.child
+        cap = obj.slots.get(index)
+        if cap is None:
+            cap = Cap(obj_space.alloc(level.object))
+            obj[index] = cap
+        obj = cap.referent
+    frame = obj_space.alloc(seL4_FrameObject, size=PAGE_SIZE)
+    obj[level.child_index(vaddr)] = Cap(frame, True, True, False)
+
+def build(architecture, dataports, dataport_size):
+    arch = lookup_architecture(architecture)
+    obj_space = ObjectAllocator()
+    elfs = {}
+    shmem = {}
+
+    for group in GROUPS:
+        pd = obj_space.alloc(arch.vspace().object,
+            name='%s_group_bin_pd' % group)
+        symbols = {}
+        for i in range(dataports):
+            vaddr = BASE + i * dataport_size
+            for v in range(vaddr, vaddr + dataport_size, PAGE_SIZE):
+                map_small_frame(arch, obj_space, pd, v)
+            symbols['dataport%d' % i] = (vaddr, dataport_size)
+        elf_name = '%s_group_bin' % group
+        elfs[elf_name] = (elf_name, SyntheticELF(symbols))
+
+    for i in range(dataports):
+        shmem['dataport%d' % i] = dict(('%s_cnode' % group,
+            [('dataport%d' % i, 'RW', None, None, True)]) for group in GROUPS)
+
+    return arch, obj_space, elfs, shmem
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description='time CapDL filters on a synthetic system')
+    parser.add_argument('--architecture', '--arch', default='x86_64',
+        help='Target architecture.')
+    parser.add_argument('--total', type=int, default=1024,
+        help='Total size of the dataports in MiB.')
+    parser.add_argument('--dataport-size', type=int, default=4,
+        help='Size of each dataport in MiB.')
+    parser.add_argument('--largeframe', action='store_true',
+        help='Promote shared memory to large frames.')
+    options = parser.parse_args(argv[1:])
+
+    dataport_size = options.dataport_size * 1024 * 1024
+    dataports = options.total // options.dataport_size
+
+    start = time.time()
+    arch, obj_space, elfs, shmem = build(options.architecture, dataports,
+        dataport_size)
+    print('built %d dataports of %d MiB (%d objects) in %.2fs' % (dataports,
+        options.dataport_size, len(obj_space.spec.objs), time.time() - start))
+
+    start = time.time()
+    collapse_shared_frames(ast=AST(None), obj_space=obj_space, elfs=elfs,
+        shmem=shmem, options=Options(options.architecture, options.largeframe),
+        vspaces=VSpaces(arch, obj_space))
+    print('collapse_shared_frames: %.2fs (%d objects remaining)' %
+        (time.time() - start, len(obj_space.spec.objs)))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,135 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Summarise the profiles written by the code generator's --profile-out option
+(or a build configured with CAmkESProfileDir). Events from every profile given
+are grouped by category and name and ranked by the total time spent in them.
+Self time excludes time spent in events nested within an event in the same
+process, so e.g. the time of the 'parse' phase is not counted again under
+'runner'. Pass --help for usage instructions.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import argparse, collections, json, os, sys
+
+def find_profiles(paths):
+    for p in paths:
+        if os.path.isdir(p):
+            for root, _, files in os.walk(p):
+                for f in sorted(files):
+                    if f.endswith('.json'):
+                        yield os.path.join(root, f)
+        else:
+            yield p
+
+def load(path):
+    with open(path, 'rt') as f:
+        data = json.load(f)
+    return [e for e in data.get('traceEvents', []) if e.get('ph') == 'X']
+
+def self_times(events):
+    '''
+    Compute the self time of each event, in place, by subtracting the time of
+    its direct children. Events nest within a process by their time ranges.
+    '''
+    by_pid = collections.defaultdict(list)
+    for e in events:
+        e['self'] = e['dur']
+        by_pid[e['pid']].append(e)
+    for evs in by_pid.values():
+        # Sort parents before their children.
+        evs.sort(key=lambda e: (e['ts'], -e['dur']))
+        stack = []
+        for e in evs:
+            while stack and stack[-1]['ts'] + stack[-1]['dur'] < \
+                    e['ts'] + e['dur']:
+                stack.pop()
+            if stack:
+                stack[-1]['self'] -= e['dur']
+            stack.append(e)
+
+Row = collections.namedtuple('Row', ('category', 'name', 'count', 'total',
+    'self', 'cpu', 'rss'))
+
+def aggregate(events, by):
+    rows = {}
+    for e in events:
+        if by == 'template':
+            if e['cat'] != 'template':
+                continue
+            key = (e['cat'], e['args'].get('template', e['name']))
+        else:
+            key = (e['cat'], e['name'])
+        count, total, self, cpu, rss = rows.get(key, (0, 0, 0, 0, 0))
+        rows[key] = (count + 1, total + e['dur'], self + max(e['self'], 0),
+            cpu + e['args'].get('cpu_us', 0),
+            max(rss, e['args'].get('max_rss_kb') or 0))
+    return [Row(c, n, *v) for (c, n), v in rows.items()]
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description='summarise code generator profiles')
+    parser.add_argument('profiles', nargs='+', help='Profiles, or directories '
+        'to search for profiles.')
+    parser.add_argument('--by', choices=('name', 'template'), default='name',
+        help='Group events by name, or template events by template file.')
+    parser.add_argument('--category', action='append',
+        help='Only report events in this category (e.g. phase, parser, cache, '
+        'capdl, filter, template). May be given multiple times.')
+    parser.add_argument('--sort', choices=('total', 'self', 'cpu', 'rss'),
+        default='total', help='Column to rank by.')
+    parser.add_argument('--top', type=int, default=30,
+        help='Number of rows to report. 0 for all.')
+    parser.add_argument('--merge', metavar='FILE', help='Also write every '
+        'event to a single trace-event file, for viewing in a trace viewer.')
+    options = parser.parse_args(argv[1:])
+
+    events = []
+    paths = list(find_profiles(options.profiles))
+    for p in paths:
+        try:
+            events.extend(load(p))
+        except (IOError, OSError, ValueError) as e:
+            sys.stderr.write('skipping %s: %s\n' % (p, e))
+    if not events:
+        sys.stderr.write('no events found\n')
+        return -1
+
+    if options.merge is not None:
+        with open(options.merge, 'wt') as f:
+            json.dump({'traceEvents':events, 'displayTimeUnit':'ms'}, f)
+
+    self_times(events)
+    rows = aggregate(events, options.by)
+    if options.category:
+        rows = [r for r in rows if r.category in options.category]
+    rows.sort(key=lambda r: getattr(r, options.sort), reverse=True)
+    if options.top > 0:
+        rows = rows[:options.top]
+
+    print('%d events from %d profiles' % (len(events), len(paths)))
+    print('%-9s %6s %10s %10s %10s %10s  %s' % ('category', 'count',
+        'total (s)', 'self (s)', 'cpu (s)', 'rss (MiB)', 'name'))
+    for r in rows:
+        print('%-9s %6d %10.3f %10.3f %10.3f %10.1f  %s' % (r.category,
+            r.count, r.total / 1000000, r.self / 1000000, r.cpu / 1000000,
+            r.rss / 1024, r.name))
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
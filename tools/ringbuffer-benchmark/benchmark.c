@@ -0,0 +1,218 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+/* A host throughput benchmark of the seL4RingBuffer and seL4RingBufferQueue
+ * connectors, built and run by tools/ringbuffer_benchmark.py. The rendered
+ * producer and consumer ends are linked with this file and with a table of
+ * their functions generated by the script, with their rings aliased and a
+ * condition variable standing in for the notification. Run with:
+ *
+ *   ring ELEMENTS BATCH    stream ELEMENTS from each producer through the
+ *                          rings, BATCH at a time
+ *   baseline ELEMENTS      pass ELEMENTS from each producer through a
+ *                          one-element dataport, as SharedData with a
+ *                          Notification each way would, with the producers
+ *                          taking turns under a lock
+ *
+ * The consumer checks that each producer's elements arrive in order.
+ */
+
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <utils/util.h>
+#include <element.h>
+
+/* The producers' enqueue functions and the consumer's dequeue (or drain)
+ * function.
+ */
+extern size_t (*const benchmark_enqueue[])(const element_t *elems,
+    size_t count);
+extern const unsigned benchmark_producers;
+size_t benchmark_dequeue(element_t *elems, size_t count);
+void in_wait(void);
+
+#define MAX_BATCH 64
+
+/* A binary notification. */
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;
+} notification_t;
+
+#define NOTIFICATION_INITIALIZER { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, 0 }
+
+static void notification_signal(notification_t *n) {
+    pthread_mutex_lock(&n->lock);
+    n->pending = 1;
+    pthread_cond_signal(&n->cond);
+    pthread_mutex_unlock(&n->lock);
+}
+
+static void notification_wait(notification_t *n) {
+    pthread_mutex_lock(&n->lock);
+    while (!n->pending) {
+        pthread_cond_wait(&n->cond, &n->lock);
+    }
+    n->pending = 0;
+    pthread_mutex_unlock(&n->lock);
+}
+
+static notification_t to_consumer = NOTIFICATION_INITIALIZER;
+static notification_t to_producer = NOTIFICATION_INITIALIZER;
+static unsigned long signals, waits;
+
+void benchmark_signal(void) {
+    __atomic_fetch_add(&signals, 1, __ATOMIC_RELAXED);
+    notification_signal(&to_consumer);
+}
+
+void benchmark_wait(void) {
+    __atomic_fetch_add(&waits, 1, __ATOMIC_RELAXED);
+    notification_wait(&to_consumer);
+}
+
+static unsigned long elements;
+static size_t batch;
+
+/* The next sequence number expected from each producer. */
+static unsigned long *expected;
+
+static void check(const volatile element_t *e) {
+    if (e->producer >= benchmark_producers || e->seq != expected[e->producer]) {
+        printf("FAIL: element %lu of producer %lu arrived out of order\n",
+            (unsigned long)e->seq, (unsigned long)e->producer);
+        exit(1);
+    }
+    expected[e->producer]++;
+}
+
+static void *ring_producer(void *arg) {
+    unsigned id = (unsigned)(uintptr_t)arg;
+    element_t buf[MAX_BATCH];
+    for (unsigned long next = 0; next < elements;) {
+        size_t n = MIN(batch, elements - next);
+        for (size_t i = 0; i < n; i++) {
+            buf[i].seq = next + i;
+            buf[i].producer = id;
+        }
+        for (size_t done = 0; done < n;) {
+            size_t sent = benchmark_enqueue[id](buf + done, n - done);
+            if (sent == 0) {
+                sched_yield();
+            }
+            done += sent;
+        }
+        next += n;
+    }
+    return NULL;
+}
+
+static void *ring_consumer(void *arg UNUSED) {
+    element_t buf[MAX_BATCH];
+    for (unsigned long received = 0; received < elements * benchmark_producers;) {
+        size_t n = benchmark_dequeue(buf, MAX_BATCH);
+        if (n == 0) {
+            in_wait();
+            continue;
+        }
+        for (size_t i = 0; i < n; i++) {
+            check(&buf[i]);
+        }
+        received += n;
+    }
+    return NULL;
+}
+
+static volatile element_t dataport;
+static pthread_mutex_t dataport_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void *baseline_producer(void *arg) {
+    unsigned id = (unsigned)(uintptr_t)arg;
+    for (unsigned long i = 0; i < elements; i++) {
+        pthread_mutex_lock(&dataport_lock);
+        dataport.seq = i;
+        dataport.producer = id;
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        benchmark_signal();
+        notification_wait(&to_producer);
+        pthread_mutex_unlock(&dataport_lock);
+    }
+    return NULL;
+}
+
+static void *baseline_consumer(void *arg UNUSED) {
+    for (unsigned long i = 0; i < elements * benchmark_producers; i++) {
+        benchmark_wait();
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        check(&dataport);
+        notification_signal(&to_producer);
+    }
+    return NULL;
+}
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    void *(*producer)(void*), *(*consumer)(void*);
+    if (argc == 4 && strcmp(argv[1], "ring") == 0) {
+        producer = ring_producer;
+        consumer = ring_consumer;
+        batch = strtoul(argv[3], NULL, 0);
+        if (batch == 0 || batch > MAX_BATCH) {
+            fprintf(stderr, "batch size must be between 1 and %d\n", MAX_BATCH);
+            return 1;
+        }
+    } else if (argc == 3 && strcmp(argv[1], "baseline") == 0) {
+        producer = baseline_producer;
+        consumer = baseline_consumer;
+    } else {
+        fprintf(stderr, "usage: %s ring elements batch | baseline elements\n",
+            argv[0]);
+        return 1;
+    }
+    elements = strtoul(argv[2], NULL, 0);
+    expected = calloc(benchmark_producers, sizeof(*expected));
+    pthread_t *producers = calloc(benchmark_producers, sizeof(*producers));
+    if (expected == NULL || producers == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    pthread_t c;
+    double start = now();
+    pthread_create(&c, NULL, consumer, NULL);
+    for (unsigned i = 0; i < benchmark_producers; i++) {
+        pthread_create(&producers[i], NULL, producer, (void*)(uintptr_t)i);
+    }
+    for (unsigned i = 0; i < benchmark_producers; i++) {
+        pthread_join(producers[i], NULL);
+    }
+    pthread_join(c, NULL);
+    double elapsed = now() - start;
+
+    unsigned long total = elements * benchmark_producers;
+    printf("%8.2f M/s  %.4f signals/element  %.4f waits/element\n",
+        total / elapsed / 1e6, (double)signals / total,
+        (double)waits / total);
+    return 0;
+}
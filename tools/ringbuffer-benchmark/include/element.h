@@ -0,0 +1,22 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* A 32-byte element, carrying its producer and sequence number. */
+typedef struct {
+    uint64_t seq;
+    uint64_t producer;
+    uint64_t payload[2];
+} element_t;
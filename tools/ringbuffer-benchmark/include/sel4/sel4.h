@@ -0,0 +1,25 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#pragma once
+
+/* The notification shared by the ends of a ring, implemented by the benchmark
+ * driver.
+ */
+typedef unsigned long seL4_CPtr;
+typedef unsigned long seL4_Word;
+
+void benchmark_signal(void);
+void benchmark_wait(void);
+
+#define seL4_Signal(cap) benchmark_signal()
+#define seL4_Wait(cap, badge) benchmark_wait()
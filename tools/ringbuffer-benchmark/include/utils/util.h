@@ -0,0 +1,19 @@
+/*
+ * Copyright 2017, Data61
+ * Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+ * ABN 41 687 119 230.
+ *
+ * This software may be distributed and modified according to the terms of
+ * the BSD 2-Clause license. Note that NO WARRANTY is provided.
+ * See "LICENSE_BSD2.txt" for details.
+ *
+ * @TAG(DATA61_BSD)
+ */
+
+#pragma once
+
+#define ALIGN(n) __attribute__((aligned(n)))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define PAGE_SIZE_4K 4096
+#define ROUND_UP_UNSAFE(v, size) (((v) + (size) - 1) / (size) * (size))
+#define UNUSED __attribute__((unused))
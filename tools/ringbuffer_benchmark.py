@@ -0,0 +1,213 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Measure the throughput of the seL4RingBuffer connector, or with more than one
+producer the seL4RingBufferQueue connector, on the host. The ends of a
+connection are rendered from their templates and linked into a program in
+ringbuffer-benchmark/, with the rings the templates register as shared aliased
+to each other and a condition variable standing in for the notification. The
+baseline passes the same elements through a one-element dataport with a
+notification each way, as a SharedData and two Notification connections
+would, with the producers taking turns under a lock. Pass --help for usage
+instructions.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import argparse, itertools, jinja2, os, re, shutil, six, subprocess, sys, \
+    tempfile
+
+MY_DIR = os.path.abspath(os.path.dirname(__file__))
+BENCHMARK_DIR = os.path.join(MY_DIR, 'ringbuffer-benchmark')
+
+# Make CAmkES importable.
+sys.path.append(os.path.join(MY_DIR, '..'))
+
+from camkes.templates import macros, TemplateError
+
+TEMPLATES = os.path.join(MY_DIR, '../camkes/templates')
+
+class Mock(object):
+    def __init__(self, **kwargs):
+        self.__dict__.update(kwargs)
+
+class Configuration(dict):
+    '''The subset of the configuration the templates read: the ring size.'''
+    def __init__(self, ring_size):
+        super(Configuration, self).__init__()
+        self.settings_dict = {'conn': {'ring_size': None}}
+        self.ring_size = ring_size
+
+    def __getitem__(self, key):
+        if key == 'conn':
+            return {'ring_size': self.ring_size}
+        return {}
+
+def connection(connector, producers):
+    '''Construct a connection from `producers` dataports `out0`, `out1`, ...
+    to a dataport `in`.'''
+    header = Mock(relative=False, source='element.h')
+    def end(instance, interface):
+        return Mock(interface=Mock(name=interface, type='element_t'),
+            instance=Mock(name=instance, type=Mock(includes=[header])))
+    from_ends = [end('producer%d' % i, 'out%d' % i)
+        for i in six.moves.range(producers)]
+    to_end = end('consumer', 'in')
+    conn = Mock(name='conn', type=Mock(name=connector), from_ends=from_ends,
+        to_ends=[to_end])
+    for e in from_ends + [to_end]:
+        e.parent = conn
+    return conn
+
+def make_table(conn, dequeue):
+    '''Generate the table of the ends' functions the benchmark driver calls
+    through.'''
+    enqueue = ['%s_enqueue_batch' % e.interface.name for e in conn.from_ends]
+    return ''.join('size_t %s(const element_t *elems, size_t count);\n' % f
+            for f in enqueue) + \
+        'size_t (*const benchmark_enqueue[])(const element_t *elems, ' \
+            'size_t count) = { %s };\n' % ', '.join(enqueue) + \
+        'const unsigned benchmark_producers = %d;\n' % len(enqueue) + \
+        'size_t %s(element_t *elems, size_t count);\n' % dequeue + \
+        'size_t benchmark_dequeue(element_t *elems, size_t count) {\n' \
+        '    return %s(elems, count);\n' \
+        '}\n' % dequeue
+
+def render(template, me, ring_size):
+    '''Render an end of a ring connection, returning the source and the
+    symbols it registers as shared, mapped to their shared names.'''
+    shared = {}
+    counter = itertools.count()
+    def register_shared_variable(name, symbol, *_):
+        shared[symbol] = name
+        return ''
+    env = jinja2.Environment(loader=jinja2.FileSystemLoader(TEMPLATES),
+        extensions=['jinja2.ext.do', 'jinja2.ext.loopcontrols'],
+        block_start_string='/*-', block_end_string='-*/',
+        variable_start_string='/*?', variable_end_string='?*/',
+        comment_start_string='/*#', comment_end_string='#*/',
+        undefined=jinja2.StrictUndefined)
+    env.globals.update(vars(six.moves.builtins))
+    env.globals.update({
+        'alloc':lambda name, *args, **kwargs: 1,
+        'c_symbol':lambda basename='unnamed': '%s_%d' % (basename,
+            next(counter)),
+        'composition':Mock(connections=[me.parent]),
+        'configuration':Configuration(ring_size),
+        'keep_symbol':lambda *args: '',
+        'macros':macros,
+        'me':me,
+        're':re,
+        'register_shared_variable':register_shared_variable,
+        'seL4_NotificationObject':None,
+        'six':six,
+        'TemplateError':TemplateError,
+    })
+    return env.get_template(template).render(), shared
+
+def build(tmp, connector, templates, dequeue, producers, ring_size, cc):
+    '''Compile the ends of a connection and the benchmark driver into a
+    program, returning its path.'''
+    include = os.path.join(BENCHMARK_DIR, 'include')
+    conn = connection(connector, producers)
+    from_template, to_template = templates
+    objects = []
+    for i, (template, me) in enumerate([(from_template, e)
+            for e in conn.from_ends] + [(to_template, conn.to_ends[0])]):
+        source, shared = render(template, me, ring_size)
+        src = os.path.join(tmp, 'end%d.c' % i)
+        with open(src, 'wt') as f:
+            f.write(source)
+        obj = os.path.join(tmp, 'end%d.o' % i)
+        subprocess.check_call([cc, '-c', '-O2', '-Wall', '-I%s' % include,
+            src, '-o', obj])
+
+        # Rename the rings after the shared names they were registered under
+        # and make them weak, so that the linker resolves every end's
+        # references to one copy of each.
+        objcopy = ['objcopy']
+        for symbol, name in shared.items():
+            objcopy.extend(['--redefine-sym', '%s=%s' % (symbol, name),
+                '--weaken-symbol', name])
+        subprocess.check_call(objcopy + [obj])
+        objects.append(obj)
+
+    table = os.path.join(tmp, 'table.c')
+    with open(table, 'wt') as f:
+        f.write('#include <stddef.h>\n#include <element.h>\n')
+        f.write(make_table(conn, dequeue))
+
+    binary = os.path.join(tmp, 'benchmark')
+    subprocess.check_call([cc, '-O2', '-Wall', '-pthread',
+        '-I%s' % include, os.path.join(BENCHMARK_DIR, 'benchmark.c'),
+        table] + objects + ['-o', binary])
+    return binary
+
+def run(binary, *args):
+    return subprocess.check_output([binary] + [str(a) for a in args],
+        universal_newlines=True).strip()
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description='measure ring buffer connector throughput on the host')
+    parser.add_argument('--producers', type=int, default=1,
+        help='Number of producers. With more than one, measure '
+        'seL4RingBufferQueue rather than seL4RingBuffer.')
+    parser.add_argument('--elements', type=int, default=4 * 1024 * 1024,
+        help='Number of elements each producer sends through the ring.')
+    parser.add_argument('--baseline-elements', type=int,
+        default=400 * 1000, help='Number of elements each producer sends '
+        'through the baseline, which is much slower.')
+    parser.add_argument('--batch', type=int, action='append',
+        help='Number of elements to enqueue at once (1 to 64). Can be given '
+        'more than once. Defaults to 1, 8 and 32.')
+    parser.add_argument('--ring-size', type=int, default=256,
+        help='Capacity of the ring, in elements.')
+    parser.add_argument('--cc', default=os.environ.get('CC', 'cc'),
+        help='C compiler to use.')
+    options = parser.parse_args(argv[1:])
+
+    if options.producers < 1:
+        parser.error('there must be at least one producer')
+
+    if options.producers == 1:
+        connector = 'seL4RingBuffer'
+        templates = ('seL4RingBuffer-from.template.c',
+            'seL4RingBuffer-to.template.c')
+        dequeue = 'in_dequeue_batch'
+    else:
+        connector = 'seL4RingBufferQueue'
+        templates = ('seL4RingBuffer-from.template.c',
+            'seL4RingBufferQueue-to.template.c')
+        dequeue = 'in_drain'
+
+    tmp = tempfile.mkdtemp()
+    try:
+        binary = build(tmp, connector, templates, dequeue, options.producers,
+            options.ring_size, options.cc)
+
+        print('%-39s %s' % ('SharedData+Notification baseline',
+            run(binary, 'baseline', options.baseline_elements)))
+        for batch in options.batch or [1, 8, 32]:
+            print('%-39s %s' % ('%s, batch size %d' % (connector, batch),
+                run(binary, 'ring', options.elements, batch)))
+    finally:
+        shutil.rmtree(tmp)
+
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))
@@ -0,0 +1,168 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+#
+# Copyright 2017, Data61
+# Commonwealth Scientific and Industrial Research Organisation (CSIRO)
+# ABN 41 687 119 230.
+#
+# This software may be distributed and modified according to the terms of
+# the BSD 2-Clause license. Note that NO WARRANTY is provided.
+# See "LICENSE_BSD2.txt" for details.
+#
+# @TAG(DATA61_BSD)
+#
+
+'''
+Decode the connector latency histograms collected with the
+CAmkESConnectorTimingHistograms build option from a memory dump (or any file
+containing them, e.g. a copy made with <interface>_timing_histograms()) and
+report percentiles of each phase of each method. The histograms are found by
+the magic at the start of their header, so a dump may contain any number of
+them at any offset. See libsel4camkes/include/camkes/timing.h for the layout.
+Pass --help for usage instructions.
+'''
+
+from __future__ import absolute_import, division, print_function, \
+    unicode_literals
+
+import argparse, collections, struct, sys
+
+MAGIC = b'CAmkEStH'
+BYTE_ORDER = 0x01020304
+NAME = 32
+
+# Everything in the header after the magic.
+HEADER = 'IIIIII%ds' % NAME
+
+Histograms = collections.namedtuple('Histograms', ('offset', 'interface',
+    'methods', 'points', 'sub_bucket_bits', 'counts'))
+
+def name(raw):
+    return raw.split(b'\0', 1)[0].decode('utf-8', 'replace')
+
+def parse(data, offset):
+    '''
+    Parse the histograms whose header starts at `offset`, or return None if
+    what is there does not look like a valid header.
+    '''
+    for endian in ('<', '>'):
+        header = struct.Struct(endian + HEADER)
+        start = offset + len(MAGIC)
+        if start + header.size > len(data):
+            return None
+        byte_order, sub_bucket_bits, buckets, methods, points, counts_offset, \
+            interface = header.unpack_from(data, start)
+        if byte_order == BYTE_ORDER:
+            break
+    else:
+        return None
+
+    if sub_bucket_bits >= 32 or \
+            buckets != (32 - sub_bucket_bits + 1) << sub_bucket_bits or \
+            points < 2:
+        return None
+    names = start + header.size
+    counts = offset + counts_offset
+    end = counts + methods * (points - 1) * buckets * 4
+    if counts < names + (methods + points) * NAME or end > len(data):
+        return None
+
+    method_names = [name(data[names + i * NAME:names + (i + 1) * NAME])
+        for i in range(methods)]
+    names += methods * NAME
+    point_names = [name(data[names + i * NAME:names + (i + 1) * NAME])
+        for i in range(points)]
+
+    histogram = struct.Struct('%s%dI' % (endian, buckets))
+    hs = {}
+    for m in range(methods):
+        for p in range(points - 1):
+            hs[(m, p)] = histogram.unpack_from(data,
+                counts + (m * (points - 1) + p) * histogram.size)
+
+    return Histograms(offset, name(interface), method_names, point_names,
+        sub_bucket_bits, hs)
+
+def find(data):
+    offset = data.find(MAGIC)
+    while offset != -1:
+        h = parse(data, offset)
+        if h is not None:
+            yield h
+        offset = data.find(MAGIC, offset + 1)
+
+def bucket_range(bucket, sub_bucket_bits):
+    '''The lowest and highest values counted in a bucket.'''
+    sub_buckets = 1 << sub_bucket_bits
+    if bucket < sub_buckets:
+        return bucket, bucket
+    shift = (bucket >> sub_bucket_bits) - 1
+    low = ((bucket & (sub_buckets - 1)) + sub_buckets) << shift
+    return low, low + (1 << shift) - 1
+
+def percentile(counts, sub_bucket_bits, p):
+    '''
+    The highest value that may have been counted at percentile `p` of the
+    samples in `counts`, as HdrHistogram reports it.
+    '''
+    total = sum(counts)
+    rank = max(1, -(-total * p // 100))
+    seen = 0
+    for bucket, count in enumerate(counts):
+        seen += count
+        if seen >= rank:
+            return bucket_range(bucket, sub_bucket_bits)[1]
+    return None
+
+def main(argv):
+    parser = argparse.ArgumentParser(
+        description='report percentiles of connector latency histograms')
+    parser.add_argument('dumps', nargs='+', help='Memory dumps containing '
+        'histograms.')
+    parser.add_argument('--percentile', '-p', type=float, action='append',
+        help='Percentile to report. May be given multiple times. Defaults to '
+        '50, 99 and 99.9.')
+    parser.add_argument('--cpu-mhz', type=float, help='Report times in '
+        'microseconds at this clock rate, rather than cycles.')
+    parser.add_argument('--all', action='store_true', help='Also report '
+        'phases with no samples.')
+    options = parser.parse_args(argv[1:])
+
+    percentiles = options.percentile or [50, 99, 99.9]
+
+    def show(cycles):
+        if options.cpu_mhz is None:
+            return '%d' % cycles
+        return '%.3f' % (cycles / options.cpu_mhz)
+
+    found = False
+    for path in options.dumps:
+        with open(path, 'rb') as f:
+            data = f.read()
+        for h in find(data):
+            found = True
+            print('%s: interface %s (offset 0x%x, %s)' % (path, h.interface,
+                h.offset, 'cycles' if options.cpu_mhz is None else 'us'))
+            print('%-24s %-40s %10s %s' % ('method', 'phase', 'count',
+                ' '.join('%10s' % ('p%g' % p) for p in percentiles + [100])))
+            for m, method in enumerate(h.methods):
+                for p in range(len(h.points) - 1):
+                    counts = h.counts[(m, p)]
+                    total = sum(counts)
+                    if total == 0 and not options.all:
+                        continue
+                    phase = '%s -> %s' % (h.points[p], h.points[p + 1])
+                    values = [percentile(counts, h.sub_bucket_bits, q)
+                        for q in percentiles + [100]]
+                    print('%-24s %-40s %10d %s' % (method, phase, total,
+                        ' '.join('%10s' % ('-' if v is None else show(v))
+                            for v in values)))
+            print()
+
+    if not found:
+        sys.stderr.write('no histograms found\n')
+        return -1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv))